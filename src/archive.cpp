@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include "archive.h"
+
+
+static_assert(CPU_DELTA_REGS_SIZE <= ARCHIVE_PAGE_MAX && MEM_PAGE_SIZE <= ARCHIVE_PAGE_MAX,
+              "archive pages must hold the registers and a memory page");
+
+Archive::Archive(u32_t _threads)
+{
+    threads = _threads ? _threads : 1;
+}
+/* Stores the states as a new snapshot, returns its id or ARCHIVE_NO_SNAPSHOT */
+u32_t Archive::archive_add(cpu_state_t *const *states, u32_t count)
+{
+    std::atomic<u32_t> failed(0);
+    snapshot_t         snap;
+    u32_t              id;
+
+    snap.alive = 1;
+    snap.manifests.resize(count);
+    parallel((count + ARCHIVE_CHUNK - 1) / ARCHIVE_CHUNK, [&](u32_t chunk) {
+        u32_t          end = (chunk + 1) * ARCHIVE_CHUNK < count ? (chunk + 1) * ARCHIVE_CHUNK : count;
+        const u8_t    *base;
+        archive_hash_t h;
+        u32_t          i;
+        u8_t           n;
+
+        for (i = chunk * ARCHIVE_CHUNK; i < end; i++) {
+            base = (const u8_t *)states[i];
+            for (n = 0; n < ARCHIVE_PAGE_NUM; n++) {
+                h = hash(base + page_offset(n), page_len(n));
+                if (put(h, base + page_offset(n), page_len(n))) {
+                    /* 64-bit collision, the page holds no reference for this manifest */
+                    h = 0;
+                    failed.store(1, std::memory_order_relaxed);
+                }
+                snap.manifests[i].pages[n] = h;
+            }
+        }
+    });
+    snapshots.push_back(std::move(snap));
+    id = snapshots.size() - 1;
+    if (failed.load()) {
+        archive_remove(id);
+        return ARCHIVE_NO_SNAPSHOT;
+    }
+    return id;
+}
+/*
+ * Rebuilds the archive_get_count(snap) states of a snapshot, returns 1 if there is no such snapshot or if
+ * a rebuilt state fails CPU::cpu_check_state() (the states are then all written, but must not be run)
+ */
+bool_t Archive::archive_restore(u32_t snap, cpu_state_t *const *states)
+{
+    std::vector<archive_manifest_t> *manifests;
+    std::atomic<u32_t>               failed(0);
+    u32_t                            count;
+
+    if (snap >= snapshots.size() || !snapshots[snap].alive) {
+        return 1;
+    }
+    manifests = &snapshots[snap].manifests;
+    count     = manifests->size();
+    parallel((count + ARCHIVE_CHUNK - 1) / ARCHIVE_CHUNK, [&](u32_t chunk) {
+        u32_t          end = (chunk + 1) * ARCHIVE_CHUNK < count ? (chunk + 1) * ARCHIVE_CHUNK : count;
+        archive_hash_t h;
+        u8_t          *base;
+        u32_t          i;
+        u8_t           n;
+
+        for (i = chunk * ARCHIVE_CHUNK; i < end; i++) {
+            base = (u8_t *)states[i];
+            for (n = 0; n < ARCHIVE_PAGE_NUM; n++) {
+                h = (*manifests)[i].pages[n];
+                /* Lookups only: nothing is inserted or erased while restoring */
+                memcpy(base + page_offset(n), shard_of(h)->pages.find(h)->second.data, page_len(n));
+            }
+            if (CPU::cpu_check_state(states[i])) {
+                failed.store(1, std::memory_order_relaxed);
+            }
+            states[i]->dirty    = MEM_PAGES_ALL;
+            states[i]->mem_hash = CPU::cpu_hash_memory(states[i]);
+        }
+    });
+    return failed.load();
+}
+/* Drops a snapshot's page references, archive_gc() frees the pages no snapshot references anymore */
+void Archive::archive_remove(u32_t snap)
+{
+    std::vector<archive_manifest_t> *manifests;
+    u32_t                            count;
+
+    if (snap >= snapshots.size() || !snapshots[snap].alive) {
+        return;
+    }
+    manifests = &snapshots[snap].manifests;
+    count     = manifests->size();
+    parallel((count + ARCHIVE_CHUNK - 1) / ARCHIVE_CHUNK, [&](u32_t chunk) {
+        u32_t          end = (chunk + 1) * ARCHIVE_CHUNK < count ? (chunk + 1) * ARCHIVE_CHUNK : count;
+        archive_hash_t h;
+        shard_t       *shard;
+        u32_t          i;
+        u8_t           n;
+
+        for (i = chunk * ARCHIVE_CHUNK; i < end; i++) {
+            for (n = 0; n < ARCHIVE_PAGE_NUM; n++) {
+                h = (*manifests)[i].pages[n];
+                if (h == 0) {
+                    continue;
+                }
+                shard = shard_of(h);
+                std::lock_guard<std::mutex> guard(shard->lock);
+                shard->pages.find(h)->second.refs--;
+            }
+        }
+    });
+    snapshots[snap].alive = 0;
+    std::vector<archive_manifest_t>().swap(*manifests);
+}
+/* Sweeps the unreferenced pages, one shard per work item, returns how many were freed */
+u32_t Archive::archive_gc(void)
+{
+    std::atomic<u32_t> freed(0);
+
+    parallel(ARCHIVE_SHARDS, [&](u32_t n) {
+        std::unordered_map<archive_hash_t, page_t> *pages = &shards[n].pages;
+        u32_t                                       count = 0;
+
+        for (auto it = pages->begin(); it != pages->end();) {
+            if (it->second.refs == 0) {
+                it = pages->erase(it);
+                count++;
+            } else {
+                ++it;
+            }
+        }
+        freed.fetch_add(count, std::memory_order_relaxed);
+    });
+    return freed.load();
+}
+u32_t Archive::archive_get_count(u32_t snap)
+{
+    if (snap >= snapshots.size() || !snapshots[snap].alive) {
+        return 0;
+    }
+    return snapshots[snap].manifests.size();
+}
+u32_t Archive::archive_get_pages(void)
+{
+    u32_t count = 0;
+    u32_t n;
+
+    for (n = 0; n < ARCHIVE_SHARDS; n++) {
+        count += shards[n].pages.size();
+    }
+    return count;
+}
+/* Size of the page data and manifests, what archive_write() stores besides record headers */
+uint64_t Archive::archive_get_bytes(void)
+{
+    uint64_t bytes = 0;
+    u32_t    n;
+
+    for (n = 0; n < ARCHIVE_SHARDS; n++) {
+        for (auto &it : shards[n].pages) {
+            bytes += it.second.len;
+        }
+    }
+    for (auto &snap : snapshots) {
+        bytes += snap.manifests.size() * sizeof(archive_manifest_t);
+    }
+    return bytes;
+}
+bool_t Archive::archive_write(const char *path)
+{
+    archive_header_t hdr;
+    FILE            *f;
+    bool_t           res = 0;
+    u32_t            count;
+    u32_t            n;
+
+    f = fopen(path, "wb");
+    if (f == NULL) {
+        return 1;
+    }
+    hdr.magic     = ARCHIVE_MAGIC;
+    hdr.version   = ARCHIVE_VERSION;
+    hdr.pages     = archive_get_pages();
+    hdr.snapshots = snapshots.size();
+    res |= fwrite(&hdr, sizeof(hdr), 1, f) != 1;
+    for (n = 0; n < ARCHIVE_SHARDS; n++) {
+        for (auto &it : shards[n].pages) {
+            res |= fwrite(&it.first, sizeof(it.first), 1, f) != 1;
+            res |= fwrite(&it.second.len, 1, 1, f) != 1;
+            res |= fwrite(it.second.data, it.second.len, 1, f) != 1;
+        }
+    }
+    for (auto &snap : snapshots) {
+        count = snap.manifests.size();
+        res |= fwrite(&count, sizeof(count), 1, f) != 1;
+        res |= fwrite(snap.manifests.data(), sizeof(archive_manifest_t), count, f) != count;
+    }
+    res |= fclose(f) != 0;
+    return res;
+}
+/*
+ * Replaces the contents of the archive with those of the file, page references are recounted. A page whose
+ * data does not hash to its key fails the read, as it would otherwise restore wrong bytes wherever it is used.
+ */
+bool_t Archive::archive_read(const char *path)
+{
+    archive_header_t hdr;
+    archive_hash_t   h;
+    page_t           page;
+    FILE            *f;
+    bool_t           res = 0;
+    u32_t            count;
+    u32_t            i, j;
+    u8_t             n;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        return 1;
+    }
+    for (n = 0; n < ARCHIVE_SHARDS; n++) {
+        shards[n].pages.clear();
+    }
+    snapshots.clear();
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != ARCHIVE_MAGIC || hdr.version != ARCHIVE_VERSION) {
+        fclose(f);
+        return 1;
+    }
+    page.refs = 0;
+    for (i = 0; i < hdr.pages; i++) {
+        if (fread(&h, sizeof(h), 1, f) != 1 || fread(&page.len, 1, 1, f) != 1 || page.len > ARCHIVE_PAGE_MAX ||
+            fread(page.data, page.len, 1, f) != 1 || hash(page.data, page.len) != h) {
+            res = 1;
+            break;
+        }
+        shard_of(h)->pages[h] = page;
+    }
+    snapshots.resize(res ? 0 : hdr.snapshots);
+    for (auto &snap : snapshots) {
+        if (fread(&count, sizeof(count), 1, f) != 1) {
+            res = 1;
+            break;
+        }
+        snap.alive = count != 0;
+        snap.manifests.resize(count);
+        if (fread(snap.manifests.data(), sizeof(archive_manifest_t), count, f) != count) {
+            res = 1;
+            break;
+        }
+        for (i = 0; i < count && res == 0; i++) {
+            for (j = 0; j < ARCHIVE_PAGE_NUM; j++) {
+                h         = snap.manifests[i].pages[j];
+                auto page = shard_of(h)->pages.find(h);
+                if (page == shard_of(h)->pages.end() || page->second.len != page_len(j)) {
+                    res = 1;
+                    break;
+                }
+                page->second.refs++;
+            }
+        }
+        if (res) {
+            break;
+        }
+    }
+    fclose(f);
+    if (res) {
+        for (n = 0; n < ARCHIVE_SHARDS; n++) {
+            shards[n].pages.clear();
+        }
+        snapshots.clear();
+    }
+    return res;
+}
+/* Page 0 is the registers, page n > 0 is memory page n - 1 */
+u32_t Archive::page_offset(u8_t n)
+{
+    return n == 0 ? 0 : CPU_DELTA_REGS_SIZE + (n - 1) * MEM_PAGE_SIZE;
+}
+u8_t Archive::page_len(u8_t n)
+{
+    if (n == 0) {
+        return CPU_DELTA_REGS_SIZE;
+    }
+    return (n * MEM_PAGE_SIZE <= MEM_BUFFER_SIZE) ? MEM_PAGE_SIZE : MEM_BUFFER_SIZE - (n - 1) * MEM_PAGE_SIZE;
+}
+/* 64-bit words through a multiply and xor-shift, then a full avalanche; never 0, which marks no page */
+archive_hash_t Archive::hash(const u8_t *data, u8_t len)
+{
+    archive_hash_t h = 0x9E3779B97F4A7C15ULL ^ len;
+    uint64_t       w;
+    u8_t           i;
+
+    for (i = 0; i < len; i += 8) {
+        w = 0;
+        memcpy(&w, data + i, len - i < 8 ? len - i : 8);
+        h = (h ^ w) * 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 31;
+    }
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h ? h : 1;
+}
+Archive::shard_t *Archive::shard_of(archive_hash_t h)
+{
+    return &shards[h % ARCHIVE_SHARDS];
+}
+/* Takes a reference on the page, storing it if it is new; returns 1 if another page has the same hash */
+bool_t Archive::put(archive_hash_t h, const u8_t *data, u8_t len)
+{
+    shard_t                    *shard = shard_of(h);
+    std::lock_guard<std::mutex> guard(shard->lock);
+    auto                        it = shard->pages.find(h);
+
+    if (it == shard->pages.end()) {
+        page_t &page = shard->pages[h];
+        page.refs    = 1;
+        page.len     = len;
+        memcpy(page.data, data, len);
+        return 0;
+    }
+    if (it->second.len != len || memcmp(it->second.data, data, len) != 0) {
+        return 1;
+    }
+    it->second.refs++;
+    return 0;
+}
+/* Runs fn(0 .. items - 1) on up to `threads` threads, the calling one included */
+void Archive::parallel(u32_t items, const std::function<void(u32_t)> &fn)
+{
+    std::atomic<u32_t>       next(0);
+    std::vector<std::thread> pool;
+    u32_t                    n = threads < items ? threads : items;
+    auto                     work = [&]() {
+        u32_t i;
+        while ((i = next.fetch_add(1, std::memory_order_relaxed)) < items) {
+            fn(i);
+        }
+    };
+
+    for (u32_t t = 1; t < n; t++) {
+        pool.emplace_back(work);
+    }
+    work();
+    for (auto &t : pool) {
+        t.join();
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef _ARCHIVE_H_
+#define _ARCHIVE_H_
+#include <stdint.h>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "cpu.h"
+
+
+#define ARCHIVE_MAGIC       0x52413645 /* "E6AR" */
+#define ARCHIVE_VERSION     1
+#define ARCHIVE_PAGE_NUM    (1 + MEM_PAGE_NUM) /* The registers, then the dirty tracking pages of memory[] */
+#define ARCHIVE_PAGE_MAX    64
+#define ARCHIVE_SHARDS      64
+#define ARCHIVE_CHUNK       256 /* Instances per work item */
+#define ARCHIVE_NO_SNAPSHOT 0xFFFFFFFF
+
+typedef uint64_t archive_hash_t;
+
+/*
+ * File layout, host byte order: the header, `pages` records of (hash, u8 length, data), then for each
+ * snapshot a u32 instance count (0 once removed) and its manifests.
+ */
+typedef struct
+{
+    u32_t magic;
+    u32_t version;
+    u32_t pages;
+    u32_t snapshots;
+} archive_header_t;
+
+/* One instance of a snapshot: the hash of each of its pages */
+typedef struct
+{
+    archive_hash_t pages[ARCHIVE_PAGE_NUM];
+} archive_manifest_t;
+
+
+/*
+ * Content-addressed archive of fleet snapshots.
+ * A state is cut into ARCHIVE_PAGE_NUM pages, the registers and the MEM_PAGE_SIZE pages of memory[]
+ * (dirty bits excluded), and each distinct page is stored once whatever the instance, the snapshot or
+ * the position it came from; a snapshot is a manifest of page hashes per instance. Pages are reference
+ * counted and sharded by hash, archiving, restoring and sweeping run on `threads` threads.
+ * Calls must not overlap.
+ */
+class Archive {
+  private:
+    typedef struct
+    {
+        u32_t refs;
+        u8_t  len;
+        u8_t  data[ARCHIVE_PAGE_MAX];
+    } page_t;
+
+    typedef struct
+    {
+        std::mutex                                 lock;
+        std::unordered_map<archive_hash_t, page_t> pages;
+    } shard_t;
+
+    typedef struct
+    {
+        bool_t                          alive;
+        std::vector<archive_manifest_t> manifests;
+    } snapshot_t;
+
+  private:
+    u32_t                   threads;
+    shard_t                 shards[ARCHIVE_SHARDS];
+    std::vector<snapshot_t> snapshots;
+
+  public:
+    Archive(u32_t _threads);
+
+    u32_t  archive_add(cpu_state_t *const *states, u32_t count);
+    bool_t archive_restore(u32_t snap, cpu_state_t *const *states);
+    void   archive_remove(u32_t snap);
+    u32_t  archive_gc(void);
+
+    u32_t    archive_get_count(u32_t snap);
+    u32_t    archive_get_pages(void);
+    uint64_t archive_get_bytes(void);
+
+    bool_t archive_write(const char *path);
+    bool_t archive_read(const char *path);
+
+  private:
+    static u32_t          page_offset(u8_t n);
+    static u8_t           page_len(u8_t n);
+    static archive_hash_t hash(const u8_t *data, u8_t len);
+
+    shard_t *shard_of(archive_hash_t h);
+    bool_t   put(archive_hash_t h, const u8_t *data, u8_t len);
+    void     parallel(u32_t items, const std::function<void(u32_t)> &fn);
+};
+#endif
@@ -0,0 +1,105 @@
+#include <string.h>
+#include <sys/mman.h>
+#include "arena.h"
+
+
+Arena::Arena(u32_t slot_size, u32_t _capacity)
+{
+    void *p;
+
+    if (slot_size < sizeof(u32_t)) {
+        slot_size = sizeof(u32_t);
+    }
+    stride = (slot_size + ARENA_SLOT_ALIGN - 1) & ~(ARENA_SLOT_ALIGN - 1);
+    length = ((size_t)stride * _capacity + ARENA_HUGE_PAGE - 1) & ~((size_t)ARENA_HUGE_PAGE - 1);
+    if (length == 0) {
+        return;
+    }
+
+#ifdef MAP_HUGETLB
+    p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        huge = 1;
+    }
+#else
+    p = MAP_FAILED;
+#endif
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) {
+            length = 0;
+            return;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(p, length, MADV_HUGEPAGE);
+#endif
+    }
+    base     = (u8_t *)p;
+    capacity = _capacity;
+}
+Arena::~Arena()
+{
+    if (base != 0) {
+        munmap(base, length);
+    }
+}
+void *Arena::arena_alloc(void)
+{
+    u32_t index;
+
+    if (free != ARENA_NO_SLOT) {
+        /* Recycled slots first, they are most likely still in cache */
+        index = free;
+        memcpy(&free, base + (size_t)index * stride, sizeof(u32_t));
+    } else if (top < capacity) {
+        /* Fresh slots are handed out in order so untouched pages are never faulted in */
+        index = top++;
+    } else {
+        return NULL;
+    }
+    used++;
+    return base + (size_t)index * stride;
+}
+void Arena::arena_free(void *ptr)
+{
+    u32_t index = arena_index(ptr);
+
+    if (index == ARENA_NO_SLOT) {
+        return;
+    }
+    memcpy(ptr, &free, sizeof(u32_t));
+    free = index;
+    used--;
+}
+u32_t Arena::arena_get_used(void)
+{
+    return used;
+}
+u32_t Arena::arena_get_capacity(void)
+{
+    return capacity;
+}
+u32_t Arena::arena_get_stride(void)
+{
+    return stride;
+}
+bool_t Arena::arena_is_huge(void)
+{
+    return huge;
+}
+u32_t Arena::arena_index(const void *ptr)
+{
+    size_t offset = (const u8_t *)ptr - base;
+
+    if (ptr < base || offset >= (size_t)stride * top || offset % stride != 0) {
+        return ARENA_NO_SLOT;
+    }
+    return offset / stride;
+}
+void *Arena::arena_at(u32_t index)
+{
+    if (index >= top) {
+        return NULL;
+    }
+    return base + (size_t)index * stride;
+}
@@ -0,0 +1,45 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+
+
+#define ARENA_SLOT_ALIGN 64
+#define ARENA_HUGE_PAGE  (2 * 1024 * 1024)
+#define ARENA_NO_SLOT    0xFFFFFFFF
+
+
+/*
+ * Fixed-size slot allocator over one contiguous mapping, meant for spawning large fleets of cpu_state_t.
+ * The mapping is backed by huge pages when the system has them reserved, otherwise transparent huge pages
+ * are requested. Slots are cache line aligned and free slots are chained through their first bytes, so
+ * alloc/free never touch the heap. Not thread safe: use one arena per thread or lock around it.
+ */
+class Arena {
+  private:
+    u8_t  *base     = 0;
+    size_t length   = 0;
+    u32_t  stride   = 0;
+    u32_t  capacity = 0;
+    u32_t  used     = 0;
+    u32_t  top      = 0;
+    u32_t  free     = ARENA_NO_SLOT;
+    bool_t huge     = 0;
+
+  public:
+    Arena(u32_t slot_size, u32_t _capacity);
+    ~Arena();
+
+    void *arena_alloc(void);
+    void  arena_free(void *ptr);
+
+    u32_t  arena_get_used(void);
+    u32_t  arena_get_capacity(void);
+    u32_t  arena_get_stride(void);
+    bool_t arena_is_huge(void);
+
+    u32_t arena_index(const void *ptr);
+    void *arena_at(u32_t index);
+};
+#endif
@@ -0,0 +1,157 @@
+#include "coro.h"
+#include "cpu_def.h"
+
+
+CoRun::CoRun(CoLoop *_loop, CPU *_cpu, coro_until_t _until, u32_t ticks)
+{
+    loop   = _loop;
+    cpu    = _cpu;
+    until  = _until;
+    target = ticks;
+}
+void CoRun::await_suspend(std::coroutine_handle<> _handle)
+{
+    handle = _handle;
+    if (cpu != 0) {
+        /* Reference points are taken when the run starts, not when the awaitable was built */
+        target      = cpu->cpu_get_state()->tick_counter + target;
+        depth       = cpu->cpu_get_depth();
+        lcd_changes = cpu->cpu_get_lcd_changes();
+    }
+    loop->coloop_queue(this);
+}
+CoLoop::~CoLoop()
+{
+    for (std::coroutine_handle<> task : tasks) {
+        task.destroy();
+    }
+}
+void CoLoop::coloop_spawn(CoTask task)
+{
+    tasks.push_back(task.handle);
+    ready.push_back(task.handle);
+    task.handle = nullptr;
+}
+void CoLoop::coloop_queue(CoRun *run)
+{
+    if (run->until == CORO_UNTIL_YIELD) {
+        ready.push_back(run->handle);
+    } else {
+        runs.push_back(run);
+    }
+}
+bool_t CoLoop::coloop_poll(void)
+{
+    size_t  n;
+    CoRun  *run;
+
+    for (n = ready.size(); n > 0; n--) {
+        std::coroutine_handle<> handle = ready.front();
+        ready.pop_front();
+        handle.resume();
+    }
+    for (n = runs.size(); n > 0; n--) {
+        run = runs.front();
+        runs.pop_front();
+        if (run_slice(run)) {
+            ready.push_back(run->handle);
+        } else {
+            runs.push_back(run);
+        }
+    }
+    for (n = tasks.size(); n > 0; n--) {
+        std::coroutine_handle<> task = tasks.front();
+        tasks.pop_front();
+        if (task.done()) {
+            task.destroy();
+        } else {
+            tasks.push_back(task);
+        }
+    }
+    return !ready.empty() || !runs.empty();
+}
+void CoLoop::coloop_run(void)
+{
+    while (coloop_poll()) {
+    }
+}
+CoRun CoLoop::coloop_frames(CPU *cpu, u32_t frames)
+{
+    return CoRun(this, cpu, CORO_UNTIL_TICKS, frames * CORO_FRAME_TICKS);
+}
+CoRun CoLoop::coloop_ticks(CPU *cpu, u32_t ticks)
+{
+    return CoRun(this, cpu, CORO_UNTIL_TICKS, ticks);
+}
+CoRun CoLoop::coloop_until_lcd(CPU *cpu, u32_t max_frames)
+{
+    return CoRun(this, cpu, CORO_UNTIL_LCD, max_frames * CORO_FRAME_TICKS);
+}
+CoRun CoLoop::coloop_exec(CPU *cpu, exec_mode_t mode)
+{
+    switch (mode) {
+        case EXEC_MODE_RUN:
+            return CoRun(this, cpu, CORO_UNTIL_BREAK, 0);
+        case EXEC_MODE_STEP:
+            return CoRun(this, cpu, CORO_UNTIL_STEP, 0);
+        case EXEC_MODE_NEXT:
+            return CoRun(this, cpu, CORO_UNTIL_NEXT, 0);
+        case EXEC_MODE_TO_CALL:
+            return CoRun(this, cpu, CORO_UNTIL_TO_CALL, 0);
+        case EXEC_MODE_TO_RET:
+            return CoRun(this, cpu, CORO_UNTIL_TO_RET, 0);
+        case EXEC_MODE_PAUSE:
+        default:
+            return CoRun(this, 0, CORO_UNTIL_YIELD, 0);
+    }
+}
+CoRun CoLoop::coloop_yield(void)
+{
+    return CoRun(this, 0, CORO_UNTIL_YIELD, 0);
+}
+bool_t CoLoop::run_slice(CoRun *run)
+{
+    CPU         *cpu = run->cpu;
+    cpu_state_t *st  = cpu->cpu_get_state();
+    u32_t        end = st->tick_counter + CORO_FRAME_TICKS;
+
+    do {
+        if ((run->until == CORO_UNTIL_TICKS || run->until == CORO_UNTIL_LCD) &&
+            (int32_t)(run->target - st->tick_counter) <= 0) {
+            run->result = (run->until == CORO_UNTIL_TICKS) ? CORO_DONE : CORO_TIMEOUT;
+            return 1;
+        }
+        if (cpu->cpu_step()) {
+            run->result = CORO_BREAK;
+            return 1;
+        }
+        run->result = CORO_DONE;
+        switch (run->until) {
+            case CORO_UNTIL_LCD:
+                if (cpu->cpu_get_lcd_changes() != run->lcd_changes) {
+                    return 1;
+                }
+                break;
+            case CORO_UNTIL_STEP:
+                return 1;
+            case CORO_UNTIL_NEXT:
+                if (cpu->cpu_get_depth() <= run->depth) {
+                    return 1;
+                }
+                break;
+            case CORO_UNTIL_TO_CALL:
+                if (cpu->cpu_get_depth() > run->depth) {
+                    return 1;
+                }
+                break;
+            case CORO_UNTIL_TO_RET:
+                if (cpu->cpu_get_depth() < run->depth) {
+                    return 1;
+                }
+                break;
+            default:
+                break;
+        }
+    } while ((int32_t)(end - st->tick_counter) > 0);
+    return 0;
+}
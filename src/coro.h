@@ -0,0 +1,134 @@
+#ifndef _CORO_H_
+#define _CORO_H_
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include "cpu.h"
+#include "tamago_def.h"
+
+
+#define CORO_FRAME_TICKS (TICK_FREQUENCY / DEFAULT_FRAMERATE)
+
+typedef enum
+{
+    CORO_DONE = 0,
+    CORO_TIMEOUT,
+    CORO_BREAK,
+} coro_result_t;
+
+typedef enum
+{
+    CORO_UNTIL_TICKS = 0,
+    CORO_UNTIL_LCD,
+    CORO_UNTIL_STEP,
+    CORO_UNTIL_NEXT,
+    CORO_UNTIL_TO_CALL,
+    CORO_UNTIL_TO_RET,
+    CORO_UNTIL_BREAK,
+    CORO_UNTIL_YIELD,
+} coro_until_t;
+
+
+class CoLoop;
+
+/* Fire-and-forget coroutine owned by a CoLoop once spawned */
+class CoTask {
+  public:
+    struct promise_type
+    {
+        CoTask get_return_object(void)
+        {
+            return CoTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend(void) noexcept
+        {
+            return {};
+        }
+        std::suspend_always final_suspend(void) noexcept
+        {
+            return {};
+        }
+        void return_void(void)
+        {
+        }
+        void unhandled_exception(void)
+        {
+            std::terminate();
+        }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+
+    explicit CoTask(std::coroutine_handle<promise_type> _handle) : handle(_handle)
+    {
+    }
+    CoTask(CoTask &&other) noexcept : handle(other.handle)
+    {
+        other.handle = nullptr;
+    }
+    CoTask(const CoTask &)            = delete;
+    CoTask &operator=(const CoTask &) = delete;
+    ~CoTask()
+    {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+};
+
+/* Awaitable run of one emulator, executed by the loop one frame worth of ticks per turn */
+class CoRun {
+  public:
+    CoLoop                 *loop;
+    CPU                    *cpu;
+    coro_until_t            until;
+    u32_t                   target;
+    u32_t                   depth;
+    u32_t                   lcd_changes;
+    coro_result_t           result = CORO_DONE;
+    std::coroutine_handle<> handle;
+
+    CoRun(CoLoop *_loop, CPU *_cpu, coro_until_t _until, u32_t ticks);
+
+    bool await_ready(void) noexcept
+    {
+        return false;
+    }
+    void          await_suspend(std::coroutine_handle<> _handle);
+    coro_result_t await_resume(void) noexcept
+    {
+        return result;
+    }
+};
+
+
+/*
+ * Single-threaded cooperative event loop interleaving many emulators, input scripts and I/O.
+ * Every awaitable is worked on in slices of at most one emulated frame, so a long run never starves the
+ * other coroutines. CPUs should be headless (or at unlimited speed), a real-time CPU sleeps inside
+ * cpu_step and stalls the whole loop.
+ */
+class CoLoop {
+  private:
+    std::deque<CoRun *>                 runs;
+    std::deque<std::coroutine_handle<>> ready;
+    std::deque<std::coroutine_handle<>> tasks;
+
+  public:
+    ~CoLoop();
+
+    void   coloop_spawn(CoTask task);
+    void   coloop_queue(CoRun *run);
+    bool_t coloop_poll(void);
+    void   coloop_run(void);
+
+    CoRun coloop_frames(CPU *cpu, u32_t frames);
+    CoRun coloop_ticks(CPU *cpu, u32_t ticks);
+    CoRun coloop_until_lcd(CPU *cpu, u32_t max_frames);
+    CoRun coloop_exec(CPU *cpu, exec_mode_t mode);
+    CoRun coloop_yield(void);
+
+  private:
+    bool_t run_slice(CoRun *run);
+};
+#endif
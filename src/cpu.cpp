@@ -1,12 +1,197 @@
+#include <stddef.h>
+#include <string.h>
 #include "cpu.h"
-#include "tamago.h"
+#include "program.h"
+#include "tamago_def.h"
+
+
+/* The save-state image is the in-memory layout, these pin it down */
+static_assert(sizeof(cpu_save_header_t) == 16, "cpu_save_header_t layout changed, bump CPU_SAVE_VERSION");
+static_assert(offsetof(cpu_state_t, memory) == 58, "cpu_state_t layout changed, bump CPU_SAVE_VERSION");
+static_assert(offsetof(cpu_state_t, dirty) == 522, "cpu_state_t layout changed, bump CPU_SAVE_VERSION");
+static_assert(offsetof(cpu_state_t, mem_hash) == 528, "cpu_state_t layout changed, bump CPU_SAVE_VERSION");
+static_assert(sizeof(cpu_state_t) == 536, "cpu_state_t layout changed, bump CPU_SAVE_VERSION");
+static_assert(MEM_PAGE_NUM <= 16, "cpu_state_t::dirty is too small for MEM_PAGE_SIZE");
+static_assert(offsetof(cpu_save_t, lcd) == 552, "cpu_save_t layout changed, bump CPU_SAVE_VERSION");
+
+/* Bytes of memory[] in a page, the last one is cut short */
+static inline u32_t page_len(u8_t page)
+{
+    return (page * MEM_PAGE_SIZE + MEM_PAGE_SIZE > MEM_BUFFER_SIZE) ? MEM_BUFFER_SIZE - page * MEM_PAGE_SIZE
+                                                                    : MEM_PAGE_SIZE;
+}
+static u32_t delta_size(uint16_t pages)
+{
+    u32_t size = sizeof(cpu_delta_header_t) + CPU_DELTA_REGS_SIZE;
+    u8_t  page;
+
+    for (page = 0; page < MEM_PAGE_NUM; page++) {
+        if (pages & (1 << page)) {
+            size += page_len(page);
+        }
+    }
+    return size;
+}
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+static void swap_header(cpu_save_header_t *header)
+{
+    header->magic       = __builtin_bswap32(header->magic);
+    header->version     = __builtin_bswap16(header->version);
+    header->header_size = __builtin_bswap16(header->header_size);
+    header->state_size  = __builtin_bswap32(header->state_size);
+    header->lcd_size    = __builtin_bswap32(header->lcd_size);
+}
+static void swap_state(cpu_state_t *state, lcd_bitmap_t *lcd)
+{
+    u8_t i;
+
+    state->pc                   = __builtin_bswap16(state->pc);
+    state->x                    = __builtin_bswap16(state->x);
+    state->y                    = __builtin_bswap16(state->y);
+    state->tick_counter         = __builtin_bswap32(state->tick_counter);
+    state->clk_timer_timestamp  = __builtin_bswap32(state->clk_timer_timestamp);
+    state->prog_timer_timestamp = __builtin_bswap32(state->prog_timer_timestamp);
+    state->call_depth           = __builtin_bswap32(state->call_depth);
+    state->dirty                = __builtin_bswap16(state->dirty);
+    state->mem_hash             = __builtin_bswap64(state->mem_hash);
+    for (i = 0; lcd && i < 16; i++) {
+        lcd->rows[i] = __builtin_bswap32(lcd->rows[i]);
+    }
+}
+#endif
 
 #define CALL_MEMBER_FN(object, ptrToMember) ((object).*(ptrToMember))
 
 
-CPU::CPU(Tamago *_tamago)
+/* LCD column of every segment line, values >= LCD_WIDTH are icon segments */
+const u8_t CPU::lcd_seg_pos[40] = {0,  1,  2,  3,  4,  5,  6,  7,  32, 8,  9,  10, 11, 12, 13, 14, 15, 33, 34, 35,
+                                   31, 30, 29, 28, 27, 26, 25, 24, 36, 23, 22, 21, 20, 19, 18, 17, 16, 37, 38, 39};
+
+const CPU::op_t CPU::ops[OP_NUM + 1] = {
+        {(char *)"PSET #0x%02X            ", 0xE40, MASK_7B, 0, 0, 5, &CPU::op_pset_cb},
+        {(char *)"JP   #0x%02X            ", 0x000, MASK_4B, 0, 0, 5, &CPU::op_jp_cb},
+        {(char *)"JP   C #0x%02X          ", 0x200, MASK_4B, 0, 0, 5, &CPU::op_jp_c_cb},
+        {(char *)"JP   NC #0x%02X         ", 0x300, MASK_4B, 0, 0, 5, &CPU::op_jp_nc_cb},
+        {(char *)"JP   Z #0x%02X          ", 0x600, MASK_4B, 0, 0, 5, &CPU::op_jp_z_cb},
+        {(char *)"JP   NZ #0x%02X         ", 0x700, MASK_4B, 0, 0, 5, &CPU::op_jp_nz_cb},
+        {(char *)"JPBA                  ", 0xFE8, MASK_12B, 0, 0, 5, &CPU::op_jpba_cb},
+        {(char *)"CALL #0x%02X            ", 0x400, MASK_4B, 0, 0, 7, &CPU::op_call_cb},
+        {(char *)"CALZ #0x%02X            ", 0x500, MASK_4B, 0, 0, 7, &CPU::op_calz_cb},
+        {(char *)"RET                   ", 0xFDF, MASK_12B, 0, 0, 7, &CPU::op_ret_cb},
+        {(char *)"RETS                  ", 0xFDE, MASK_12B, 0, 0, 12, &CPU::op_rets_cb},
+        {(char *)"RETD #0x%02X            ", 0x100, MASK_4B, 0, 0, 12, &CPU::op_retd_cb},
+        {(char *)"NOP5                  ", 0xFFB, MASK_12B, 0, 0, 5, &CPU::op_nop5_cb},
+        {(char *)"NOP7                  ", 0xFFF, MASK_12B, 0, 0, 7, &CPU::op_nop7_cb},
+        {(char *)"HALT                  ", 0xFF8, MASK_12B, 0, 0, 5, &CPU::op_halt_cb},
+        {(char *)"INC  X #0x%02X          ", 0xEE0, MASK_12B, 0, 0, 5, &CPU::op_inc_x_cb},
+        {(char *)"INC  Y #0x%02X          ", 0xEF0, MASK_12B, 0, 0, 5, &CPU::op_inc_y_cb},
+        {(char *)"LD   X #0x%02X          ", 0xB00, MASK_4B, 0, 0, 5, &CPU::op_ld_x_cb},
+        {(char *)"LD   Y #0x%02X          ", 0x800, MASK_4B, 0, 0, 5, &CPU::op_ld_y_cb},
+        {(char *)"LD   XP R(#0x%02X)      ", 0xE80, MASK_10B, 0, 0, 5, &CPU::op_ld_xp_r_cb},
+        {(char *)"LD   XH R(#0x%02X)      ", 0xE84, MASK_10B, 0, 0, 5, &CPU::op_ld_xh_r_cb},
+        {(char *)"LD   XL R(#0x%02X)      ", 0xE88, MASK_10B, 0, 0, 5, &CPU::op_ld_xl_r_cb},
+        {(char *)"LD   YP R(#0x%02X)      ", 0xE90, MASK_10B, 0, 0, 5, &CPU::op_ld_yp_r_cb},
+        {(char *)"LD   YH R(#0x%02X)      ", 0xE94, MASK_10B, 0, 0, 5, &CPU::op_ld_yh_r_cb},
+        {(char *)"LD   YL R(#0x%02X)      ", 0xE98, MASK_10B, 0, 0, 5, &CPU::op_ld_yl_r_cb},
+        {(char *)"LD   R(#0x%02X) XP      ", 0xEA0, MASK_10B, 0, 0, 5, &CPU::op_ld_r_xp_cb},
+        {(char *)"LD   R(#0x%02X) XH      ", 0xEA4, MASK_10B, 0, 0, 5, &CPU::op_ld_r_xh_cb},
+        {(char *)"LD   R(#0x%02X) XL      ", 0xEA8, MASK_10B, 0, 0, 5, &CPU::op_ld_r_xl_cb},
+        {(char *)"LD   R(#0x%02X) YP      ", 0xEB0, MASK_10B, 0, 0, 5, &CPU::op_ld_r_yp_cb},
+        {(char *)"LD   R(#0x%02X) YH      ", 0xEB4, MASK_10B, 0, 0, 5, &CPU::op_ld_r_yh_cb},
+        {(char *)"LD   R(#0x%02X) YL      ", 0xEB8, MASK_10B, 0, 0, 5, &CPU::op_ld_r_yl_cb},
+        {(char *)"ADC  XH #0x%02X         ", 0xA00, MASK_8B, 0, 0, 7, &CPU::op_adc_xh_cb},
+        {(char *)"ADC  XL #0x%02X         ", 0xA10, MASK_8B, 0, 0, 7, &CPU::op_adc_xl_cb},
+        {(char *)"ADC  YH #0x%02X         ", 0xA20, MASK_8B, 0, 0, 7, &CPU::op_adc_yh_cb},
+        {(char *)"ADC  YL #0x%02X         ", 0xA30, MASK_8B, 0, 0, 7, &CPU::op_adc_yl_cb},
+        {(char *)"CP   XH #0x%02X         ", 0xA40, MASK_8B, 0, 0, 7, &CPU::op_cp_xh_cb},
+        {(char *)"CP   XL #0x%02X         ", 0xA50, MASK_8B, 0, 0, 7, &CPU::op_cp_xl_cb},
+        {(char *)"CP   YH #0x%02X         ", 0xA60, MASK_8B, 0, 0, 7, &CPU::op_cp_yh_cb},
+        {(char *)"CP   YL #0x%02X         ", 0xA70, MASK_8B, 0, 0, 7, &CPU::op_cp_yl_cb},
+        {(char *)"LD   R(#0x%02X) #0x%02X   ", 0xE00, MASK_6B, 4, 0x030, 5, &CPU::op_ld_r_i_cb},
+        {(char *)"LD   R(#0x%02X) Q(#0x%02X)", 0xEC0, MASK_8B, 2, 0x00C, 5, &CPU::op_ld_r_q_cb},
+        {(char *)"LD   A M(#0x%02X)       ", 0xFA0, MASK_8B, 0, 0, 5, &CPU::op_ld_a_mn_cb},
+        {(char *)"LD   B M(#0x%02X)       ", 0xFB0, MASK_8B, 0, 0, 5, &CPU::op_ld_b_mn_cb},
+        {(char *)"LD   M(#0x%02X) A       ", 0xF80, MASK_8B, 0, 0, 5, &CPU::op_ld_mn_a_cb},
+        {(char *)"LD   M(#0x%02X) B       ", 0xF90, MASK_8B, 0, 0, 5, &CPU::op_ld_mn_b_cb},
+        {(char *)"LDPX MX #0x%02X         ", 0xE60, MASK_8B, 0, 0, 5, &CPU::op_ldpx_mx_cb},
+        {(char *)"LDPX R(#0x%02X) Q(#0x%02X)", 0xEE0, MASK_8B, 2, 0x00C, 5, &CPU::op_ldpx_r_cb},
+        {(char *)"LDPY MY #0x%02X         ", 0xE70, MASK_8B, 0, 0, 5, &CPU::op_ldpy_my_cb},
+        {(char *)"LDPY R(#0x%02X) Q(#0x%02X)", 0xEF0, MASK_8B, 2, 0x00C, 5, &CPU::op_ldpy_r_cb},
+        {(char *)"LBPX #0x%02X            ", 0x900, MASK_4B, 0, 0, 5, &CPU::op_lbpx_cb},
+        {(char *)"SET  #0x%02X            ", 0xF40, MASK_8B, 0, 0, 7, &CPU::op_set_cb},
+        {(char *)"RST  #0x%02X            ", 0xF50, MASK_8B, 0, 0, 7, &CPU::op_rst_cb},
+        {(char *)"SCF                   ", 0xF41, MASK_12B, 0, 0, 7, &CPU::op_scf_cb},
+        {(char *)"RCF                   ", 0xF5E, MASK_12B, 0, 0, 7, &CPU::op_rcf_cb},
+        {(char *)"SZF                   ", 0xF42, MASK_12B, 0, 0, 7, &CPU::op_szf_cb},
+        {(char *)"RZF                   ", 0xF5D, MASK_12B, 0, 0, 7, &CPU::op_rzf_cb},
+        {(char *)"SDF                   ", 0xF44, MASK_12B, 0, 0, 7, &CPU::op_sdf_cb},
+        {(char *)"RDF                   ", 0xF5B, MASK_12B, 0, 0, 7, &CPU::op_rdf_cb},
+        {(char *)"EI                    ", 0xF48, MASK_12B, 0, 0, 7, &CPU::op_ei_cb},
+        {(char *)"DI                    ", 0xF57, MASK_12B, 0, 0, 7, &CPU::op_di_cb},
+        {(char *)"INC  SP               ", 0xFDB, MASK_12B, 0, 0, 5, &CPU::op_inc_sp_cb},
+        {(char *)"DEC  SP               ", 0xFCB, MASK_12B, 0, 0, 5, &CPU::op_dec_sp_cb},
+        {(char *)"PUSH R(#0x%02X)         ", 0xFC0, MASK_10B, 0, 0, 5, &CPU::op_push_r_cb},
+        {(char *)"PUSH XP               ", 0xFC4, MASK_12B, 0, 0, 5, &CPU::op_push_xp_cb},
+        {(char *)"PUSH XH               ", 0xFC5, MASK_12B, 0, 0, 5, &CPU::op_push_xh_cb},
+        {(char *)"PUSH XL               ", 0xFC6, MASK_12B, 0, 0, 5, &CPU::op_push_xl_cb},
+        {(char *)"PUSH YP               ", 0xFC7, MASK_12B, 0, 0, 5, &CPU::op_push_yp_cb},
+        {(char *)"PUSH YH               ", 0xFC8, MASK_12B, 0, 0, 5, &CPU::op_push_yh_cb},
+        {(char *)"PUSH YL               ", 0xFC9, MASK_12B, 0, 0, 5, &CPU::op_push_yl_cb},
+        {(char *)"PUSH F                ", 0xFCA, MASK_12B, 0, 0, 5, &CPU::op_push_f_cb},
+        {(char *)"POP  R(#0x%02X)         ", 0xFD0, MASK_10B, 0, 0, 5, &CPU::op_pop_r_cb},
+        {(char *)"POP  XP               ", 0xFD4, MASK_12B, 0, 0, 5, &CPU::op_pop_xp_cb},
+        {(char *)"POP  XH               ", 0xFD5, MASK_12B, 0, 0, 5, &CPU::op_pop_xh_cb},
+        {(char *)"POP  XL               ", 0xFD6, MASK_12B, 0, 0, 5, &CPU::op_pop_xl_cb},
+        {(char *)"POP  YP               ", 0xFD7, MASK_12B, 0, 0, 5, &CPU::op_pop_yp_cb},
+        {(char *)"POP  YH               ", 0xFD8, MASK_12B, 0, 0, 5, &CPU::op_pop_yh_cb},
+        {(char *)"POP  YL               ", 0xFD9, MASK_12B, 0, 0, 5, &CPU::op_pop_yl_cb},
+        {(char *)"POP  F                ", 0xFDA, MASK_12B, 0, 0, 5, &CPU::op_pop_f_cb},
+        {(char *)"LD   SPH R(#0x%02X)     ", 0xFE0, MASK_10B, 0, 0, 5, &CPU::op_ld_sph_r_cb},
+        {(char *)"LD   SPL R(#0x%02X)     ", 0xFF0, MASK_10B, 0, 0, 5, &CPU::op_ld_spl_r_cb},
+        {(char *)"LD   R(#0x%02X) SPH     ", 0xFE4, MASK_10B, 0, 0, 5, &CPU::op_ld_r_sph_cb},
+        {(char *)"LD   R(#0x%02X) SPL     ", 0xFF4, MASK_10B, 0, 0, 5, &CPU::op_ld_r_spl_cb},
+        {(char *)"ADD  R(#0x%02X) #0x%02X   ", 0xC00, MASK_6B, 4, 0x030, 7, &CPU::op_add_r_i_cb},
+        {(char *)"ADD  R(#0x%02X) Q(#0x%02X)", 0xA80, MASK_8B, 2, 0x00C, 7, &CPU::op_add_r_q_cb},
+        {(char *)"ADC  R(#0x%02X) #0x%02X   ", 0xC40, MASK_6B, 4, 0x030, 7, &CPU::op_adc_r_i_cb},
+        {(char *)"ADC  R(#0x%02X) Q(#0x%02X)", 0xA90, MASK_8B, 2, 0x00C, 7, &CPU::op_adc_r_q_cb},
+        {(char *)"SUB  R(#0x%02X) Q(#0x%02X)", 0xAA0, MASK_8B, 2, 0x00C, 7, &CPU::op_sub_cb},
+        {(char *)"SBC  R(#0x%02X) #0x%02X   ", 0xB40, MASK_6B, 4, 0x030, 7, &CPU::op_sbc_r_i_cb},
+        {(char *)"SBC  R(#0x%02X) Q(#0x%02X)", 0xAB0, MASK_8B, 2, 0x00C, 7, &CPU::op_sbc_r_q_cb},
+        {(char *)"AND  R(#0x%02X) #0x%02X   ", 0xC80, MASK_6B, 4, 0x030, 7, &CPU::op_and_r_i_cb},
+        {(char *)"AND  R(#0x%02X) Q(#0x%02X)", 0xAC0, MASK_8B, 2, 0x00C, 7, &CPU::op_and_r_q_cb},
+        {(char *)"OR   R(#0x%02X) #0x%02X   ", 0xCC0, MASK_6B, 4, 0x030, 7, &CPU::op_or_r_i_cb},
+        {(char *)"OR   R(#0x%02X) Q(#0x%02X)", 0xAD0, MASK_8B, 2, 0x00C, 7, &CPU::op_or_r_q_cb},
+        {(char *)"XOR  R(#0x%02X) #0x%02X   ", 0xD00, MASK_6B, 4, 0x030, 7, &CPU::op_xor_r_i_cb},
+        {(char *)"XOR  R(#0x%02X) Q(#0x%02X)", 0xAE0, MASK_8B, 2, 0x00C, 7, &CPU::op_xor_r_q_cb},
+        {(char *)"CP   R(#0x%02X) #0x%02X   ", 0xDC0, MASK_6B, 4, 0x030, 7, &CPU::op_cp_r_i_cb},
+        {(char *)"CP   R(#0x%02X) Q(#0x%02X)", 0xF00, MASK_8B, 2, 0x00C, 7, &CPU::op_cp_r_q_cb},
+        {(char *)"FAN  R(#0x%02X) #0x%02X   ", 0xD80, MASK_6B, 4, 0x030, 7, &CPU::op_fan_r_i_cb},
+        {(char *)"FAN  R(#0x%02X) Q(#0x%02X)", 0xF10, MASK_8B, 2, 0x00C, 7, &CPU::op_fan_r_q_cb},
+        {(char *)"RLC  R(#0x%02X)         ", 0xAF0, MASK_8B, 0, 0, 7, &CPU::op_rlc_cb},
+        {(char *)"RRC  R(#0x%02X)         ", 0xE8C, MASK_10B, 0, 0, 5, &CPU::op_rrc_cb},
+        {(char *)"INC  M(#0x%02X)         ", 0xF60, MASK_8B, 0, 0, 7, &CPU::op_inc_mn_cb},
+        {(char *)"DEC  M(#0x%02X)         ", 0xF70, MASK_8B, 0, 0, 7, &CPU::op_dec_mn_cb},
+        {(char *)"ACPX R(#0x%02X)         ", 0xF28, MASK_10B, 0, 0, 7, &CPU::op_acpx_cb},
+        {(char *)"ACPY R(#0x%02X)         ", 0xF2C, MASK_10B, 0, 0, 7, &CPU::op_acpy_cb},
+        {(char *)"SCPX R(#0x%02X)         ", 0xF38, MASK_10B, 0, 0, 7, &CPU::op_scpx_cb},
+        {(char *)"SCPY R(#0x%02X)         ", 0xF3C, MASK_10B, 0, 0, 7, &CPU::op_scpy_cb},
+        {(char *)"NOT  R(#0x%02X)         ", 0xD0F, 0xFCF, 4, 0, 7, &CPU::op_not_cb},
+        {0, 0, 0, 0, 0, 0, 0},
+};
+
+CPU::CPU(Hal *_hal)
+{
+    hal = _hal;
+    cpu_init_state(&state);
+}
+CPU::~CPU()
 {
-    tamago = _tamago;
+    if (shared && shared->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete shared;
+    }
+    if (g_program) {
+        g_program->program_release();
+    }
 }
 void CPU::cpu_set_speed(u8_t speed)
 {
@@ -14,18 +199,50 @@ void CPU::cpu_set_speed(u8_t speed)
 }
 u32_t CPU::cpu_get_depth(void)
 {
-    return call_depth;
+    return st->call_depth;
+}
+u32_t CPU::cpu_get_lcd_changes(void)
+{
+    return lcd_changes;
+}
+cpu_state_t *CPU::cpu_get_state(void)
+{
+    /* Callers may write through the pointer */
+    own_state();
+    return st;
+}
+void CPU::cpu_bind_state(cpu_state_t *state)
+{
+    own_state();
+    st = state;
+}
+void CPU::cpu_set_lcd_bitmap(lcd_bitmap_t *bitmap)
+{
+    lcd_bitmap = bitmap;
+}
+void CPU::cpu_set_input_hook(cpu_input_cb_t cb, void *ctx)
+{
+    input_cb  = cb;
+    input_ctx = ctx;
 }
 void CPU::generate_interrupt(int_slot_t slot, u8_t bit)
 {
-    interrupts[slot].factor_flag_reg = interrupts[slot].factor_flag_reg | (0x1 << bit);
-    if (interrupts[slot].mask_reg & (0x1 << bit)) {
-        interrupts[slot].triggered = 1;
+    own_state();
+    st->interrupts[slot].factor_flag_reg = st->interrupts[slot].factor_flag_reg | (0x1 << bit);
+    if (st->interrupts[slot].mask_reg & (0x1 << bit)) {
+        st->interrupts[slot].triggered = 1;
     }
 }
 void CPU::cpu_set_input_pin(pin_t pin, pin_state_t state)
 {
-    inputs[pin & 0x4].states = (inputs[pin & 0x4].states & ~(0x1 << (pin & 0x3))) | (state << (pin & 0x3));
+    input_port_t *port;
+
+    own_state();
+    if (input_cb) {
+        input_cb(input_ctx, st->tick_counter, pin, state);
+    }
+    port         = &st->inputs[(pin & 0x4) >> 2];
+    port->states = (port->states & ~(0x1 << (pin & 0x3))) | (state << (pin & 0x3));
     if (state == PIN_STATE_LOW) {
         switch ((pin & 0x4) >> 2) {
             case 0:
@@ -39,122 +256,135 @@ void CPU::cpu_set_input_pin(pin_t pin, pin_state_t state)
 }
 void CPU::cpu_sync_ref_timestamp(void)
 {
-    ref_ts = tamago->hal_get_timestamp();
+    ref_ts = hal ? hal->hal_get_timestamp() : 0;
 }
 u4_t CPU::get_io(u12_t n)
 {
     u4_t tmp;
+    own_state();
     switch (n) {
         case REG_CLK_INT_FACTOR_FLAGS:
-            tmp                                              = interrupts[INT_CLOCK_TIMER_SLOT].factor_flag_reg;
-            interrupts[INT_CLOCK_TIMER_SLOT].factor_flag_reg = 0;
+            tmp                                                  = st->interrupts[INT_CLOCK_TIMER_SLOT].factor_flag_reg;
+            st->interrupts[INT_CLOCK_TIMER_SLOT].factor_flag_reg = 0;
             return tmp;
         case REG_SW_INT_FACTOR_FLAGS:
-            tmp                                            = interrupts[INT_STOPWATCH_SLOT].factor_flag_reg;
-            interrupts[INT_STOPWATCH_SLOT].factor_flag_reg = 0;
+            tmp                                                = st->interrupts[INT_STOPWATCH_SLOT].factor_flag_reg;
+            st->interrupts[INT_STOPWATCH_SLOT].factor_flag_reg = 0;
             return tmp;
         case REG_PROG_INT_FACTOR_FLAGS:
-            tmp                                             = interrupts[INT_PROG_TIMER_SLOT].factor_flag_reg;
-            interrupts[INT_PROG_TIMER_SLOT].factor_flag_reg = 0;
+            tmp                                                 = st->interrupts[INT_PROG_TIMER_SLOT].factor_flag_reg;
+            st->interrupts[INT_PROG_TIMER_SLOT].factor_flag_reg = 0;
             return tmp;
         case REG_SERIAL_INT_FACTOR_FLAGS:
-            tmp                                         = interrupts[INT_SERIAL_SLOT].factor_flag_reg;
-            interrupts[INT_SERIAL_SLOT].factor_flag_reg = 0;
+            tmp                                             = st->interrupts[INT_SERIAL_SLOT].factor_flag_reg;
+            st->interrupts[INT_SERIAL_SLOT].factor_flag_reg = 0;
             return tmp;
         case REG_K00_K03_INT_FACTOR_FLAGS:
-            tmp                                          = interrupts[INT_K00_K03_SLOT].factor_flag_reg;
-            interrupts[INT_K00_K03_SLOT].factor_flag_reg = 0;
+            tmp                                              = st->interrupts[INT_K00_K03_SLOT].factor_flag_reg;
+            st->interrupts[INT_K00_K03_SLOT].factor_flag_reg = 0;
             return tmp;
         case REG_K10_K13_INT_FACTOR_FLAGS:
-            tmp                                          = interrupts[INT_K10_K13_SLOT].factor_flag_reg;
-            interrupts[INT_K10_K13_SLOT].factor_flag_reg = 0;
+            tmp                                              = st->interrupts[INT_K10_K13_SLOT].factor_flag_reg;
+            st->interrupts[INT_K10_K13_SLOT].factor_flag_reg = 0;
             return tmp;
         case REG_CLOCK_INT_MASKS:
-            return interrupts[INT_CLOCK_TIMER_SLOT].mask_reg;
+            return st->interrupts[INT_CLOCK_TIMER_SLOT].mask_reg;
         case REG_SW_INT_MASKS:
-            return interrupts[INT_STOPWATCH_SLOT].mask_reg & 0x3;
+            return st->interrupts[INT_STOPWATCH_SLOT].mask_reg & 0x3;
         case REG_PROG_INT_MASKS:
-            return interrupts[INT_PROG_TIMER_SLOT].mask_reg & 0x1;
+            return st->interrupts[INT_PROG_TIMER_SLOT].mask_reg & 0x1;
         case REG_SERIAL_INT_MASKS:
-            return interrupts[INT_SERIAL_SLOT].mask_reg & 0x1;
+            return st->interrupts[INT_SERIAL_SLOT].mask_reg & 0x1;
         case REG_K00_K03_INT_MASKS:
-            return interrupts[INT_K00_K03_SLOT].mask_reg;
+            return st->interrupts[INT_K00_K03_SLOT].mask_reg;
         case REG_K10_K13_INT_MASKS:
-            return interrupts[INT_K10_K13_SLOT].mask_reg;
+            return st->interrupts[INT_K10_K13_SLOT].mask_reg;
         case REG_PROG_TIMER_DATA_L:
-            return prog_timer_data & 0xF;
+            return st->prog_timer_data & 0xF;
         case REG_PROG_TIMER_DATA_H:
-            return (prog_timer_data >> 4) & 0xF;
+            return (st->prog_timer_data >> 4) & 0xF;
         case REG_PROG_TIMER_RELOAD_DATA_L:
-            return prog_timer_rld & 0xF;
+            return st->prog_timer_rld & 0xF;
         case REG_PROG_TIMER_RELOAD_DATA_H:
-            return (prog_timer_rld >> 4) & 0xF;
+            return (st->prog_timer_rld >> 4) & 0xF;
         case REG_K00_K03_INPUT_PORT:
-            return inputs[0].states;
+            return st->inputs[0].states;
         case REG_K10_K13_INPUT_PORT:
-            return inputs[1].states;
+            return st->inputs[1].states;
+        case REG_SERIAL_DATA_L:
+        case REG_SERIAL_DATA_H:
+            return GET_IO_MEMORY(st->memory, n);
         case REG_K40_K43_BZ_OUTPUT_PORT:
-            return GET_IO_MEMORY(memory, n);
+            return GET_IO_MEMORY(st->memory, n);
         case REG_CPU_OSC3_CTRL:
-            return GET_IO_MEMORY(memory, n);
+            return GET_IO_MEMORY(st->memory, n);
         case REG_LCD_CTRL:
-            return GET_IO_MEMORY(memory, n);
+            return GET_IO_MEMORY(st->memory, n);
         case REG_LCD_CONTRAST:
             break;
         case REG_SVD_CTRL:
-            return GET_IO_MEMORY(memory, n) & 0x7;
+            return GET_IO_MEMORY(st->memory, n) & 0x7;
         case REG_BUZZER_CTRL1:
-            return GET_IO_MEMORY(memory, n);
+            return GET_IO_MEMORY(st->memory, n);
         case REG_BUZZER_CTRL2:
-            return GET_IO_MEMORY(memory, n) & 0x3;
+            return GET_IO_MEMORY(st->memory, n) & 0x3;
         case REG_CLK_WD_TIMER_CTRL:
             break;
         case REG_SW_TIMER_CTRL:
             break;
         case REG_PROG_TIMER_CTRL:
-            return !!prog_timer_enabled;
+            return !!st->prog_timer_enabled;
         case REG_PROG_TIMER_CLK_SEL:
             break;
+        case REG_SERIAL_CTRL:
+            return (GET_IO_MEMORY(st->memory, n) & ~SERIAL_CTRL_TRIGGER) |
+                   ((st->serial_state != SERIAL_IDLE) ? SERIAL_CTRL_TRIGGER : 0);
         default:;
     }
     return 0;
 }
 void CPU::set_io(u12_t n, u4_t v)
 {
+    own_state();
     switch (n) {
         case REG_CLOCK_INT_MASKS:
-            interrupts[INT_CLOCK_TIMER_SLOT].mask_reg = v;
+            st->interrupts[INT_CLOCK_TIMER_SLOT].mask_reg = v;
             break;
         case REG_SW_INT_MASKS:
-            interrupts[INT_STOPWATCH_SLOT].mask_reg = v;
+            st->interrupts[INT_STOPWATCH_SLOT].mask_reg = v;
             break;
         case REG_PROG_INT_MASKS:
-            interrupts[INT_PROG_TIMER_SLOT].mask_reg = v;
+            st->interrupts[INT_PROG_TIMER_SLOT].mask_reg = v;
             break;
         case REG_SERIAL_INT_MASKS:
-            interrupts[INT_K10_K13_SLOT].mask_reg = v;
+            st->interrupts[INT_K10_K13_SLOT].mask_reg = v;
             break;
         case REG_K00_K03_INT_MASKS:
-            interrupts[INT_SERIAL_SLOT].mask_reg = v;
+            st->interrupts[INT_SERIAL_SLOT].mask_reg = v;
             break;
         case REG_K10_K13_INT_MASKS:
-            interrupts[INT_K10_K13_SLOT].mask_reg = v;
+            st->interrupts[INT_K10_K13_SLOT].mask_reg = v;
             break;
         case REG_PROG_TIMER_RELOAD_DATA_L:
-            prog_timer_rld = v | (prog_timer_rld & 0xF0);
+            st->prog_timer_rld = v | (st->prog_timer_rld & 0xF0);
             break;
         case REG_PROG_TIMER_RELOAD_DATA_H:
-            prog_timer_rld = (prog_timer_rld & 0xF) | (v << 4);
+            st->prog_timer_rld = (st->prog_timer_rld & 0xF) | (v << 4);
             break;
         case REG_K00_K03_INPUT_PORT:
             break;
         case REG_K40_K43_BZ_OUTPUT_PORT:
             //
-            tamago->hal_play_frequency(!(v & 0x8));
+            if (hal) {
+                hal->hal_play_frequency(!(v & 0x8));
+            }
             break;
         case REG_CPU_OSC3_CTRL:
             break;
         case REG_LCD_CTRL:
+            if (hal) {
+                hal->hw_enable_lcd(!(v & LCD_CTRL_ALOFF));
+            }
             break;
         case REG_LCD_CONTRAST:
             break;
@@ -170,15 +400,21 @@ void CPU::set_io(u12_t n, u4_t v)
             break;
         case REG_PROG_TIMER_CTRL:
             if (v & 0x2) {
-                prog_timer_data = prog_timer_rld;
+                st->prog_timer_data = st->prog_timer_rld;
             }
-            if ((v & 0x1) && !prog_timer_enabled) {
-                prog_timer_timestamp = tick_counter;
+            if ((v & 0x1) && !st->prog_timer_enabled) {
+                st->prog_timer_timestamp = st->tick_counter;
             }
-            prog_timer_enabled = v & 0x1;
+            st->prog_timer_enabled = v & 0x1;
             break;
         case REG_PROG_TIMER_CLK_SEL:
             break;
+        case REG_SERIAL_CTRL:
+            /* The transfer itself is carried out by whatever links this instance (see SerialLink) */
+            if ((v & SERIAL_CTRL_TRIGGER) && st->serial_state == SERIAL_IDLE) {
+                st->serial_state = SERIAL_REQUESTED;
+            }
+            break;
         default:;
     }
 }
@@ -188,22 +424,381 @@ void CPU::set_lcd(u12_t n, u4_t v)
     u8_t seg, com0;
     seg  = ((n & 0x7F) >> 1);
     com0 = (((n & 0x80) >> 7) * 8 + (n & 0x1) * 4);
+    if (lcd_bitmap) {
+        for (i = 0; i < 4; i++) {
+            set_lcd_bitmap(lcd_bitmap, seg, com0 + i, (v >> i) & 0x1);
+        }
+    }
+    if (!hal) {
+        return;
+    }
     for (i = 0; i < 4; i++) {
-        tamago->hw_set_lcd_pin(seg, com0 + i, (v >> i) & 0x1);
+        hal->hw_set_lcd_pin(seg, com0 + i, (v >> i) & 0x1);
+    }
+}
+void CPU::set_lcd_bitmap(lcd_bitmap_t *lcd_bitmap, u8_t seg, u8_t com, u8_t val)
+{
+    u8_t col = lcd_seg_pos[seg];
+    u8_t icon;
+    if (col < LCD_WIDTH) {
+        lcd_bitmap->rows[com] = (lcd_bitmap->rows[com] & ~(1U << col)) | ((u32_t)val << col);
+        return;
+    }
+    if (seg == 8 && com < 4) {
+        icon = com;
+    } else if (seg == 28 && com >= 12) {
+        icon = com - 8;
+    } else {
+        return;
+    }
+    lcd_bitmap->icons = (lcd_bitmap->icons & ~(1 << icon)) | (val << icon);
+}
+void CPU::cpu_render_lcd(const cpu_state_t *state, lcd_bitmap_t *bitmap)
+{
+    u12_t n;
+    u4_t  v;
+    u8_t  i;
+    memset(bitmap, 0, sizeof(lcd_bitmap_t));
+    for (n = MEM_DISPLAY1_ADDR; n < MEM_DISPLAY2_ADDR + MEM_DISPLAY2_SIZE; n++) {
+        if (n == MEM_DISPLAY1_ADDR + MEM_DISPLAY1_SIZE) {
+            n = MEM_DISPLAY2_ADDR;
+        }
+        v = (n < MEM_DISPLAY2_ADDR) ? GET_DISP1_MEMORY(state->memory, n) : GET_DISP2_MEMORY(state->memory, n);
+        for (i = 0; v != 0 && i < 4; i++) {
+            if ((v >> i) & 0x1) {
+                set_lcd_bitmap(bitmap, (n & 0x7F) >> 1, ((n & 0x80) >> 7) * 8 + (n & 0x1) * 4 + i, 1);
+            }
+        }
+    }
+}
+void CPU::cpu_encode_state(const cpu_state_t *state, const lcd_bitmap_t *lcd, cpu_save_t *save)
+{
+    save->header = {CPU_SAVE_MAGIC, CPU_SAVE_VERSION, sizeof(cpu_save_header_t), sizeof(cpu_state_t),
+                    sizeof(lcd_bitmap_t)};
+    save->state  = *state;
+    save->lcd    = *lcd;
+    /* A full save is a checkpoint of its own, nothing in it is relative to an earlier one */
+    save->state.dirty = 0;
+    /* Keep the image deterministic, the tail padding would otherwise carry whatever was on the stack */
+    memset((u8_t *)save + offsetof(cpu_save_t, lcd) + sizeof(lcd_bitmap_t), 0,
+           sizeof(cpu_save_t) - offsetof(cpu_save_t, lcd) - sizeof(lcd_bitmap_t));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    swap_header(&save->header);
+    swap_state(&save->state, &save->lcd);
+#endif
+}
+bool_t CPU::cpu_decode_state(const void *buf, u32_t size, cpu_state_t *state, lcd_bitmap_t *lcd)
+{
+    cpu_save_header_t header;
+    cpu_state_t       loaded;
+    lcd_bitmap_t      loaded_lcd;
+
+    if (size < sizeof(cpu_save_t)) {
+        return 1;
+    }
+    memcpy(&header, buf, sizeof(header));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    swap_header(&header);
+#endif
+    if (header.magic != CPU_SAVE_MAGIC || header.version != CPU_SAVE_VERSION ||
+        header.header_size != sizeof(cpu_save_header_t) || header.state_size != sizeof(cpu_state_t) ||
+        header.lcd_size != sizeof(lcd_bitmap_t)) {
+        return 1;
+    }
+    /* Decoded aside, a rejected save leaves the state and the LCD untouched */
+    memcpy(&loaded, (const u8_t *)buf + offsetof(cpu_save_t, state), sizeof(cpu_state_t));
+    memcpy(&loaded_lcd, (const u8_t *)buf + offsetof(cpu_save_t, lcd), sizeof(lcd_bitmap_t));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    swap_state(&loaded, &loaded_lcd);
+#endif
+    if (cpu_check_state(&loaded)) {
+        return 1;
+    }
+    *state          = loaded;
+    state->dirty    = 0;
+    state->mem_hash = cpu_hash_memory(state);
+    if (lcd) {
+        *lcd = loaded_lcd;
+    }
+    return 0;
+}
+/* Registers read back from outside are used as indexes as they are, so anything wider than the hardware is refused */
+bool_t CPU::cpu_check_state(const cpu_state_t *state)
+{
+    return state->pc > 0x1FFF || state->np > 0x1F || state->x > 0xFFF || state->y > 0xFFF ||
+           state->a > 0xF || state->b > 0xF || state->flags > 0xF || state->serial_state > SERIAL_IN_FLIGHT;
+}
+u32_t CPU::cpu_encode_delta(cpu_state_t *state, void *buf, u32_t size)
+{
+    cpu_delta_header_t header = {CPU_DELTA_MAGIC, CPU_SAVE_VERSION, state->dirty, delta_size(state->dirty)};
+    cpu_state_t        regs;
+    u8_t              *out = (u8_t *)buf;
+    u32_t              at, len;
+    u8_t               page;
+
+    if (size < header.size) {
+        return 0;
+    }
+    len = header.size;
+    at  = sizeof(header) + CPU_DELTA_REGS_SIZE;
+    for (page = 0; page < MEM_PAGE_NUM; page++) {
+        if (state->dirty & (1 << page)) {
+            memcpy(out + at, &state->memory[page * MEM_PAGE_SIZE], page_len(page));
+            at += page_len(page);
+        }
+    }
+    memcpy(&regs, state, CPU_DELTA_REGS_SIZE);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    header.magic   = __builtin_bswap32(header.magic);
+    header.version = __builtin_bswap16(header.version);
+    header.pages   = __builtin_bswap16(header.pages);
+    header.size    = __builtin_bswap32(header.size);
+    swap_state(&regs, NULL);
+#endif
+    memcpy(out, &header, sizeof(header));
+    memcpy(out + sizeof(header), &regs, CPU_DELTA_REGS_SIZE);
+    state->dirty = 0;
+    return len;
+}
+bool_t CPU::cpu_decode_delta(const void *buf, u32_t size, cpu_state_t *state)
+{
+    const u8_t        *in = (const u8_t *)buf;
+    cpu_delta_header_t header;
+    cpu_state_t        loaded;
+    u32_t              at;
+    u8_t               page;
+
+    if (size < sizeof(header) + CPU_DELTA_REGS_SIZE) {
+        return 1;
+    }
+    memcpy(&header, in, sizeof(header));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    header.magic   = __builtin_bswap32(header.magic);
+    header.version = __builtin_bswap16(header.version);
+    header.pages   = __builtin_bswap16(header.pages);
+    header.size    = __builtin_bswap32(header.size);
+#endif
+    if (header.magic != CPU_DELTA_MAGIC || header.version != CPU_SAVE_VERSION || header.size > size ||
+        (header.pages & ~MEM_PAGES_ALL) || header.size != delta_size(header.pages)) {
+        return 1;
+    }
+    /* Applied to a copy, a rejected delta leaves the state untouched */
+    loaded = *state;
+    memcpy(&loaded, in + sizeof(header), CPU_DELTA_REGS_SIZE);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    swap_state(&loaded, NULL);
+#endif
+    if (cpu_check_state(&loaded)) {
+        return 1;
+    }
+    at = sizeof(header) + CPU_DELTA_REGS_SIZE;
+    for (page = 0; page < MEM_PAGE_NUM; page++) {
+        if (header.pages & (1 << page)) {
+            memcpy(&loaded.memory[page * MEM_PAGE_SIZE], in + at, page_len(page));
+            at += page_len(page);
+        }
+    }
+    *state          = loaded;
+    state->dirty    = 0;
+    state->mem_hash = cpu_hash_memory(state);
+    return 0;
+}
+void CPU::cpu_save_state(cpu_save_t *save)
+{
+    own_state();
+    get_lcd(&save->lcd);
+    cpu_encode_state(st, &save->lcd, save);
+    st->dirty = 0;
+}
+bool_t CPU::cpu_load_state(const void *buf, u32_t size)
+{
+    lcd_bitmap_t lcd;
+
+    own_state();
+    if (cpu_decode_state(buf, size, st, &lcd)) {
+        return 1;
+    }
+    /* Hand the saved LCD over in one go rather than replaying display RAM through set_memory() */
+    if (lcd_bitmap) {
+        *lcd_bitmap = lcd;
+    }
+    if (hal) {
+        hal->hw_set_lcd_bitmap(&lcd);
+    }
+    set_io(REG_K40_K43_BZ_OUTPUT_PORT, GET_IO_MEMORY(st->memory, REG_K40_K43_BZ_OUTPUT_PORT));
+    set_io(REG_LCD_CTRL, GET_IO_MEMORY(st->memory, REG_LCD_CTRL));
+    lcd_changes++;
+    cpu_sync_ref_timestamp();
+    return 0;
+}
+bool_t CPU::cpu_load_delta(const void *buf, u32_t size)
+{
+    own_state();
+    if (cpu_decode_delta(buf, size, st)) {
+        return 1;
+    }
+    refresh_state();
+    return 0;
+}
+void CPU::cpu_restore_state(const cpu_state_t *state)
+{
+    own_state();
+    *st = *state;
+    /* Nothing is known about how the state relates to the last checkpoint */
+    st->dirty = MEM_PAGES_ALL;
+    refresh_state();
+}
+uint64_t CPU::cpu_get_hash(void)
+{
+    return cpu_hash_state(st);
+}
+/* Recomputes the memory hash from scratch, returns 1 if the running one has drifted from it */
+bool_t CPU::cpu_verify_hash(void)
+{
+    return cpu_hash_memory(st) != st->mem_hash;
+}
+/* Hash of everything but the dirty bits in O(1): the registers are mixed here, memory[] comes as mem_hash */
+uint64_t CPU::cpu_hash_state(const cpu_state_t *state)
+{
+    const u8_t *p = (const u8_t *)state;
+    uint64_t    h = state->mem_hash;
+    uint64_t    w;
+    u32_t       i;
+
+    for (i = 0; i < CPU_DELTA_REGS_SIZE; i += 8) {
+        w = 0;
+        memcpy(&w, p + i, CPU_DELTA_REGS_SIZE - i < 8 ? CPU_DELTA_REGS_SIZE - i : 8);
+        h = (h ^ w) * 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 31;
+    }
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+/* What mem_hash should be, for whoever rewrites memory[] wholesale */
+uint64_t CPU::cpu_hash_memory(const cpu_state_t *state)
+{
+    uint64_t h = 0;
+    u32_t    i;
+
+    for (i = 0; i < MEM_BUFFER_SIZE; i++) {
+        h += cpu_mem_mix(i, state->memory[i]);
+    }
+    return h;
+}
+/* The LCD is taken from whoever mirrors it, headless instances without a bitmap render display RAM */
+void CPU::get_lcd(lcd_bitmap_t *lcd)
+{
+    if (hal) {
+        hal->hw_get_lcd_bitmap(lcd);
+    } else if (lcd_bitmap) {
+        *lcd = *lcd_bitmap;
+    } else {
+        cpu_render_lcd(st, lcd);
+    }
+}
+/* Headless CPU running the same program at the same speed, with no breakpoints */
+CPU *CPU::clone_executor(void)
+{
+    CPU *clone = new CPU(nullptr);
+
+    if (g_program) {
+        clone->g_program = g_program->program_acquire();
+        clone->g_decode  = g_decode;
+    }
+    clone->ts_freq     = ts_freq;
+    clone->speed_ratio = speed_ratio;
+    return clone;
+}
+/* Independent headless copy of this instance, lcd (optional) receives the LCD mirror and stays attached */
+CPU *CPU::cpu_clone(lcd_bitmap_t *lcd)
+{
+    CPU *clone = clone_executor();
+
+    clone->state = *st;
+    if (lcd) {
+        get_lcd(lcd);
+        clone->lcd_bitmap = lcd;
+    }
+    return clone;
+}
+/*
+ * Makes `count` clones of this instance. With cow set they all start on one shared frozen copy of the
+ * state and each takes a private copy on its first write, so branches that are never run cost no copy.
+ */
+u32_t CPU::cpu_fork(CPU **clones, lcd_bitmap_t *lcds, u32_t count, bool_t cow)
+{
+    cpu_shared_t *frozen = NULL;
+    lcd_bitmap_t  lcd;
+    u32_t         i;
+
+    if (count == 0) {
+        return 0;
     }
+    if (cow) {
+        frozen        = new cpu_shared_t;
+        frozen->state = *st;
+        frozen->refs.store(count, std::memory_order_relaxed);
+    }
+    if (lcds) {
+        get_lcd(&lcd);
+    }
+    for (i = 0; i < count; i++) {
+        clones[i] = clone_executor();
+        if (frozen) {
+            clones[i]->shared = frozen;
+            clones[i]->st     = &frozen->state;
+        } else {
+            clones[i]->state = *st;
+        }
+        if (lcds) {
+            lcds[i]               = lcd;
+            clones[i]->lcd_bitmap = &lcds[i];
+        }
+    }
+    return count;
+}
+void CPU::unshare(void)
+{
+    cpu_shared_t *frozen = shared;
+
+    state  = frozen->state;
+    st     = &state;
+    shared = 0;
+    if (frozen->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete frozen;
+    }
+}
+void CPU::refresh_state(void)
+{
+    lcd_bitmap_t lcd;
+
+    /* Same end result as replaying display RAM through set_memory(), in one render */
+    cpu_render_lcd(st, &lcd);
+    if (lcd_bitmap) {
+        *lcd_bitmap = lcd;
+    }
+    if (hal) {
+        hal->hw_set_lcd_bitmap(&lcd);
+    }
+    lcd_changes++;
+    set_io(REG_K40_K43_BZ_OUTPUT_PORT, GET_IO_MEMORY(st->memory, REG_K40_K43_BZ_OUTPUT_PORT));
+    set_io(REG_LCD_CTRL, GET_IO_MEMORY(st->memory, REG_LCD_CTRL));
+    cpu_sync_ref_timestamp();
 }
 u4_t CPU::get_memory(u12_t n)
 {
     u4_t res = 0;
     if (n < MEM_RAM_SIZE) {
 
-        res = GET_RAM_MEMORY(memory, n);
+        res = GET_RAM_MEMORY(st->memory, n);
     } else if (n >= MEM_DISPLAY1_ADDR && n < (MEM_DISPLAY1_ADDR + MEM_DISPLAY1_SIZE)) {
 
-        res = GET_DISP1_MEMORY(memory, n);
+        res = GET_DISP1_MEMORY(st->memory, n);
     } else if (n >= MEM_DISPLAY2_ADDR && n < (MEM_DISPLAY2_ADDR + MEM_DISPLAY2_SIZE)) {
 
-        res = GET_DISP2_MEMORY(memory, n);
+        res = GET_DISP2_MEMORY(st->memory, n);
     } else if (n >= MEM_IO_ADDR && n < (MEM_IO_ADDR + MEM_IO_SIZE)) {
 
         res = get_io(n);
@@ -216,19 +811,36 @@ u4_t CPU::get_memory(u12_t n)
 }
 void CPU::set_memory(u12_t n, u4_t v)
 {
+    u8_t old;
+    own_state();
+
     if (n < MEM_RAM_SIZE) {
-        SET_RAM_MEMORY(memory, n, v);
+        old = st->memory[RAM_TO_MEMORY(n)];
+        SET_RAM_MEMORY(st->memory, n, v);
+        SET_PAGE_DIRTY(st->dirty, st->memory, RAM_TO_MEMORY(n), old);
+        SET_MEM_HASH(st->mem_hash, st->memory, RAM_TO_MEMORY(n), old);
 
     } else if (n >= MEM_DISPLAY1_ADDR && n < (MEM_DISPLAY1_ADDR + MEM_DISPLAY1_SIZE)) {
-        SET_DISP1_MEMORY(memory, n, v);
+        lcd_changes += (GET_DISP1_MEMORY(st->memory, n) != v);
+        old = st->memory[DISP1_TO_MEMORY(n)];
+        SET_DISP1_MEMORY(st->memory, n, v);
+        SET_PAGE_DIRTY(st->dirty, st->memory, DISP1_TO_MEMORY(n), old);
+        SET_MEM_HASH(st->mem_hash, st->memory, DISP1_TO_MEMORY(n), old);
         set_lcd(n, v);
 
     } else if (n >= MEM_DISPLAY2_ADDR && n < (MEM_DISPLAY2_ADDR + MEM_DISPLAY2_SIZE)) {
-        SET_DISP2_MEMORY(memory, n, v);
+        lcd_changes += (GET_DISP2_MEMORY(st->memory, n) != v);
+        old = st->memory[DISP2_TO_MEMORY(n)];
+        SET_DISP2_MEMORY(st->memory, n, v);
+        SET_PAGE_DIRTY(st->dirty, st->memory, DISP2_TO_MEMORY(n), old);
+        SET_MEM_HASH(st->mem_hash, st->memory, DISP2_TO_MEMORY(n), old);
         set_lcd(n, v);
 
     } else if (n >= MEM_IO_ADDR && n < (MEM_IO_ADDR + MEM_IO_SIZE)) {
-        SET_IO_MEMORY(memory, n, v);
+        old = st->memory[IO_TO_MEMORY(n)];
+        SET_IO_MEMORY(st->memory, n, v);
+        SET_PAGE_DIRTY(st->dirty, st->memory, IO_TO_MEMORY(n), old);
+        SET_MEM_HASH(st->mem_hash, st->memory, IO_TO_MEMORY(n), old);
         set_io(n, v);
 
     } else {
@@ -251,7 +863,7 @@ void CPU::cpu_refresh_hw(void)
     };
     for (int i = 0; refresh_locs[i].size != 0; i++) {
         for (u12_t n = refresh_locs[i].addr; n < (refresh_locs[i].addr + refresh_locs[i].size); n++) {
-            set_memory(n, GET_MEMORY(memory, n));
+            set_memory(n, GET_MEMORY(st->memory, n));
         }
     }
 }
@@ -259,13 +871,13 @@ u4_t CPU::get_rq(u12_t rq)
 {
     switch (rq & 0x3) {
         case 0x0:
-            return a;
+            return st->a;
         case 0x1:
-            return b;
+            return st->b;
         case 0x2:
-            return M(x);
+            return M(st->x);
         case 0x3:
-            return M(y);
+            return M(st->y);
     }
     return 0;
 }
@@ -273,1042 +885,242 @@ void CPU::set_rq(u12_t rq, u4_t v)
 {
     switch (rq & 0x3) {
         case 0x0:
-            a = v;
+            st->a = v;
             break;
         case 0x1:
-            b = v;
+            st->b = v;
             break;
         case 0x2:
-            SET_M(x, v);
+            SET_M(st->x, v);
             break;
         case 0x3:
-            SET_M(y, v);
+            SET_M(st->y, v);
             break;
     }
 }
 
 //
 
-void CPU::op_pset_cb(u8_t arg0, u8_t arg1)
-{
-    np = arg0;
-}
-void CPU::op_jp_cb(u8_t arg0, u8_t arg1)
-{
-    next_pc = arg0 | (np << 8);
-}
-void CPU::op_jp_c_cb(u8_t arg0, u8_t arg1)
+#define CPU_OP(name) void CPU::op_##name##_cb(u8_t arg0, u8_t arg1)
+#include "cpu_ops.h"
+#undef CPU_OP
+
+//
+
+timestamp_t CPU::wait_for_cycles(timestamp_t since, u8_t cycles)
 {
-    if (flags & FLAG_C) {
-        next_pc = arg0 | (np << 8);
+    timestamp_t deadline;
+    st->tick_counter += cycles;
+    if (!hal) {
+        return since;
     }
-}
-void CPU::op_jp_nc_cb(u8_t arg0, u8_t arg1)
-{
-    if (!(flags & FLAG_C)) {
-        next_pc = arg0 | (np << 8);
+    if (speed_ratio == 0) {
+        return hal->hal_get_timestamp();
     }
+    deadline = since + (cycles * ts_freq) / (TICK_FREQUENCY * speed_ratio);
+    hal->hal_sleep_until(deadline);
+    return deadline;
 }
-void CPU::op_jp_z_cb(u8_t arg0, u8_t arg1)
+void CPU::process_interrupts(void)
 {
-    if (flags & FLAG_Z) {
-        next_pc = arg0 | (np << 8);
+    u8_t i;
+    for (i = 0; i < INT_SLOT_NUM; i++) {
+        if (st->interrupts[i].triggered) {
+
+            SET_M(st->sp - 1, PCP);
+            SET_M(st->sp - 2, PCSH);
+            SET_M(st->sp - 3, PCSL);
+            st->sp = (st->sp - 3) & 0xFF;
+            CLEAR_I();
+            st->np = TO_NP(NBP, 1);
+            st->pc = TO_PC(PCB, 1, st->interrupts[i].vector);
+            st->call_depth++;
+            ref_ts                      = wait_for_cycles(ref_ts, 12);
+            st->interrupts[i].triggered = 0;
+        }
     }
 }
-void CPU::op_jp_nz_cb(u8_t arg0, u8_t arg1)
+void CPU::cpu_reset(void)
 {
-    if (!(flags & FLAG_Z)) {
-        next_pc = arg0 | (np << 8);
+    u13_t i;
+    own_state();
+    st->pc    = TO_PC(0, 1, 0x00);
+    st->np    = TO_NP(0, 1);
+    st->a     = 0;
+    st->b     = 0;
+    st->x     = 0;
+    st->y     = 0;
+    st->sp    = 0;
+    st->flags = 0;
+    for (i = 0; i < MEM_BUFFER_SIZE; i++) {
+        st->memory[i] = 0;
     }
+    SET_IO_MEMORY(st->memory, REG_K40_K43_BZ_OUTPUT_PORT, 0xF);
+    SET_IO_MEMORY(st->memory, REG_LCD_CTRL, 0x8);
+    st->dirty    = MEM_PAGES_ALL;
+    st->pad[0]   = 0;
+    st->pad[1]   = 0;
+    st->mem_hash = cpu_hash_memory(st);
+    if (lcd_bitmap) {
+        memset(lcd_bitmap, 0, sizeof(lcd_bitmap_t));
+    }
+    cpu_sync_ref_timestamp();
 }
-void CPU::op_jpba_cb(u8_t arg0, u8_t arg1)
-{
-    next_pc = a | (b << 4) | (np << 8);
-}
-void CPU::op_call_cb(u8_t arg0, u8_t arg1)
-{
-    pc = (pc + 1) & 0x1FFF;
-    SET_M(sp - 1, PCP);
-    SET_M(sp - 2, PCSH);
-    SET_M(sp - 3, PCSL);
-    sp      = (sp - 3) & 0xFF;
-    next_pc = TO_PC(PCB, NPP, arg0);
-    call_depth++;
-}
-void CPU::op_calz_cb(u8_t arg0, u8_t arg1)
-{
-    pc = (pc + 1) & 0x1FFF;
-    SET_M(sp - 1, PCP);
-    SET_M(sp - 2, PCSH);
-    SET_M(sp - 3, PCSL);
-    sp      = (sp - 3) & 0xFF;
-    next_pc = TO_PC(PCB, 0, arg0);
-    call_depth++;
-}
-void CPU::op_ret_cb(u8_t arg0, u8_t arg1)
-{
-    next_pc = M(sp) | (M(sp + 1) << 4) | (M(sp + 2) << 8) | (PCB << 12);
-    sp      = (sp + 3) & 0xFF;
-    call_depth--;
-}
-void CPU::op_rets_cb(u8_t arg0, u8_t arg1)
-{
-    next_pc = M(sp) | (M(sp + 1) << 4) | (M(sp + 2) << 8) | (PCB << 12);
-    sp      = (sp + 3) & 0xFF;
-    next_pc = (pc + 1) & 0x1FFF;
-    call_depth--;
-}
-void CPU::op_retd_cb(u8_t arg0, u8_t arg1)
-{
-    next_pc = M(sp) | (M(sp + 1) << 4) | (M(sp + 2) << 8) | (PCB << 12);
-    sp      = (sp + 3) & 0xFF;
-    SET_M(x, arg0 & 0xF);
-    SET_M(x + 1, (arg0 >> 4) & 0xF);
-    x = ((x + 2) & 0xFF) | (XP << 8);
-    call_depth--;
-}
-void CPU::op_nop5_cb(u8_t arg0, u8_t arg1)
-{
-}
-void CPU::op_nop7_cb(u8_t arg0, u8_t arg1)
-{
-}
-void CPU::op_halt_cb(u8_t arg0, u8_t arg1)
-{
-    tamago->hal_halt();
-}
-void CPU::op_inc_x_cb(u8_t arg0, u8_t arg1)
-{
-    x = ((x + 1) & 0xFF) | (XP << 8);
-}
-void CPU::op_inc_y_cb(u8_t arg0, u8_t arg1)
-{
-    y = ((y + 1) & 0xFF) | (YP << 8);
-}
-void CPU::op_ld_x_cb(u8_t arg0, u8_t arg1)
-{
-    x = arg0 | (XP << 8);
-}
-void CPU::op_ld_y_cb(u8_t arg0, u8_t arg1)
-{
-    y = arg0 | (YP << 8);
-}
-void CPU::op_ld_xp_r_cb(u8_t arg0, u8_t arg1)
-{
-    x = XHL | (RQ(arg0) << 8);
-}
-void CPU::op_ld_xh_r_cb(u8_t arg0, u8_t arg1)
-{
-    x = XL | (RQ(arg0) << 4) | (XP << 8);
-}
-void CPU::op_ld_xl_r_cb(u8_t arg0, u8_t arg1)
-{
-    x = RQ(arg0) | (XH << 4) | (XP << 8);
-}
-void CPU::op_ld_yp_r_cb(u8_t arg0, u8_t arg1)
-{
-    y = YHL | (RQ(arg0) << 8);
-}
-void CPU::op_ld_yh_r_cb(u8_t arg0, u8_t arg1)
-{
-    y = YL | (RQ(arg0) << 4) | (YP << 8);
-}
-void CPU::op_ld_yl_r_cb(u8_t arg0, u8_t arg1)
-{
-    y = RQ(arg0) | (YH << 4) | (YP << 8);
-}
-void CPU::op_ld_r_xp_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, XP);
-}
-void CPU::op_ld_r_xh_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, XH);
-}
-void CPU::op_ld_r_xl_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, XL);
-}
-void CPU::op_ld_r_yp_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, YP);
-}
-void CPU::op_ld_r_yh_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, YH);
-}
-void CPU::op_ld_r_yl_cb(u8_t arg0, u8_t arg1)
+void CPU::cpu_init_state(cpu_state_t *state)
 {
-    SET_RQ(arg0, YL);
+    static const u8_t vectors[INT_SLOT_NUM] = {0x0C, 0x0A, 0x08, 0x06, 0x04, 0x02};
+    u8_t              i;
+
+    memset(state, 0, sizeof(cpu_state_t));
+    for (i = 0; i < INT_SLOT_NUM; i++) {
+        state->interrupts[i].vector = vectors[i];
+    }
+    state->pc = TO_PC(0, 1, 0x00);
+    state->np = TO_NP(0, 1);
+    SET_IO_MEMORY(state->memory, REG_K40_K43_BZ_OUTPUT_PORT, 0xF);
+    SET_IO_MEMORY(state->memory, REG_LCD_CTRL, 0x8);
+    state->dirty    = MEM_PAGES_ALL;
+    state->mem_hash = cpu_hash_memory(state);
 }
-void CPU::op_adc_xh_cb(u8_t arg0, u8_t arg1)
+bool_t CPU::cpu_init(Program *program, breakpoint_t *breakpoints, u32_t freq)
 {
-    u8_t tmp;
-    tmp = XH + arg0 + C;
-    x   = XL | ((tmp & 0xF) << 4) | (XP << 8);
-    if (tmp >> 4) {
-        SET_C();
-    } else {
-        CLEAR_C();
-    }
-    if (!(tmp & 0xF)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
+    Program *prev = g_program;
+    g_program     = program->program_acquire();
+    g_decode      = program->program_get_decode();
+    g_breakpoints = breakpoints;
+    if (prev) {
+        prev->program_release();
     }
+    ts_freq       = freq;
+    cpu_reset();
+    return 0;
 }
-void CPU::op_adc_xl_cb(u8_t arg0, u8_t arg1)
+bool_t CPU::cpu_decode(u12_t op, decoded_op_t *dec)
 {
-    u8_t tmp;
-    tmp = XL + arg0 + C;
-    x   = (tmp & 0xF) | (XH << 4) | (XP << 8);
-    if (tmp >> 4) {
-        SET_C();
-    } else {
-        CLEAR_C();
+    u8_t i;
+    for (i = 0; ops[i].log != 0; i++) {
+        if ((op & ops[i].mask) == ops[i].code) {
+            break;
+        }
+    }
+
+    dec->id     = i;
+    dec->cycles = ops[i].cycles;
+    if (ops[i].log == 0) {
+
+        dec->arg0 = 0;
+        dec->arg1 = 0;
+        return 1;
     }
-    if (!(tmp & 0xF)) {
-        SET_Z();
+
+    if (ops[i].mask_arg0 != 0) {
+        dec->arg0 = (op & ops[i].mask_arg0) >> ops[i].shift_arg0;
+        dec->arg1 = op & ~(ops[i].mask | ops[i].mask_arg0);
     } else {
-        CLEAR_Z();
+        dec->arg0 = (op & ~ops[i].mask) >> ops[i].shift_arg0;
+        dec->arg1 = 0;
     }
+    return 0;
 }
-void CPU::op_adc_yh_cb(u8_t arg0, u8_t arg1)
+/*
+ * Runs up to the instruction boundary at which tick_counter reads `tick`, where an input recorded at that
+ * tick is to be replayed. Every instruction advances the counter, so the boundary is unique (bar the
+ * ones before and after the first instruction after a reset). Returns 1 on an invalid opcode or breakpoint.
+ */
+int CPU::cpu_run_to(u32_t tick)
 {
-    u8_t tmp;
-    tmp = YH + arg0 + C;
-    y   = YL | ((tmp & 0xF) << 4) | (YP << 8);
-    if (tmp >> 4) {
-        SET_C();
-    } else {
-        CLEAR_C();
-    }
-    if (!(tmp & 0xF)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
+    while ((int32_t)(tick - st->tick_counter) > 0) {
+        if (cpu_step()) {
+            return 1;
+        }
     }
+    return 0;
 }
-void CPU::op_adc_yl_cb(u8_t arg0, u8_t arg1)
-{
-    u8_t tmp;
-    tmp = YL + arg0 + C;
-    y   = (tmp & 0xF) | (YH << 4) | (YP << 8);
-    if (tmp >> 4) {
-        SET_C();
-    } else {
-        CLEAR_C();
+/*
+ * Time-skip: runs `ticks` ticks as fast as possible, as a device left on for that long would have.
+ * A CPU with a Hal runs on a headless clone and takes its state at the end, so it neither paces nor
+ * redraws meanwhile. `progress` is called every CATCHUP_CHUNK ticks and may cancel, the time already run
+ * is kept. Returns the number of ticks run.
+ */
+uint64_t CPU::cpu_catch_up(uint64_t ticks, cpu_progress_cb_t progress, void *ctx)
+{
+    CPU     *exec = hal ? cpu_clone(NULL) : this;
+    uint64_t done = 0;
+    u32_t    start, chunk;
+
+    while (done < ticks) {
+        chunk = (ticks - done < CATCHUP_CHUNK) ? ticks - done : CATCHUP_CHUNK;
+        start = exec->st->tick_counter;
+        if (exec->cpu_run_to(start + chunk)) {
+            done += exec->st->tick_counter - start;
+            break;
+        }
+        done += exec->st->tick_counter - start;
+        if (progress && progress(ctx, done, ticks)) {
+            break;
+        }
     }
-    if (!(tmp & 0xF)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
+    if (exec != this) {
+        cpu_restore_state(exec->st);
+        delete exec;
     }
-}
-void CPU::op_cp_xh_cb(u8_t arg0, u8_t arg1)
-{
-    if (XH < arg0) {
-        SET_C();
-    } else {
-        CLEAR_C();
-    }
-    if (XH == arg0) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_cp_xl_cb(u8_t arg0, u8_t arg1)
-{
-    if (XL < arg0) {
-        SET_C();
-    } else {
-        CLEAR_C();
-    }
-    if (XL == arg0) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_cp_yh_cb(u8_t arg0, u8_t arg1)
-{
-    if (YH < arg0) {
-        SET_C();
-    } else {
-        CLEAR_C();
-    }
-    if (YH == arg0) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_cp_yl_cb(u8_t arg0, u8_t arg1)
-{
-    if (YL < arg0) {
-        SET_C();
-    } else {
-        CLEAR_C();
-    }
-    if (YL == arg0) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_ld_r_i_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, arg1);
-}
-void CPU::op_ld_r_q_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, RQ(arg1));
-}
-void CPU::op_ld_a_mn_cb(u8_t arg0, u8_t arg1)
-{
-    a = M(arg0);
-}
-void CPU::op_ld_b_mn_cb(u8_t arg0, u8_t arg1)
-{
-    b = M(arg0);
-}
-void CPU::op_ld_mn_a_cb(u8_t arg0, u8_t arg1)
-{
-    SET_M(arg0, a);
-}
-void CPU::op_ld_mn_b_cb(u8_t arg0, u8_t arg1)
-{
-    SET_M(arg0, b);
-}
-void CPU::op_ldpx_mx_cb(u8_t arg0, u8_t arg1)
-{
-    SET_M(x, arg0);
-    x = ((x + 1) & 0xFF) | (XP << 8);
-}
-void CPU::op_ldpx_r_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, RQ(arg1));
-    x = ((x + 1) & 0xFF) | (XP << 8);
-}
-void CPU::op_ldpy_my_cb(u8_t arg0, u8_t arg1)
-{
-    SET_M(y, arg0);
-    y = ((y + 1) & 0xFF) | (YP << 8);
-}
-void CPU::op_ldpy_r_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, RQ(arg1));
-    y = ((y + 1) & 0xFF) | (YP << 8);
-}
-void CPU::op_lbpx_cb(u8_t arg0, u8_t arg1)
-{
-    SET_M(x, arg0 & 0xF);
-    SET_M(x + 1, (arg0 >> 4) & 0xF);
-    x = ((x + 2) & 0xFF) | (XP << 8);
-}
-void CPU::op_set_cb(u8_t arg0, u8_t arg1)
-{
-    flags |= arg0;
-}
-void CPU::op_rst_cb(u8_t arg0, u8_t arg1)
-{
-    flags &= arg0;
-}
-void CPU::op_scf_cb(u8_t arg0, u8_t arg1)
-{
-    SET_C();
-}
-void CPU::op_rcf_cb(u8_t arg0, u8_t arg1)
-{
-    CLEAR_C();
-}
-void CPU::op_szf_cb(u8_t arg0, u8_t arg1)
-{
-    SET_Z();
-}
-void CPU::op_rzf_cb(u8_t arg0, u8_t arg1)
-{
-    CLEAR_Z();
-}
-void CPU::op_sdf_cb(u8_t arg0, u8_t arg1)
-{
-    SET_D();
-}
-void CPU::op_rdf_cb(u8_t arg0, u8_t arg1)
-{
-    CLEAR_D();
-}
-void CPU::op_ei_cb(u8_t arg0, u8_t arg1)
-{
-    SET_I();
-}
-void CPU::op_di_cb(u8_t arg0, u8_t arg1)
-{
-    CLEAR_I();
-}
-void CPU::op_inc_sp_cb(u8_t arg0, u8_t arg1)
-{
-    sp = (sp + 1) & 0xFF;
-}
-void CPU::op_dec_sp_cb(u8_t arg0, u8_t arg1)
-{
-    sp = (sp - 1) & 0xFF;
-}
-void CPU::op_push_r_cb(u8_t arg0, u8_t arg1)
-{
-    sp = (sp - 1) & 0xFF;
-    SET_M(sp, RQ(arg0));
-}
-void CPU::op_push_xp_cb(u8_t arg0, u8_t arg1)
-{
-    sp = (sp - 1) & 0xFF;
-    SET_M(sp, XP);
-}
-void CPU::op_push_xh_cb(u8_t arg0, u8_t arg1)
-{
-    sp = (sp - 1) & 0xFF;
-    SET_M(sp, XH);
-}
-void CPU::op_push_xl_cb(u8_t arg0, u8_t arg1)
-{
-    sp = (sp - 1) & 0xFF;
-    SET_M(sp, XL);
-}
-void CPU::op_push_yp_cb(u8_t arg0, u8_t arg1)
-{
-    sp = (sp - 1) & 0xFF;
-    SET_M(sp, YP);
-}
-void CPU::op_push_yh_cb(u8_t arg0, u8_t arg1)
-{
-    sp = (sp - 1) & 0xFF;
-    SET_M(sp, YH);
-}
-void CPU::op_push_yl_cb(u8_t arg0, u8_t arg1)
-{
-    sp = (sp - 1) & 0xFF;
-    SET_M(sp, YL);
-}
-void CPU::op_push_f_cb(u8_t arg0, u8_t arg1)
-{
-    sp = (sp - 1) & 0xFF;
-    SET_M(sp, flags);
-}
-void CPU::op_pop_r_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, M(sp));
-    sp = (sp + 1) & 0xFF;
-}
-void CPU::op_pop_xp_cb(u8_t arg0, u8_t arg1)
-{
-    x  = XL | (XH << 4) | (M(sp) << 8);
-    sp = (sp + 1) & 0xFF;
-}
-void CPU::op_pop_xh_cb(u8_t arg0, u8_t arg1)
-{
-    x  = XL | (M(sp) << 4) | (XP << 8);
-    sp = (sp + 1) & 0xFF;
-}
-void CPU::op_pop_xl_cb(u8_t arg0, u8_t arg1)
-{
-    x  = M(sp) | (XH << 4) | (XP << 8);
-    sp = (sp + 1) & 0xFF;
-}
-void CPU::op_pop_yp_cb(u8_t arg0, u8_t arg1)
-{
-    y  = YL | (YH << 4) | (M(sp) << 8);
-    sp = (sp + 1) & 0xFF;
-}
-void CPU::op_pop_yh_cb(u8_t arg0, u8_t arg1)
-{
-    y  = YL | (M(sp) << 4) | (YP << 8);
-    sp = (sp + 1) & 0xFF;
-}
-void CPU::op_pop_yl_cb(u8_t arg0, u8_t arg1)
-{
-    y  = M(sp) | (YH << 4) | (YP << 8);
-    sp = (sp + 1) & 0xFF;
-}
-void CPU::op_pop_f_cb(u8_t arg0, u8_t arg1)
-{
-    flags = M(sp);
-    sp    = (sp + 1) & 0xFF;
-}
-void CPU::op_ld_sph_r_cb(u8_t arg0, u8_t arg1)
-{
-    sp = SPL | (RQ(arg0) << 4);
-}
-void CPU::op_ld_spl_r_cb(u8_t arg0, u8_t arg1)
-{
-    sp = RQ(arg0) | (SPH << 4);
-}
-void CPU::op_ld_r_sph_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, SPH);
-}
-void CPU::op_ld_r_spl_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, SPL);
-}
-void CPU::op_add_r_i_cb(u8_t arg0, u8_t arg1)
-{
-    u8_t tmp;
-    tmp = RQ(arg0) + arg1;
-    if (D) {
-        if (tmp >= 10) {
-            SET_RQ(arg0, (tmp - 10) & 0xF);
-            SET_C();
-        } else {
-            SET_RQ(arg0, tmp);
-            CLEAR_C();
-        }
-    } else {
-        SET_RQ(arg0, tmp & 0xF);
-        if (tmp >> 4) {
-            SET_C();
-        } else {
-            CLEAR_C();
-        }
-    }
-    if (!RQ(arg0)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_add_r_q_cb(u8_t arg0, u8_t arg1)
-{
-    u8_t tmp;
-    tmp = RQ(arg0) + RQ(arg1);
-    if (D) {
-        if (tmp >= 10) {
-            SET_RQ(arg0, (tmp - 10) & 0xF);
-            SET_C();
-        } else {
-            SET_RQ(arg0, tmp);
-            CLEAR_C();
-        }
-    } else {
-        SET_RQ(arg0, tmp & 0xF);
-        if (tmp >> 4) {
-            SET_C();
-        } else {
-            CLEAR_C();
-        }
-    }
-    if (!RQ(arg0)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_adc_r_i_cb(u8_t arg0, u8_t arg1)
-{
-    u8_t tmp;
-    tmp = RQ(arg0) + arg1 + C;
-    if (D) {
-        if (tmp >= 10) {
-            SET_RQ(arg0, (tmp - 10) & 0xF);
-            SET_C();
-        } else {
-            SET_RQ(arg0, tmp);
-            CLEAR_C();
-        }
-    } else {
-        SET_RQ(arg0, tmp & 0xF);
-        if (tmp >> 4) {
-            SET_C();
-        } else {
-            CLEAR_C();
-        }
-    }
-    if (!RQ(arg0)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_adc_r_q_cb(u8_t arg0, u8_t arg1)
-{
-    u8_t tmp;
-    tmp = RQ(arg0) + RQ(arg1) + C;
-    if (D) {
-        if (tmp >= 10) {
-            SET_RQ(arg0, (tmp - 10) & 0xF);
-            SET_C();
-        } else {
-            SET_RQ(arg0, tmp);
-            CLEAR_C();
-        }
-    } else {
-        SET_RQ(arg0, tmp & 0xF);
-        if (tmp >> 4) {
-            SET_C();
-        } else {
-            CLEAR_C();
-        }
-    }
-    if (!RQ(arg0)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_sub_cb(u8_t arg0, u8_t arg1)
-{
-    u8_t tmp;
-    tmp = RQ(arg0) - RQ(arg1);
-    if (D) {
-        if (tmp >> 4) {
-            SET_RQ(arg0, (tmp - 6) & 0xF);
-        } else {
-            SET_RQ(arg0, tmp);
-        }
-    } else {
-        SET_RQ(arg0, tmp & 0xF);
-    }
-    if (tmp >> 4) {
-        SET_C();
-    } else {
-        CLEAR_C();
-    }
-    if (!RQ(arg0)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_sbc_r_i_cb(u8_t arg0, u8_t arg1)
-{
-    u8_t tmp;
-    tmp = RQ(arg0) - arg1 - C;
-    if (D) {
-        if (tmp >> 4) {
-            SET_RQ(arg0, (tmp - 6) & 0xF);
-        } else {
-            SET_RQ(arg0, tmp);
-        }
-    } else {
-        SET_RQ(arg0, tmp & 0xF);
-    }
-    if (tmp >> 4) {
-        SET_C();
-    } else {
-        CLEAR_C();
-    }
-    if (!RQ(arg0)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_sbc_r_q_cb(u8_t arg0, u8_t arg1)
-{
-    u8_t tmp;
-    tmp = RQ(arg0) - RQ(arg1) - C;
-    if (D) {
-        if (tmp >> 4) {
-            SET_RQ(arg0, (tmp - 6) & 0xF);
-        } else {
-            SET_RQ(arg0, tmp);
-        }
-    } else {
-        SET_RQ(arg0, tmp & 0xF);
-    }
-    if (tmp >> 4) {
-        SET_C();
-    } else {
-        CLEAR_C();
-    }
-    if (!RQ(arg0)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_and_r_i_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, RQ(arg0) & arg1);
-    if (!RQ(arg0)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_and_r_q_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, RQ(arg0) & RQ(arg1));
-    if (!RQ(arg0)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_or_r_i_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, RQ(arg0) | arg1);
-    if (!RQ(arg0)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_or_r_q_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, RQ(arg0) | RQ(arg1));
-    if (!RQ(arg0)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_xor_r_i_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, RQ(arg0) ^ arg1);
-    if (!RQ(arg0)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_xor_r_q_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, RQ(arg0) ^ RQ(arg1));
-    if (!RQ(arg0)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_cp_r_i_cb(u8_t arg0, u8_t arg1)
-{
-    if (RQ(arg0) < arg1) {
-        SET_C();
-    } else {
-        CLEAR_C();
-    }
-    if (RQ(arg0) == arg1) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_cp_r_q_cb(u8_t arg0, u8_t arg1)
-{
-    if (RQ(arg0) < RQ(arg1)) {
-        SET_C();
-    } else {
-        CLEAR_C();
-    }
-    if (RQ(arg0) == RQ(arg1)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_fan_r_i_cb(u8_t arg0, u8_t arg1)
-{
-    if (!(RQ(arg0) & arg1)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_fan_r_q_cb(u8_t arg0, u8_t arg1)
-{
-    if (!(RQ(arg0) & RQ(arg1))) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_rlc_cb(u8_t arg0, u8_t arg1)
-{
-    u8_t tmp;
-    tmp = (RQ(arg0) << 1) | C;
-    if (RQ(arg0) & 0x8) {
-        SET_C();
-    } else {
-        CLEAR_C();
-    }
-    SET_RQ(arg0, tmp & 0xF);
-}
-void CPU::op_rrc_cb(u8_t arg0, u8_t arg1)
-{
-    u8_t tmp;
-    tmp = (RQ(arg0) >> 1) | (C << 3);
-    if (RQ(arg0) & 0x1) {
-        SET_C();
-    } else {
-        CLEAR_C();
-    }
-    SET_RQ(arg0, tmp & 0xF);
-}
-void CPU::op_inc_mn_cb(u8_t arg0, u8_t arg1)
-{
-    u8_t tmp;
-    tmp = M(arg0) + 1;
-    SET_M(arg0, tmp & 0xF);
-    if (tmp >> 4) {
-        SET_C();
-    } else {
-        CLEAR_C();
-    }
-    if (!M(arg0)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_dec_mn_cb(u8_t arg0, u8_t arg1)
-{
-    u8_t tmp;
-    tmp = M(arg0) - 1;
-    SET_M(arg0, tmp & 0xF);
-    if (tmp >> 4) {
-        SET_C();
-    } else {
-        CLEAR_C();
-    }
-    if (!M(arg0)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-void CPU::op_acpx_cb(u8_t arg0, u8_t arg1)
-{
-    u8_t tmp;
-    tmp = M(x) + RQ(arg0) + C;
-    if (D) {
-        if (tmp >= 10) {
-            SET_M(x, (tmp - 10) & 0xF);
-            SET_C();
-        } else {
-            SET_M(x, tmp);
-            CLEAR_C();
-        }
-    } else {
-        SET_M(x, tmp & 0xF);
-        if (tmp >> 4) {
-            SET_C();
-        } else {
-            CLEAR_C();
-        }
-    }
-    if (!M(x)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-    x = ((x + 1) & 0xFF) | (XP << 8);
-}
-void CPU::op_acpy_cb(u8_t arg0, u8_t arg1)
-{
-    u8_t tmp;
-    tmp = M(y) + RQ(arg0) + C;
-    if (D) {
-        if (tmp >= 10) {
-            SET_M(y, (tmp - 10) & 0xF);
-            SET_C();
-        } else {
-            SET_M(y, tmp);
-            CLEAR_C();
-        }
-    } else {
-        SET_M(y, tmp & 0xF);
-        if (tmp >> 4) {
-            SET_C();
-        } else {
-            CLEAR_C();
-        }
-    }
-    if (!M(y)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-    y = ((y + 1) & 0xFF) | (YP << 8);
-}
-void CPU::op_scpx_cb(u8_t arg0, u8_t arg1)
-{
-    u8_t tmp;
-    tmp = M(x) - RQ(arg0) - C;
-    if (D) {
-        if (tmp >> 4) {
-            SET_M(x, (tmp - 6) & 0xF);
-        } else {
-            SET_M(x, tmp);
-        }
-    } else {
-        SET_M(x, tmp & 0xF);
-    }
-    if (tmp >> 4) {
-        SET_C();
-    } else {
-        CLEAR_C();
-    }
-    if (!M(x)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-    x = ((x + 1) & 0xFF) | (XP << 8);
-}
-void CPU::op_scpy_cb(u8_t arg0, u8_t arg1)
-{
-    u8_t tmp;
-    tmp = M(y) - RQ(arg0) - C;
-    if (D) {
-        if (tmp >> 4) {
-            SET_M(y, (tmp - 6) & 0xF);
-        } else {
-            SET_M(y, tmp);
-        }
-    } else {
-        SET_M(y, tmp & 0xF);
-    }
-    if (tmp >> 4) {
-        SET_C();
-    } else {
-        CLEAR_C();
-    }
-    if (!M(y)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-    y = ((y + 1) & 0xFF) | (YP << 8);
-}
-void CPU::op_not_cb(u8_t arg0, u8_t arg1)
-{
-    SET_RQ(arg0, ~RQ(arg0) & 0xF);
-    if (!RQ(arg0)) {
-        SET_Z();
-    } else {
-        CLEAR_Z();
-    }
-}
-
-//
-
-timestamp_t CPU::wait_for_cycles(timestamp_t since, u8_t cycles)
-{
-    timestamp_t deadline;
-    tick_counter += cycles;
-    if (speed_ratio == 0) {
-        return tamago->hal_get_timestamp();
-    }
-    deadline = since + (cycles * ts_freq) / (TICK_FREQUENCY * speed_ratio);
-    tamago->hal_sleep_until(deadline);
-    return deadline;
-}
-void CPU::process_interrupts(void)
-{
-    u8_t i;
-    for (i = 0; i < INT_SLOT_NUM; i++) {
-        if (interrupts[i].triggered) {
-
-            SET_M(sp - 1, PCP);
-            SET_M(sp - 2, PCSH);
-            SET_M(sp - 3, PCSL);
-            sp = (sp - 3) & 0xFF;
-            CLEAR_I();
-            np = TO_NP(NBP, 1);
-            pc = TO_PC(PCB, 1, interrupts[i].vector);
-            call_depth++;
-            ref_ts                  = wait_for_cycles(ref_ts, 12);
-            interrupts[i].triggered = 0;
-        }
-    }
-}
-void CPU::cpu_reset(void)
-{
-    u13_t i;
-    pc    = TO_PC(0, 1, 0x00);
-    np    = TO_NP(0, 1);
-    a     = 0;
-    b     = 0;
-    x     = 0;
-    y     = 0;
-    sp    = 0;
-    flags = 0;
-    for (i = 0; i < MEM_BUFFER_SIZE; i++) {
-        memory[i] = 0;
-    }
-    SET_IO_MEMORY(memory, REG_K40_K43_BZ_OUTPUT_PORT, 0xF);
-    SET_IO_MEMORY(memory, REG_LCD_CTRL, 0x8);
-    cpu_sync_ref_timestamp();
-}
-bool_t CPU::cpu_init(const u12_t *program, breakpoint_t *breakpoints, u32_t freq)
-{
-    g_program     = program;
-    g_breakpoints = breakpoints;
-    ts_freq       = freq;
-    cpu_reset();
-    return 0;
+    return done;
 }
 int CPU::cpu_step(void)
 {
-    u12_t         op;
-    u8_t          i;
-    breakpoint_t *bp = g_breakpoints;
+    own_state();
 
-    op = g_program[pc];
-    for (i = 0; ops[i].log != 0; i++) {
-        if ((op & ops[i].mask) == ops[i].code) {
-            break;
-        }
-    }
+    const decoded_op_t *dec = &g_decode[st->pc];
+    u8_t                i   = dec->id;
+    breakpoint_t       *bp  = g_breakpoints;
 
-    if (ops[i].log == 0) {
+    if (i == OP_NUM) {
 
         return 1;
     }
 
-    next_pc = (pc + 1) & 0x1FFF;
-    ref_ts  = wait_for_cycles(ref_ts, precycles);
+    next_pc = (st->pc + 1) & 0x1FFF;
+    ref_ts  = wait_for_cycles(ref_ts, st->precycles);
 
-    if (ops[i].mask_arg0 != 0) {
-        CALL_MEMBER_FN(*this, ops[i].cb)
-        ((op & ops[i].mask_arg0) >> ops[i].shift_arg0, op & ~(ops[i].mask | ops[i].mask_arg0));
-    } else {
-        CALL_MEMBER_FN(*this, ops[i].cb)
-        ((op & ~ops[i].mask) >> ops[i].shift_arg0, 0);
-    }
+    CALL_MEMBER_FN(*this, ops[i].cb)(dec->arg0, dec->arg1);
 
-    pc        = next_pc;
-    precycles = ops[i].cycles;
+    st->pc        = next_pc;
+    st->precycles = ops[i].cycles;
 
     if (i > 0) {
-        np = (pc >> 8) & 0x1F;
+        st->np = (st->pc >> 8) & 0x1F;
     }
 
-    if (tick_counter - clk_timer_timestamp >= TIMER_1HZ_PERIOD) {
+    if (st->tick_counter - st->clk_timer_timestamp >= TIMER_1HZ_PERIOD) {
         do {
-            clk_timer_timestamp += TIMER_1HZ_PERIOD;
-        } while (tick_counter - clk_timer_timestamp >= TIMER_1HZ_PERIOD);
+            st->clk_timer_timestamp += TIMER_1HZ_PERIOD;
+        } while (st->tick_counter - st->clk_timer_timestamp >= TIMER_1HZ_PERIOD);
         generate_interrupt(INT_CLOCK_TIMER_SLOT, 3);
     }
 
-    if (prog_timer_enabled && tick_counter - prog_timer_timestamp >= TIMER_256HZ_PERIOD) {
+    if (st->prog_timer_enabled && st->tick_counter - st->prog_timer_timestamp >= TIMER_256HZ_PERIOD) {
         do {
-            prog_timer_timestamp += TIMER_256HZ_PERIOD;
-            prog_timer_data--;
-            if (prog_timer_data == 0) {
-                prog_timer_data = prog_timer_rld;
+            st->prog_timer_timestamp += TIMER_256HZ_PERIOD;
+            st->prog_timer_data--;
+            if (st->prog_timer_data == 0) {
+                st->prog_timer_data = st->prog_timer_rld;
                 generate_interrupt(INT_PROG_TIMER_SLOT, 0);
             }
-        } while (tick_counter - prog_timer_timestamp >= TIMER_256HZ_PERIOD);
+        } while (st->tick_counter - st->prog_timer_timestamp >= TIMER_256HZ_PERIOD);
     }
 
     if (I && i > 0) {
         process_interrupts();
     }
 
+#ifdef CPU_VERIFY_HASH
+    /* Verification builds stop like on a breakpoint as soon as a write bypassed the memory hash */
+    if (cpu_verify_hash()) {
+        return 1;
+    }
+#endif
     while (bp != 0) {
-        if (bp->addr == pc) {
+        if (bp->addr == st->pc) {
             return 1;
         }
         bp = bp->next;
@@ -1,6 +1,8 @@
 #ifndef _CPU_H_
 #define _CPU_H_
+#include <stddef.h>
 #include <stdint.h>
+#include <atomic>
 #include "cpu_def.h"
 
 
@@ -39,6 +41,17 @@ typedef enum
     PIN_STATE_HIGH = 1,
 } pin_state_t;
 
+/* How far a debugger run goes: NEXT, TO_CALL and TO_RET compare the call depth with the one it started at */
+typedef enum
+{
+    EXEC_MODE_PAUSE,
+    EXEC_MODE_RUN,
+    EXEC_MODE_STEP,
+    EXEC_MODE_NEXT,
+    EXEC_MODE_TO_CALL,
+    EXEC_MODE_TO_RET,
+} exec_mode_t;
+
 typedef enum
 {
     INT_PROG_TIMER_SLOT  = 0,
@@ -50,17 +63,152 @@ typedef enum
     INT_SLOT_NUM,
 } int_slot_t;
 
+/* Same order as CPU::ops, so that the index returned by the decoder identifies the instruction */
+typedef enum
+{
+    OP_PSET = 0,
+    OP_JP,
+    OP_JP_C,
+    OP_JP_NC,
+    OP_JP_Z,
+    OP_JP_NZ,
+    OP_JPBA,
+    OP_CALL,
+    OP_CALZ,
+    OP_RET,
+    OP_RETS,
+    OP_RETD,
+    OP_NOP5,
+    OP_NOP7,
+    OP_HALT,
+    OP_INC_X,
+    OP_INC_Y,
+    OP_LD_X,
+    OP_LD_Y,
+    OP_LD_XP_R,
+    OP_LD_XH_R,
+    OP_LD_XL_R,
+    OP_LD_YP_R,
+    OP_LD_YH_R,
+    OP_LD_YL_R,
+    OP_LD_R_XP,
+    OP_LD_R_XH,
+    OP_LD_R_XL,
+    OP_LD_R_YP,
+    OP_LD_R_YH,
+    OP_LD_R_YL,
+    OP_ADC_XH,
+    OP_ADC_XL,
+    OP_ADC_YH,
+    OP_ADC_YL,
+    OP_CP_XH,
+    OP_CP_XL,
+    OP_CP_YH,
+    OP_CP_YL,
+    OP_LD_R_I,
+    OP_LD_R_Q,
+    OP_LD_A_MN,
+    OP_LD_B_MN,
+    OP_LD_MN_A,
+    OP_LD_MN_B,
+    OP_LDPX_MX,
+    OP_LDPX_R,
+    OP_LDPY_MY,
+    OP_LDPY_R,
+    OP_LBPX,
+    OP_SET,
+    OP_RST,
+    OP_SCF,
+    OP_RCF,
+    OP_SZF,
+    OP_RZF,
+    OP_SDF,
+    OP_RDF,
+    OP_EI,
+    OP_DI,
+    OP_INC_SP,
+    OP_DEC_SP,
+    OP_PUSH_R,
+    OP_PUSH_XP,
+    OP_PUSH_XH,
+    OP_PUSH_XL,
+    OP_PUSH_YP,
+    OP_PUSH_YH,
+    OP_PUSH_YL,
+    OP_PUSH_F,
+    OP_POP_R,
+    OP_POP_XP,
+    OP_POP_XH,
+    OP_POP_XL,
+    OP_POP_YP,
+    OP_POP_YH,
+    OP_POP_YL,
+    OP_POP_F,
+    OP_LD_SPH_R,
+    OP_LD_SPL_R,
+    OP_LD_R_SPH,
+    OP_LD_R_SPL,
+    OP_ADD_R_I,
+    OP_ADD_R_Q,
+    OP_ADC_R_I,
+    OP_ADC_R_Q,
+    OP_SUB,
+    OP_SBC_R_I,
+    OP_SBC_R_Q,
+    OP_AND_R_I,
+    OP_AND_R_Q,
+    OP_OR_R_I,
+    OP_OR_R_Q,
+    OP_XOR_R_I,
+    OP_XOR_R_Q,
+    OP_CP_R_I,
+    OP_CP_R_Q,
+    OP_FAN_R_I,
+    OP_FAN_R_Q,
+    OP_RLC,
+    OP_RRC,
+    OP_INC_MN,
+    OP_DEC_MN,
+    OP_ACPX,
+    OP_ACPY,
+    OP_SCPX,
+    OP_SCPY,
+    OP_NOT,
+    OP_NUM,
+} op_id_t;
+
+typedef struct
+{
+    u8_t id;
+    u8_t arg0;
+    u8_t arg1;
+    u8_t cycles;
+} decoded_op_t;
+
 typedef struct breakpoint
 {
     u13_t              addr;
     struct breakpoint *next;
 } breakpoint_t;
 
+/* Progress of a long run in ticks, returns 1 to cancel it */
+typedef bool_t (*cpu_progress_cb_t)(void *ctx, uint64_t done, uint64_t total);
+
+/* Sees every input pin change with the tick_counter it is applied at */
+typedef void (*cpu_input_cb_t)(void *ctx, u32_t tick, pin_t pin, pin_state_t state);
+
 typedef struct
 {
     u4_t states;
 } input_port_t;
 
+typedef enum
+{
+    SERIAL_IDLE = 0,
+    SERIAL_REQUESTED,
+    SERIAL_IN_FLIGHT,
+} serial_state_t;
+
 typedef struct
 {
     u4_t   factor_flag_reg;
@@ -69,8 +217,110 @@ typedef struct
     u8_t   vector;
 } interrupt_t;
 
+/* Everything that is specific to one running instance, kept flat so that it can be copied in one go */
+typedef struct
+{
+    u13_t        pc;
+    u12_t        x;
+    u12_t        y;
+    u4_t         a;
+    u4_t         b;
+    u5_t         np;
+    u8_t         sp;
+    u4_t         flags;
+    u8_t         precycles;
+    bool_t       prog_timer_enabled;
+    u8_t         prog_timer_data;
+    u8_t         prog_timer_rld;
+    u8_t         serial_state;
+    u32_t        tick_counter;
+    u32_t        clk_timer_timestamp;
+    u32_t        prog_timer_timestamp;
+    u32_t        call_depth;
+    input_port_t inputs[2];
+    interrupt_t  interrupts[INT_SLOT_NUM];
+    u8_t         memory[MEM_BUFFER_SIZE];
+    uint16_t     dirty;    /* Bit n set: page n of memory[] was written since the last checkpoint */
+    uint16_t     pad[2];
+    uint64_t     mem_hash; /* Sum of CPU::cpu_mem_mix() over memory[], kept up to date by every write */
+} cpu_state_t;
+
+/* Packed LCD image: bit x of rows[y] is the pixel at column x, row y; bit n of icons is icon n */
+typedef struct
+{
+    u32_t rows[16];
+    u8_t  icons;
+} lcd_bitmap_t;
+
+/* Frozen state shared by copy-on-write clones, each one copies it out on its first write */
+typedef struct
+{
+    std::atomic<u32_t> refs;
+    cpu_state_t        state;
+} cpu_shared_t;
+
+/*
+ * Save-state image: a header, the cpu_state_t and the LCD as last drawn, little-endian multi-byte fields.
+ * The layout is the in-memory one on little-endian hosts so that saving and loading are a single copy,
+ * any change to cpu_state_t has to bump CPU_SAVE_VERSION.
+ */
+#define CPU_SAVE_MAGIC   0x53533645 /* "E6SS" */
+#define CPU_SAVE_VERSION 2
 
-class Tamago;
+typedef struct
+{
+    u32_t    magic;
+    uint16_t version;
+    uint16_t header_size;
+    u32_t    state_size;
+    u32_t    lcd_size;
+} cpu_save_header_t;
+
+typedef struct
+{
+    cpu_save_header_t header;
+    cpu_state_t       state;
+    lcd_bitmap_t      lcd;
+} cpu_save_t;
+
+/*
+ * Delta snapshot: everything in cpu_state_t before memory[], then the memory[] pages written since the last
+ * checkpoint (full save or delta) in ascending order. Applying a full save then its deltas in order rebuilds
+ * the exact state.
+ */
+#define CPU_DELTA_MAGIC     0x44533645 /* "E6SD" */
+#define CPU_DELTA_REGS_SIZE offsetof(cpu_state_t, memory)
+#define CPU_DELTA_MAX_SIZE  (sizeof(cpu_delta_header_t) + CPU_DELTA_REGS_SIZE + MEM_BUFFER_SIZE)
+
+typedef struct
+{
+    u32_t    magic;
+    uint16_t version;
+    uint16_t pages;
+    u32_t    size;
+} cpu_delta_header_t;
+
+
+/*
+ * What a CPU needs from the machine around it: time for pacing, the buzzer, the LCD and a way to stop.
+ * Tamago implements it for the SDL front end; a CPU without one runs headless and never sleeps.
+ */
+class Hal {
+  public:
+    virtual timestamp_t hal_get_timestamp(void)                       = 0;
+    virtual void        hal_sleep_until(timestamp_t ts)               = 0;
+    virtual void        hal_play_frequency(bool_t en)                 = 0;
+    virtual void        hal_halt(void)                                = 0;
+    virtual void        hw_set_lcd_pin(u8_t seg, u8_t com, u8_t val)  = 0;
+    virtual void        hw_get_lcd_bitmap(lcd_bitmap_t *bitmap)       = 0;
+    virtual void        hw_set_lcd_bitmap(const lcd_bitmap_t *bitmap) = 0;
+    virtual void        hw_enable_lcd(bool_t en)                      = 0;
+
+  protected:
+    ~Hal() = default;
+};
+
+class Program;
 class CPU {
   private:
     typedef void (CPU::*proc_t)(u8_t, u8_t);
@@ -86,45 +336,45 @@ class CPU {
     } op_t;
 
   public:
-    Tamago *tamago = nullptr;
+    Hal *hal = nullptr;
 
-  private:
-    const u12_t *g_program = 0;
-
-    u13_t pc, next_pc;
-    u12_t x, y;
-    u4_t  a, b;
-    u5_t  np;
-    u8_t  sp;
-    u4_t  flags;
-
-    breakpoint_t *g_breakpoints        = 0;
-    u32_t         call_depth           = 0;
-    u32_t         clk_timer_timestamp  = 0;
-    u32_t         prog_timer_timestamp = 0;
-    bool_t        prog_timer_enabled   = 0;
-    u8_t          prog_timer_data      = 0;
-    u8_t          prog_timer_rld       = 0;
-    u32_t         tick_counter         = 0;
-    u32_t         ts_freq;
-    u8_t          speed_ratio = 1;
-    timestamp_t   ref_ts;
-
-    u8_t         memory[MEM_BUFFER_SIZE];
-    input_port_t inputs[2] = {{0}};
+    static const u8_t lcd_seg_pos[40];
 
-    u8_t precycles = 0;
-
-    interrupt_t interrupts[INT_SLOT_NUM] = {
-        {0x0, 0x0, 0, 0x0C}, {0x0, 0x0, 0, 0x0A}, {0x0, 0x0, 0, 0x08},
-        {0x0, 0x0, 0, 0x06}, {0x0, 0x0, 0, 0x04}, {0x0, 0x0, 0, 0x02},
-    };
+  private:
+    Program            *g_program = 0;
+    const decoded_op_t *g_decode  = 0;
+
+    cpu_state_t  state;
+    cpu_state_t *st = &state;
+    u13_t        next_pc;
+
+    breakpoint_t  *g_breakpoints = 0;
+    u32_t          ts_freq;
+    u8_t           speed_ratio = 1;
+    timestamp_t    ref_ts;
+    u32_t          lcd_changes = 0;
+    lcd_bitmap_t  *lcd_bitmap  = 0;
+    cpu_shared_t  *shared      = 0;
+    cpu_input_cb_t input_cb    = 0;
+    void          *input_ctx   = 0;
 
   public:
-    CPU(Tamago *_tamago);
-
-    void  cpu_set_speed(u8_t speed);
-    u32_t cpu_get_depth(void);
+    CPU(Hal *_hal);
+    ~CPU();
+
+    void         cpu_set_speed(u8_t speed);
+    u32_t        cpu_get_depth(void);
+    u32_t        cpu_get_lcd_changes(void);
+    cpu_state_t *cpu_get_state(void);
+    void         cpu_bind_state(cpu_state_t *state);
+    void         cpu_set_lcd_bitmap(lcd_bitmap_t *bitmap);
+    void         cpu_set_input_hook(cpu_input_cb_t cb, void *ctx);
+    void         cpu_save_state(cpu_save_t *save);
+    bool_t       cpu_load_state(const void *buf, u32_t size);
+    bool_t       cpu_load_delta(const void *buf, u32_t size);
+    void         cpu_restore_state(const cpu_state_t *state);
+    CPU         *cpu_clone(lcd_bitmap_t *lcd);
+    u32_t        cpu_fork(CPU **clones, lcd_bitmap_t *lcds, u32_t count, bool_t cow);
 
     void generate_interrupt(int_slot_t slot, u8_t bit);
     void cpu_set_input_pin(pin_t pin, pin_state_t state);
@@ -145,10 +395,50 @@ class CPU {
     void        process_interrupts(void);
 
     void   cpu_reset(void);
-    bool_t cpu_init(const u12_t *program, breakpoint_t *breakpoints, u32_t freq);
+    bool_t cpu_init(Program *program, breakpoint_t *breakpoints, u32_t freq);
     int    cpu_step(void);
+    int    cpu_run_to(u32_t tick);
+
+    uint64_t cpu_catch_up(uint64_t ticks, cpu_progress_cb_t progress, void *ctx);
+
+    static bool_t cpu_decode(u12_t op, decoded_op_t *dec);
+    static void   cpu_init_state(cpu_state_t *state);
+    static void   cpu_render_lcd(const cpu_state_t *state, lcd_bitmap_t *bitmap);
+    static void   cpu_encode_state(const cpu_state_t *state, const lcd_bitmap_t *lcd, cpu_save_t *save);
+    static bool_t cpu_decode_state(const void *buf, u32_t size, cpu_state_t *state, lcd_bitmap_t *lcd);
+    static bool_t cpu_check_state(const cpu_state_t *state);
+    static u32_t  cpu_encode_delta(cpu_state_t *state, void *buf, u32_t size);
+    static bool_t cpu_decode_delta(const void *buf, u32_t size, cpu_state_t *state);
+
+    uint64_t        cpu_get_hash(void);
+    bool_t          cpu_verify_hash(void);
+    static uint64_t cpu_hash_state(const cpu_state_t *state);
+    static uint64_t cpu_hash_memory(const cpu_state_t *state);
+
+    /* Term of memory[i] == byte in cpu_state_t::mem_hash: a bijective mix of (i, byte) */
+    static inline uint64_t cpu_mem_mix(u32_t i, u8_t byte)
+    {
+        uint64_t k = ((uint64_t)i << 8 | byte) * 0x9E3779B97F4A7C15ULL;
+        k ^= k >> 32;
+        k *= 0xD6E8FEB86659FD93ULL;
+        return k ^ (k >> 32);
+    }
 
   private:
+    static void set_lcd_bitmap(lcd_bitmap_t *lcd_bitmap, u8_t seg, u8_t com, u8_t val);
+
+    void refresh_state(void);
+    void get_lcd(lcd_bitmap_t *lcd);
+    CPU *clone_executor(void);
+    void unshare(void);
+
+    inline void own_state(void)
+    {
+        if (shared) {
+            unshare();
+        }
+    }
+
     void op_pset_cb(u8_t arg0, u8_t arg1);
     void op_jp_cb(u8_t arg0, u8_t arg1);
     void op_jp_c_cb(u8_t arg0, u8_t arg1);
@@ -278,116 +568,6 @@ class CPU {
     void op_not_cb(u8_t arg0, u8_t arg1);
 
   private:
-    const op_t ops[109] = {
-        {(char *)"PSET #0x%02X            ", 0xE40, MASK_7B, 0, 0, 5, &CPU::op_pset_cb},
-        {(char *)"JP   #0x%02X            ", 0x000, MASK_4B, 0, 0, 5, &CPU::op_jp_cb},
-        {(char *)"JP   C #0x%02X          ", 0x200, MASK_4B, 0, 0, 5, &CPU::op_jp_c_cb},
-        {(char *)"JP   NC #0x%02X         ", 0x300, MASK_4B, 0, 0, 5, &CPU::op_jp_nc_cb},
-        {(char *)"JP   Z #0x%02X          ", 0x600, MASK_4B, 0, 0, 5, &CPU::op_jp_z_cb},
-        {(char *)"JP   NZ #0x%02X         ", 0x700, MASK_4B, 0, 0, 5, &CPU::op_jp_nz_cb},
-        {(char *)"JPBA                  ", 0xFE8, MASK_12B, 0, 0, 5, &CPU::op_jpba_cb},
-        {(char *)"CALL #0x%02X            ", 0x400, MASK_4B, 0, 0, 7, &CPU::op_call_cb},
-        {(char *)"CALZ #0x%02X            ", 0x500, MASK_4B, 0, 0, 7, &CPU::op_calz_cb},
-        {(char *)"RET                   ", 0xFDF, MASK_12B, 0, 0, 7, &CPU::op_ret_cb},
-        {(char *)"RETS                  ", 0xFDE, MASK_12B, 0, 0, 12, &CPU::op_rets_cb},
-        {(char *)"RETD #0x%02X            ", 0x100, MASK_4B, 0, 0, 12, &CPU::op_retd_cb},
-        {(char *)"NOP5                  ", 0xFFB, MASK_12B, 0, 0, 5, &CPU::op_nop5_cb},
-        {(char *)"NOP7                  ", 0xFFF, MASK_12B, 0, 0, 7, &CPU::op_nop7_cb},
-        {(char *)"HALT                  ", 0xFF8, MASK_12B, 0, 0, 5, &CPU::op_halt_cb},
-        {(char *)"INC  X #0x%02X          ", 0xEE0, MASK_12B, 0, 0, 5, &CPU::op_inc_x_cb},
-        {(char *)"INC  Y #0x%02X          ", 0xEF0, MASK_12B, 0, 0, 5, &CPU::op_inc_y_cb},
-        {(char *)"LD   X #0x%02X          ", 0xB00, MASK_4B, 0, 0, 5, &CPU::op_ld_x_cb},
-        {(char *)"LD   Y #0x%02X          ", 0x800, MASK_4B, 0, 0, 5, &CPU::op_ld_y_cb},
-        {(char *)"LD   XP R(#0x%02X)      ", 0xE80, MASK_10B, 0, 0, 5, &CPU::op_ld_xp_r_cb},
-        {(char *)"LD   XH R(#0x%02X)      ", 0xE84, MASK_10B, 0, 0, 5, &CPU::op_ld_xh_r_cb},
-        {(char *)"LD   XL R(#0x%02X)      ", 0xE88, MASK_10B, 0, 0, 5, &CPU::op_ld_xl_r_cb},
-        {(char *)"LD   YP R(#0x%02X)      ", 0xE90, MASK_10B, 0, 0, 5, &CPU::op_ld_yp_r_cb},
-        {(char *)"LD   YH R(#0x%02X)      ", 0xE94, MASK_10B, 0, 0, 5, &CPU::op_ld_yh_r_cb},
-        {(char *)"LD   YL R(#0x%02X)      ", 0xE98, MASK_10B, 0, 0, 5, &CPU::op_ld_yl_r_cb},
-        {(char *)"LD   R(#0x%02X) XP      ", 0xEA0, MASK_10B, 0, 0, 5, &CPU::op_ld_r_xp_cb},
-        {(char *)"LD   R(#0x%02X) XH      ", 0xEA4, MASK_10B, 0, 0, 5, &CPU::op_ld_r_xh_cb},
-        {(char *)"LD   R(#0x%02X) XL      ", 0xEA8, MASK_10B, 0, 0, 5, &CPU::op_ld_r_xl_cb},
-        {(char *)"LD   R(#0x%02X) YP      ", 0xEB0, MASK_10B, 0, 0, 5, &CPU::op_ld_r_yp_cb},
-        {(char *)"LD   R(#0x%02X) YH      ", 0xEB4, MASK_10B, 0, 0, 5, &CPU::op_ld_r_yh_cb},
-        {(char *)"LD   R(#0x%02X) YL      ", 0xEB8, MASK_10B, 0, 0, 5, &CPU::op_ld_r_yl_cb},
-        {(char *)"ADC  XH #0x%02X         ", 0xA00, MASK_8B, 0, 0, 7, &CPU::op_adc_xh_cb},
-        {(char *)"ADC  XL #0x%02X         ", 0xA10, MASK_8B, 0, 0, 7, &CPU::op_adc_xl_cb},
-        {(char *)"ADC  YH #0x%02X         ", 0xA20, MASK_8B, 0, 0, 7, &CPU::op_adc_yh_cb},
-        {(char *)"ADC  YL #0x%02X         ", 0xA30, MASK_8B, 0, 0, 7, &CPU::op_adc_yl_cb},
-        {(char *)"CP   XH #0x%02X         ", 0xA40, MASK_8B, 0, 0, 7, &CPU::op_cp_xh_cb},
-        {(char *)"CP   XL #0x%02X         ", 0xA50, MASK_8B, 0, 0, 7, &CPU::op_cp_xl_cb},
-        {(char *)"CP   YH #0x%02X         ", 0xA60, MASK_8B, 0, 0, 7, &CPU::op_cp_yh_cb},
-        {(char *)"CP   YL #0x%02X         ", 0xA70, MASK_8B, 0, 0, 7, &CPU::op_cp_yl_cb},
-        {(char *)"LD   R(#0x%02X) #0x%02X   ", 0xE00, MASK_6B, 4, 0x030, 5, &CPU::op_ld_r_i_cb},
-        {(char *)"LD   R(#0x%02X) Q(#0x%02X)", 0xEC0, MASK_8B, 2, 0x00C, 5, &CPU::op_ld_r_q_cb},
-        {(char *)"LD   A M(#0x%02X)       ", 0xFA0, MASK_8B, 0, 0, 5, &CPU::op_ld_a_mn_cb},
-        {(char *)"LD   B M(#0x%02X)       ", 0xFB0, MASK_8B, 0, 0, 5, &CPU::op_ld_b_mn_cb},
-        {(char *)"LD   M(#0x%02X) A       ", 0xF80, MASK_8B, 0, 0, 5, &CPU::op_ld_mn_a_cb},
-        {(char *)"LD   M(#0x%02X) B       ", 0xF90, MASK_8B, 0, 0, 5, &CPU::op_ld_mn_b_cb},
-        {(char *)"LDPX MX #0x%02X         ", 0xE60, MASK_8B, 0, 0, 5, &CPU::op_ldpx_mx_cb},
-        {(char *)"LDPX R(#0x%02X) Q(#0x%02X)", 0xEE0, MASK_8B, 2, 0x00C, 5, &CPU::op_ldpx_r_cb},
-        {(char *)"LDPY MY #0x%02X         ", 0xE70, MASK_8B, 0, 0, 5, &CPU::op_ldpy_my_cb},
-        {(char *)"LDPY R(#0x%02X) Q(#0x%02X)", 0xEF0, MASK_8B, 2, 0x00C, 5, &CPU::op_ldpy_r_cb},
-        {(char *)"LBPX #0x%02X            ", 0x900, MASK_4B, 0, 0, 5, &CPU::op_lbpx_cb},
-        {(char *)"SET  #0x%02X            ", 0xF40, MASK_8B, 0, 0, 7, &CPU::op_set_cb},
-        {(char *)"RST  #0x%02X            ", 0xF50, MASK_8B, 0, 0, 7, &CPU::op_rst_cb},
-        {(char *)"SCF                   ", 0xF41, MASK_12B, 0, 0, 7, &CPU::op_scf_cb},
-        {(char *)"RCF                   ", 0xF5E, MASK_12B, 0, 0, 7, &CPU::op_rcf_cb},
-        {(char *)"SZF                   ", 0xF42, MASK_12B, 0, 0, 7, &CPU::op_szf_cb},
-        {(char *)"RZF                   ", 0xF5D, MASK_12B, 0, 0, 7, &CPU::op_rzf_cb},
-        {(char *)"SDF                   ", 0xF44, MASK_12B, 0, 0, 7, &CPU::op_sdf_cb},
-        {(char *)"RDF                   ", 0xF5B, MASK_12B, 0, 0, 7, &CPU::op_rdf_cb},
-        {(char *)"EI                    ", 0xF48, MASK_12B, 0, 0, 7, &CPU::op_ei_cb},
-        {(char *)"DI                    ", 0xF57, MASK_12B, 0, 0, 7, &CPU::op_di_cb},
-        {(char *)"INC  SP               ", 0xFDB, MASK_12B, 0, 0, 5, &CPU::op_inc_sp_cb},
-        {(char *)"DEC  SP               ", 0xFCB, MASK_12B, 0, 0, 5, &CPU::op_dec_sp_cb},
-        {(char *)"PUSH R(#0x%02X)         ", 0xFC0, MASK_10B, 0, 0, 5, &CPU::op_push_r_cb},
-        {(char *)"PUSH XP               ", 0xFC4, MASK_12B, 0, 0, 5, &CPU::op_push_xp_cb},
-        {(char *)"PUSH XH               ", 0xFC5, MASK_12B, 0, 0, 5, &CPU::op_push_xh_cb},
-        {(char *)"PUSH XL               ", 0xFC6, MASK_12B, 0, 0, 5, &CPU::op_push_xl_cb},
-        {(char *)"PUSH YP               ", 0xFC7, MASK_12B, 0, 0, 5, &CPU::op_push_yp_cb},
-        {(char *)"PUSH YH               ", 0xFC8, MASK_12B, 0, 0, 5, &CPU::op_push_yh_cb},
-        {(char *)"PUSH YL               ", 0xFC9, MASK_12B, 0, 0, 5, &CPU::op_push_yl_cb},
-        {(char *)"PUSH F                ", 0xFCA, MASK_12B, 0, 0, 5, &CPU::op_push_f_cb},
-        {(char *)"POP  R(#0x%02X)         ", 0xFD0, MASK_10B, 0, 0, 5, &CPU::op_pop_r_cb},
-        {(char *)"POP  XP               ", 0xFD4, MASK_12B, 0, 0, 5, &CPU::op_pop_xp_cb},
-        {(char *)"POP  XH               ", 0xFD5, MASK_12B, 0, 0, 5, &CPU::op_pop_xh_cb},
-        {(char *)"POP  XL               ", 0xFD6, MASK_12B, 0, 0, 5, &CPU::op_pop_xl_cb},
-        {(char *)"POP  YP               ", 0xFD7, MASK_12B, 0, 0, 5, &CPU::op_pop_yp_cb},
-        {(char *)"POP  YH               ", 0xFD8, MASK_12B, 0, 0, 5, &CPU::op_pop_yh_cb},
-        {(char *)"POP  YL               ", 0xFD9, MASK_12B, 0, 0, 5, &CPU::op_pop_yl_cb},
-        {(char *)"POP  F                ", 0xFDA, MASK_12B, 0, 0, 5, &CPU::op_pop_f_cb},
-        {(char *)"LD   SPH R(#0x%02X)     ", 0xFE0, MASK_10B, 0, 0, 5, &CPU::op_ld_sph_r_cb},
-        {(char *)"LD   SPL R(#0x%02X)     ", 0xFF0, MASK_10B, 0, 0, 5, &CPU::op_ld_spl_r_cb},
-        {(char *)"LD   R(#0x%02X) SPH     ", 0xFE4, MASK_10B, 0, 0, 5, &CPU::op_ld_r_sph_cb},
-        {(char *)"LD   R(#0x%02X) SPL     ", 0xFF4, MASK_10B, 0, 0, 5, &CPU::op_ld_r_spl_cb},
-        {(char *)"ADD  R(#0x%02X) #0x%02X   ", 0xC00, MASK_6B, 4, 0x030, 7, &CPU::op_add_r_i_cb},
-        {(char *)"ADD  R(#0x%02X) Q(#0x%02X)", 0xA80, MASK_8B, 2, 0x00C, 7, &CPU::op_add_r_q_cb},
-        {(char *)"ADC  R(#0x%02X) #0x%02X   ", 0xC40, MASK_6B, 4, 0x030, 7, &CPU::op_adc_r_i_cb},
-        {(char *)"ADC  R(#0x%02X) Q(#0x%02X)", 0xA90, MASK_8B, 2, 0x00C, 7, &CPU::op_adc_r_q_cb},
-        {(char *)"SUB  R(#0x%02X) Q(#0x%02X)", 0xAA0, MASK_8B, 2, 0x00C, 7, &CPU::op_sub_cb},
-        {(char *)"SBC  R(#0x%02X) #0x%02X   ", 0xB40, MASK_6B, 4, 0x030, 7, &CPU::op_sbc_r_i_cb},
-        {(char *)"SBC  R(#0x%02X) Q(#0x%02X)", 0xAB0, MASK_8B, 2, 0x00C, 7, &CPU::op_sbc_r_q_cb},
-        {(char *)"AND  R(#0x%02X) #0x%02X   ", 0xC80, MASK_6B, 4, 0x030, 7, &CPU::op_and_r_i_cb},
-        {(char *)"AND  R(#0x%02X) Q(#0x%02X)", 0xAC0, MASK_8B, 2, 0x00C, 7, &CPU::op_and_r_q_cb},
-        {(char *)"OR   R(#0x%02X) #0x%02X   ", 0xCC0, MASK_6B, 4, 0x030, 7, &CPU::op_or_r_i_cb},
-        {(char *)"OR   R(#0x%02X) Q(#0x%02X)", 0xAD0, MASK_8B, 2, 0x00C, 7, &CPU::op_or_r_q_cb},
-        {(char *)"XOR  R(#0x%02X) #0x%02X   ", 0xD00, MASK_6B, 4, 0x030, 7, &CPU::op_xor_r_i_cb},
-        {(char *)"XOR  R(#0x%02X) Q(#0x%02X)", 0xAE0, MASK_8B, 2, 0x00C, 7, &CPU::op_xor_r_q_cb},
-        {(char *)"CP   R(#0x%02X) #0x%02X   ", 0xDC0, MASK_6B, 4, 0x030, 7, &CPU::op_cp_r_i_cb},
-        {(char *)"CP   R(#0x%02X) Q(#0x%02X)", 0xF00, MASK_8B, 2, 0x00C, 7, &CPU::op_cp_r_q_cb},
-        {(char *)"FAN  R(#0x%02X) #0x%02X   ", 0xD80, MASK_6B, 4, 0x030, 7, &CPU::op_fan_r_i_cb},
-        {(char *)"FAN  R(#0x%02X) Q(#0x%02X)", 0xF10, MASK_8B, 2, 0x00C, 7, &CPU::op_fan_r_q_cb},
-        {(char *)"RLC  R(#0x%02X)         ", 0xAF0, MASK_8B, 0, 0, 7, &CPU::op_rlc_cb},
-        {(char *)"RRC  R(#0x%02X)         ", 0xE8C, MASK_10B, 0, 0, 5, &CPU::op_rrc_cb},
-        {(char *)"INC  M(#0x%02X)         ", 0xF60, MASK_8B, 0, 0, 7, &CPU::op_inc_mn_cb},
-        {(char *)"DEC  M(#0x%02X)         ", 0xF70, MASK_8B, 0, 0, 7, &CPU::op_dec_mn_cb},
-        {(char *)"ACPX R(#0x%02X)         ", 0xF28, MASK_10B, 0, 0, 7, &CPU::op_acpx_cb},
-        {(char *)"ACPY R(#0x%02X)         ", 0xF2C, MASK_10B, 0, 0, 7, &CPU::op_acpy_cb},
-        {(char *)"SCPX R(#0x%02X)         ", 0xF38, MASK_10B, 0, 0, 7, &CPU::op_scpx_cb},
-        {(char *)"SCPY R(#0x%02X)         ", 0xF3C, MASK_10B, 0, 0, 7, &CPU::op_scpy_cb},
-        {(char *)"NOT  R(#0x%02X)         ", 0xD0F, 0xFCF, 4, 0, 7, &CPU::op_not_cb},
-        {0, 0, 0, 0, 0, 0, 0},
-    };
+    static const op_t ops[OP_NUM + 1];
 };
 #endif
@@ -4,6 +4,18 @@
 #define DISP2_TO_MEMORY(n) ((n - MEM_DISPLAY2_ADDR + MEM_RAM_SIZE + MEM_DISPLAY1_SIZE) / 2)
 #define IO_TO_MEMORY(n)    ((n - MEM_IO_ADDR + MEM_RAM_SIZE + MEM_DISPLAY1_SIZE + MEM_DISPLAY2_SIZE) / 2)
 
+/* memory[] is tracked for incremental snapshots in pages of MEM_PAGE_SIZE bytes, see cpu_state_t::dirty */
+#define MEM_PAGE_SHIFT 5
+#define MEM_PAGE_SIZE  (1 << MEM_PAGE_SHIFT)
+#define MEM_PAGE_NUM   ((MEM_BUFFER_SIZE + MEM_PAGE_SIZE - 1) / MEM_PAGE_SIZE)
+#define MEM_PAGES_ALL  ((1 << MEM_PAGE_NUM) - 1)
+
+/* To be used after a SET_*_MEMORY(buffer, ...) write to buffer[i], old being the byte before the write */
+#define SET_PAGE_DIRTY(dirty, buffer, i, old) ((dirty) |= ((buffer[i] != (old)) << ((i) >> MEM_PAGE_SHIFT)))
+
+/* Same, keeps cpu_state_t::mem_hash in step with the write */
+#define SET_MEM_HASH(hash, buffer, i, old) ((hash) += CPU::cpu_mem_mix(i, buffer[i]) - CPU::cpu_mem_mix(i, old))
+
 #define MASK_4B  0xF00
 #define MASK_6B  0xFC0
 #define MASK_7B  0xFE0
@@ -76,6 +88,7 @@
 #define TICK_FREQUENCY     32768
 #define TIMER_1HZ_PERIOD   32768
 #define TIMER_256HZ_PERIOD 128
+#define CATCHUP_CHUNK      (TICK_FREQUENCY * 60) /* Ticks between progress reports, an emulated minute */
 
 #define REG_CLK_INT_FACTOR_FLAGS     0xF00
 #define REG_SW_INT_FACTOR_FLAGS      0xF01
@@ -95,6 +108,8 @@
 #define REG_PROG_TIMER_RELOAD_DATA_H 0xF27
 #define REG_K00_K03_INPUT_PORT       0xF40
 #define REG_K10_K13_INPUT_PORT       0xF42
+#define REG_SERIAL_DATA_L            0xF48
+#define REG_SERIAL_DATA_H            0xF49
 #define REG_K40_K43_BZ_OUTPUT_PORT   0xF54
 #define REG_CPU_OSC3_CTRL            0xF70
 #define REG_LCD_CTRL                 0xF71
@@ -106,70 +121,74 @@
 #define REG_SW_TIMER_CTRL            0xF77
 #define REG_PROG_TIMER_CTRL          0xF78
 #define REG_PROG_TIMER_CLK_SEL       0xF79
+#define REG_SERIAL_CTRL              0xF7A
+
+#define SERIAL_CTRL_TRIGGER 0x8
+#define LCD_CTRL_ALOFF      0x8 /* All LCD dots off, set at reset */
 
-#define PCS  (pc & 0xFF)
-#define PCSL (pc & 0xF)
-#define PCSH ((pc >> 4) & 0xF)
-#define PCP  ((pc >> 8) & 0xF)
-#define PCB  ((pc >> 12) & 0x1)
+#define PCS  (st->pc & 0xFF)
+#define PCSL (st->pc & 0xF)
+#define PCSH ((st->pc >> 4) & 0xF)
+#define PCP  ((st->pc >> 8) & 0xF)
+#define PCB  ((st->pc >> 12) & 0x1)
 
 #define TO_PC(bank, page, step) ((step & 0xFF) | ((page & 0xF) << 8) | (bank & 0x1) << 12)
 #define TO_NP(bank, page)       ((page & 0xF) | (bank & 0x1) << 4)
 
-#define NBP          ((np >> 4) & 0x1)
-#define NPP          (np & 0xF)
-#define XHL          (x & 0xFF)
-#define XL           (x & 0xF)
-#define XH           ((x >> 4) & 0xF)
-#define XP           ((x >> 8) & 0xF)
-#define YHL          (y & 0xFF)
-#define YL           (y & 0xF)
-#define YH           ((y >> 4) & 0xF)
-#define YP           ((y >> 8) & 0xF)
+#define NBP          ((st->np >> 4) & 0x1)
+#define NPP          (st->np & 0xF)
+#define XHL          (st->x & 0xFF)
+#define XL           (st->x & 0xF)
+#define XH           ((st->x >> 4) & 0xF)
+#define XP           ((st->x >> 8) & 0xF)
+#define YHL          (st->y & 0xFF)
+#define YL           (st->y & 0xF)
+#define YH           ((st->y >> 4) & 0xF)
+#define YP           ((st->y >> 8) & 0xF)
 #define M(n)         get_memory(n)
 #define SET_M(n, v)  set_memory(n, v)
 #define RQ(i)        get_rq(i)
 #define SET_RQ(i, v) set_rq(i, v)
-#define SPL          (sp & 0xF)
-#define SPH          ((sp >> 4) & 0xF)
+#define SPL          (st->sp & 0xF)
+#define SPH          ((st->sp >> 4) & 0xF)
 #define FLAG_C       (0x1 << 0)
 #define FLAG_Z       (0x1 << 1)
 #define FLAG_D       (0x1 << 2)
 #define FLAG_I       (0x1 << 3)
-#define C            !!(flags & FLAG_C)
-#define Z            !!(flags & FLAG_Z)
-#define D            !!(flags & FLAG_D)
-#define I            !!(flags & FLAG_I)
+#define C            !!(st->flags & FLAG_C)
+#define Z            !!(st->flags & FLAG_Z)
+#define D            !!(st->flags & FLAG_D)
+#define I            !!(st->flags & FLAG_I)
 
 #define SET_C()                                                                                                        \
     {                                                                                                                  \
-        flags |= FLAG_C;                                                                                               \
+        st->flags |= FLAG_C;                                                                                           \
     }
 #define CLEAR_C()                                                                                                      \
     {                                                                                                                  \
-        flags &= ~FLAG_C;                                                                                              \
+        st->flags &= ~FLAG_C;                                                                                          \
     }
 #define SET_Z()                                                                                                        \
     {                                                                                                                  \
-        flags |= FLAG_Z;                                                                                               \
+        st->flags |= FLAG_Z;                                                                                           \
     }
 #define CLEAR_Z()                                                                                                      \
     {                                                                                                                  \
-        flags &= ~FLAG_Z;                                                                                              \
+        st->flags &= ~FLAG_Z;                                                                                          \
     }
 #define SET_D()                                                                                                        \
     {                                                                                                                  \
-        flags |= FLAG_D;                                                                                               \
+        st->flags |= FLAG_D;                                                                                           \
     }
 #define CLEAR_D()                                                                                                      \
     {                                                                                                                  \
-        flags &= ~FLAG_D;                                                                                              \
+        st->flags &= ~FLAG_D;                                                                                          \
     }
 #define SET_I()                                                                                                        \
     {                                                                                                                  \
-        flags |= FLAG_I;                                                                                               \
+        st->flags |= FLAG_I;                                                                                           \
     }
 #define CLEAR_I()                                                                                                      \
     {                                                                                                                  \
-        flags &= ~FLAG_I;                                                                                              \
+        st->flags &= ~FLAG_I;                                                                                          \
     }
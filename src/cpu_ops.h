@@ -0,0 +1,1025 @@
+#ifndef _CPU_OPS_H_
+#define _CPU_OPS_H_
+/* Every instruction in op_id_t order, as X(id, name) with CPU_OP(name) the body below */
+#define CPU_OP_LIST(X)                                                                                                 \
+    X(OP_PSET, pset)                                                                                                   \
+    X(OP_JP, jp)                                                                                                       \
+    X(OP_JP_C, jp_c)                                                                                                   \
+    X(OP_JP_NC, jp_nc)                                                                                                 \
+    X(OP_JP_Z, jp_z)                                                                                                   \
+    X(OP_JP_NZ, jp_nz)                                                                                                 \
+    X(OP_JPBA, jpba)                                                                                                   \
+    X(OP_CALL, call)                                                                                                   \
+    X(OP_CALZ, calz)                                                                                                   \
+    X(OP_RET, ret)                                                                                                     \
+    X(OP_RETS, rets)                                                                                                   \
+    X(OP_RETD, retd)                                                                                                   \
+    X(OP_NOP5, nop5)                                                                                                   \
+    X(OP_NOP7, nop7)                                                                                                   \
+    X(OP_HALT, halt)                                                                                                   \
+    X(OP_INC_X, inc_x)                                                                                                 \
+    X(OP_INC_Y, inc_y)                                                                                                 \
+    X(OP_LD_X, ld_x)                                                                                                   \
+    X(OP_LD_Y, ld_y)                                                                                                   \
+    X(OP_LD_XP_R, ld_xp_r)                                                                                             \
+    X(OP_LD_XH_R, ld_xh_r)                                                                                             \
+    X(OP_LD_XL_R, ld_xl_r)                                                                                             \
+    X(OP_LD_YP_R, ld_yp_r)                                                                                             \
+    X(OP_LD_YH_R, ld_yh_r)                                                                                             \
+    X(OP_LD_YL_R, ld_yl_r)                                                                                             \
+    X(OP_LD_R_XP, ld_r_xp)                                                                                             \
+    X(OP_LD_R_XH, ld_r_xh)                                                                                             \
+    X(OP_LD_R_XL, ld_r_xl)                                                                                             \
+    X(OP_LD_R_YP, ld_r_yp)                                                                                             \
+    X(OP_LD_R_YH, ld_r_yh)                                                                                             \
+    X(OP_LD_R_YL, ld_r_yl)                                                                                             \
+    X(OP_ADC_XH, adc_xh)                                                                                               \
+    X(OP_ADC_XL, adc_xl)                                                                                               \
+    X(OP_ADC_YH, adc_yh)                                                                                               \
+    X(OP_ADC_YL, adc_yl)                                                                                               \
+    X(OP_CP_XH, cp_xh)                                                                                                 \
+    X(OP_CP_XL, cp_xl)                                                                                                 \
+    X(OP_CP_YH, cp_yh)                                                                                                 \
+    X(OP_CP_YL, cp_yl)                                                                                                 \
+    X(OP_LD_R_I, ld_r_i)                                                                                               \
+    X(OP_LD_R_Q, ld_r_q)                                                                                               \
+    X(OP_LD_A_MN, ld_a_mn)                                                                                             \
+    X(OP_LD_B_MN, ld_b_mn)                                                                                             \
+    X(OP_LD_MN_A, ld_mn_a)                                                                                             \
+    X(OP_LD_MN_B, ld_mn_b)                                                                                             \
+    X(OP_LDPX_MX, ldpx_mx)                                                                                             \
+    X(OP_LDPX_R, ldpx_r)                                                                                               \
+    X(OP_LDPY_MY, ldpy_my)                                                                                             \
+    X(OP_LDPY_R, ldpy_r)                                                                                               \
+    X(OP_LBPX, lbpx)                                                                                                   \
+    X(OP_SET, set)                                                                                                     \
+    X(OP_RST, rst)                                                                                                     \
+    X(OP_SCF, scf)                                                                                                     \
+    X(OP_RCF, rcf)                                                                                                     \
+    X(OP_SZF, szf)                                                                                                     \
+    X(OP_RZF, rzf)                                                                                                     \
+    X(OP_SDF, sdf)                                                                                                     \
+    X(OP_RDF, rdf)                                                                                                     \
+    X(OP_EI, ei)                                                                                                       \
+    X(OP_DI, di)                                                                                                       \
+    X(OP_INC_SP, inc_sp)                                                                                               \
+    X(OP_DEC_SP, dec_sp)                                                                                               \
+    X(OP_PUSH_R, push_r)                                                                                               \
+    X(OP_PUSH_XP, push_xp)                                                                                             \
+    X(OP_PUSH_XH, push_xh)                                                                                             \
+    X(OP_PUSH_XL, push_xl)                                                                                             \
+    X(OP_PUSH_YP, push_yp)                                                                                             \
+    X(OP_PUSH_YH, push_yh)                                                                                             \
+    X(OP_PUSH_YL, push_yl)                                                                                             \
+    X(OP_PUSH_F, push_f)                                                                                               \
+    X(OP_POP_R, pop_r)                                                                                                 \
+    X(OP_POP_XP, pop_xp)                                                                                               \
+    X(OP_POP_XH, pop_xh)                                                                                               \
+    X(OP_POP_XL, pop_xl)                                                                                               \
+    X(OP_POP_YP, pop_yp)                                                                                               \
+    X(OP_POP_YH, pop_yh)                                                                                               \
+    X(OP_POP_YL, pop_yl)                                                                                               \
+    X(OP_POP_F, pop_f)                                                                                                 \
+    X(OP_LD_SPH_R, ld_sph_r)                                                                                           \
+    X(OP_LD_SPL_R, ld_spl_r)                                                                                           \
+    X(OP_LD_R_SPH, ld_r_sph)                                                                                           \
+    X(OP_LD_R_SPL, ld_r_spl)                                                                                           \
+    X(OP_ADD_R_I, add_r_i)                                                                                             \
+    X(OP_ADD_R_Q, add_r_q)                                                                                             \
+    X(OP_ADC_R_I, adc_r_i)                                                                                             \
+    X(OP_ADC_R_Q, adc_r_q)                                                                                             \
+    X(OP_SUB, sub)                                                                                                     \
+    X(OP_SBC_R_I, sbc_r_i)                                                                                             \
+    X(OP_SBC_R_Q, sbc_r_q)                                                                                             \
+    X(OP_AND_R_I, and_r_i)                                                                                             \
+    X(OP_AND_R_Q, and_r_q)                                                                                             \
+    X(OP_OR_R_I, or_r_i)                                                                                               \
+    X(OP_OR_R_Q, or_r_q)                                                                                               \
+    X(OP_XOR_R_I, xor_r_i)                                                                                             \
+    X(OP_XOR_R_Q, xor_r_q)                                                                                             \
+    X(OP_CP_R_I, cp_r_i)                                                                                               \
+    X(OP_CP_R_Q, cp_r_q)                                                                                               \
+    X(OP_FAN_R_I, fan_r_i)                                                                                             \
+    X(OP_FAN_R_Q, fan_r_q)                                                                                             \
+    X(OP_RLC, rlc)                                                                                                     \
+    X(OP_RRC, rrc)                                                                                                     \
+    X(OP_INC_MN, inc_mn)                                                                                               \
+    X(OP_DEC_MN, dec_mn)                                                                                               \
+    X(OP_ACPX, acpx)                                                                                                   \
+    X(OP_ACPY, acpy)                                                                                                   \
+    X(OP_SCPX, scpx)                                                                                                   \
+    X(OP_SCPY, scpy)                                                                                                   \
+    X(OP_NOT, not)
+#endif
+
+/*
+ * The instruction bodies, shared by CPU and Lockstep so that both run the exact same code. The includer
+ * defines CPU_OP(name) as the signature of a member taking (u8_t arg0, u8_t arg1), and provides `st`
+ * (the registers, addressed like a cpu_state_t), `next_pc`, `hal` and the accessors behind M(), SET_M(),
+ * RQ() and SET_RQ().
+ */
+#ifdef CPU_OP
+CPU_OP(pset)
+{
+    st->np = arg0;
+}
+CPU_OP(jp)
+{
+    next_pc = arg0 | (st->np << 8);
+}
+CPU_OP(jp_c)
+{
+    if (st->flags & FLAG_C) {
+        next_pc = arg0 | (st->np << 8);
+    }
+}
+CPU_OP(jp_nc)
+{
+    if (!(st->flags & FLAG_C)) {
+        next_pc = arg0 | (st->np << 8);
+    }
+}
+CPU_OP(jp_z)
+{
+    if (st->flags & FLAG_Z) {
+        next_pc = arg0 | (st->np << 8);
+    }
+}
+CPU_OP(jp_nz)
+{
+    if (!(st->flags & FLAG_Z)) {
+        next_pc = arg0 | (st->np << 8);
+    }
+}
+CPU_OP(jpba)
+{
+    next_pc = st->a | (st->b << 4) | (st->np << 8);
+}
+CPU_OP(call)
+{
+    st->pc = (st->pc + 1) & 0x1FFF;
+    SET_M(st->sp - 1, PCP);
+    SET_M(st->sp - 2, PCSH);
+    SET_M(st->sp - 3, PCSL);
+    st->sp  = (st->sp - 3) & 0xFF;
+    next_pc = TO_PC(PCB, NPP, arg0);
+    st->call_depth++;
+}
+CPU_OP(calz)
+{
+    st->pc = (st->pc + 1) & 0x1FFF;
+    SET_M(st->sp - 1, PCP);
+    SET_M(st->sp - 2, PCSH);
+    SET_M(st->sp - 3, PCSL);
+    st->sp  = (st->sp - 3) & 0xFF;
+    next_pc = TO_PC(PCB, 0, arg0);
+    st->call_depth++;
+}
+CPU_OP(ret)
+{
+    next_pc = M(st->sp) | (M(st->sp + 1) << 4) | (M(st->sp + 2) << 8) | (PCB << 12);
+    st->sp  = (st->sp + 3) & 0xFF;
+    st->call_depth--;
+}
+CPU_OP(rets)
+{
+    next_pc = M(st->sp) | (M(st->sp + 1) << 4) | (M(st->sp + 2) << 8) | (PCB << 12);
+    st->sp  = (st->sp + 3) & 0xFF;
+    next_pc = (st->pc + 1) & 0x1FFF;
+    st->call_depth--;
+}
+CPU_OP(retd)
+{
+    next_pc = M(st->sp) | (M(st->sp + 1) << 4) | (M(st->sp + 2) << 8) | (PCB << 12);
+    st->sp  = (st->sp + 3) & 0xFF;
+    SET_M(st->x, arg0 & 0xF);
+    SET_M(st->x + 1, (arg0 >> 4) & 0xF);
+    st->x = ((st->x + 2) & 0xFF) | (XP << 8);
+    st->call_depth--;
+}
+CPU_OP(nop5)
+{
+}
+CPU_OP(nop7)
+{
+}
+CPU_OP(halt)
+{
+    if (hal) {
+        hal->hal_halt();
+    }
+}
+CPU_OP(inc_x)
+{
+    st->x = ((st->x + 1) & 0xFF) | (XP << 8);
+}
+CPU_OP(inc_y)
+{
+    st->y = ((st->y + 1) & 0xFF) | (YP << 8);
+}
+CPU_OP(ld_x)
+{
+    st->x = arg0 | (XP << 8);
+}
+CPU_OP(ld_y)
+{
+    st->y = arg0 | (YP << 8);
+}
+CPU_OP(ld_xp_r)
+{
+    st->x = XHL | (RQ(arg0) << 8);
+}
+CPU_OP(ld_xh_r)
+{
+    st->x = XL | (RQ(arg0) << 4) | (XP << 8);
+}
+CPU_OP(ld_xl_r)
+{
+    st->x = RQ(arg0) | (XH << 4) | (XP << 8);
+}
+CPU_OP(ld_yp_r)
+{
+    st->y = YHL | (RQ(arg0) << 8);
+}
+CPU_OP(ld_yh_r)
+{
+    st->y = YL | (RQ(arg0) << 4) | (YP << 8);
+}
+CPU_OP(ld_yl_r)
+{
+    st->y = RQ(arg0) | (YH << 4) | (YP << 8);
+}
+CPU_OP(ld_r_xp)
+{
+    SET_RQ(arg0, XP);
+}
+CPU_OP(ld_r_xh)
+{
+    SET_RQ(arg0, XH);
+}
+CPU_OP(ld_r_xl)
+{
+    SET_RQ(arg0, XL);
+}
+CPU_OP(ld_r_yp)
+{
+    SET_RQ(arg0, YP);
+}
+CPU_OP(ld_r_yh)
+{
+    SET_RQ(arg0, YH);
+}
+CPU_OP(ld_r_yl)
+{
+    SET_RQ(arg0, YL);
+}
+CPU_OP(adc_xh)
+{
+    u8_t tmp;
+    tmp   = XH + arg0 + C;
+    st->x = XL | ((tmp & 0xF) << 4) | (XP << 8);
+    if (tmp >> 4) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    if (!(tmp & 0xF)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(adc_xl)
+{
+    u8_t tmp;
+    tmp   = XL + arg0 + C;
+    st->x = (tmp & 0xF) | (XH << 4) | (XP << 8);
+    if (tmp >> 4) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    if (!(tmp & 0xF)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(adc_yh)
+{
+    u8_t tmp;
+    tmp   = YH + arg0 + C;
+    st->y = YL | ((tmp & 0xF) << 4) | (YP << 8);
+    if (tmp >> 4) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    if (!(tmp & 0xF)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(adc_yl)
+{
+    u8_t tmp;
+    tmp   = YL + arg0 + C;
+    st->y = (tmp & 0xF) | (YH << 4) | (YP << 8);
+    if (tmp >> 4) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    if (!(tmp & 0xF)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(cp_xh)
+{
+    if (XH < arg0) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    if (XH == arg0) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(cp_xl)
+{
+    if (XL < arg0) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    if (XL == arg0) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(cp_yh)
+{
+    if (YH < arg0) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    if (YH == arg0) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(cp_yl)
+{
+    if (YL < arg0) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    if (YL == arg0) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(ld_r_i)
+{
+    SET_RQ(arg0, arg1);
+}
+CPU_OP(ld_r_q)
+{
+    SET_RQ(arg0, RQ(arg1));
+}
+CPU_OP(ld_a_mn)
+{
+    st->a = M(arg0);
+}
+CPU_OP(ld_b_mn)
+{
+    st->b = M(arg0);
+}
+CPU_OP(ld_mn_a)
+{
+    SET_M(arg0, st->a);
+}
+CPU_OP(ld_mn_b)
+{
+    SET_M(arg0, st->b);
+}
+CPU_OP(ldpx_mx)
+{
+    SET_M(st->x, arg0);
+    st->x = ((st->x + 1) & 0xFF) | (XP << 8);
+}
+CPU_OP(ldpx_r)
+{
+    SET_RQ(arg0, RQ(arg1));
+    st->x = ((st->x + 1) & 0xFF) | (XP << 8);
+}
+CPU_OP(ldpy_my)
+{
+    SET_M(st->y, arg0);
+    st->y = ((st->y + 1) & 0xFF) | (YP << 8);
+}
+CPU_OP(ldpy_r)
+{
+    SET_RQ(arg0, RQ(arg1));
+    st->y = ((st->y + 1) & 0xFF) | (YP << 8);
+}
+CPU_OP(lbpx)
+{
+    SET_M(st->x, arg0 & 0xF);
+    SET_M(st->x + 1, (arg0 >> 4) & 0xF);
+    st->x = ((st->x + 2) & 0xFF) | (XP << 8);
+}
+CPU_OP(set)
+{
+    st->flags |= arg0;
+}
+CPU_OP(rst)
+{
+    st->flags &= arg0;
+}
+CPU_OP(scf)
+{
+    SET_C();
+}
+CPU_OP(rcf)
+{
+    CLEAR_C();
+}
+CPU_OP(szf)
+{
+    SET_Z();
+}
+CPU_OP(rzf)
+{
+    CLEAR_Z();
+}
+CPU_OP(sdf)
+{
+    SET_D();
+}
+CPU_OP(rdf)
+{
+    CLEAR_D();
+}
+CPU_OP(ei)
+{
+    SET_I();
+}
+CPU_OP(di)
+{
+    CLEAR_I();
+}
+CPU_OP(inc_sp)
+{
+    st->sp = (st->sp + 1) & 0xFF;
+}
+CPU_OP(dec_sp)
+{
+    st->sp = (st->sp - 1) & 0xFF;
+}
+CPU_OP(push_r)
+{
+    st->sp = (st->sp - 1) & 0xFF;
+    SET_M(st->sp, RQ(arg0));
+}
+CPU_OP(push_xp)
+{
+    st->sp = (st->sp - 1) & 0xFF;
+    SET_M(st->sp, XP);
+}
+CPU_OP(push_xh)
+{
+    st->sp = (st->sp - 1) & 0xFF;
+    SET_M(st->sp, XH);
+}
+CPU_OP(push_xl)
+{
+    st->sp = (st->sp - 1) & 0xFF;
+    SET_M(st->sp, XL);
+}
+CPU_OP(push_yp)
+{
+    st->sp = (st->sp - 1) & 0xFF;
+    SET_M(st->sp, YP);
+}
+CPU_OP(push_yh)
+{
+    st->sp = (st->sp - 1) & 0xFF;
+    SET_M(st->sp, YH);
+}
+CPU_OP(push_yl)
+{
+    st->sp = (st->sp - 1) & 0xFF;
+    SET_M(st->sp, YL);
+}
+CPU_OP(push_f)
+{
+    st->sp = (st->sp - 1) & 0xFF;
+    SET_M(st->sp, st->flags);
+}
+CPU_OP(pop_r)
+{
+    SET_RQ(arg0, M(st->sp));
+    st->sp = (st->sp + 1) & 0xFF;
+}
+CPU_OP(pop_xp)
+{
+    st->x  = XL | (XH << 4) | (M(st->sp) << 8);
+    st->sp = (st->sp + 1) & 0xFF;
+}
+CPU_OP(pop_xh)
+{
+    st->x  = XL | (M(st->sp) << 4) | (XP << 8);
+    st->sp = (st->sp + 1) & 0xFF;
+}
+CPU_OP(pop_xl)
+{
+    st->x  = M(st->sp) | (XH << 4) | (XP << 8);
+    st->sp = (st->sp + 1) & 0xFF;
+}
+CPU_OP(pop_yp)
+{
+    st->y  = YL | (YH << 4) | (M(st->sp) << 8);
+    st->sp = (st->sp + 1) & 0xFF;
+}
+CPU_OP(pop_yh)
+{
+    st->y  = YL | (M(st->sp) << 4) | (YP << 8);
+    st->sp = (st->sp + 1) & 0xFF;
+}
+CPU_OP(pop_yl)
+{
+    st->y  = M(st->sp) | (YH << 4) | (YP << 8);
+    st->sp = (st->sp + 1) & 0xFF;
+}
+CPU_OP(pop_f)
+{
+    st->flags = M(st->sp);
+    st->sp    = (st->sp + 1) & 0xFF;
+}
+CPU_OP(ld_sph_r)
+{
+    st->sp = SPL | (RQ(arg0) << 4);
+}
+CPU_OP(ld_spl_r)
+{
+    st->sp = RQ(arg0) | (SPH << 4);
+}
+CPU_OP(ld_r_sph)
+{
+    SET_RQ(arg0, SPH);
+}
+CPU_OP(ld_r_spl)
+{
+    SET_RQ(arg0, SPL);
+}
+CPU_OP(add_r_i)
+{
+    u8_t tmp;
+    tmp = RQ(arg0) + arg1;
+    if (D) {
+        if (tmp >= 10) {
+            SET_RQ(arg0, (tmp - 10) & 0xF);
+            SET_C();
+        } else {
+            SET_RQ(arg0, tmp);
+            CLEAR_C();
+        }
+    } else {
+        SET_RQ(arg0, tmp & 0xF);
+        if (tmp >> 4) {
+            SET_C();
+        } else {
+            CLEAR_C();
+        }
+    }
+    if (!RQ(arg0)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(add_r_q)
+{
+    u8_t tmp;
+    tmp = RQ(arg0) + RQ(arg1);
+    if (D) {
+        if (tmp >= 10) {
+            SET_RQ(arg0, (tmp - 10) & 0xF);
+            SET_C();
+        } else {
+            SET_RQ(arg0, tmp);
+            CLEAR_C();
+        }
+    } else {
+        SET_RQ(arg0, tmp & 0xF);
+        if (tmp >> 4) {
+            SET_C();
+        } else {
+            CLEAR_C();
+        }
+    }
+    if (!RQ(arg0)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(adc_r_i)
+{
+    u8_t tmp;
+    tmp = RQ(arg0) + arg1 + C;
+    if (D) {
+        if (tmp >= 10) {
+            SET_RQ(arg0, (tmp - 10) & 0xF);
+            SET_C();
+        } else {
+            SET_RQ(arg0, tmp);
+            CLEAR_C();
+        }
+    } else {
+        SET_RQ(arg0, tmp & 0xF);
+        if (tmp >> 4) {
+            SET_C();
+        } else {
+            CLEAR_C();
+        }
+    }
+    if (!RQ(arg0)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(adc_r_q)
+{
+    u8_t tmp;
+    tmp = RQ(arg0) + RQ(arg1) + C;
+    if (D) {
+        if (tmp >= 10) {
+            SET_RQ(arg0, (tmp - 10) & 0xF);
+            SET_C();
+        } else {
+            SET_RQ(arg0, tmp);
+            CLEAR_C();
+        }
+    } else {
+        SET_RQ(arg0, tmp & 0xF);
+        if (tmp >> 4) {
+            SET_C();
+        } else {
+            CLEAR_C();
+        }
+    }
+    if (!RQ(arg0)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(sub)
+{
+    u8_t tmp;
+    tmp = RQ(arg0) - RQ(arg1);
+    if (D) {
+        if (tmp >> 4) {
+            SET_RQ(arg0, (tmp - 6) & 0xF);
+        } else {
+            SET_RQ(arg0, tmp);
+        }
+    } else {
+        SET_RQ(arg0, tmp & 0xF);
+    }
+    if (tmp >> 4) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    if (!RQ(arg0)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(sbc_r_i)
+{
+    u8_t tmp;
+    tmp = RQ(arg0) - arg1 - C;
+    if (D) {
+        if (tmp >> 4) {
+            SET_RQ(arg0, (tmp - 6) & 0xF);
+        } else {
+            SET_RQ(arg0, tmp);
+        }
+    } else {
+        SET_RQ(arg0, tmp & 0xF);
+    }
+    if (tmp >> 4) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    if (!RQ(arg0)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(sbc_r_q)
+{
+    u8_t tmp;
+    tmp = RQ(arg0) - RQ(arg1) - C;
+    if (D) {
+        if (tmp >> 4) {
+            SET_RQ(arg0, (tmp - 6) & 0xF);
+        } else {
+            SET_RQ(arg0, tmp);
+        }
+    } else {
+        SET_RQ(arg0, tmp & 0xF);
+    }
+    if (tmp >> 4) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    if (!RQ(arg0)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(and_r_i)
+{
+    SET_RQ(arg0, RQ(arg0) & arg1);
+    if (!RQ(arg0)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(and_r_q)
+{
+    SET_RQ(arg0, RQ(arg0) & RQ(arg1));
+    if (!RQ(arg0)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(or_r_i)
+{
+    SET_RQ(arg0, RQ(arg0) | arg1);
+    if (!RQ(arg0)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(or_r_q)
+{
+    SET_RQ(arg0, RQ(arg0) | RQ(arg1));
+    if (!RQ(arg0)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(xor_r_i)
+{
+    SET_RQ(arg0, RQ(arg0) ^ arg1);
+    if (!RQ(arg0)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(xor_r_q)
+{
+    SET_RQ(arg0, RQ(arg0) ^ RQ(arg1));
+    if (!RQ(arg0)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(cp_r_i)
+{
+    if (RQ(arg0) < arg1) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    if (RQ(arg0) == arg1) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(cp_r_q)
+{
+    if (RQ(arg0) < RQ(arg1)) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    if (RQ(arg0) == RQ(arg1)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(fan_r_i)
+{
+    if (!(RQ(arg0) & arg1)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(fan_r_q)
+{
+    if (!(RQ(arg0) & RQ(arg1))) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(rlc)
+{
+    u8_t tmp;
+    tmp = (RQ(arg0) << 1) | C;
+    if (RQ(arg0) & 0x8) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    SET_RQ(arg0, tmp & 0xF);
+}
+CPU_OP(rrc)
+{
+    u8_t tmp;
+    tmp = (RQ(arg0) >> 1) | (C << 3);
+    if (RQ(arg0) & 0x1) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    SET_RQ(arg0, tmp & 0xF);
+}
+CPU_OP(inc_mn)
+{
+    u8_t tmp;
+    tmp = M(arg0) + 1;
+    SET_M(arg0, tmp & 0xF);
+    if (tmp >> 4) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    if (!M(arg0)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(dec_mn)
+{
+    u8_t tmp;
+    tmp = M(arg0) - 1;
+    SET_M(arg0, tmp & 0xF);
+    if (tmp >> 4) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    if (!M(arg0)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+CPU_OP(acpx)
+{
+    u8_t tmp;
+    tmp = M(st->x) + RQ(arg0) + C;
+    if (D) {
+        if (tmp >= 10) {
+            SET_M(st->x, (tmp - 10) & 0xF);
+            SET_C();
+        } else {
+            SET_M(st->x, tmp);
+            CLEAR_C();
+        }
+    } else {
+        SET_M(st->x, tmp & 0xF);
+        if (tmp >> 4) {
+            SET_C();
+        } else {
+            CLEAR_C();
+        }
+    }
+    if (!M(st->x)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+    st->x = ((st->x + 1) & 0xFF) | (XP << 8);
+}
+CPU_OP(acpy)
+{
+    u8_t tmp;
+    tmp = M(st->y) + RQ(arg0) + C;
+    if (D) {
+        if (tmp >= 10) {
+            SET_M(st->y, (tmp - 10) & 0xF);
+            SET_C();
+        } else {
+            SET_M(st->y, tmp);
+            CLEAR_C();
+        }
+    } else {
+        SET_M(st->y, tmp & 0xF);
+        if (tmp >> 4) {
+            SET_C();
+        } else {
+            CLEAR_C();
+        }
+    }
+    if (!M(st->y)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+    st->y = ((st->y + 1) & 0xFF) | (YP << 8);
+}
+CPU_OP(scpx)
+{
+    u8_t tmp;
+    tmp = M(st->x) - RQ(arg0) - C;
+    if (D) {
+        if (tmp >> 4) {
+            SET_M(st->x, (tmp - 6) & 0xF);
+        } else {
+            SET_M(st->x, tmp);
+        }
+    } else {
+        SET_M(st->x, tmp & 0xF);
+    }
+    if (tmp >> 4) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    if (!M(st->x)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+    st->x = ((st->x + 1) & 0xFF) | (XP << 8);
+}
+CPU_OP(scpy)
+{
+    u8_t tmp;
+    tmp = M(st->y) - RQ(arg0) - C;
+    if (D) {
+        if (tmp >> 4) {
+            SET_M(st->y, (tmp - 6) & 0xF);
+        } else {
+            SET_M(st->y, tmp);
+        }
+    } else {
+        SET_M(st->y, tmp & 0xF);
+    }
+    if (tmp >> 4) {
+        SET_C();
+    } else {
+        CLEAR_C();
+    }
+    if (!M(st->y)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+    st->y = ((st->y + 1) & 0xFF) | (YP << 8);
+}
+CPU_OP(not)
+{
+    SET_RQ(arg0, ~RQ(arg0) & 0xF);
+    if (!RQ(arg0)) {
+        SET_Z();
+    } else {
+        CLEAR_Z();
+    }
+}
+#endif
@@ -0,0 +1,154 @@
+#include <new>
+#include <stddef.h>
+#include <string.h>
+#include "e0c6s46.h"
+#include "cpu.h"
+#include "program.h"
+
+
+static_assert(sizeof(e0c6s46_lcd_t) == sizeof(lcd_bitmap_t), "e0c6s46_lcd_t must mirror lcd_bitmap_t");
+static_assert(offsetof(e0c6s46_lcd_t, icons) == offsetof(lcd_bitmap_t, icons), "e0c6s46_lcd_t must mirror lcd_bitmap_t");
+static_assert(sizeof(cpu_save_t) == E0C6S46_SAVE_SIZE, "E0C6S46_SAVE_SIZE must match cpu_save_t");
+static_assert(CPU_DELTA_MAX_SIZE == E0C6S46_DELTA_MAX, "E0C6S46_DELTA_MAX must match CPU_DELTA_MAX_SIZE");
+
+struct e0c6s46
+{
+    CPU          cpu{nullptr};
+    cpu_state_t *state  = 0;
+    lcd_bitmap_t lcd    = {{0}, 0};
+    bool_t       loaded = 0;
+};
+
+
+static void e0c6s46_release_inputs(e0c6s46_t *inst)
+{
+    inst->cpu.cpu_set_input_pin(PIN_K00, PIN_STATE_HIGH);
+    inst->cpu.cpu_set_input_pin(PIN_K01, PIN_STATE_HIGH);
+    inst->cpu.cpu_set_input_pin(PIN_K02, PIN_STATE_HIGH);
+}
+uint32_t e0c6s46_abi_version(void)
+{
+    return E0C6S46_ABI_VERSION;
+}
+e0c6s46_t *e0c6s46_create(void)
+{
+    e0c6s46_t *inst = new (std::nothrow) e0c6s46_t;
+    if (inst) {
+        inst->state = inst->cpu.cpu_get_state();
+        inst->cpu.cpu_set_lcd_bitmap(&inst->lcd);
+    }
+    return inst;
+}
+void e0c6s46_destroy(e0c6s46_t *inst)
+{
+    delete inst;
+}
+int e0c6s46_load_rom(e0c6s46_t *inst, const uint16_t *words, uint32_t count)
+{
+    Program *program;
+
+    if (words == NULL || count == 0) {
+        return -1;
+    }
+    program = Program::program_get(words, count);
+    if (program == NULL) {
+        return -1;
+    }
+    inst->cpu.cpu_init(program, NULL, 1000000);
+    program->program_release();
+    e0c6s46_release_inputs(inst);
+    inst->loaded = 1;
+    return 0;
+}
+void e0c6s46_reset(e0c6s46_t *inst)
+{
+    inst->cpu.cpu_reset();
+    e0c6s46_release_inputs(inst);
+}
+uint32_t e0c6s46_run_cycles(e0c6s46_t *inst, uint32_t cycles)
+{
+    cpu_state_t *st = inst->state;
+    u32_t        start, target;
+
+    if (!inst->loaded) {
+        return 0;
+    }
+    start  = st->tick_counter;
+    target = start + cycles;
+    while ((int32_t)(target - st->tick_counter) > 0) {
+        if (inst->cpu.cpu_step()) {
+            break;
+        }
+    }
+    return st->tick_counter - start;
+}
+void e0c6s46_set_button(e0c6s46_t *inst, e0c6s46_button_t button, int pressed)
+{
+    pin_state_t state = pressed ? PIN_STATE_LOW : PIN_STATE_HIGH;
+    switch (button) {
+        case E0C6S46_BUTTON_LEFT:
+            inst->cpu.cpu_set_input_pin(PIN_K02, state);
+            break;
+        case E0C6S46_BUTTON_MIDDLE:
+            inst->cpu.cpu_set_input_pin(PIN_K01, state);
+            break;
+        case E0C6S46_BUTTON_RIGHT:
+            inst->cpu.cpu_set_input_pin(PIN_K00, state);
+            break;
+    }
+}
+uint32_t e0c6s46_get_cycles(const e0c6s46_t *inst)
+{
+    return inst->state->tick_counter;
+}
+const uint8_t *e0c6s46_get_ram(const e0c6s46_t *inst, uint32_t *size)
+{
+    if (size) {
+        *size = MEM_RAM_SIZE / 2;
+    }
+    return &inst->state->memory[RAM_TO_MEMORY(MEM_RAM_ADDR)];
+}
+const uint8_t *e0c6s46_get_display_ram(const e0c6s46_t *inst, uint32_t *size)
+{
+    if (size) {
+        *size = (MEM_DISPLAY1_SIZE + MEM_DISPLAY2_SIZE) / 2;
+    }
+    return &inst->state->memory[DISP1_TO_MEMORY(MEM_DISPLAY1_ADDR)];
+}
+const e0c6s46_lcd_t *e0c6s46_get_lcd(const e0c6s46_t *inst)
+{
+    return (const e0c6s46_lcd_t *)&inst->lcd;
+}
+uint32_t e0c6s46_save_state(e0c6s46_t *inst, void *buf, uint32_t size)
+{
+    cpu_save_t save;
+
+    if (buf == NULL || size < sizeof(cpu_save_t)) {
+        return 0;
+    }
+    /* The caller's buffer may not be aligned for cpu_save_t */
+    inst->cpu.cpu_save_state(&save);
+    memcpy(buf, &save, sizeof(save));
+    return sizeof(save);
+}
+int e0c6s46_load_state(e0c6s46_t *inst, const void *buf, uint32_t size)
+{
+    if (buf == NULL || inst->cpu.cpu_load_state(buf, size)) {
+        return -1;
+    }
+    return 0;
+}
+uint32_t e0c6s46_save_delta(e0c6s46_t *inst, void *buf, uint32_t size)
+{
+    if (buf == NULL) {
+        return 0;
+    }
+    return CPU::cpu_encode_delta(inst->state, buf, size);
+}
+int e0c6s46_load_delta(e0c6s46_t *inst, const void *buf, uint32_t size)
+{
+    if (buf == NULL || inst->cpu.cpu_load_delta(buf, size)) {
+        return -1;
+    }
+    return 0;
+}
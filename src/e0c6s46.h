@@ -0,0 +1,85 @@
+#ifndef _E0C6S46_H_
+#define _E0C6S46_H_
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Stable C ABI of libe0c6s46.so.
+ * Bump E0C6S46_ABI_VERSION on any incompatible change and check e0c6s46_abi_version() at load time.
+ * Instances are headless and not thread safe, but distinct instances can be driven from distinct threads.
+ * Every pointer returned by a getter references the instance storage itself: it stays valid and keeps
+ * following the emulation until the instance is destroyed.
+ */
+
+#define E0C6S46_ABI_VERSION 1
+
+#define E0C6S46_CLOCK_HZ   32768
+#define E0C6S46_LCD_WIDTH  32
+#define E0C6S46_LCD_HEIGHT 16
+#define E0C6S46_ICON_NUM   8
+#define E0C6S46_SAVE_SIZE  624
+#define E0C6S46_DELTA_MAX  534
+
+#if defined(__GNUC__)
+#define E0C6S46_API __attribute__((visibility("default")))
+#else
+#define E0C6S46_API
+#endif
+
+typedef struct e0c6s46 e0c6s46_t;
+
+typedef enum
+{
+    E0C6S46_BUTTON_LEFT = 0,
+    E0C6S46_BUTTON_MIDDLE,
+    E0C6S46_BUTTON_RIGHT,
+} e0c6s46_button_t;
+
+/* Bit x of rows[y] is the pixel at column x, row y; bit n of icons is icon n */
+typedef struct
+{
+    uint32_t rows[E0C6S46_LCD_HEIGHT];
+    uint8_t  icons;
+} e0c6s46_lcd_t;
+
+E0C6S46_API uint32_t e0c6s46_abi_version(void);
+
+E0C6S46_API e0c6s46_t *e0c6s46_create(void);
+E0C6S46_API void       e0c6s46_destroy(e0c6s46_t *inst);
+
+/* ROM is given as 12-bit words, loading it resets the instance. Returns 0 on success */
+E0C6S46_API int  e0c6s46_load_rom(e0c6s46_t *inst, const uint16_t *words, uint32_t count);
+E0C6S46_API void e0c6s46_reset(e0c6s46_t *inst);
+
+/* Runs at least the given number of 32.768 kHz clock cycles, returns the number actually run */
+E0C6S46_API uint32_t e0c6s46_run_cycles(e0c6s46_t *inst, uint32_t cycles);
+E0C6S46_API void     e0c6s46_set_button(e0c6s46_t *inst, e0c6s46_button_t button, int pressed);
+E0C6S46_API uint32_t e0c6s46_get_cycles(const e0c6s46_t *inst);
+
+/* Packed nibbles, the low nibble of byte n holds address 2n and the high nibble address 2n + 1 */
+E0C6S46_API const uint8_t *e0c6s46_get_ram(const e0c6s46_t *inst, uint32_t *size);
+E0C6S46_API const uint8_t *e0c6s46_get_display_ram(const e0c6s46_t *inst, uint32_t *size);
+
+E0C6S46_API const e0c6s46_lcd_t *e0c6s46_get_lcd(const e0c6s46_t *inst);
+
+/*
+ * Versioned, little-endian save-state of E0C6S46_SAVE_SIZE bytes covering the whole CPU and LCD.
+ * Save returns the number of bytes written (0 if size is too small), load returns 0 on success.
+ */
+E0C6S46_API uint32_t e0c6s46_save_state(e0c6s46_t *inst, void *buf, uint32_t size);
+E0C6S46_API int      e0c6s46_load_state(e0c6s46_t *inst, const void *buf, uint32_t size);
+
+/*
+ * Delta of at most E0C6S46_DELTA_MAX bytes holding the registers and the RAM pages changed since the last
+ * save or delta, which it replaces as the checkpoint. Load a save then its deltas in order to rebuild a state.
+ */
+E0C6S46_API uint32_t e0c6s46_save_delta(e0c6s46_t *inst, void *buf, uint32_t size);
+E0C6S46_API int      e0c6s46_load_delta(e0c6s46_t *inst, const void *buf, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
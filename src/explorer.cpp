@@ -0,0 +1,98 @@
+#include <time.h>
+#include "explorer.h"
+
+
+/* What each child of a state does during its frame, as VecEnv action bits */
+const u8_t Explorer::actions[EXPLORER_ACTIONS] = {0, VECENV_ACTION_LEFT, VECENV_ACTION_MIDDLE, VECENV_ACTION_RIGHT};
+
+static uint64_t get_time_us(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+Explorer::Explorer(Program *program, u32_t threads)
+{
+    env = new VecEnv(program, EXPLORER_BATCH, threads, 1);
+}
+Explorer::~Explorer()
+{
+    delete env;
+}
+/*
+ * Searches up to `max_depth` frames deep, or until `max_states` distinct states were reached.
+ * Returns 1 if no state within the limits satisfies the goal; explorer_get_path() gives the inputs otherwise.
+ */
+bool_t Explorer::explorer_search(const cpu_state_t *start, explorer_goal_t goal, void *ctx, u32_t max_depth,
+                                 u32_t max_states, explorer_result_t *result)
+{
+    std::vector<cpu_state_t> frontier(1, *start);
+    std::vector<cpu_state_t> next;
+    u8_t                     batch[EXPLORER_BATCH];
+    const cpu_state_t       *st;
+    uint64_t                 begin = get_time_us();
+    uint64_t                 total, base, c;
+    u32_t                    count, k;
+    bool_t                   full = 0;
+
+    levels.assign(1, std::vector<node_t>(1, {0, 0}));
+    visited.clear();
+    visited.insert(CPU::cpu_hash_state(start));
+    found            = goal(ctx, start) ? 0 : EXPLORER_NOT_FOUND;
+    result->expanded = 0;
+    while (found == EXPLORER_NOT_FOUND && !full && !frontier.empty() && levels.size() <= max_depth) {
+        levels.emplace_back();
+        next.clear();
+        total = (uint64_t)frontier.size() * EXPLORER_ACTIONS;
+        for (base = 0; base < total && found == EXPLORER_NOT_FOUND && !full; base += EXPLORER_BATCH) {
+            count = (total - base < EXPLORER_BATCH) ? total - base : EXPLORER_BATCH;
+            for (k = 0; k < count; k++) {
+                c = base + k;
+                env->vecenv_load_state(k, &frontier[c / EXPLORER_ACTIONS]);
+                batch[k] = actions[c % EXPLORER_ACTIONS];
+            }
+            env->vecenv_step_envs(batch, count);
+            result->expanded += count;
+            /* In child order, so that the path found does not depend on the thread count */
+            for (k = 0; k < count; k++) {
+                c  = base + k;
+                st = env->vecenv_get_state(k);
+                if (env->vecenv_get_done()[k] || !visited.insert(CPU::cpu_hash_state(st)).second) {
+                    continue;
+                }
+                levels.back().push_back({(u32_t)(c / EXPLORER_ACTIONS), (u8_t)(c % EXPLORER_ACTIONS)});
+                if (goal(ctx, st)) {
+                    found = levels.back().size() - 1;
+                    break;
+                }
+                if (visited.size() >= max_states) {
+                    full = 1;
+                    break;
+                }
+                next.push_back(*st);
+            }
+        }
+        frontier.swap(next);
+    }
+    result->depth      = (found == EXPLORER_NOT_FOUND) ? EXPLORER_NOT_FOUND : levels.size() - 1;
+    result->unique     = visited.size();
+    result->elapsed_us = get_time_us() - begin;
+    return found == EXPLORER_NOT_FOUND;
+}
+/* Writes the VecEnv action of every frame from the start to the goal of the last search, returns how many */
+u32_t Explorer::explorer_get_path(u8_t *path, u32_t size)
+{
+    u32_t depth = levels.size() - 1;
+    u32_t n     = found;
+    u32_t d;
+
+    if (found == EXPLORER_NOT_FOUND || depth > size) {
+        return 0;
+    }
+    for (d = depth; d > 0; d--) {
+        path[d - 1] = actions[levels[d][n].action];
+        n           = levels[d][n].parent;
+    }
+    return depth;
+}
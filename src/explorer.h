@@ -0,0 +1,59 @@
+#ifndef _EXPLORER_H_
+#define _EXPLORER_H_
+#include <stdint.h>
+#include <unordered_set>
+#include <vector>
+#include "cpu.h"
+#include "vecenv.h"
+
+
+#define EXPLORER_ACTIONS    4         /* Nothing, or one of the three buttons held for the frame */
+#define EXPLORER_BATCH      4096      /* Children emulated per VecEnv step */
+#define EXPLORER_MAX_DEPTH  64
+#define EXPLORER_MAX_STATES (1 << 20) /* About 550 MB of frontier at worst */
+#define EXPLORER_NOT_FOUND  0xFFFFFFFF
+
+/* RAM predicate marking the states searched for, called on the searching thread only */
+typedef bool_t (*explorer_goal_t)(void *ctx, const cpu_state_t *state);
+
+typedef struct
+{
+    u32_t    depth;    /* Frames to the goal, EXPLORER_NOT_FOUND if it was not reached within the limits */
+    uint64_t expanded; /* Frames emulated */
+    uint64_t unique;   /* Distinct states reached, the start included */
+    uint64_t elapsed_us;
+} explorer_result_t;
+
+
+/*
+ * Breadth-first search over button inputs at frame granularity, for the shortest input sequence from a
+ * state to one the goal accepts. Every frame a state branches into EXPLORER_ACTIONS children, one frame
+ * emulated each; the children of a level are run in batches on a VecEnv, so on all its worker threads,
+ * and deduplicated by CPU::cpu_hash_state() before they join the next level. Only the frontier keeps
+ * whole states, the levels behind it keep a parent index and an action per state for the path.
+ */
+class Explorer {
+  private:
+    typedef struct
+    {
+        u32_t parent;
+        u8_t  action;
+    } node_t;
+
+  private:
+    VecEnv                          *env;
+    std::vector<std::vector<node_t>> levels;
+    std::unordered_set<uint64_t>     visited;
+    u32_t                            found = EXPLORER_NOT_FOUND;
+
+  public:
+    Explorer(Program *program, u32_t threads);
+    ~Explorer();
+
+    bool_t explorer_search(const cpu_state_t *start, explorer_goal_t goal, void *ctx, u32_t max_depth,
+                           u32_t max_states, explorer_result_t *result);
+    u32_t  explorer_get_path(u8_t *path, u32_t size);
+
+    static const u8_t actions[EXPLORER_ACTIONS];
+};
+#endif
@@ -0,0 +1,300 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "journal.h"
+
+
+static_assert(sizeof(journal_record_t) == 12, "journal records must be packed");
+
+Journal::Journal(u32_t _sync_us)
+{
+    sync_us = _sync_us;
+    path[0] = '\0';
+    pending.reserve(JOURNAL_BATCH);
+}
+Journal::~Journal()
+{
+    journal_close();
+}
+/* Files are only read here, the first journal_snapshot() starts the journal */
+bool_t Journal::journal_open(const char *_path, u32_t _count)
+{
+    char             name[JOURNAL_NAME_SIZE];
+    journal_header_t hdr;
+    int              f;
+
+    journal_close();
+    if (_count == 0 || strlen(_path) >= sizeof(path)) {
+        return 1;
+    }
+    strcpy(path, _path);
+    count      = _count;
+    generation = 0;
+    /* Keep counting from an existing snapshot, so that its journal can never pass for the next one's */
+    snprintf(name, sizeof(name), "%s.snap", path);
+    f = open(name, O_RDONLY);
+    if (f >= 0) {
+        if (read(f, &hdr, sizeof(hdr)) == sizeof(hdr) && hdr.magic == JOURNAL_SNAP_MAGIC) {
+            generation = hdr.generation;
+        }
+        close(f);
+    }
+    return 0;
+}
+void Journal::journal_close(void)
+{
+    if (fd < 0) {
+        return;
+    }
+    journal_flush();
+    close(fd);
+    fd = -1;
+}
+/*
+ * Loads the last snapshot into `states` and replays the journal onto them, using `cpu` (headless, running
+ * the same program at unlimited speed) as the executor. Each instance is left at its last journaled tick.
+ * Returns 1 if there is no usable snapshot.
+ */
+bool_t Journal::journal_recover(CPU *cpu, cpu_state_t *const *states)
+{
+    char                    name[JOURNAL_NAME_SIZE];
+    journal_header_t        hdr;
+    journal_record_t        rec;
+    struct stat             sb;
+    std::vector<cpu_save_t> saves(count);
+    lcd_bitmap_t            lcd;
+    int                     f;
+    bool_t                  res = 0;
+    u32_t                   i;
+
+    snprintf(name, sizeof(name), "%s.snap", path);
+    f = open(name, O_RDONLY);
+    if (f < 0) {
+        return 1;
+    }
+    if (read(f, &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != JOURNAL_SNAP_MAGIC ||
+        hdr.version != JOURNAL_VERSION || hdr.count != count ||
+        read(f, saves.data(), count * sizeof(cpu_save_t)) != (ssize_t)(count * sizeof(cpu_save_t))) {
+        close(f);
+        return 1;
+    }
+    mtime = fstat(f, &sb) == 0 ? sb.st_mtime : 0;
+    close(f);
+    for (i = 0; i < count; i++) {
+        res |= CPU::cpu_decode_state(&saves[i], sizeof(cpu_save_t), states[i], &lcd);
+    }
+    if (res) {
+        return 1;
+    }
+    generation = hdr.generation;
+
+    snprintf(name, sizeof(name), "%s.jnl", path);
+    f = open(name, O_RDONLY);
+    if (f < 0) {
+        return 0;
+    }
+    if (fstat(f, &sb) == 0) {
+        mtime = sb.st_mtime;
+    }
+    if (read(f, &hdr, sizeof(hdr)) == sizeof(hdr) && hdr.magic == JOURNAL_MAGIC &&
+        hdr.version == JOURNAL_VERSION && hdr.generation == generation && hdr.count == count) {
+        while (read(f, &rec, sizeof(rec)) == sizeof(rec)) {
+            if (rec.check != check(&rec) || rec.id >= count) {
+                break;
+            }
+            cpu->cpu_bind_state(states[rec.id]);
+            if (cpu->cpu_run_to(rec.tick)) {
+                break;
+            }
+            if (rec.pin != JOURNAL_MARK) {
+                cpu->cpu_set_input_pin((pin_t)rec.pin, (pin_state_t)rec.state);
+            }
+        }
+    }
+    close(f);
+    return 0;
+}
+/*
+ * Writes a snapshot of all instances and starts a new, empty journal after it. Unflushed records are
+ * dropped, the snapshot already holds their effect. Both files are replaced atomically, the snapshot first,
+ * and the directory is synced after each rename.
+ */
+bool_t Journal::journal_snapshot(cpu_state_t *const *states)
+{
+    char              name[JOURNAL_NAME_SIZE];
+    std::vector<u8_t> buf(sizeof(journal_header_t) + count * sizeof(cpu_save_t));
+    journal_header_t *hdr   = (journal_header_t *)buf.data();
+    cpu_save_t       *saves = (cpu_save_t *)(hdr + 1);
+    lcd_bitmap_t      lcd;
+    u32_t             i;
+
+    if (count == 0) {
+        return 1;
+    }
+    hdr->magic      = JOURNAL_SNAP_MAGIC;
+    hdr->version    = JOURNAL_VERSION;
+    hdr->generation = generation + 1;
+    hdr->count      = count;
+    for (i = 0; i < count; i++) {
+        CPU::cpu_render_lcd(states[i], &lcd);
+        CPU::cpu_encode_state(states[i], &lcd, &saves[i]);
+    }
+    snprintf(name, sizeof(name), "%s.snap", path);
+    /* The new snapshot's name must be durable before the journal it supersedes is emptied */
+    if (write_file(name, buf.data(), buf.size()) || sync_dir()) {
+        return 1;
+    }
+    generation = hdr->generation;
+
+    hdr->magic = JOURNAL_MAGIC;
+    snprintf(name, sizeof(name), "%s.jnl", path);
+    if (write_file(name, hdr, sizeof(journal_header_t)) || sync_dir()) {
+        return 1;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    pending.clear();
+    fd = open(name, O_WRONLY | O_APPEND);
+    return fd < 0;
+}
+/* When the recovered snapshot or journal was last written, i.e. when its instances last ran */
+time_t Journal::journal_get_mtime(void)
+{
+    return mtime;
+}
+bool_t Journal::journal_record(u32_t id, u32_t tick, pin_t pin, pin_state_t state)
+{
+    return append(id, tick, pin, state);
+}
+/* Records how far an instance has run, so that recovery brings it at least that far */
+bool_t Journal::journal_mark(u32_t id, u32_t tick)
+{
+    return append(id, tick, JOURNAL_MARK, 0);
+}
+bool_t Journal::journal_flush(void)
+{
+    const u8_t *p    = (const u8_t *)pending.data();
+    size_t      left = pending.size() * sizeof(journal_record_t);
+    ssize_t     n;
+
+    if (fd < 0) {
+        return 1;
+    }
+    if (left == 0) {
+        return 0;
+    }
+    while (left > 0) {
+        n = write(fd, p, left);
+        if (n < 0) {
+            return 1;
+        }
+        p += n;
+        left -= n;
+    }
+    pending.clear();
+    return fdatasync(fd) != 0;
+}
+bool_t Journal::journal_poll(void)
+{
+    if (pending.empty() || get_time_us() - pending_us < sync_us) {
+        return 0;
+    }
+    return journal_flush();
+}
+uint64_t Journal::get_time_us(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+/* FNV-1a over the record up to the check, folded to 16 bits */
+uint16_t Journal::check(const journal_record_t *rec)
+{
+    const u8_t *p = (const u8_t *)rec;
+    u32_t       h = 0x811C9DC5;
+    u8_t        i;
+
+    for (i = 0; i < offsetof(journal_record_t, check); i++) {
+        h = (h ^ p[i]) * 0x01000193;
+    }
+    return (uint16_t)(h ^ (h >> 16));
+}
+bool_t Journal::append(u32_t id, u32_t tick, u8_t pin, u8_t state)
+{
+    journal_record_t rec;
+
+    if (fd < 0 || id >= count) {
+        return 1;
+    }
+    if (pending.empty()) {
+        pending_us = get_time_us();
+    }
+    rec.id    = id;
+    rec.tick  = tick;
+    rec.pin   = pin;
+    rec.state = state;
+    rec.check = check(&rec);
+    pending.push_back(rec);
+    if (pending.size() >= JOURNAL_BATCH) {
+        return journal_flush();
+    }
+    return 0;
+}
+/* Write to a temporary file, make it durable, then rename it over `name` */
+bool_t Journal::write_file(const char *name, const void *buf, size_t size)
+{
+    char        tmp[JOURNAL_NAME_SIZE + 4];
+    const u8_t *p = (const u8_t *)buf;
+    ssize_t     n;
+    int         f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+    f = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (f < 0) {
+        return 1;
+    }
+    while (size > 0) {
+        n = write(f, p, size);
+        if (n < 0) {
+            close(f);
+            return 1;
+        }
+        p += n;
+        size -= n;
+    }
+    if (fsync(f) != 0) {
+        close(f);
+        return 1;
+    }
+    close(f);
+    return rename(tmp, name) != 0;
+}
+/* Makes the renames durable */
+bool_t Journal::sync_dir(void)
+{
+    char  dir[sizeof(path)];
+    char *slash;
+    int   f;
+    int   res;
+
+    strcpy(dir, path);
+    slash = strrchr(dir, '/');
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else if (slash == dir) {
+        slash[1] = '\0';
+    } else {
+        slash[0] = '\0';
+    }
+    f = open(dir, O_RDONLY | O_DIRECTORY);
+    if (f < 0) {
+        return 1;
+    }
+    res = fsync(f);
+    close(f);
+    return res != 0;
+}
@@ -0,0 +1,82 @@
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+#include "cpu.h"
+
+
+#define JOURNAL_MAGIC      0x4E4A3645 /* "E6JN" */
+#define JOURNAL_SNAP_MAGIC 0x4E533645 /* "E6SN" */
+#define JOURNAL_VERSION    1
+#define JOURNAL_BATCH      256  /* Records buffered before a write is forced */
+#define JOURNAL_MARK       0xFF /* Record pin of a progress mark: replay runs up to its tick, no input */
+#define JOURNAL_PATH_SIZE  256
+#define JOURNAL_NAME_SIZE  (JOURNAL_PATH_SIZE + 16) /* Room for the file suffixes */
+
+/*
+ * <path>.snap holds a header and one save-state image per instance, <path>.jnl a header and the input
+ * records appended since that snapshot. Both carry the snapshot generation: a journal whose generation is
+ * not the snapshot's predates it and is ignored. Records check themselves, a torn tail ends the replay.
+ */
+typedef struct
+{
+    u32_t magic;
+    u32_t version;
+    u32_t generation;
+    u32_t count;
+} journal_header_t;
+
+typedef struct
+{
+    u32_t    id;
+    u32_t    tick;
+    u8_t     pin;
+    u8_t     state;
+    uint16_t check;
+} journal_record_t;
+
+
+/*
+ * Write-ahead input journal of a set of instances, for crash recovery without a snapshot per input.
+ * Every input is recorded with the tick_counter it was applied at and buffered; the buffer is written and
+ * fdatasync'ed once it is full, or on journal_poll() once its oldest record is `sync_us` old, so a crash
+ * loses at most that much input. Recovery loads the last snapshot and replays the journal at unlimited
+ * speed, each input landing at the same instruction boundary as the first time.
+ */
+class Journal {
+  private:
+    u32_t                         sync_us;
+    u32_t                         count      = 0;
+    u32_t                         generation = 0;
+    int                           fd         = -1;
+    uint64_t                      pending_us = 0;
+    time_t                        mtime      = 0;
+    std::vector<journal_record_t> pending;
+    char                          path[JOURNAL_PATH_SIZE];
+
+  public:
+    Journal(u32_t _sync_us);
+    ~Journal();
+
+    bool_t journal_open(const char *_path, u32_t _count);
+    void   journal_close(void);
+
+    bool_t journal_recover(CPU *cpu, cpu_state_t *const *states);
+    bool_t journal_snapshot(cpu_state_t *const *states);
+    time_t journal_get_mtime(void);
+
+    bool_t journal_record(u32_t id, u32_t tick, pin_t pin, pin_state_t state);
+    bool_t journal_mark(u32_t id, u32_t tick);
+    bool_t journal_flush(void);
+    bool_t journal_poll(void);
+
+  private:
+    static uint64_t get_time_us(void);
+    static uint16_t check(const journal_record_t *rec);
+
+    bool_t append(u32_t id, u32_t tick, u8_t pin, u8_t state);
+    bool_t write_file(const char *name, const void *buf, size_t size);
+    bool_t sync_dir(void);
+};
+#endif
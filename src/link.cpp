@@ -0,0 +1,144 @@
+#include <thread>
+#include "link.h"
+
+
+SerialLink::SerialLink(Program *program, u32_t _latency)
+{
+    u8_t n;
+
+    latency   = (_latency < 2) ? 2 : _latency;
+    lookahead = latency / 2;
+    for (n = 0; n < 2; n++) {
+        sides[n].cpu = new CPU(nullptr);
+        sides[n].cpu->cpu_init(program, NULL, 1000000);
+        CPU::cpu_init_state(&sides[n].state);
+        sides[n].state.inputs[0].states = 0x7;
+        sides[n].cpu->cpu_bind_state(&sides[n].state);
+        sides[n].inbox.head.store(0);
+        sides[n].inbox.tail.store(0);
+        sides[n].done_pending = 0;
+        sides[n].clock.store(0);
+    }
+}
+SerialLink::~SerialLink()
+{
+    delete sides[0].cpu;
+    delete sides[1].cpu;
+}
+cpu_state_t *SerialLink::link_get_state(u8_t side)
+{
+    return &sides[side].state;
+}
+void SerialLink::link_set_input_pin(u8_t side, pin_t pin, pin_state_t state)
+{
+    /* Only valid between two link_run() calls */
+    sides[side].cpu->cpu_set_input_pin(pin, state);
+}
+void SerialLink::link_run(u32_t ticks)
+{
+    u8_t n;
+
+    for (n = 0; n < 2; n++) {
+        sides[n].clock.store(sides[n].state.tick_counter);
+    }
+    std::thread peer(&SerialLink::side_main, this, 1, sides[1].state.tick_counter + ticks);
+    side_main(0, sides[0].state.tick_counter + ticks);
+    peer.join();
+}
+void SerialLink::queue_push(link_queue_t *queue, u32_t tick, u8_t type, u8_t data)
+{
+    u32_t tail = queue->tail.load(std::memory_order_relaxed);
+
+    while (tail - queue->head.load(std::memory_order_acquire) >= LINK_QUEUE_SIZE) {
+        std::this_thread::yield();
+    }
+    queue->msgs[tail % LINK_QUEUE_SIZE] = {tick, type, data};
+    queue->tail.store(tail + 1, std::memory_order_release);
+}
+void SerialLink::side_complete(u8_t n, u8_t data)
+{
+    link_side_t *side = &sides[n];
+    u8_t         old;
+
+    old = side->state.memory[IO_TO_MEMORY(REG_SERIAL_DATA_L)];
+    SET_IO_MEMORY(side->state.memory, REG_SERIAL_DATA_L, data & 0xF);
+    SET_IO_MEMORY(side->state.memory, REG_SERIAL_DATA_H, data >> 4);
+    SET_PAGE_DIRTY(side->state.dirty, side->state.memory, IO_TO_MEMORY(REG_SERIAL_DATA_L), old);
+    SET_MEM_HASH(side->state.mem_hash, side->state.memory, IO_TO_MEMORY(REG_SERIAL_DATA_L), old);
+    side->state.serial_state = SERIAL_IDLE;
+    side->cpu->generate_interrupt(INT_SERIAL_SLOT, 0);
+}
+void SerialLink::side_deliver(u8_t n)
+{
+    link_side_t  *side = &sides[n];
+    link_side_t  *peer = &sides[n ^ 1];
+    cpu_state_t  *st   = &side->state;
+    link_queue_t *in   = &side->inbox;
+    u32_t         head = in->head.load(std::memory_order_relaxed);
+    link_msg_t    msg;
+    u8_t          mine;
+
+    while (head != in->tail.load(std::memory_order_acquire)) {
+        msg = in->msgs[head % LINK_QUEUE_SIZE];
+        if ((int32_t)(msg.tick - st->tick_counter) > 0) {
+            break;
+        }
+        head++;
+        in->head.store(head, std::memory_order_release);
+        if (msg.type == LINK_MSG_REQUEST) {
+            /*
+             * Answer with the byte held right now, take the peer's byte when the transfer ends.
+             * Both are stamped from our own clock, never from msg.tick: the peer may already have been allowed
+             * up to our published clock plus the lookahead.
+             */
+            mine = GET_IO_MEMORY(st->memory, REG_SERIAL_DATA_L) | (GET_IO_MEMORY(st->memory, REG_SERIAL_DATA_H) << 4);
+            queue_push(&peer->inbox, st->tick_counter + lookahead, LINK_MSG_RESPONSE, mine);
+            side->done_tick    = st->tick_counter + lookahead;
+            side->done_data    = msg.data;
+            side->done_pending = 1;
+        } else {
+            side_complete(n, msg.data);
+        }
+    }
+    if (side->done_pending && (int32_t)(side->done_tick - st->tick_counter) <= 0) {
+        side->done_pending = 0;
+        side_complete(n, side->done_data);
+    }
+}
+void SerialLink::side_main(u8_t n, u32_t end)
+{
+    link_side_t *side = &sides[n];
+    link_side_t *peer = &sides[n ^ 1];
+    cpu_state_t *st   = &side->state;
+    u32_t        bound, published = st->tick_counter;
+    u8_t         mine;
+
+    while ((int32_t)(end - st->tick_counter) > 0) {
+        bound = peer->clock.load(std::memory_order_acquire) + lookahead;
+        if ((int32_t)(bound - st->tick_counter) <= 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        while ((int32_t)(bound - st->tick_counter) > 0 && (int32_t)(end - st->tick_counter) > 0) {
+            side_deliver(n);
+            if (side->cpu->cpu_step()) {
+                /* Dead instance: never hold the peer back again */
+                side->clock.store(st->tick_counter + LINK_STOPPED, std::memory_order_release);
+                return;
+            }
+            if (st->serial_state == SERIAL_REQUESTED) {
+                mine = GET_IO_MEMORY(st->memory, REG_SERIAL_DATA_L) |
+                       (GET_IO_MEMORY(st->memory, REG_SERIAL_DATA_H) << 4);
+                queue_push(&peer->inbox, st->tick_counter + lookahead, LINK_MSG_REQUEST, mine);
+                st->serial_state = SERIAL_IN_FLIGHT;
+            }
+            /* Publishing often keeps the peer from stalling on a stale clock, it is a plain store */
+            if (st->tick_counter - published >= lookahead / 4) {
+                published = st->tick_counter;
+                side->clock.store(published, std::memory_order_release);
+            }
+        }
+        published = st->tick_counter;
+        side->clock.store(published, std::memory_order_release);
+    }
+}
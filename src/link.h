@@ -0,0 +1,79 @@
+#ifndef _LINK_H_
+#define _LINK_H_
+#include <stdint.h>
+#include <atomic>
+#include "cpu.h"
+#include "program.h"
+
+
+#define LINK_DEFAULT_LATENCY 1024
+#define LINK_QUEUE_SIZE      64
+#define LINK_STOPPED         0x40000000
+
+typedef enum
+{
+    LINK_MSG_REQUEST = 0,
+    LINK_MSG_RESPONSE,
+} link_msg_type_t;
+
+typedef struct
+{
+    u32_t tick;
+    u8_t  type;
+    u8_t  data;
+} link_msg_t;
+
+
+/*
+ * Two headless instances wired through their serial interface, each running on its own thread.
+ * Writing the trigger bit of REG_SERIAL_CTRL exchanges the serial data registers of both sides:
+ * the request reaches the peer `latency / 2` ticks after the trigger, the peer answers with its own byte,
+ * and both sides complete (data swapped, serial interrupt raised) `latency / 2` ticks after that, i.e. about
+ * `latency` ticks after the trigger.
+ *
+ * The threads synchronize conservatively: nothing a side sends can take effect earlier than half the
+ * latency after its own clock, so each side publishes its tick_counter and runs freely until it is that
+ * lookahead ahead of its peer. Messages are always queued before the clock that allows the peer to pass
+ * their timestamp is published, so every message is applied at the same instruction boundary on every
+ * run and the linked pair is deterministic.
+ */
+class SerialLink {
+  private:
+    typedef struct
+    {
+        alignas(64) std::atomic<u32_t> head;
+        alignas(64) std::atomic<u32_t> tail;
+        link_msg_t msgs[LINK_QUEUE_SIZE];
+    } link_queue_t;
+
+    typedef struct
+    {
+        CPU                            *cpu;
+        cpu_state_t                     state;
+        link_queue_t                    inbox;
+        u32_t                           done_tick;
+        u8_t                            done_data;
+        bool_t                          done_pending;
+        alignas(64) std::atomic<u32_t> clock;
+    } link_side_t;
+
+  private:
+    link_side_t sides[2];
+    u32_t       latency;
+    u32_t       lookahead;
+
+  public:
+    SerialLink(Program *program, u32_t _latency);
+    ~SerialLink();
+
+    cpu_state_t *link_get_state(u8_t side);
+    void         link_set_input_pin(u8_t side, pin_t pin, pin_state_t state);
+    void         link_run(u32_t ticks);
+
+  private:
+    void side_main(u8_t n, u32_t end);
+    void side_deliver(u8_t n);
+    void side_complete(u8_t n, u8_t data);
+    void queue_push(link_queue_t *queue, u32_t tick, u8_t type, u8_t data);
+};
+#endif
@@ -0,0 +1,978 @@
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "lockstep.h"
+#include "cpu_ops.h"
+
+/* Lane-local versions of the accessors used by the instruction bodies in cpu_def.h */
+#undef M
+#undef SET_M
+#undef RQ
+#undef SET_RQ
+#define M(n)         get_memory(lane, n)
+#define SET_M(n, v)  set_memory(lane, n, v)
+#define RQ(i)        get_rq(lane, i)
+#define SET_RQ(i, v) set_rq(lane, i, v)
+
+#define LANE_BIT(lane) ((lane_mask_t)0x1 << (lane))
+
+
+static u32_t group_scalar(const u13_t *pcs, u13_t pc, u8_t lanes)
+{
+    u32_t mask = 0;
+    u8_t  i;
+    for (i = 0; i < lanes; i++) {
+        mask |= (u32_t)(pcs[i] == pc) << i;
+    }
+    return mask;
+}
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static u32_t group_avx2(const u13_t *pcs, u13_t pc, u8_t lanes)
+{
+    __m256i v  = _mm256_set1_epi16(pc);
+    __m256i lo = _mm256_cmpeq_epi16(_mm256_load_si256((const __m256i *)pcs), v);
+    __m256i hi = _mm256_cmpeq_epi16(_mm256_load_si256((const __m256i *)(pcs + 16)), v);
+    u32_t   mask;
+
+    // packs interleaves the 128-bit halves, the permute puts the lanes back in order
+    mask = _mm256_movemask_epi8(_mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), 0xD8));
+    return (lanes < 32) ? mask & ((0x1u << lanes) - 1) : mask;
+}
+__attribute__((target("avx512bw"))) static u32_t group_avx512(const u13_t *pcs, u13_t pc, u8_t lanes)
+{
+    u32_t mask = _mm512_cmpeq_epi16_mask(_mm512_load_si512((const void *)pcs), _mm512_set1_epi16(pc));
+    return (lanes < 32) ? mask & ((0x1u << lanes) - 1) : mask;
+}
+#endif
+
+
+Lockstep::Lockstep(u8_t _lanes)
+{
+    u8_t i;
+    lanes = (_lanes <= 8) ? 8 : (_lanes <= 16) ? 16 : 32;
+    all   = (lanes == 32) ? ~(lane_mask_t)0 : LANE_BIT(lanes) - 1;
+    group = &group_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx512bw")) {
+        group = &group_avx512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        group = &group_avx2;
+    }
+#endif
+    memset(pc, 0, sizeof(pc));
+    memset(next_pc, 0, sizeof(next_pc));
+    for (i = 0; i < LOCKSTEP_MAX_LANES; i++) {
+        lockstep_reset_lane(i);
+    }
+}
+Lockstep::~Lockstep()
+{
+    if (program) {
+        program->program_release();
+    }
+}
+bool_t Lockstep::lockstep_init(Program *_program)
+{
+    Program *prev = program;
+    program       = _program->program_acquire();
+    decode        = program->program_get_decode();
+    stopped       = 0;
+    if (prev) {
+        prev->program_release();
+    }
+    return 0;
+}
+u8_t Lockstep::lockstep_get_lanes(void)
+{
+    return lanes;
+}
+lane_mask_t Lockstep::lockstep_get_stopped(void)
+{
+    return stopped;
+}
+void Lockstep::lockstep_reset_lane(u8_t lane)
+{
+    cpu_state_t state;
+    CPU::cpu_init_state(&state);
+    lockstep_load_lane(lane, &state);
+}
+void Lockstep::lockstep_load_lane(u8_t lane, const cpu_state_t *state)
+{
+    u32_t n;
+
+    pc[lane]                   = state->pc;
+    x[lane]                    = state->x;
+    y[lane]                    = state->y;
+    a[lane]                    = state->a;
+    b[lane]                    = state->b;
+    np[lane]                   = state->np;
+    sp[lane]                   = state->sp;
+    flags[lane]                = state->flags;
+    tick_counter[lane]         = state->tick_counter;
+    clk_timer_timestamp[lane]  = state->clk_timer_timestamp;
+    prog_timer_timestamp[lane] = state->prog_timer_timestamp;
+    prog_timer_enabled[lane]   = state->prog_timer_enabled;
+    prog_timer_data[lane]      = state->prog_timer_data;
+    prog_timer_rld[lane]       = state->prog_timer_rld;
+    serial_state[lane]         = state->serial_state;
+    call_depth[lane]           = state->call_depth;
+    precycles[lane]            = state->precycles;
+    memcpy(inputs[lane], state->inputs, sizeof(inputs[lane]));
+    memcpy(interrupts[lane], state->interrupts, sizeof(interrupts[lane]));
+    for (n = 0; n < MEM_BUFFER_SIZE; n++) {
+        memory[n][lane] = state->memory[n];
+    }
+    dirty[lane] = state->dirty;
+    irq &= ~LANE_BIT(lane);
+    for (n = 0; n < INT_SLOT_NUM; n++) {
+        if (interrupts[lane][n].triggered) {
+            irq |= LANE_BIT(lane);
+        }
+    }
+    stopped &= ~LANE_BIT(lane);
+}
+void Lockstep::lockstep_store_lane(u8_t lane, cpu_state_t *state)
+{
+    u32_t n;
+
+    state->pc                   = pc[lane];
+    state->x                    = x[lane];
+    state->y                    = y[lane];
+    state->a                    = a[lane];
+    state->b                    = b[lane];
+    state->np                   = np[lane];
+    state->sp                   = sp[lane];
+    state->flags                = flags[lane];
+    state->tick_counter         = tick_counter[lane];
+    state->clk_timer_timestamp  = clk_timer_timestamp[lane];
+    state->prog_timer_timestamp = prog_timer_timestamp[lane];
+    state->prog_timer_enabled   = prog_timer_enabled[lane];
+    state->prog_timer_data      = prog_timer_data[lane];
+    state->prog_timer_rld       = prog_timer_rld[lane];
+    state->serial_state         = serial_state[lane];
+    state->call_depth           = call_depth[lane];
+    state->precycles            = precycles[lane];
+    memcpy(state->inputs, inputs[lane], sizeof(inputs[lane]));
+    memcpy(state->interrupts, interrupts[lane], sizeof(interrupts[lane]));
+    for (n = 0; n < MEM_BUFFER_SIZE; n++) {
+        state->memory[n] = memory[n][lane];
+    }
+    state->dirty    = dirty[lane];
+    /* Rehashed here rather than on every write, which would cost the lane loops their vectorization */
+    state->mem_hash = CPU::cpu_hash_memory(state);
+}
+void Lockstep::generate_interrupt(u8_t lane, int_slot_t slot, u8_t bit)
+{
+    interrupt_t *interrupts = this->interrupts[lane];
+
+    interrupts[slot].factor_flag_reg = interrupts[slot].factor_flag_reg | (0x1 << bit);
+    if (interrupts[slot].mask_reg & (0x1 << bit)) {
+        interrupts[slot].triggered = 1;
+        irq |= LANE_BIT(lane);
+    }
+}
+void Lockstep::lockstep_set_input_pin(u8_t lane, pin_t pin, pin_state_t state)
+{
+    input_port_t *port = &inputs[lane][(pin & 0x4) >> 2];
+
+    port->states = (port->states & ~(0x1 << (pin & 0x3))) | (state << (pin & 0x3));
+    if (state == PIN_STATE_LOW) {
+        switch ((pin & 0x4) >> 2) {
+            case 0:
+                generate_interrupt(lane, INT_K00_K03_SLOT, pin & 0x3);
+                break;
+            case 1:
+                generate_interrupt(lane, INT_K10_K13_SLOT, pin & 0x3);
+                break;
+        }
+    }
+}
+u4_t Lockstep::get_io(u8_t lane, u12_t n)
+{
+    interrupt_t   *interrupts         = this->interrupts[lane];
+    input_port_t  *inputs             = this->inputs[lane];
+    lane_memory_t  memory             = {this->memory, lane};
+    bool_t        &prog_timer_enabled = this->prog_timer_enabled[lane];
+    u8_t          &prog_timer_data    = this->prog_timer_data[lane];
+    u8_t          &prog_timer_rld     = this->prog_timer_rld[lane];
+    u8_t          &serial_state       = this->serial_state[lane];
+    u4_t           tmp;
+    switch (n) {
+        case REG_CLK_INT_FACTOR_FLAGS:
+            tmp                                              = interrupts[INT_CLOCK_TIMER_SLOT].factor_flag_reg;
+            interrupts[INT_CLOCK_TIMER_SLOT].factor_flag_reg = 0;
+            return tmp;
+        case REG_SW_INT_FACTOR_FLAGS:
+            tmp                                            = interrupts[INT_STOPWATCH_SLOT].factor_flag_reg;
+            interrupts[INT_STOPWATCH_SLOT].factor_flag_reg = 0;
+            return tmp;
+        case REG_PROG_INT_FACTOR_FLAGS:
+            tmp                                             = interrupts[INT_PROG_TIMER_SLOT].factor_flag_reg;
+            interrupts[INT_PROG_TIMER_SLOT].factor_flag_reg = 0;
+            return tmp;
+        case REG_SERIAL_INT_FACTOR_FLAGS:
+            tmp                                         = interrupts[INT_SERIAL_SLOT].factor_flag_reg;
+            interrupts[INT_SERIAL_SLOT].factor_flag_reg = 0;
+            return tmp;
+        case REG_K00_K03_INT_FACTOR_FLAGS:
+            tmp                                          = interrupts[INT_K00_K03_SLOT].factor_flag_reg;
+            interrupts[INT_K00_K03_SLOT].factor_flag_reg = 0;
+            return tmp;
+        case REG_K10_K13_INT_FACTOR_FLAGS:
+            tmp                                          = interrupts[INT_K10_K13_SLOT].factor_flag_reg;
+            interrupts[INT_K10_K13_SLOT].factor_flag_reg = 0;
+            return tmp;
+        case REG_CLOCK_INT_MASKS:
+            return interrupts[INT_CLOCK_TIMER_SLOT].mask_reg;
+        case REG_SW_INT_MASKS:
+            return interrupts[INT_STOPWATCH_SLOT].mask_reg & 0x3;
+        case REG_PROG_INT_MASKS:
+            return interrupts[INT_PROG_TIMER_SLOT].mask_reg & 0x1;
+        case REG_SERIAL_INT_MASKS:
+            return interrupts[INT_SERIAL_SLOT].mask_reg & 0x1;
+        case REG_K00_K03_INT_MASKS:
+            return interrupts[INT_K00_K03_SLOT].mask_reg;
+        case REG_K10_K13_INT_MASKS:
+            return interrupts[INT_K10_K13_SLOT].mask_reg;
+        case REG_PROG_TIMER_DATA_L:
+            return prog_timer_data & 0xF;
+        case REG_PROG_TIMER_DATA_H:
+            return (prog_timer_data >> 4) & 0xF;
+        case REG_PROG_TIMER_RELOAD_DATA_L:
+            return prog_timer_rld & 0xF;
+        case REG_PROG_TIMER_RELOAD_DATA_H:
+            return (prog_timer_rld >> 4) & 0xF;
+        case REG_K00_K03_INPUT_PORT:
+            return inputs[0].states;
+        case REG_K10_K13_INPUT_PORT:
+            return inputs[1].states;
+        case REG_SERIAL_DATA_L:
+        case REG_SERIAL_DATA_H:
+            return GET_IO_MEMORY(memory, n);
+        case REG_K40_K43_BZ_OUTPUT_PORT:
+            return GET_IO_MEMORY(memory, n);
+        case REG_CPU_OSC3_CTRL:
+            return GET_IO_MEMORY(memory, n);
+        case REG_LCD_CTRL:
+            return GET_IO_MEMORY(memory, n);
+        case REG_LCD_CONTRAST:
+            break;
+        case REG_SVD_CTRL:
+            return GET_IO_MEMORY(memory, n) & 0x7;
+        case REG_BUZZER_CTRL1:
+            return GET_IO_MEMORY(memory, n);
+        case REG_BUZZER_CTRL2:
+            return GET_IO_MEMORY(memory, n) & 0x3;
+        case REG_CLK_WD_TIMER_CTRL:
+            break;
+        case REG_SW_TIMER_CTRL:
+            break;
+        case REG_PROG_TIMER_CTRL:
+            return !!prog_timer_enabled;
+        case REG_PROG_TIMER_CLK_SEL:
+            break;
+        case REG_SERIAL_CTRL:
+            return (GET_IO_MEMORY(memory, n) & ~SERIAL_CTRL_TRIGGER) |
+                   ((serial_state != SERIAL_IDLE) ? SERIAL_CTRL_TRIGGER : 0);
+        default:;
+    }
+    return 0;
+}
+void Lockstep::set_io(u8_t lane, u12_t n, u4_t v)
+{
+    interrupt_t *interrupts           = this->interrupts[lane];
+    u32_t       &tick_counter         = this->tick_counter[lane];
+    u32_t       &prog_timer_timestamp = this->prog_timer_timestamp[lane];
+    bool_t      &prog_timer_enabled   = this->prog_timer_enabled[lane];
+    u8_t        &prog_timer_data      = this->prog_timer_data[lane];
+    u8_t        &prog_timer_rld       = this->prog_timer_rld[lane];
+    u8_t        &serial_state         = this->serial_state[lane];
+    switch (n) {
+        case REG_CLOCK_INT_MASKS:
+            interrupts[INT_CLOCK_TIMER_SLOT].mask_reg = v;
+            break;
+        case REG_SW_INT_MASKS:
+            interrupts[INT_STOPWATCH_SLOT].mask_reg = v;
+            break;
+        case REG_PROG_INT_MASKS:
+            interrupts[INT_PROG_TIMER_SLOT].mask_reg = v;
+            break;
+        case REG_SERIAL_INT_MASKS:
+            interrupts[INT_K10_K13_SLOT].mask_reg = v;
+            break;
+        case REG_K00_K03_INT_MASKS:
+            interrupts[INT_SERIAL_SLOT].mask_reg = v;
+            break;
+        case REG_K10_K13_INT_MASKS:
+            interrupts[INT_K10_K13_SLOT].mask_reg = v;
+            break;
+        case REG_PROG_TIMER_RELOAD_DATA_L:
+            prog_timer_rld = v | (prog_timer_rld & 0xF0);
+            break;
+        case REG_PROG_TIMER_RELOAD_DATA_H:
+            prog_timer_rld = (prog_timer_rld & 0xF) | (v << 4);
+            break;
+        case REG_K00_K03_INPUT_PORT:
+            break;
+        case REG_K40_K43_BZ_OUTPUT_PORT:
+            break;
+        case REG_CPU_OSC3_CTRL:
+            break;
+        case REG_LCD_CTRL:
+            break;
+        case REG_LCD_CONTRAST:
+            break;
+        case REG_SVD_CTRL:
+            break;
+        case REG_BUZZER_CTRL1:
+            break;
+        case REG_BUZZER_CTRL2:
+            break;
+        case REG_CLK_WD_TIMER_CTRL:
+            break;
+        case REG_SW_TIMER_CTRL:
+            break;
+        case REG_PROG_TIMER_CTRL:
+            if (v & 0x2) {
+                prog_timer_data = prog_timer_rld;
+            }
+            if ((v & 0x1) && !prog_timer_enabled) {
+                prog_timer_timestamp = tick_counter;
+            }
+            prog_timer_enabled = v & 0x1;
+            break;
+        case REG_PROG_TIMER_CLK_SEL:
+            break;
+        case REG_SERIAL_CTRL:
+            /* Requested only, as on CPU; lanes are not linked, so a request stays pending */
+            if ((v & SERIAL_CTRL_TRIGGER) && serial_state == SERIAL_IDLE) {
+                serial_state = SERIAL_REQUESTED;
+            }
+            break;
+        default:;
+    }
+}
+u4_t Lockstep::get_memory(u8_t lane, u12_t n)
+{
+    lane_memory_t memory = {this->memory, lane};
+    u4_t          res    = 0;
+    if (n < MEM_RAM_SIZE) {
+
+        res = GET_RAM_MEMORY(memory, n);
+    } else if (n >= MEM_DISPLAY1_ADDR && n < (MEM_DISPLAY1_ADDR + MEM_DISPLAY1_SIZE)) {
+
+        res = GET_DISP1_MEMORY(memory, n);
+    } else if (n >= MEM_DISPLAY2_ADDR && n < (MEM_DISPLAY2_ADDR + MEM_DISPLAY2_SIZE)) {
+
+        res = GET_DISP2_MEMORY(memory, n);
+    } else if (n >= MEM_IO_ADDR && n < (MEM_IO_ADDR + MEM_IO_SIZE)) {
+
+        res = get_io(lane, n);
+    } else {
+
+        return 0;
+    }
+
+    return res;
+}
+void Lockstep::set_memory(u8_t lane, u12_t n, u4_t v)
+{
+    lane_memory_t memory = {this->memory, lane};
+    u8_t          old;
+
+    if (n < MEM_RAM_SIZE) {
+        old = memory[RAM_TO_MEMORY(n)];
+        SET_RAM_MEMORY(memory, n, v);
+        SET_PAGE_DIRTY(dirty[lane], memory, RAM_TO_MEMORY(n), old);
+
+    } else if (n >= MEM_DISPLAY1_ADDR && n < (MEM_DISPLAY1_ADDR + MEM_DISPLAY1_SIZE)) {
+        old = memory[DISP1_TO_MEMORY(n)];
+        SET_DISP1_MEMORY(memory, n, v);
+        SET_PAGE_DIRTY(dirty[lane], memory, DISP1_TO_MEMORY(n), old);
+
+    } else if (n >= MEM_DISPLAY2_ADDR && n < (MEM_DISPLAY2_ADDR + MEM_DISPLAY2_SIZE)) {
+        old = memory[DISP2_TO_MEMORY(n)];
+        SET_DISP2_MEMORY(memory, n, v);
+        SET_PAGE_DIRTY(dirty[lane], memory, DISP2_TO_MEMORY(n), old);
+
+    } else if (n >= MEM_IO_ADDR && n < (MEM_IO_ADDR + MEM_IO_SIZE)) {
+        old = memory[IO_TO_MEMORY(n)];
+        SET_IO_MEMORY(memory, n, v);
+        SET_PAGE_DIRTY(dirty[lane], memory, IO_TO_MEMORY(n), old);
+        set_io(lane, n, v);
+
+    } else {
+
+        return;
+    }
+}
+u4_t Lockstep::get_rq(u8_t lane, u12_t rq)
+{
+    u12_t &x = this->x[lane];
+    u12_t &y = this->y[lane];
+    switch (rq & 0x3) {
+        case 0x0:
+            return a[lane];
+        case 0x1:
+            return b[lane];
+        case 0x2:
+            return M(x);
+        case 0x3:
+            return M(y);
+    }
+    return 0;
+}
+void Lockstep::set_rq(u8_t lane, u12_t rq, u4_t v)
+{
+    u12_t &x = this->x[lane];
+    u12_t &y = this->y[lane];
+    switch (rq & 0x3) {
+        case 0x0:
+            a[lane] = v;
+            break;
+        case 0x1:
+            b[lane] = v;
+            break;
+        case 0x2:
+            SET_M(x, v);
+            break;
+        case 0x3:
+            SET_M(y, v);
+            break;
+    }
+}
+/*
+ * One lane seen as a CPU by the instruction bodies of cpu_ops.h: `st` addresses the lane's registers and
+ * the accessors forward to the lane-local ones, so that the per-lane path runs the very code CPU does.
+ */
+class Lockstep::Lane {
+  private:
+    Lockstep    *ls;
+    u8_t         lane;
+    lane_regs_t  regs;
+    lane_regs_t *st;
+    u13_t       &next_pc;
+    Hal         *hal = nullptr;
+
+    u4_t get_memory(u8_t _lane, u12_t n)
+    {
+        return ls->get_memory(_lane, n);
+    }
+    void set_memory(u8_t _lane, u12_t n, u4_t v)
+    {
+        ls->set_memory(_lane, n, v);
+    }
+    u4_t get_rq(u8_t _lane, u12_t rq)
+    {
+        return ls->get_rq(_lane, rq);
+    }
+    void set_rq(u8_t _lane, u12_t rq, u4_t v)
+    {
+        ls->set_rq(_lane, rq, v);
+    }
+
+#define CPU_OP(name) void op_##name##_cb(u8_t arg0, u8_t arg1)
+#include "cpu_ops.h"
+#undef CPU_OP
+
+  public:
+    Lane(Lockstep *_ls, u8_t _lane)
+        : ls(_ls), lane(_lane),
+          regs{_ls->pc[_lane], _ls->x[_lane],  _ls->y[_lane],     _ls->a[_lane],         _ls->b[_lane],
+               _ls->np[_lane], _ls->sp[_lane], _ls->flags[_lane], _ls->call_depth[_lane]},
+          st(&regs), next_pc(_ls->next_pc[_lane])
+    {
+    }
+
+    void lane_exec(const decoded_op_t *dec)
+    {
+#define LANE_OP(id, name)                                                                                              \
+    case id:                                                                                                           \
+        op_##name##_cb(dec->arg0, dec->arg1);                                                                          \
+        break;
+        switch (dec->id) {
+            CPU_OP_LIST(LANE_OP)
+        }
+#undef LANE_OP
+    }
+};
+
+void Lockstep::exec_lane(u8_t lane, const decoded_op_t *dec)
+{
+    Lane core(this, lane);
+    core.lane_exec(dec);
+}
+void Lockstep::process_interrupts(u8_t lane)
+{
+    lane_regs_t regs = {this->pc[lane], this->x[lane],  this->y[lane],     this->a[lane],
+                        this->b[lane],  this->np[lane], this->sp[lane],    this->flags[lane],
+                        this->call_depth[lane]};
+    lane_regs_t *st         = &regs;
+    interrupt_t *interrupts = this->interrupts[lane];
+    u8_t         i;
+    for (i = 0; i < INT_SLOT_NUM; i++) {
+        if (interrupts[i].triggered) {
+
+            SET_M(st->sp - 1, PCP);
+            SET_M(st->sp - 2, PCSH);
+            SET_M(st->sp - 3, PCSL);
+            st->sp = (st->sp - 3) & 0xFF;
+            CLEAR_I();
+            st->np = TO_NP(NBP, 1);
+            st->pc = TO_PC(PCB, 1, interrupts[i].vector);
+            st->call_depth++;
+            tick_counter[lane] += 12;
+            interrupts[i].triggered = 0;
+        }
+    }
+    irq &= ~LANE_BIT(lane);
+}
+
+//
+
+bool_t Lockstep::exec_vector(const decoded_op_t *dec)
+{
+    alignas(64) u4_t imm[LOCKSTEP_MAX_LANES];
+    u8_t             arg0                    = dec->arg0;
+    u8_t             arg1                    = dec->arg1;
+    u4_t            *r                       = (arg0 & 0x3) == 0x0 ? a : (arg0 & 0x3) == 0x1 ? b : 0;
+    u4_t            *q                       = (arg1 & 0x3) == 0x0 ? a : (arg1 & 0x3) == 0x1 ? b : 0;
+    u8_t             i, tmp, res, cy, f, set = 0, keep = 0xFF, test = 0;
+    u8_t             carry                   = 0, sub = 0;
+    u8_t            *row;
+    u8_t             shift, old;
+
+    switch (dec->id) {
+        case OP_PSET:
+            for (i = 0; i < lanes; i++) {
+                np[i] = sel[i] ? arg0 : np[i];
+            }
+            return 1;
+        case OP_JP:
+        case OP_JP_NC:
+        case OP_JP_NZ:
+            test = (dec->id == OP_JP_NC) ? FLAG_C : (dec->id == OP_JP_NZ) ? FLAG_Z : 0;
+            for (i = 0; i < lanes; i++) {
+                next_pc[i] = (sel[i] && !(flags[i] & test)) ? (arg0 | (np[i] << 8)) : next_pc[i];
+            }
+            return 1;
+        case OP_JP_C:
+        case OP_JP_Z:
+            test = (dec->id == OP_JP_C) ? FLAG_C : FLAG_Z;
+            for (i = 0; i < lanes; i++) {
+                next_pc[i] = (sel[i] && (flags[i] & test)) ? (arg0 | (np[i] << 8)) : next_pc[i];
+            }
+            return 1;
+        case OP_JPBA:
+            for (i = 0; i < lanes; i++) {
+                next_pc[i] = sel[i] ? (a[i] | (b[i] << 4) | (np[i] << 8)) : next_pc[i];
+            }
+            return 1;
+        case OP_NOP5:
+        case OP_NOP7:
+        case OP_HALT:
+            return 1;
+        case OP_INC_X:
+            for (i = 0; i < lanes; i++) {
+                x[i] = sel[i] ? (((x[i] + 1) & 0xFF) | (x[i] & 0xF00)) : x[i];
+            }
+            return 1;
+        case OP_INC_Y:
+            for (i = 0; i < lanes; i++) {
+                y[i] = sel[i] ? (((y[i] + 1) & 0xFF) | (y[i] & 0xF00)) : y[i];
+            }
+            return 1;
+        case OP_LD_X:
+            for (i = 0; i < lanes; i++) {
+                x[i] = sel[i] ? (arg0 | (x[i] & 0xF00)) : x[i];
+            }
+            return 1;
+        case OP_LD_Y:
+            for (i = 0; i < lanes; i++) {
+                y[i] = sel[i] ? (arg0 | (y[i] & 0xF00)) : y[i];
+            }
+            return 1;
+        case OP_SET:
+            set = arg0;
+            break;
+        case OP_RST:
+            keep = arg0;
+            break;
+        case OP_SCF:
+            set = FLAG_C;
+            break;
+        case OP_RCF:
+            keep = ~FLAG_C;
+            break;
+        case OP_SZF:
+            set = FLAG_Z;
+            break;
+        case OP_RZF:
+            keep = ~FLAG_Z;
+            break;
+        case OP_SDF:
+            set = FLAG_D;
+            break;
+        case OP_RDF:
+            keep = ~FLAG_D;
+            break;
+        case OP_EI:
+            set = FLAG_I;
+            break;
+        case OP_DI:
+            keep = ~FLAG_I;
+            break;
+        case OP_INC_SP:
+            for (i = 0; i < lanes; i++) {
+                sp[i] = sel[i] ? ((sp[i] + 1) & 0xFF) : sp[i];
+            }
+            return 1;
+        case OP_DEC_SP:
+            for (i = 0; i < lanes; i++) {
+                sp[i] = sel[i] ? ((sp[i] - 1) & 0xFF) : sp[i];
+            }
+            return 1;
+        case OP_LD_A_MN:
+        case OP_LD_B_MN:
+            // M(n) with a 4-bit immediate always lands in RAM, at the same address for every lane
+            r     = (dec->id == OP_LD_A_MN) ? a : b;
+            row   = memory[RAM_TO_MEMORY(arg0)];
+            shift = (arg0 % 2) << 2;
+            for (i = 0; i < lanes; i++) {
+                r[i] = sel[i] ? ((row[i] >> shift) & 0xF) : r[i];
+            }
+            return 1;
+        case OP_LD_MN_A:
+        case OP_LD_MN_B:
+            r     = (dec->id == OP_LD_MN_A) ? a : b;
+            row   = memory[RAM_TO_MEMORY(arg0)];
+            shift = (arg0 % 2) << 2;
+            for (i = 0; i < lanes; i++) {
+                old    = row[i];
+                row[i] = sel[i] ? ((row[i] & ~(0xF << shift)) | ((r[i] & 0xF) << shift)) : row[i];
+                dirty[i] |= (row[i] != old) << (RAM_TO_MEMORY(arg0) >> MEM_PAGE_SHIFT);
+            }
+            return 1;
+        case OP_INC_MN:
+        case OP_DEC_MN:
+            row   = memory[RAM_TO_MEMORY(arg0)];
+            shift = (arg0 % 2) << 2;
+            sub   = (dec->id == OP_DEC_MN);
+            for (i = 0; i < lanes; i++) {
+                tmp      = (u8_t)(((row[i] >> shift) & 0xF) + (sub ? -1 : 1));
+                res      = tmp & 0xF;
+                f        = (flags[i] & ~(FLAG_C | FLAG_Z)) | ((tmp >> 4) ? FLAG_C : 0) | (res ? 0 : FLAG_Z);
+                old      = row[i];
+                row[i]   = sel[i] ? ((row[i] & ~(0xF << shift)) | (res << shift)) : row[i];
+                flags[i] = sel[i] ? f : flags[i];
+                dirty[i] |= (row[i] != old) << (RAM_TO_MEMORY(arg0) >> MEM_PAGE_SHIFT);
+            }
+            return 1;
+        case OP_LD_R_I:
+            if (!r) {
+                return 0;
+            }
+            for (i = 0; i < lanes; i++) {
+                r[i] = sel[i] ? arg1 : r[i];
+            }
+            return 1;
+        case OP_LD_R_Q:
+            if (!r || !q) {
+                return 0;
+            }
+            for (i = 0; i < lanes; i++) {
+                r[i] = sel[i] ? q[i] : r[i];
+            }
+            return 1;
+        case OP_ADC_R_I:
+        case OP_SBC_R_I:
+            carry = 1;
+            // fallthrough
+        case OP_ADD_R_I:
+        case OP_AND_R_I:
+        case OP_OR_R_I:
+        case OP_XOR_R_I:
+        case OP_CP_R_I:
+        case OP_FAN_R_I:
+            memset(imm, arg1, sizeof(imm));
+            q = imm;
+            break;
+        case OP_ADC_R_Q:
+        case OP_SBC_R_Q:
+            carry = 1;
+            // fallthrough
+        case OP_ADD_R_Q:
+        case OP_SUB:
+        case OP_AND_R_Q:
+        case OP_OR_R_Q:
+        case OP_XOR_R_Q:
+        case OP_CP_R_Q:
+        case OP_FAN_R_Q:
+        case OP_RLC:
+        case OP_RRC:
+        case OP_NOT:
+            break;
+        default:
+            return 0;
+    }
+
+    if (set || keep != 0xFF) {
+        for (i = 0; i < lanes; i++) {
+            flags[i] = sel[i] ? ((flags[i] & keep) | set) : flags[i];
+        }
+        return 1;
+    }
+    if (!r || !q) {
+        return 0;
+    }
+
+    switch (dec->id) {
+        case OP_ADD_R_I:
+        case OP_ADD_R_Q:
+        case OP_ADC_R_I:
+        case OP_ADC_R_Q:
+            for (i = 0; i < lanes; i++) {
+                tmp = r[i] + q[i] + (carry & flags[i] & FLAG_C);
+                if (flags[i] & FLAG_D) {
+                    res = (tmp >= 10) ? ((tmp - 10) & 0xF) : tmp;
+                    cy  = (tmp >= 10);
+                } else {
+                    res = tmp & 0xF;
+                    cy  = (tmp >> 4) != 0;
+                }
+                f        = (flags[i] & ~(FLAG_C | FLAG_Z)) | (cy ? FLAG_C : 0) | (res ? 0 : FLAG_Z);
+                r[i]     = sel[i] ? res : r[i];
+                flags[i] = sel[i] ? f : flags[i];
+            }
+            return 1;
+        case OP_SUB:
+        case OP_SBC_R_I:
+        case OP_SBC_R_Q:
+            for (i = 0; i < lanes; i++) {
+                tmp = r[i] - q[i] - (carry & flags[i] & FLAG_C);
+                if (flags[i] & FLAG_D) {
+                    res = (tmp >> 4) ? ((tmp - 6) & 0xF) : tmp;
+                } else {
+                    res = tmp & 0xF;
+                }
+                f        = (flags[i] & ~(FLAG_C | FLAG_Z)) | ((tmp >> 4) ? FLAG_C : 0) | (res ? 0 : FLAG_Z);
+                r[i]     = sel[i] ? res : r[i];
+                flags[i] = sel[i] ? f : flags[i];
+            }
+            return 1;
+        case OP_AND_R_I:
+        case OP_AND_R_Q:
+        case OP_OR_R_I:
+        case OP_OR_R_Q:
+        case OP_XOR_R_I:
+        case OP_XOR_R_Q:
+            for (i = 0; i < lanes; i++) {
+                switch (dec->id) {
+                    case OP_AND_R_I:
+                    case OP_AND_R_Q:
+                        res = r[i] & q[i];
+                        break;
+                    case OP_OR_R_I:
+                    case OP_OR_R_Q:
+                        res = r[i] | q[i];
+                        break;
+                    default:
+                        res = r[i] ^ q[i];
+                        break;
+                }
+                f        = (flags[i] & ~FLAG_Z) | (res ? 0 : FLAG_Z);
+                r[i]     = sel[i] ? res : r[i];
+                flags[i] = sel[i] ? f : flags[i];
+            }
+            return 1;
+        case OP_CP_R_I:
+        case OP_CP_R_Q:
+            for (i = 0; i < lanes; i++) {
+                f        = (flags[i] & ~(FLAG_C | FLAG_Z)) | ((r[i] < q[i]) ? FLAG_C : 0) | ((r[i] == q[i]) ? FLAG_Z : 0);
+                flags[i] = sel[i] ? f : flags[i];
+            }
+            return 1;
+        case OP_FAN_R_I:
+        case OP_FAN_R_Q:
+            for (i = 0; i < lanes; i++) {
+                f        = (flags[i] & ~FLAG_Z) | ((r[i] & q[i]) ? 0 : FLAG_Z);
+                flags[i] = sel[i] ? f : flags[i];
+            }
+            return 1;
+        case OP_RLC:
+            for (i = 0; i < lanes; i++) {
+                res      = ((r[i] << 1) | (flags[i] & FLAG_C)) & 0xF;
+                f        = (flags[i] & ~FLAG_C) | ((r[i] & 0x8) ? FLAG_C : 0);
+                r[i]     = sel[i] ? res : r[i];
+                flags[i] = sel[i] ? f : flags[i];
+            }
+            return 1;
+        case OP_RRC:
+            for (i = 0; i < lanes; i++) {
+                res      = ((r[i] >> 1) | ((flags[i] & FLAG_C) << 3)) & 0xF;
+                f        = (flags[i] & ~FLAG_C) | ((r[i] & 0x1) ? FLAG_C : 0);
+                r[i]     = sel[i] ? res : r[i];
+                flags[i] = sel[i] ? f : flags[i];
+            }
+            return 1;
+        case OP_NOT:
+            for (i = 0; i < lanes; i++) {
+                res      = ~r[i] & 0xF;
+                f        = (flags[i] & ~FLAG_Z) | (res ? 0 : FLAG_Z);
+                r[i]     = sel[i] ? res : r[i];
+                flags[i] = sel[i] ? f : flags[i];
+            }
+            return 1;
+    }
+    return 0;
+}
+void Lockstep::finish_group(const decoded_op_t *dec, lane_mask_t mask)
+{
+    lane_mask_t pending = 0;
+    u8_t        i, lane;
+
+    for (i = 0; i < lanes; i++) {
+        pc[i]        = sel[i] ? next_pc[i] : pc[i];
+        precycles[i] = sel[i] ? dec->cycles : precycles[i];
+        if (dec->id > 0) {
+            np[i] = sel[i] ? ((pc[i] >> 8) & 0x1F) : np[i];
+        }
+    }
+
+    // Timers and interrupts rarely fire, only the lanes flagged here take the scalar path
+    for (i = 0; i < lanes; i++) {
+        pending |= (lane_mask_t)((tick_counter[i] - clk_timer_timestamp[i] >= TIMER_1HZ_PERIOD) ||
+                                 (prog_timer_enabled[i] &&
+                                  tick_counter[i] - prog_timer_timestamp[i] >= TIMER_256HZ_PERIOD))
+                   << i;
+    }
+    if (dec->id > 0) {
+        pending |= irq;
+    }
+    pending &= mask;
+
+    while (pending) {
+        lane = __builtin_ctz(pending);
+        pending &= pending - 1;
+
+        finish_lane(lane, dec);
+    }
+}
+void Lockstep::finish_lane(u8_t lane, const decoded_op_t *dec)
+{
+    if (tick_counter[lane] - clk_timer_timestamp[lane] >= TIMER_1HZ_PERIOD) {
+        do {
+            clk_timer_timestamp[lane] += TIMER_1HZ_PERIOD;
+        } while (tick_counter[lane] - clk_timer_timestamp[lane] >= TIMER_1HZ_PERIOD);
+        generate_interrupt(lane, INT_CLOCK_TIMER_SLOT, 3);
+    }
+
+    if (prog_timer_enabled[lane] && tick_counter[lane] - prog_timer_timestamp[lane] >= TIMER_256HZ_PERIOD) {
+        do {
+            prog_timer_timestamp[lane] += TIMER_256HZ_PERIOD;
+            prog_timer_data[lane]--;
+            if (prog_timer_data[lane] == 0) {
+                prog_timer_data[lane] = prog_timer_rld[lane];
+                generate_interrupt(lane, INT_PROG_TIMER_SLOT, 0);
+            }
+        } while (tick_counter[lane] - prog_timer_timestamp[lane] >= TIMER_256HZ_PERIOD);
+    }
+
+    if ((flags[lane] & FLAG_I) && dec->id > 0 && (irq & LANE_BIT(lane))) {
+        process_interrupts(lane);
+    }
+}
+void Lockstep::step_lane(u8_t lane, const decoded_op_t *dec)
+{
+    next_pc[lane] = (pc[lane] + 1) & 0x1FFF;
+    tick_counter[lane] += precycles[lane];
+
+    exec_lane(lane, dec);
+
+    pc[lane]        = next_pc[lane];
+    precycles[lane] = dec->cycles;
+    if (dec->id > 0) {
+        np[lane] = (pc[lane] >> 8) & 0x1F;
+    }
+    finish_lane(lane, dec);
+}
+void Lockstep::exec_group(u13_t at, lane_mask_t mask)
+{
+    const decoded_op_t *dec = &decode[at];
+    lane_mask_t         todo;
+    u8_t                i;
+
+    if (dec->id == OP_NUM) {
+        stopped |= mask;
+        return;
+    }
+
+    // Below a few lanes the column sweeps cost more than they save
+    if (__builtin_popcount(mask) < LOCKSTEP_MIN_GROUP) {
+        for (todo = mask; todo; todo &= todo - 1) {
+            step_lane(__builtin_ctz(todo), dec);
+        }
+        return;
+    }
+
+    for (i = 0; i < lanes; i++) {
+        sel[i] = ((mask >> i) & 0x1) ? 0xFF : 0x00;
+    }
+    for (i = 0; i < lanes; i++) {
+        next_pc[i]      = sel[i] ? ((pc[i] + 1) & 0x1FFF) : next_pc[i];
+        tick_counter[i] = sel[i] ? (tick_counter[i] + precycles[i]) : tick_counter[i];
+    }
+
+    if (!exec_vector(dec)) {
+        for (todo = mask; todo; todo &= todo - 1) {
+            exec_lane(__builtin_ctz(todo), dec);
+        }
+    }
+
+    finish_group(dec, mask);
+}
+u32_t Lockstep::step_lanes(lane_mask_t todo)
+{
+    u32_t       steps = 0;
+    lane_mask_t mask;
+    u13_t       at;
+
+    if (!decode) {
+        return 0;
+    }
+    todo &= all & ~stopped;
+    while (todo) {
+        at   = pc[__builtin_ctz(todo)];
+        mask = group(pc, at, lanes) & todo;
+        exec_group(at, mask);
+        steps += __builtin_popcount(mask & ~stopped);
+        todo &= ~mask;
+    }
+    return steps;
+}
+u32_t Lockstep::lockstep_step(void)
+{
+    return step_lanes(all);
+}
+u32_t Lockstep::lockstep_run(u32_t ticks)
+{
+    u32_t       start[LOCKSTEP_MAX_LANES];
+    u32_t       steps = 0;
+    lane_mask_t todo;
+    u8_t        i;
+
+    memcpy(start, tick_counter, sizeof(start));
+    for (;;) {
+        todo = 0;
+        for (i = 0; i < lanes; i++) {
+            todo |= (lane_mask_t)(tick_counter[i] - start[i] < ticks) << i;
+        }
+        todo &= ~stopped;
+        if (!todo) {
+            break;
+        }
+        steps += step_lanes(todo);
+    }
+    return steps;
+}
@@ -0,0 +1,121 @@
+#ifndef _LOCKSTEP_H_
+#define _LOCKSTEP_H_
+#include <stdint.h>
+#include "cpu.h"
+#include "program.h"
+
+
+#define LOCKSTEP_MAX_LANES 32
+#define LOCKSTEP_MIN_GROUP 4
+
+typedef uint32_t lane_mask_t;
+
+
+/*
+ * Runs up to 32 headless instances of the same ROM side by side.
+ * Registers, timers and RAM are held in structure-of-arrays layout (one column per lane), the lanes
+ * sharing a PC are grouped with a SIMD compare and execute one decoded instruction together.
+ * Per-lane results are identical to CPU::cpu_step on a CPU without a Hal attached.
+ */
+class Lockstep {
+  private:
+    typedef u32_t (*group_fn_t)(const u13_t *pcs, u13_t pc, u8_t lanes);
+
+    class Lane;
+
+    struct lane_memory_t
+    {
+        u8_t (*buffer)[LOCKSTEP_MAX_LANES];
+        u8_t lane;
+
+        u8_t &operator[](u32_t n) const
+        {
+            return buffer[n][lane];
+        }
+    };
+
+    /* One lane's registers viewed the way cpu_def.h addresses a cpu_state_t */
+    struct lane_regs_t
+    {
+        u13_t &pc;
+        u12_t &x;
+        u12_t &y;
+        u4_t  &a;
+        u4_t  &b;
+        u5_t  &np;
+        u8_t  &sp;
+        u4_t  &flags;
+        u32_t &call_depth;
+    };
+
+  private:
+    u8_t                lanes   = 0;
+    lane_mask_t         all     = 0;
+    group_fn_t          group   = 0;
+    Program            *program = 0;
+    const decoded_op_t *decode  = 0;
+
+    alignas(64) u13_t pc[LOCKSTEP_MAX_LANES];
+    alignas(64) u13_t next_pc[LOCKSTEP_MAX_LANES];
+    alignas(64) u12_t x[LOCKSTEP_MAX_LANES];
+    alignas(64) u12_t y[LOCKSTEP_MAX_LANES];
+    alignas(64) u4_t a[LOCKSTEP_MAX_LANES];
+    alignas(64) u4_t b[LOCKSTEP_MAX_LANES];
+    alignas(64) u5_t np[LOCKSTEP_MAX_LANES];
+    alignas(64) u8_t sp[LOCKSTEP_MAX_LANES];
+    alignas(64) u4_t flags[LOCKSTEP_MAX_LANES];
+    alignas(64) u8_t precycles[LOCKSTEP_MAX_LANES];
+    alignas(64) u32_t tick_counter[LOCKSTEP_MAX_LANES];
+    alignas(64) u32_t call_depth[LOCKSTEP_MAX_LANES];
+    alignas(64) u32_t clk_timer_timestamp[LOCKSTEP_MAX_LANES];
+    alignas(64) u32_t prog_timer_timestamp[LOCKSTEP_MAX_LANES];
+    alignas(64) bool_t prog_timer_enabled[LOCKSTEP_MAX_LANES];
+    alignas(64) u8_t prog_timer_data[LOCKSTEP_MAX_LANES];
+    alignas(64) u8_t prog_timer_rld[LOCKSTEP_MAX_LANES];
+    alignas(64) u8_t serial_state[LOCKSTEP_MAX_LANES];
+    alignas(64) u8_t memory[MEM_BUFFER_SIZE][LOCKSTEP_MAX_LANES];
+    alignas(64) uint16_t dirty[LOCKSTEP_MAX_LANES];
+
+    input_port_t inputs[LOCKSTEP_MAX_LANES][2];
+    interrupt_t  interrupts[LOCKSTEP_MAX_LANES][INT_SLOT_NUM];
+
+    lane_mask_t stopped = 0;
+    lane_mask_t irq     = 0;
+
+    alignas(64) u8_t sel[LOCKSTEP_MAX_LANES];
+
+  public:
+    Lockstep(u8_t _lanes);
+    ~Lockstep();
+
+    bool_t      lockstep_init(Program *_program);
+    u8_t        lockstep_get_lanes(void);
+    lane_mask_t lockstep_get_stopped(void);
+
+    void lockstep_reset_lane(u8_t lane);
+    void lockstep_load_lane(u8_t lane, const cpu_state_t *state);
+    void lockstep_store_lane(u8_t lane, cpu_state_t *state);
+    void lockstep_set_input_pin(u8_t lane, pin_t pin, pin_state_t state);
+
+    u32_t lockstep_step(void);
+    u32_t lockstep_run(u32_t ticks);
+
+  private:
+    u32_t  step_lanes(lane_mask_t todo);
+    void   exec_group(u13_t at, lane_mask_t mask);
+    bool_t exec_vector(const decoded_op_t *dec);
+    void   exec_lane(u8_t lane, const decoded_op_t *dec);
+    void   finish_group(const decoded_op_t *dec, lane_mask_t mask);
+    void   finish_lane(u8_t lane, const decoded_op_t *dec);
+    void   step_lane(u8_t lane, const decoded_op_t *dec);
+
+    void generate_interrupt(u8_t lane, int_slot_t slot, u8_t bit);
+    void process_interrupts(u8_t lane);
+    u4_t get_io(u8_t lane, u12_t n);
+    void set_io(u8_t lane, u12_t n, u4_t v);
+    u4_t get_memory(u8_t lane, u12_t n);
+    void set_memory(u8_t lane, u12_t n, u4_t v);
+    u4_t get_rq(u8_t lane, u12_t rq);
+    void set_rq(u8_t lane, u12_t rq, u4_t v);
+};
+#endif
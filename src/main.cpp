@@ -1,10 +1,305 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 #include "cpu.h"
 #include "tamago.h"
+#include "server.h"
+#include "publisher.h"
+#include "rewind.h"
+#include "statefile.h"
+#include "journal.h"
+#include "movie.h"
+#include "explorer.h"
+#include "scheduler.h"
 
 Tamago *tamgo = new Tamago();
 
+typedef struct
+{
+    u12_t addr;
+    u4_t  value;
+} explore_goal_t;
+
+static volatile bool_t  g_stop      = 0;
+static FramePublisher *g_publisher = NULL;
+
+
+static void stop_handler(int)
+{
+    g_stop = 1;
+}
+static int server_main(const char *path)
+{
+    Server  *server  = new Server(SRV_DEFAULT_CAPACITY);
+    Program *program = Tamago::hw_get_program();
+    bool_t   res     = server->server_init(program, path);
+    program->program_release();
+    if (res) {
+        delete server;
+        return 1;
+    }
+    server->server_set_publisher(g_publisher);
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+    server->server_run(&g_stop);
+    delete server;
+    return 0;
+}
+static uint64_t get_time_us(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+/* Replays each movie at full speed and verifies its state hashes, returns 1 if any failed */
+static int verify_main(int count, char **paths)
+{
+    Program       *program = Tamago::hw_get_program();
+    Movie         *movie   = new Movie();
+    movie_result_t result;
+    uint64_t       start, elapsed;
+    int            res = 0;
+    int            i;
+
+    for (i = 0; i < count; i++) {
+        CPU *cpu = new CPU(nullptr);
+        cpu->cpu_init(program, NULL, 1000000);
+        if (movie->movie_load(paths[i])) {
+            printf("%s: cannot load\n", paths[i]);
+            res = 1;
+            delete cpu;
+            continue;
+        }
+        start   = get_time_us();
+        res    |= movie->movie_replay(cpu, &result);
+        elapsed = get_time_us() - start;
+        printf("%s: %u events, %u checks, %us emulated in %.3fs", paths[i], result.events, result.checks,
+               result.ticks / TICK_FREQUENCY, elapsed / 1e6);
+        if (result.diverged != MOVIE_NO_DIVERGENCE) {
+            printf(", diverged at check %u (tick %u)", result.diverged, result.tick);
+        }
+        printf("\n");
+        delete cpu;
+    }
+    delete movie;
+    program->program_release();
+    return res;
+}
+/* Runs `count` headless instances from power-on in real time until interrupted, then prints how late they woke */
+static int fleet_main(u32_t count)
+{
+    Program                 *program   = Tamago::hw_get_program();
+    Scheduler               *scheduler = new Scheduler(count, SCHED_DEFAULT_QUANTUM_US);
+    std::vector<cpu_state_t> states(count);
+    const sched_stats_t     *stats;
+    u32_t                    i;
+    u8_t                     bucket;
+
+    if (scheduler->scheduler_init(program)) {
+        delete scheduler;
+        program->program_release();
+        return 1;
+    }
+    for (i = 0; i < count; i++) {
+        CPU::cpu_init_state(&states[i]);
+        states[i].inputs[0].states = 0x7;
+        scheduler->scheduler_add(&states[i]);
+    }
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+    scheduler->scheduler_run(&g_stop);
+
+    stats = scheduler->scheduler_get_stats();
+    printf("%u instances, %llu wakeups in %.2fs, %.1f%% busy, %llu us late at most\n",
+           scheduler->scheduler_get_used(), (unsigned long long)stats->wakeups, stats->elapsed_us / 1e6,
+           stats->busy_us * 100.0 / (stats->elapsed_us ? stats->elapsed_us : 1), (unsigned long long)stats->max_us);
+    for (bucket = 0; bucket < SCHED_LATENESS_BUCKETS; bucket++) {
+        if (stats->buckets[bucket] == 0) {
+            continue;
+        }
+        if (bucket == 0) {
+            printf("  on time    %10u\n", stats->buckets[bucket]);
+        } else if (bucket == SCHED_LATENESS_BUCKETS - 1) {
+            printf("  >= %7uus %10u\n", 1u << (bucket - 1), stats->buckets[bucket]);
+        } else {
+            printf("  <  %7uus %10u\n", 1u << bucket, stats->buckets[bucket]);
+        }
+    }
+    delete scheduler;
+    program->program_release();
+    return 0;
+}
+/* Every watched nibble holds its value */
+static bool_t explore_goal(void *ctx, const cpu_state_t *state)
+{
+    const std::vector<explore_goal_t> *goals = (const std::vector<explore_goal_t> *)ctx;
 
+    for (const explore_goal_t &g : *goals) {
+        if (GET_MEMORY(state->memory, g.addr) != g.value) {
+            return 0;
+        }
+    }
+    return 1;
+}
+/* Searches for the shortest inputs to the goals, from the save-state at `path` or from power-on */
+static int explore_main(const std::vector<explore_goal_t> &goals, u32_t depth, const char *path)
+{
+    Program          *program = Tamago::hw_get_program();
+    CPU              *cpu     = new CPU(nullptr);
+    Explorer         *explorer;
+    explorer_result_t result;
+    cpu_save_t        save;
+    std::vector<u8_t> inputs(depth);
+    FILE             *f;
+    size_t            n = 0;
+    u32_t             i;
+    bool_t            res;
+
+    cpu->cpu_init(program, NULL, 1000000);
+    cpu->cpu_get_state()->inputs[0].states = 0x7;
+    if (path) {
+        f = fopen(path, "rb");
+        if (f) {
+            n = fread(&save, 1, sizeof(save), f);
+            fclose(f);
+        }
+        if (f == NULL || cpu->cpu_load_state(&save, n)) {
+            printf("%s: cannot load\n", path);
+            delete cpu;
+            program->program_release();
+            return 1;
+        }
+    }
+    explorer = new Explorer(program, 0);
+    res      = explorer->explorer_search(cpu->cpu_get_state(), explore_goal, (void *)&goals, depth,
+                                         EXPLORER_MAX_STATES, &result);
+    if (res) {
+        printf("not found within %u frames and %u states\n", depth, EXPLORER_MAX_STATES);
+    } else {
+        n = explorer->explorer_get_path(inputs.data(), inputs.size());
+        printf("found in %u frames:", result.depth);
+        for (i = 0; i < n; i++) {
+            printf(" %c", inputs[i] == VECENV_ACTION_LEFT     ? 'L'
+                          : inputs[i] == VECENV_ACTION_MIDDLE ? 'M'
+                          : inputs[i] == VECENV_ACTION_RIGHT  ? 'R'
+                                                              : '.');
+        }
+        printf("\n");
+    }
+    printf("%llu states expanded in %.2fs (%.0f/s), %llu unique\n", (unsigned long long)result.expanded,
+           result.elapsed_us / 1e6, result.expanded * 1e6 / (result.elapsed_us ? result.elapsed_us : 1),
+           (unsigned long long)result.unique);
+    delete explorer;
+    delete cpu;
+    program->program_release();
+    return res;
+}
 int main(int argc, char **argv)
 {
-    tamgo->init(argc, argv);
+    const char *socket_path = NULL;
+    const char *shm_name    = NULL;
+    const char *state_path  = NULL;
+    const char *jnl_path    = NULL;
+    const char *movie_path  = NULL;
+    bool_t      verify      = 0;
+    int         rewind_secs = 0;
+    u32_t       depth       = EXPLORER_MAX_DEPTH;
+    u32_t       fleet       = 0;
+    int         opt, res;
+
+    std::vector<explore_goal_t> goals;
+    unsigned int                addr, value;
+
+    while ((opt = getopt(argc, argv, "s:p:r:m:j:M:vx:D:f:")) != -1) {
+        switch (opt) {
+            case 's':
+                socket_path = optarg;
+                break;
+            case 'p':
+                shm_name = optarg;
+                break;
+            case 'r':
+                rewind_secs = atoi(optarg);
+                break;
+            case 'm':
+                state_path = optarg;
+                break;
+            case 'j':
+                jnl_path = optarg;
+                break;
+            case 'M':
+                movie_path = optarg;
+                break;
+            case 'v':
+                verify = 1;
+                break;
+            case 'x':
+                if (sscanf(optarg, "%i=%i", &addr, &value) != 2) {
+                    return 1;
+                }
+                goals.push_back({(u12_t)(addr & 0xFFF), (u4_t)(value & 0xF)});
+                break;
+            case 'D':
+                depth = atoi(optarg);
+                break;
+            case 'f':
+                fleet = atoi(optarg);
+                break;
+        }
+    }
+    if (verify) {
+        return verify_main(argc - optind, argv + optind);
+    }
+    if (!goals.empty()) {
+        return explore_main(goals, depth, optind < argc ? argv[optind] : NULL);
+    }
+    if (fleet > 0) {
+        return fleet_main(fleet);
+    }
+    if (movie_path && socket_path) {
+        /* A server runs many instances, none of which is the session a movie would start from */
+        printf("-M cannot be used with -s\n");
+        return 1;
+    }
+    if (rewind_secs > 0) {
+        tamgo->g_rewind = new Rewind(rewind_secs * DEFAULT_FRAMERATE, 1);
+    }
+    if (state_path) {
+        tamgo->g_statefile = new StateFile();
+        if (tamgo->g_statefile->statefile_open(state_path, 1)) {
+            return 1;
+        }
+    }
+    if (jnl_path) {
+        tamgo->g_journal = new Journal(JOURNAL_SYNC_US);
+        if (tamgo->g_journal->journal_open(jnl_path, 1)) {
+            return 1;
+        }
+    }
+    if (movie_path) {
+        tamgo->g_movie = new Movie();
+    }
+    if (shm_name) {
+        g_publisher = new FramePublisher();
+        if (g_publisher->publisher_open(shm_name, socket_path ? SRV_DEFAULT_CAPACITY : 1)) {
+            return 1;
+        }
+        tamgo->g_publisher = g_publisher;
+    }
+    if (socket_path) {
+        res = server_main(socket_path);
+    } else {
+        res = tamgo->init(argc, argv);
+    }
+    if (movie_path && tamgo->g_movie->movie_save(movie_path)) {
+        res = 1;
+    }
+    delete g_publisher;
+    delete tamgo->g_rewind;
+    delete tamgo->g_statefile;
+    delete tamgo->g_journal;
+    delete tamgo->g_movie;
+    return res;
 }
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "movie.h"
+
+
+static_assert(sizeof(movie_event_t) == 8 && sizeof(movie_check_t) == 8, "movie records must be packed");
+
+/* Starts a new recording from `state`, `_hash_ticks` apart checks (0 for none) */
+void Movie::movie_start(const cpu_state_t *state, u32_t _hash_ticks)
+{
+    lcd_bitmap_t lcd;
+
+    CPU::cpu_render_lcd(state, &lcd);
+    CPU::cpu_encode_state(state, &lcd, &start);
+    events.clear();
+    checks.clear();
+    hash_ticks = _hash_ticks;
+    next_tick  = state->tick_counter + (hash_ticks ? hash_ticks : 0x80000000);
+}
+void Movie::movie_record(u32_t tick, pin_t pin, pin_state_t state)
+{
+    events.push_back({tick, (u8_t)pin, (u8_t)state, {0, 0}});
+}
+/* Records the hash of the state as it is now, movie_poll() calls it every `hash_ticks` */
+void Movie::movie_check(const cpu_state_t *state)
+{
+    checks.push_back({state->tick_counter, movie_hash(state)});
+    next_tick = state->tick_counter + (hash_ticks ? hash_ticks : 0x80000000);
+}
+/*
+ * Replays the movie on `cpu`, a headless CPU running the same program, and verifies every check.
+ * Returns 1 if the movie has no valid initial state or diverged, see `result`.
+ */
+bool_t Movie::movie_replay(CPU *cpu, movie_result_t *result)
+{
+    cpu_state_t  state;
+    lcd_bitmap_t lcd;
+    cpu_state_t *st;
+    u32_t        begin;
+    u32_t        e = 0;
+    u32_t        c = 0;
+
+    memset(result, 0, sizeof(movie_result_t));
+    result->diverged = MOVIE_NO_DIVERGENCE;
+    if (CPU::cpu_decode_state(&start, sizeof(start), &state, &lcd)) {
+        return 1;
+    }
+    cpu->cpu_restore_state(&state);
+    st    = cpu->cpu_get_state();
+    begin = st->tick_counter;
+    while (e < events.size() || c < checks.size()) {
+        /* At the same tick the hash was taken before the inputs were applied */
+        if (c < checks.size() && (e == events.size() || (int32_t)(checks[c].tick - events[e].tick) <= 0)) {
+            /* A running memory hash that drifted would make the hashes themselves meaningless */
+            if (cpu->cpu_run_to(checks[c].tick) || st->tick_counter != checks[c].tick ||
+                movie_hash(st) != checks[c].hash || cpu->cpu_verify_hash()) {
+                result->diverged = c;
+                break;
+            }
+            c++;
+        } else {
+            /* Stopped short of the event (invalid opcode or breakpoint): the next check can no longer be met */
+            if (cpu->cpu_run_to(events[e].tick)) {
+                result->diverged = c;
+                break;
+            }
+            cpu->cpu_set_input_pin((pin_t)events[e].pin, (pin_state_t)events[e].state);
+            e++;
+        }
+    }
+    result->events = e;
+    result->checks = c;
+    result->tick   = st->tick_counter;
+    result->ticks  = st->tick_counter - begin;
+    return result->diverged != MOVIE_NO_DIVERGENCE;
+}
+u32_t Movie::movie_get_events(void)
+{
+    return events.size();
+}
+bool_t Movie::movie_save(const char *path)
+{
+    movie_header_t hdr;
+    FILE          *f;
+    bool_t         res = 0;
+
+    f = fopen(path, "wb");
+    if (f == NULL) {
+        return 1;
+    }
+    hdr.magic       = MOVIE_MAGIC;
+    hdr.version     = MOVIE_VERSION;
+    hdr.header_size = sizeof(movie_header_t);
+    hdr.events      = events.size();
+    hdr.checks      = checks.size();
+    res |= fwrite(&hdr, sizeof(hdr), 1, f) != 1;
+    res |= fwrite(&start, sizeof(start), 1, f) != 1;
+    res |= fwrite(events.data(), sizeof(movie_event_t), events.size(), f) != events.size();
+    res |= fwrite(checks.data(), sizeof(movie_check_t), checks.size(), f) != checks.size();
+    res |= fclose(f) != 0;
+    return res;
+}
+bool_t Movie::movie_load(const char *path)
+{
+    movie_header_t hdr;
+    struct stat    sb;
+    FILE          *f;
+    bool_t         res = 0;
+    u32_t          i;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        return 1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != MOVIE_MAGIC || hdr.version != MOVIE_VERSION ||
+        hdr.header_size != sizeof(movie_header_t) || fread(&start, sizeof(start), 1, f) != 1) {
+        fclose(f);
+        return 1;
+    }
+    /* The counts must describe the rest of the file exactly, before anything is sized after them */
+    if (fstat(fileno(f), &sb) != 0 ||
+        (uint64_t)sb.st_size != sizeof(hdr) + sizeof(start) + (uint64_t)hdr.events * sizeof(movie_event_t) +
+                                    (uint64_t)hdr.checks * sizeof(movie_check_t)) {
+        fclose(f);
+        return 1;
+    }
+    events.resize(hdr.events);
+    checks.resize(hdr.checks);
+    res |= fread(events.data(), sizeof(movie_event_t), events.size(), f) != events.size();
+    res |= fread(checks.data(), sizeof(movie_check_t), checks.size(), f) != checks.size();
+    fclose(f);
+    /* Events are handed to CPU::cpu_set_input_pin as they are */
+    for (i = 0; res == 0 && i < events.size(); i++) {
+        res = events[i].pin > PIN_K13 || events[i].state > PIN_STATE_HIGH;
+    }
+    return res;
+}
+/* cpu_input_cb_t recording into the Movie given as context */
+void Movie::movie_input_hook(void *ctx, u32_t tick, pin_t pin, pin_state_t state)
+{
+    ((Movie *)ctx)->movie_record(tick, pin, state);
+}
+/* The whole-state hash folded to 32 bits, the dirty bits depend on who took checkpoints and are left out */
+u32_t Movie::movie_hash(const cpu_state_t *state)
+{
+    uint64_t h = CPU::cpu_hash_state(state);
+    return (u32_t)(h ^ (h >> 32));
+}
@@ -0,0 +1,86 @@
+#ifndef _MOVIE_H_
+#define _MOVIE_H_
+#include <stdint.h>
+#include <vector>
+#include "cpu.h"
+
+
+#define MOVIE_MAGIC         0x564D3645 /* "E6MV" */
+#define MOVIE_VERSION       2
+#define MOVIE_HASH_TICKS    TICK_FREQUENCY /* One state hash per emulated second */
+#define MOVIE_NO_DIVERGENCE 0xFFFFFFFF
+
+/*
+ * File layout, host byte order: the header, the save-state image of the initial state, `events` input
+ * events then `checks` state hashes, both in tick order.
+ */
+typedef struct
+{
+    u32_t    magic;
+    uint16_t version;
+    uint16_t header_size;
+    u32_t    events;
+    u32_t    checks;
+} movie_header_t;
+
+typedef struct
+{
+    u32_t tick;
+    u8_t  pin;
+    u8_t  state;
+    u8_t  pad[2];
+} movie_event_t;
+
+/* Hash of the state at the instruction boundary where tick_counter read `tick`, before that boundary's inputs */
+typedef struct
+{
+    u32_t tick;
+    u32_t hash;
+} movie_check_t;
+
+typedef struct
+{
+    u32_t events;   /* Replayed */
+    u32_t checks;   /* Verified */
+    u32_t ticks;    /* Emulated */
+    u32_t diverged; /* Index of the first failed or unreached check, or MOVIE_NO_DIVERGENCE */
+    u32_t tick;     /* Where the replay stood when it failed */
+} movie_result_t;
+
+
+/*
+ * Input movie: an initial state and the input events of a session, with a state hash every `hash_ticks`
+ * ticks along the way. Recording hooks CPU::cpu_set_input_pin; replay runs the movie on a headless CPU at
+ * full speed and stops at the first hash that does not match, which bounds the divergence to the
+ * interval before it.
+ */
+class Movie {
+  private:
+    cpu_save_t                 start;
+    std::vector<movie_event_t> events;
+    std::vector<movie_check_t> checks;
+    u32_t                      hash_ticks = MOVIE_HASH_TICKS;
+    u32_t                      next_tick  = 0;
+
+  public:
+    void   movie_start(const cpu_state_t *state, u32_t _hash_ticks);
+    void   movie_record(u32_t tick, pin_t pin, pin_state_t state);
+    void   movie_check(const cpu_state_t *state);
+    bool_t movie_replay(CPU *cpu, movie_result_t *result);
+    u32_t  movie_get_events(void);
+
+    bool_t movie_save(const char *path);
+    bool_t movie_load(const char *path);
+
+    static void  movie_input_hook(void *ctx, u32_t tick, pin_t pin, pin_state_t state);
+    static u32_t movie_hash(const cpu_state_t *state);
+
+    /* Called after every step, or less often at the cost of coarser checks */
+    inline void movie_poll(const cpu_state_t *state)
+    {
+        if ((int32_t)(state->tick_counter - next_tick) >= 0) {
+            movie_check(state);
+        }
+    }
+};
+#endif
@@ -0,0 +1,96 @@
+#include <string.h>
+#include <mutex>
+#include <unordered_map>
+#include "program.h"
+
+
+static std::mutex                                        g_programs_lock;
+static std::unordered_multimap<program_hash_t, Program *> g_programs; /* Colliding ROMs share a hash */
+
+
+Program::Program(const u12_t *_rom, u32_t _size, program_hash_t _hash)
+{
+    u32_t n;
+    hash = _hash;
+    size = (_size < PROGRAM_PC_NUM) ? _size : PROGRAM_PC_NUM;
+    refs = 1;
+    rom  = new u12_t[size];
+    memcpy(rom, _rom, size * sizeof(u12_t));
+    for (n = 0; n < PROGRAM_PC_NUM; n++) {
+        if (n >= size || CPU::cpu_decode(rom[n], &decode[n])) {
+            decode[n].id = OP_NUM;
+        }
+    }
+}
+Program::~Program()
+{
+    delete[] rom;
+}
+program_hash_t Program::program_hash(const u12_t *rom, u32_t size)
+{
+    program_hash_t h = 0xCBF29CE484222325ULL;
+    u32_t          n;
+    for (n = 0; n < size; n++) {
+        h = (h ^ (rom[n] & 0xFF)) * 0x100000001B3ULL;
+        h = (h ^ (rom[n] >> 8)) * 0x100000001B3ULL;
+    }
+    return (h ^ size) * 0x100000001B3ULL;
+}
+Program *Program::program_get(const u12_t *rom, u32_t size)
+{
+    program_hash_t              h;
+    std::lock_guard<std::mutex> lock(g_programs_lock);
+
+    /* Words past the last addressable one are dropped by the constructor, they must not tell ROMs apart */
+    size = (size < PROGRAM_PC_NUM) ? size : PROGRAM_PC_NUM;
+    h    = program_hash(rom, size);
+
+    auto range = g_programs.equal_range(h);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second->size == size && !memcmp(it->second->rom, rom, size * sizeof(u12_t))) {
+            it->second->refs++;
+            return it->second;
+        }
+    }
+
+    Program *program = new Program(rom, size, h);
+    g_programs.emplace(h, program);
+    return program;
+}
+Program *Program::program_acquire(void)
+{
+    std::lock_guard<std::mutex> lock(g_programs_lock);
+    refs++;
+    return this;
+}
+void Program::program_release(void)
+{
+    std::lock_guard<std::mutex> lock(g_programs_lock);
+    if (--refs > 0) {
+        return;
+    }
+    auto range = g_programs.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == this) {
+            g_programs.erase(it);
+            break;
+        }
+    }
+    delete this;
+}
+program_hash_t Program::program_get_hash(void) const
+{
+    return hash;
+}
+u32_t Program::program_get_size(void) const
+{
+    return size;
+}
+const u12_t *Program::program_get_rom(void) const
+{
+    return rom;
+}
+const decoded_op_t *Program::program_get_decode(void) const
+{
+    return decode;
+}
@@ -0,0 +1,41 @@
+#ifndef _PROGRAM_H_
+#define _PROGRAM_H_
+#include <stdint.h>
+#include "cpu.h"
+
+
+#define PROGRAM_PC_NUM 0x2000
+
+typedef uint64_t program_hash_t;
+
+
+/*
+ * Immutable ROM image plus everything derived from it (decode table).
+ * Programs are reference counted and interned by ROM hash, so every instance running the same ROM
+ * points at one copy. Addresses past the end of the ROM decode as invalid (OP_NUM).
+ */
+class Program {
+  private:
+    program_hash_t hash;
+    u32_t          size;
+    u32_t          refs;
+    u12_t         *rom;
+    decoded_op_t   decode[PROGRAM_PC_NUM];
+
+  private:
+    Program(const u12_t *_rom, u32_t _size, program_hash_t _hash);
+    ~Program();
+
+  public:
+    static program_hash_t program_hash(const u12_t *rom, u32_t size);
+    static Program       *program_get(const u12_t *rom, u32_t size);
+
+    Program *program_acquire(void);
+    void     program_release(void);
+
+    program_hash_t      program_get_hash(void) const;
+    u32_t               program_get_size(void) const;
+    const u12_t        *program_get_rom(void) const;
+    const decoded_op_t *program_get_decode(void) const;
+};
+#endif
@@ -0,0 +1,171 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "publisher.h"
+
+
+FramePublisher::FramePublisher()
+{
+    name[0] = '\0';
+}
+FramePublisher::~FramePublisher()
+{
+    publisher_close();
+}
+bool_t FramePublisher::publisher_open(const char *_name, u32_t count)
+{
+    void *p;
+    int   fd;
+
+    publisher_close();
+    if (strlen(_name) >= sizeof(name)) {
+        return 1;
+    }
+    length = sizeof(shm_header_t) + (size_t)count * sizeof(shm_slot_t);
+    fd     = shm_open(_name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        return 1;
+    }
+    if (ftruncate(fd, length) != 0) {
+        close(fd);
+        shm_unlink(_name);
+        return 1;
+    }
+    p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        shm_unlink(_name);
+        return 1;
+    }
+    strcpy(name, _name);
+    header = (shm_header_t *)p;
+    slots  = (shm_slot_t *)(header + 1);
+    memset(p, 0, length);
+    header->version   = PUBLISHER_VERSION;
+    header->slots     = count;
+    header->slot_size = sizeof(shm_slot_t);
+    /* Readers check the magic last, so they never see a half initialized header */
+    __atomic_store_n(&header->magic, PUBLISHER_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+void FramePublisher::publisher_close(void)
+{
+    if (header == 0) {
+        return;
+    }
+    munmap(header, length);
+    shm_unlink(name);
+    header = 0;
+    slots  = 0;
+}
+u32_t FramePublisher::publisher_get_slots(void)
+{
+    return header ? header->slots : 0;
+}
+void FramePublisher::publisher_write(u32_t slot, const lcd_bitmap_t *bitmap)
+{
+    shm_slot_t *s;
+    u32_t       seq;
+    u8_t        i;
+
+    if (header == 0 || slot >= header->slots) {
+        return;
+    }
+    s   = &slots[slot];
+    seq = s->seq;
+    __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (i = 0; i < 16; i++) {
+        __atomic_store_n(&s->rows[i], bitmap->rows[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&s->icons, bitmap->icons, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->frame, s->frame + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
+void FramePublisher::publisher_write_state(u32_t slot, const cpu_state_t *state)
+{
+    lcd_bitmap_t bitmap;
+    CPU::cpu_render_lcd(state, &bitmap);
+    publisher_write(slot, &bitmap);
+}
+FrameReader::~FrameReader()
+{
+    reader_close();
+}
+bool_t FrameReader::reader_open(const char *name)
+{
+    struct stat sb;
+    void       *p;
+    int         fd;
+
+    reader_close();
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return 1;
+    }
+    if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(shm_header_t)) {
+        close(fd);
+        return 1;
+    }
+    p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return 1;
+    }
+    header = (const shm_header_t *)p;
+    slots  = (const shm_slot_t *)(header + 1);
+    length = sb.st_size;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != PUBLISHER_MAGIC ||
+        header->version != PUBLISHER_VERSION || header->slot_size != sizeof(shm_slot_t) ||
+        length < sizeof(shm_header_t) + (size_t)header->slots * sizeof(shm_slot_t)) {
+        reader_close();
+        return 1;
+    }
+    return 0;
+}
+void FrameReader::reader_close(void)
+{
+    if (header == 0) {
+        return;
+    }
+    munmap((void *)header, length);
+    header = 0;
+    slots  = 0;
+}
+u32_t FrameReader::reader_get_slots(void)
+{
+    return header ? header->slots : 0;
+}
+uint64_t FrameReader::reader_get_frame(u32_t slot)
+{
+    if (header == 0 || slot >= header->slots) {
+        return 0;
+    }
+    return __atomic_load_n(&slots[slot].frame, __ATOMIC_RELAXED);
+}
+bool_t FrameReader::reader_read(u32_t slot, lcd_bitmap_t *bitmap, uint64_t *frame)
+{
+    const shm_slot_t *s;
+    u32_t             seq0, seq1;
+    u8_t              i;
+
+    if (header == 0 || slot >= header->slots) {
+        return 1;
+    }
+    s = &slots[slot];
+    do {
+        seq0 = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        for (i = 0; i < 16; i++) {
+            bitmap->rows[i] = __atomic_load_n(&s->rows[i], __ATOMIC_RELAXED);
+        }
+        bitmap->icons = __atomic_load_n(&s->icons, __ATOMIC_RELAXED);
+        if (frame) {
+            *frame = __atomic_load_n(&s->frame, __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq1 = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+    } while ((seq0 & 1) || seq0 != seq1);
+    return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef _PUBLISHER_H_
+#define _PUBLISHER_H_
+#include <stdint.h>
+#include "cpu.h"
+
+
+#define PUBLISHER_MAGIC   0x4D485336 /* "6SHM" */
+#define PUBLISHER_VERSION 1
+
+/*
+ * Layout of the shared-memory region: one header followed by `slots` cache line aligned frame slots.
+ * Each slot is guarded by a seqlock: `seq` is odd while the writer updates the slot, readers copy the slot
+ * and retry if `seq` was odd or changed meanwhile. `frame` counts the frames published to the slot.
+ */
+typedef struct
+{
+    u32_t magic;
+    u32_t version;
+    u32_t slots;
+    u32_t slot_size;
+    u8_t  pad[48];
+} shm_header_t;
+
+typedef struct alignas(64)
+{
+    u32_t    seq;
+    u32_t    icons;
+    uint64_t frame;
+    u32_t    rows[16];
+} shm_slot_t;
+
+
+/*
+ * Publishes LCD frames of any number of instances to a POSIX shared-memory region.
+ * The writer never waits on readers and never makes a syscall per frame; there must be a single writer.
+ */
+class FramePublisher {
+  private:
+    shm_header_t *header = 0;
+    shm_slot_t   *slots  = 0;
+    size_t        length = 0;
+    char          name[256];
+
+  public:
+    FramePublisher();
+    ~FramePublisher();
+
+    bool_t publisher_open(const char *_name, u32_t count);
+    void   publisher_close(void);
+    u32_t  publisher_get_slots(void);
+
+    void publisher_write(u32_t slot, const lcd_bitmap_t *bitmap);
+    void publisher_write_state(u32_t slot, const cpu_state_t *state);
+};
+
+/* Read side, for viewer and recorder processes */
+class FrameReader {
+  private:
+    const shm_header_t *header = 0;
+    const shm_slot_t   *slots  = 0;
+    size_t              length = 0;
+
+  public:
+    ~FrameReader();
+
+    bool_t reader_open(const char *name);
+    void   reader_close(void);
+    u32_t  reader_get_slots(void);
+
+    uint64_t reader_get_frame(u32_t slot);
+    bool_t   reader_read(u32_t slot, lcd_bitmap_t *bitmap, uint64_t *frame);
+};
+#endif
@@ -0,0 +1,159 @@
+#include <string.h>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "query.h"
+
+
+static inline u8_t filter_one(u8_t v, const query_pred_t *pred)
+{
+    switch (pred->op) {
+        case QUERY_EQ:
+            return v == pred->a;
+        case QUERY_RANGE:
+            return v >= pred->a && v <= pred->b;
+        case QUERY_MASK:
+            return (v & pred->a) == pred->b;
+    }
+    return 0;
+}
+static void filter_scalar(const u8_t *column, u32_t count, const query_pred_t *pred, u8_t *result)
+{
+    u32_t i;
+    for (i = 0; i < count; i++) {
+        result[i] &= filter_one(column[i], pred) ? 0xFF : 0x00;
+    }
+}
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static void filter_avx2(const u8_t *column, u32_t count, const query_pred_t *pred,
+                                                        u8_t *result)
+{
+    __m256i a = _mm256_set1_epi8(pred->a);
+    __m256i b = _mm256_set1_epi8(pred->b);
+    __m256i v, m;
+    u32_t   i;
+
+    for (i = 0; i + 32 <= count; i += 32) {
+        v = _mm256_loadu_si256((const __m256i *)(column + i));
+        switch (pred->op) {
+            case QUERY_EQ:
+                m = _mm256_cmpeq_epi8(v, a);
+                break;
+            case QUERY_RANGE:
+                // unsigned v >= a and v <= b as two compares, so that an empty range (a > b) matches nothing
+                m = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, a), v),
+                                     _mm256_cmpeq_epi8(_mm256_min_epu8(v, b), v));
+                break;
+            case QUERY_MASK:
+                m = _mm256_cmpeq_epi8(_mm256_and_si256(v, a), b);
+                break;
+            default:
+                m = _mm256_setzero_si256();
+        }
+        _mm256_storeu_si256((__m256i *)(result + i),
+                            _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(result + i)), m));
+    }
+    filter_scalar(column + i, count - i, pred, result + i);
+}
+#endif
+
+
+RamQuery::RamQuery()
+{
+    query_set_simd(1);
+}
+/* SIMD filters are used by default where the host has them, disabling them is for checking one against the other */
+void RamQuery::query_set_simd(bool_t en)
+{
+    filter = &filter_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    if (en && __builtin_cpu_supports("avx2")) {
+        filter = &filter_avx2;
+    }
+#endif
+}
+bool_t RamQuery::query_add(u12_t addr, query_op_t op, u4_t a, u4_t b)
+{
+    u8_t n;
+
+    if (pred_num == QUERY_MAX_PREDS || addr >= MEM_RAM_SIZE) {
+        return 1;
+    }
+    preds[pred_num] = {addr, (u8_t)op, a, b};
+    for (n = 0; n < addrs.size() && addrs[n] != addr; n++) {
+    }
+    if (n == addrs.size()) {
+        addrs.push_back(addr);
+        columns.emplace_back();
+    }
+    pred_column[pred_num++] = n;
+    return 0;
+}
+void RamQuery::query_clear(void)
+{
+    pred_num = 0;
+    addrs.clear();
+    columns.clear();
+}
+void RamQuery::gather(const query_source_t *sources, u32_t count)
+{
+    const cpu_state_t *st;
+    u32_t              i, seq0, seq1;
+    u8_t               c;
+
+    for (c = 0; c < columns.size(); c++) {
+        columns[c].resize(count);
+    }
+    for (i = 0; i < count; i++) {
+        st = sources[i].state;
+        if (sources[i].seq == NULL) {
+            for (c = 0; c < addrs.size(); c++) {
+                columns[c][i] = GET_RAM_MEMORY(st->memory, addrs[c]);
+            }
+            continue;
+        }
+        for (;;) {
+            seq0 = sources[i].seq->load(std::memory_order_acquire);
+            if (seq0 & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            for (c = 0; c < addrs.size(); c++) {
+                columns[c][i] = __atomic_load_n(&st->memory[RAM_TO_MEMORY(addrs[c])], __ATOMIC_RELAXED);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            seq1 = sources[i].seq->load(std::memory_order_relaxed);
+            if (seq0 == seq1) {
+                break;
+            }
+        }
+        for (c = 0; c < addrs.size(); c++) {
+            columns[c][i] = (columns[c][i] >> ((addrs[c] % 2) << 2)) & 0xF;
+        }
+    }
+}
+u32_t RamQuery::query_run(const query_source_t *sources, u32_t count, std::vector<u32_t> *ids)
+{
+    uint64_t word;
+    u32_t    i;
+    u8_t     n;
+
+    ids->clear();
+    gather(sources, count);
+    result.assign(count + sizeof(uint64_t), 0);
+    memset(result.data(), 0xFF, count);
+    for (n = 0; n < pred_num; n++) {
+        filter(columns[pred_column[n]].data(), count, &preds[n], result.data());
+    }
+
+    /* Matches are usually rare, skip eight instances at a time while the mask is all zero */
+    for (i = 0; i < count; i += sizeof(word)) {
+        memcpy(&word, &result[i], sizeof(word));
+        word &= 0x0101010101010101ULL;
+        for (; word != 0; word &= word - 1) {
+            ids->push_back(i + __builtin_ctzll(word) / 8);
+        }
+    }
+    return ids->size();
+}
@@ -0,0 +1,64 @@
+#ifndef _QUERY_H_
+#define _QUERY_H_
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "cpu.h"
+
+
+#define QUERY_MAX_PREDS 16
+
+typedef enum
+{
+    QUERY_EQ = 0, /* nibble == a */
+    QUERY_RANGE,  /* a <= nibble <= b */
+    QUERY_MASK,   /* (nibble & a) == b */
+} query_op_t;
+
+typedef struct
+{
+    u12_t addr;
+    u8_t  op;
+    u4_t  a;
+    u4_t  b;
+} query_pred_t;
+
+/* One instance as seen by a query; seq is odd while the owner is running it, NULL if it is not running */
+typedef struct
+{
+    const cpu_state_t        *state;
+    const std::atomic<u32_t> *seq;
+} query_source_t;
+
+
+/*
+ * Conjunction of nibble predicates evaluated over a whole fleet.
+ * A run first gathers the nibbles the predicates touch into one column per address (an instance is re-read
+ * until its seq is even and unchanged, so its nibbles all come from the same point between two of its run
+ * batches), then filters the columns with SIMD compares and returns the indices of the matching sources.
+ */
+class RamQuery {
+  private:
+    typedef void (*filter_fn_t)(const u8_t *column, u32_t count, const query_pred_t *pred, u8_t *result);
+
+  private:
+    query_pred_t                   preds[QUERY_MAX_PREDS];
+    u8_t                           pred_column[QUERY_MAX_PREDS];
+    u8_t                           pred_num = 0;
+    std::vector<u12_t>             addrs;
+    std::vector<std::vector<u8_t>> columns;
+    std::vector<u8_t>              result;
+    filter_fn_t                    filter;
+
+  public:
+    RamQuery();
+
+    bool_t query_add(u12_t addr, query_op_t op, u4_t a, u4_t b);
+    void   query_clear(void);
+    u32_t  query_run(const query_source_t *sources, u32_t count, std::vector<u32_t> *ids);
+    void   query_set_simd(bool_t en);
+
+  private:
+    void gather(const query_source_t *sources, u32_t count);
+};
+#endif
@@ -0,0 +1,138 @@
+#include <string.h>
+#include "rewind.h"
+
+
+Rewind::Rewind(u32_t frames, u32_t _interval)
+{
+    interval  = (_interval > 0) ? _interval : 1;
+    slots     = frames / interval + 1;
+    ring_size = slots * REWIND_RECORD_AVG;
+    if (ring_size < 2 * REWIND_RECORD_MAX) {
+        ring_size = 2 * REWIND_RECORD_MAX;
+    }
+    ring    = new u8_t[ring_size];
+    rec_off = new u32_t[slots];
+    rec_len = new uint16_t[slots];
+}
+Rewind::~Rewind()
+{
+    delete[] ring;
+    delete[] rec_off;
+    delete[] rec_len;
+}
+void Rewind::rewind_reset(const cpu_state_t *state)
+{
+    last      = *state;
+    primed    = 1;
+    head      = 0;
+    first     = 0;
+    count     = 0;
+    next_tick = state->tick_counter + interval * REWIND_FRAME_TICKS;
+}
+u32_t Rewind::encode(const cpu_state_t *state)
+{
+    const u8_t *cur  = (const u8_t *)state;
+    const u8_t *prev = (const u8_t *)&last;
+    uint64_t    a, b;
+    u32_t       at, len = 0;
+    u32_t       n = 0, zeros, lits;
+
+    while (n < sizeof(cpu_state_t)) {
+        /* Most of the state is unchanged from one capture to the next, skip it eight bytes at a time */
+        for (zeros = 0; n + 8 <= sizeof(cpu_state_t) && zeros + 8 <= 255; n += 8, zeros += 8) {
+            memcpy(&a, cur + n, 8);
+            memcpy(&b, prev + n, 8);
+            if (a != b) {
+                break;
+            }
+        }
+        for (; n < sizeof(cpu_state_t) && zeros < 255 && cur[n] == prev[n]; n++, zeros++) {
+        }
+        scratch[len++] = zeros;
+        at             = len++;
+        for (lits = 0; n < sizeof(cpu_state_t) && lits < 255 && cur[n] != prev[n]; n++, lits++) {
+            scratch[len++] = cur[n] ^ prev[n];
+        }
+        scratch[at] = lits;
+    }
+    return len;
+}
+void Rewind::store(u32_t len)
+{
+    u32_t slot, end;
+
+    if (head + len > ring_size) {
+        /* Whatever still lies past head is from the previous lap, older than anything at the start */
+        while (count > 0 && rec_off[first] >= head) {
+            first = (first + 1) % slots;
+            count--;
+        }
+        head = 0;
+    }
+    end = head + len;
+    /* Drop the oldest records that the new one would overwrite, or that hold its slot */
+    while (count > 0 && (count == slots || (rec_off[first] < end && rec_off[first] + rec_len[first] > head))) {
+        first = (first + 1) % slots;
+        count--;
+    }
+    slot          = (first + count) % slots;
+    rec_off[slot] = head;
+    rec_len[slot] = len;
+    memcpy(&ring[head], scratch, len);
+    head = end;
+    count++;
+}
+void Rewind::rewind_capture(const cpu_state_t *state)
+{
+    next_tick = state->tick_counter + interval * REWIND_FRAME_TICKS;
+    if (!primed) {
+        last   = *state;
+        primed = 1;
+        return;
+    }
+    store(encode(state));
+    last = *state;
+}
+void Rewind::apply(u32_t rec, cpu_state_t *state)
+{
+    const u8_t *in  = &ring[rec_off[rec]];
+    const u8_t *end = in + rec_len[rec];
+    u8_t       *out = (u8_t *)state;
+    u32_t       n   = 0, lits;
+
+    while (in < end) {
+        n += *in++;
+        for (lits = *in++; lits > 0; lits--) {
+            out[n++] ^= *in++;
+        }
+    }
+}
+/* Rebuilds the state `steps` captures before the last one into `state` and forgets the captures after it */
+bool_t Rewind::rewind_seek(u32_t steps, cpu_state_t *state)
+{
+    u32_t rec;
+
+    if (!primed || steps > count) {
+        return 1;
+    }
+    for (; steps > 0; steps--) {
+        rec = (first + count - 1) % slots;
+        apply(rec, &last);
+        head = rec_off[rec];
+        count--;
+    }
+    if (count == 0) {
+        head = first = 0;
+    }
+    *state    = last;
+    next_tick = last.tick_counter + interval * REWIND_FRAME_TICKS;
+    return 0;
+}
+u32_t Rewind::rewind_get_count(void)
+{
+    return count;
+}
+u32_t Rewind::rewind_get_interval(void)
+{
+    return interval;
+}
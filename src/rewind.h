@@ -0,0 +1,59 @@
+#ifndef _REWIND_H_
+#define _REWIND_H_
+#include <stdint.h>
+#include "cpu.h"
+#include "tamago.h"
+
+
+#define REWIND_FRAME_TICKS  (TICK_FREQUENCY / DEFAULT_FRAMERATE)
+#define REWIND_RECORD_AVG   64 /* Bytes of ring reserved per record, captures one frame apart average ~30 */
+#define REWIND_RECORD_MAX   (sizeof(cpu_state_t) * 3 / 2 + 2) /* Every other byte changed */
+
+
+/*
+ * Rewind history of one instance.
+ * Every `interval` emulated frames the state is XORed against the previous capture and the result, mostly
+ * zero, is run-length coded into a byte ring as (zero count, literal count, literals) groups. XOR being its
+ * own inverse, older states are rebuilt by walking the records back from the last capture, so there are no
+ * key frames and the oldest records are simply overwritten when the ring is full.
+ */
+class Rewind {
+  private:
+    u8_t       *ring      = 0;
+    u32_t       ring_size = 0;
+    u32_t       head      = 0;
+    u32_t      *rec_off   = 0;
+    uint16_t   *rec_len   = 0;
+    u32_t       slots     = 0;
+    u32_t       first     = 0;
+    u32_t       count     = 0;
+    u32_t       interval;
+    u32_t       next_tick = 0;
+    bool_t      primed    = 0;
+    cpu_state_t last;
+    u8_t        scratch[REWIND_RECORD_MAX];
+
+  public:
+    Rewind(u32_t frames, u32_t _interval);
+    ~Rewind();
+
+    void   rewind_reset(const cpu_state_t *state);
+    void   rewind_capture(const cpu_state_t *state);
+    bool_t rewind_seek(u32_t steps, cpu_state_t *state);
+    u32_t  rewind_get_count(void);
+    u32_t  rewind_get_interval(void);
+
+    /* Called as often as wanted, captures once the instance has run `interval` frames since the last one */
+    inline void rewind_poll(const cpu_state_t *state)
+    {
+        if ((int32_t)(state->tick_counter - next_tick) >= 0) {
+            rewind_capture(state);
+        }
+    }
+
+  private:
+    u32_t encode(const cpu_state_t *state);
+    void  apply(u32_t rec, cpu_state_t *state);
+    void  store(u32_t len);
+};
+#endif
@@ -0,0 +1,290 @@
+#include <string.h>
+#include <time.h>
+#include "scheduler.h"
+#include "cpu_def.h"
+
+
+Scheduler::Scheduler(u32_t _capacity, u32_t _quantum_us)
+{
+    u32_t n;
+
+    capacity   = _capacity;
+    quantum_us = (_quantum_us < SCHED_TICK_US) ? SCHED_TICK_US : _quantum_us;
+    entries    = new sched_entry_t[capacity];
+    for (n = 0; n < capacity; n++) {
+        entries[n].active = 0;
+        entries[n].next   = (n + 1 < capacity) ? n + 1 : SCHED_NO_ENTRY;
+        entries[n].seq.store(0, std::memory_order_relaxed);
+    }
+    free = (capacity > 0) ? 0 : SCHED_NO_ENTRY;
+    memset(wheel, 0xFF, sizeof(wheel));
+    start_us = clock_us();
+    scheduler_reset_stats();
+}
+Scheduler::~Scheduler()
+{
+    delete cpu;
+    delete[] entries;
+}
+sched_time_t Scheduler::get_time_us(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (sched_time_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+bool_t Scheduler::scheduler_init(Program *program)
+{
+    if (cpu == 0) {
+        cpu = new CPU(nullptr);
+    }
+    return cpu->cpu_init(program, NULL, 1000000);
+}
+u32_t Scheduler::scheduler_add(cpu_state_t *state)
+{
+    u32_t          id;
+    sched_entry_t *e;
+
+    if (cpu == 0 || free == SCHED_NO_ENTRY) {
+        return SCHED_NO_ENTRY;
+    }
+    id   = free;
+    e    = &entries[id];
+    free = e->next;
+
+    e->state       = state;
+    e->epoch_us    = clock_us();
+    e->epoch_ticks = state->tick_counter;
+    /* Spread new instances over one quantum so that they do not all wake up on the same tick */
+    e->due_tick = now_tick + 1 + id % (quantum_us / SCHED_TICK_US);
+    e->active   = 1;
+    wheel_insert(id);
+    used++;
+    return id;
+}
+void Scheduler::scheduler_remove(u32_t id)
+{
+    if (id >= capacity || !entries[id].active) {
+        return;
+    }
+    wheel_unlink(id);
+    entries[id].active = 0;
+    entries[id].next   = free;
+    free               = id;
+    used--;
+}
+void Scheduler::scheduler_set_input_pin(u32_t id, pin_t pin, pin_state_t state)
+{
+    if (id >= capacity || !entries[id].active) {
+        return;
+    }
+    write_begin(&entries[id]);
+    cpu->cpu_bind_state(entries[id].state);
+    cpu->cpu_set_input_pin(pin, state);
+    write_end(&entries[id]);
+}
+u32_t Scheduler::scheduler_get_used(void)
+{
+    return used;
+}
+/* May be called from any thread while scheduler_run() is going, but not concurrently with scheduler_add/remove() */
+u32_t Scheduler::scheduler_query(RamQuery *query, std::vector<u32_t> *ids)
+{
+    std::vector<query_source_t> sources;
+    std::vector<u32_t>          map;
+    u32_t                       n;
+
+    sources.reserve(used);
+    map.reserve(used);
+    for (n = 0; n < capacity; n++) {
+        if (entries[n].active) {
+            sources.push_back({entries[n].state, &entries[n].seq});
+            map.push_back(n);
+        }
+    }
+    query->query_run(sources.data(), sources.size(), ids);
+    for (n = 0; n < ids->size(); n++) {
+        (*ids)[n] = map[(*ids)[n]];
+    }
+    return ids->size();
+}
+void Scheduler::write_begin(sched_entry_t *e)
+{
+    e->seq.store(e->seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+void Scheduler::write_end(sched_entry_t *e)
+{
+    e->seq.store(e->seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+/*
+ * Files the entry under its deadline. An entry cascading down on the tick it is due lands in the level 0
+ * slot of that tick, which wheel_expire() runs right after the cascade; a deadline already past is filed
+ * the same way, and keeps its value so that its lateness is measured from it.
+ */
+void Scheduler::wheel_insert(u32_t id)
+{
+    sched_entry_t *e    = &entries[id];
+    sched_time_t   tick = (e->due_tick > now_tick) ? e->due_tick : now_tick;
+    sched_time_t   delta;
+    u8_t           level;
+
+    delta = tick - now_tick;
+    for (level = 0; level < SCHED_WHEEL_LEVELS - 1; level++) {
+        if (delta < ((sched_time_t)1 << (SCHED_WHEEL_BITS * (level + 1)))) {
+            break;
+        }
+    }
+    if (delta >= ((sched_time_t)1 << (SCHED_WHEEL_BITS * SCHED_WHEEL_LEVELS))) {
+        tick        = now_tick + ((sched_time_t)1 << (SCHED_WHEEL_BITS * SCHED_WHEEL_LEVELS)) - 1;
+        e->due_tick = tick;
+    }
+    e->level = level;
+    e->slot  = (tick >> (SCHED_WHEEL_BITS * level)) & SCHED_WHEEL_MASK;
+    e->prev  = SCHED_NO_ENTRY;
+    e->next  = wheel[level][e->slot];
+    if (e->next != SCHED_NO_ENTRY) {
+        entries[e->next].prev = id;
+    }
+    wheel[level][e->slot] = id;
+}
+void Scheduler::wheel_unlink(u32_t id)
+{
+    sched_entry_t *e = &entries[id];
+
+    if (e->prev != SCHED_NO_ENTRY) {
+        entries[e->prev].next = e->next;
+    } else {
+        wheel[e->level][e->slot] = e->next;
+    }
+    if (e->next != SCHED_NO_ENTRY) {
+        entries[e->next].prev = e->prev;
+    }
+}
+void Scheduler::wheel_cascade(u8_t level)
+{
+    u8_t  slot = (now_tick >> (SCHED_WHEEL_BITS * level)) & SCHED_WHEEL_MASK;
+    u32_t id   = wheel[level][slot];
+    u32_t next;
+
+    wheel[level][slot] = SCHED_NO_ENTRY;
+    for (; id != SCHED_NO_ENTRY; id = next) {
+        next = entries[id].next;
+        wheel_insert(id);
+    }
+}
+u32_t Scheduler::wheel_expire(void)
+{
+    u8_t         slot   = now_tick & SCHED_WHEEL_MASK;
+    u32_t        id     = wheel[0][slot];
+    sched_time_t now_us = clock_us();
+    u32_t        count  = 0;
+    sched_time_t due_us, late;
+    u32_t        next;
+    u8_t         bucket;
+
+    wheel[0][slot] = SCHED_NO_ENTRY;
+    for (; id != SCHED_NO_ENTRY; id = next) {
+        next = entries[id].next;
+        /* From the entry's own deadline, run_entry() moves it to the next one */
+        due_us = start_us + entries[id].due_tick * SCHED_TICK_US;
+        late   = (now_us > due_us) ? now_us - due_us : 0;
+        for (bucket = 0; bucket < SCHED_LATENESS_BUCKETS - 1 && (late >> bucket) != 0; bucket++) {
+        }
+        stats.buckets[bucket]++;
+        if (late > stats.max_us) {
+            stats.max_us = late;
+        }
+        run_entry(id, now_us);
+        count++;
+    }
+    stats.wakeups += count;
+    return count;
+}
+u32_t Scheduler::wheel_next_delta(void)
+{
+    u32_t delta;
+    u8_t  slot;
+
+    /* Never look past the next level 1 boundary, entries may cascade down to level 0 there */
+    for (delta = 1; delta < SCHED_WHEEL_SLOTS; delta++) {
+        slot = (now_tick + delta) & SCHED_WHEEL_MASK;
+        if (slot == 0 || wheel[0][slot] != SCHED_NO_ENTRY) {
+            break;
+        }
+    }
+    return delta;
+}
+void Scheduler::run_entry(u32_t id, sched_time_t now_us)
+{
+    sched_entry_t *e  = &entries[id];
+    cpu_state_t   *st = e->state;
+    u32_t          target;
+
+    /* Emulated time is derived from wall-clock time since the instance was added, late wakeups catch up */
+    target = e->epoch_ticks + (u32_t)((now_us - e->epoch_us) * TICK_FREQUENCY / 1000000);
+    cpu->cpu_bind_state(st);
+    write_begin(e);
+    while ((int32_t)(target - st->tick_counter) > 0) {
+        if (cpu->cpu_step()) {
+            /* Invalid opcode: the instance is dead, drop it from the wheel */
+            write_end(e);
+            e->active = 0;
+            e->next   = free;
+            free      = id;
+            used--;
+            return;
+        }
+    }
+    write_end(e);
+    e->due_tick = now_tick + quantum_us / SCHED_TICK_US;
+    wheel_insert(id);
+}
+u32_t Scheduler::scheduler_poll(void)
+{
+    sched_time_t now_us = clock_us();
+    sched_time_t target = (now_us - start_us) / SCHED_TICK_US;
+    u32_t        count  = 0;
+    u8_t         level;
+
+    while (now_tick < target) {
+        now_tick++;
+        for (level = SCHED_WHEEL_LEVELS - 1; level > 0; level--) {
+            if ((now_tick & (((sched_time_t)1 << (SCHED_WHEEL_BITS * level)) - 1)) == 0) {
+                wheel_cascade(level);
+            }
+        }
+        count += wheel_expire();
+    }
+    stats.busy_us += clock_us() - now_us;
+    return count;
+}
+void Scheduler::scheduler_run(volatile bool_t *stop)
+{
+    struct timespec t;
+    sched_time_t    wake_us;
+
+    while (!*stop) {
+        scheduler_poll();
+        wake_us   = start_us + (now_tick + wheel_next_delta()) * SCHED_TICK_US;
+        t.tv_sec  = wake_us / 1000000;
+        t.tv_nsec = (wake_us % 1000000) * 1000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+    }
+}
+const sched_stats_t *Scheduler::scheduler_get_stats(void)
+{
+    stats.elapsed_us = clock_us() - stats_us;
+    return &stats;
+}
+void Scheduler::scheduler_reset_stats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+    stats_us = clock_us();
+}
+/* Replaces the monotonic clock, before any instance is added; scheduler_run() still sleeps on the real one */
+void Scheduler::scheduler_set_clock(clock_fn_t fn)
+{
+    clock_us = fn;
+    start_us = clock_us();
+    scheduler_reset_stats();
+}
@@ -0,0 +1,100 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "cpu.h"
+#include "program.h"
+#include "query.h"
+
+
+#define SCHED_WHEEL_LEVELS       4
+#define SCHED_WHEEL_BITS         6
+#define SCHED_WHEEL_SLOTS        (1 << SCHED_WHEEL_BITS)
+#define SCHED_WHEEL_MASK         (SCHED_WHEEL_SLOTS - 1)
+#define SCHED_TICK_US            1000
+#define SCHED_DEFAULT_QUANTUM_US 10000
+#define SCHED_LATENESS_BUCKETS   24
+#define SCHED_NO_ENTRY           0xFFFFFFFF
+
+typedef uint64_t sched_time_t;
+
+typedef struct
+{
+    cpu_state_t       *state;
+    sched_time_t       epoch_us;
+    u32_t              epoch_ticks;
+    sched_time_t       due_tick;
+    u32_t              next;
+    u32_t              prev;
+    u8_t               level;
+    u8_t               slot;
+    bool_t             active;
+    std::atomic<u32_t> seq; /* Odd while the state is being run, see RamQuery */
+} sched_entry_t;
+
+typedef struct
+{
+    u32_t        buckets[SCHED_LATENESS_BUCKETS];
+    uint64_t     wakeups;
+    sched_time_t max_us;
+    sched_time_t busy_us;
+    sched_time_t elapsed_us;
+} sched_stats_t;
+
+
+/*
+ * Real-time (1x) fleet runner: every instance sleeps in a hierarchical timer wheel until its next wakeup,
+ * then one headless CPU catches its state up to wall-clock time in a single batch and schedules it again
+ * one quantum later. Lateness of each wakeup is recorded in a log2 histogram (bucket n holds wakeups
+ * that were [2^(n-1), 2^n) us late, the last bucket everything beyond).
+ */
+class Scheduler {
+  public:
+    typedef sched_time_t (*clock_fn_t)(void);
+
+  private:
+    CPU           *cpu      = 0;
+    sched_entry_t *entries  = 0;
+    u32_t          capacity = 0;
+    u32_t          used     = 0;
+    u32_t          free     = SCHED_NO_ENTRY;
+    u32_t          quantum_us;
+    sched_time_t   start_us;
+    sched_time_t   stats_us;
+    sched_time_t   now_tick = 0;
+    u32_t          wheel[SCHED_WHEEL_LEVELS][SCHED_WHEEL_SLOTS];
+    sched_stats_t  stats;
+    clock_fn_t     clock_us = &get_time_us;
+
+  public:
+    Scheduler(u32_t _capacity, u32_t _quantum_us);
+    ~Scheduler();
+
+    bool_t scheduler_init(Program *program);
+    u32_t  scheduler_add(cpu_state_t *state);
+    void   scheduler_remove(u32_t id);
+    void   scheduler_set_input_pin(u32_t id, pin_t pin, pin_state_t state);
+    u32_t  scheduler_get_used(void);
+    u32_t  scheduler_query(RamQuery *query, std::vector<u32_t> *ids);
+
+    u32_t scheduler_poll(void);
+    void  scheduler_run(volatile bool_t *stop);
+
+    const sched_stats_t *scheduler_get_stats(void);
+    void                 scheduler_reset_stats(void);
+    void                 scheduler_set_clock(clock_fn_t fn);
+
+  private:
+    static sched_time_t get_time_us(void);
+
+    void  wheel_insert(u32_t id);
+    void  wheel_unlink(u32_t id);
+    void  wheel_cascade(u8_t level);
+    u32_t wheel_expire(void);
+    u32_t wheel_next_delta(void);
+    void  run_entry(u32_t id, sched_time_t now_us);
+    void  write_begin(sched_entry_t *e);
+    void  write_end(sched_entry_t *e);
+};
+#endif
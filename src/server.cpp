@@ -0,0 +1,388 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "server.h"
+
+
+Server::Server(u32_t capacity) : arena(sizeof(srv_instance_t), capacity)
+{
+}
+Server::~Server()
+{
+    while (!clients.empty()) {
+        close_client(clients.size() - 1);
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(path);
+    }
+    if (program) {
+        program->program_release();
+    }
+}
+bool_t Server::server_init(Program *_program, const char *_path)
+{
+    struct sockaddr_un addr;
+
+    if (arena.arena_get_capacity() == 0 || strlen(_path) >= sizeof(addr.sun_path)) {
+        return 1;
+    }
+    program = _program->program_acquire();
+    path    = _path;
+    cpu.cpu_init(program, NULL, 1000000);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        return 1;
+    }
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, SRV_MAX_CLIENTS) != 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        return 1;
+    }
+    return 0;
+}
+Server::srv_instance_t *Server::get_instance(u32_t id)
+{
+    srv_instance_t *inst = (srv_instance_t *)arena.arena_at(id);
+    return (inst && inst->alive) ? inst : NULL;
+}
+void Server::accept_client(void)
+{
+    srv_client_t *client;
+    int           fd;
+
+    while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if (clients.size() >= SRV_MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+        client     = new srv_client_t;
+        client->fd = fd;
+        clients.push_back(client);
+    }
+}
+void Server::close_client(u32_t n)
+{
+    close(clients[n]->fd);
+    delete clients[n];
+    clients.erase(clients.begin() + n);
+}
+bool_t Server::read_client(srv_client_t *client)
+{
+    srv_frame_t frame;
+    size_t      used = 0;
+    size_t      size;
+    ssize_t     res;
+
+    for (;;) {
+        size = client->in.size();
+        client->in.resize(size + SRV_READ_CHUNK);
+        res = recv(client->fd, client->in.data() + size, SRV_READ_CHUNK, 0);
+        client->in.resize(size + ((res > 0) ? res : 0));
+        if (res == 0) {
+            return 1;
+        }
+        if (res < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return 1;
+        }
+    }
+
+    /* Handle every complete frame, a partial one stays buffered until the rest arrives */
+    while (client->in.size() - used >= sizeof(srv_frame_t)) {
+        /* Frames follow each other at any byte offset of the buffer */
+        memcpy(&frame, client->in.data() + used, sizeof(frame));
+        if (frame.magic != SRV_MAGIC || frame.type != SRV_FRAME_REQUEST || frame.size > SRV_MAX_FRAME_SIZE) {
+            return 1;
+        }
+        if (client->in.size() - used < sizeof(srv_frame_t) + frame.size) {
+            break;
+        }
+        handle_frame(client, &frame, client->in.data() + used + sizeof(srv_frame_t));
+        used += sizeof(srv_frame_t) + frame.size;
+    }
+    client->in.erase(client->in.begin(), client->in.begin() + used);
+    return 0;
+}
+bool_t Server::write_client(srv_client_t *client)
+{
+    size_t  sent = 0;
+    ssize_t res;
+
+    while (sent < client->out.size()) {
+        res = send(client->fd, client->out.data() + sent, client->out.size() - sent, MSG_NOSIGNAL);
+        if (res < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return 1;
+        }
+        sent += res;
+    }
+    client->out.erase(client->out.begin(), client->out.begin() + sent);
+    return 0;
+}
+void Server::handle_frame(srv_client_t *client, const srv_frame_t *frame, const u8_t *data)
+{
+    std::vector<u8_t> &out    = client->out;
+    size_t             header = out.size();
+    size_t             at     = 0;
+    srv_frame_t        reply_frame;
+    srv_cmd_t          cmd;
+    srv_reply_t        reply;
+    size_t             rec;
+    uint16_t           n;
+
+    out.resize(header + sizeof(srv_frame_t));
+    for (n = 0; n < frame->count; n++) {
+        if (frame->size - at < sizeof(srv_cmd_t)) {
+            break;
+        }
+        memcpy(&cmd, data + at, sizeof(cmd));
+        at += sizeof(cmd);
+        if (frame->size - at < cmd.size) {
+            break;
+        }
+
+        /* Reply data is appended by handle_cmd right after the record, its size patched in afterwards */
+        rec = out.size();
+        out.resize(rec + sizeof(srv_reply_t));
+        memset(&reply, 0, sizeof(reply));
+        reply.op     = cmd.op;
+        reply.inst   = cmd.inst;
+        reply.status = handle_cmd(client, &cmd, data + at, &reply);
+        reply.size   = out.size() - rec - sizeof(srv_reply_t);
+        memcpy(out.data() + rec, &reply, sizeof(reply));
+        at += cmd.size;
+    }
+    reply_frame.magic = SRV_MAGIC;
+    reply_frame.type  = SRV_FRAME_REPLY;
+    reply_frame.count = n;
+    reply_frame.size  = out.size() - header - sizeof(srv_frame_t);
+    memcpy(out.data() + header, &reply_frame, sizeof(reply_frame));
+}
+u8_t Server::handle_cmd(srv_client_t *client, const srv_cmd_t *cmd, const u8_t *payload, srv_reply_t *reply)
+{
+    static const pin_t  pins[3] = {PIN_K02, PIN_K01, PIN_K00};
+    std::vector<u8_t>  &out     = client->out;
+    srv_instance_t     *inst    = NULL;
+    lcd_bitmap_t        bitmap;
+    cpu_save_t          save;
+    size_t              at;
+    u32_t               start, changes, n;
+
+    if (cmd->op >= SRV_OP_NUM) {
+        return SRV_ERR_OP;
+    }
+    if (cmd->op == SRV_OP_CREATE) {
+        inst = (srv_instance_t *)arena.arena_alloc();
+        if (inst == NULL) {
+            return SRV_ERR_FULL;
+        }
+        CPU::cpu_init_state(&inst->state);
+        inst->state.inputs[0].states = 0x7;
+        inst->alive                  = 1;
+        inst->dirty                  = 0;
+        reply->inst                  = arena.arena_index(inst);
+        return SRV_OK;
+    }
+    inst = get_instance(cmd->inst);
+    if (inst == NULL) {
+        return SRV_ERR_INSTANCE;
+    }
+    switch (cmd->op) {
+        case SRV_OP_DESTROY:
+            for (srv_client_t *c : clients) {
+                c->subs.erase(cmd->inst);
+            }
+            inst->alive = 0;
+            arena.arena_free(inst);
+            break;
+
+        case SRV_OP_BUTTON:
+            if (cmd->flags >= 3) {
+                return SRV_ERR_ARG;
+            }
+            cpu.cpu_bind_state(&inst->state);
+            cpu.cpu_set_input_pin(pins[cmd->flags], cmd->arg ? PIN_STATE_LOW : PIN_STATE_HIGH);
+            break;
+
+        case SRV_OP_RUN:
+            /* Tick arithmetic is modulo 2^32, longer runs would compare as already done */
+            if (cmd->arg >= 0x80000000) {
+                return SRV_ERR_ARG;
+            }
+            cpu.cpu_bind_state(&inst->state);
+            start   = inst->state.tick_counter;
+            changes = cpu.cpu_get_lcd_changes();
+            while ((int32_t)(start + cmd->arg - inst->state.tick_counter) > 0) {
+                if (cpu.cpu_step()) {
+                    break;
+                }
+            }
+            n = inst->state.tick_counter - start;
+            out.insert(out.end(), (const u8_t *)&n, (const u8_t *)&n + sizeof(n));
+            if (cpu.cpu_get_lcd_changes() != changes && !inst->dirty) {
+                inst->dirty = 1;
+                dirty.push_back(cmd->inst);
+            }
+            if ((int32_t)(start + cmd->arg - inst->state.tick_counter) > 0) {
+                return SRV_ERR_HALTED;
+            }
+            break;
+
+        case SRV_OP_GET_FRAME:
+            CPU::cpu_render_lcd(&inst->state, &bitmap);
+            out.insert(out.end(), (const u8_t *)bitmap.rows, (const u8_t *)bitmap.rows + sizeof(bitmap.rows));
+            out.push_back(bitmap.icons);
+            break;
+
+        case SRV_OP_GET_RAM:
+            if (cmd->arg > 0x1000 || cmd->addr > 0x1000 - cmd->arg) {
+                return SRV_ERR_ARG;
+            }
+            at = out.size();
+            out.resize(at + cmd->arg);
+            for (n = 0; n < cmd->arg; n++) {
+                out[at + n] = GET_MEMORY(inst->state.memory, (u12_t)(cmd->addr + n));
+            }
+            break;
+
+        case SRV_OP_SNAPSHOT:
+            CPU::cpu_render_lcd(&inst->state, &save.lcd);
+            CPU::cpu_encode_state(&inst->state, &save.lcd, &save);
+            out.insert(out.end(), (const u8_t *)&save, (const u8_t *)&save + sizeof(save));
+            break;
+
+        case SRV_OP_RESTORE:
+            if (CPU::cpu_decode_state(payload, cmd->size, &inst->state, NULL)) {
+                return SRV_ERR_ARG;
+            }
+            if (!inst->dirty) {
+                inst->dirty = 1;
+                dirty.push_back(cmd->inst);
+            }
+            break;
+
+        case SRV_OP_SUBSCRIBE:
+            if (cmd->arg) {
+                client->subs.insert(cmd->inst);
+            } else {
+                client->subs.erase(cmd->inst);
+            }
+            break;
+    }
+    return SRV_OK;
+}
+void Server::notify(void)
+{
+    srv_instance_t *inst;
+    lcd_bitmap_t    bitmap;
+    srv_frame_t     frame;
+    srv_reply_t     reply;
+    size_t          header;
+
+    /* One notification frame per client, carrying every changed instance it subscribed to */
+    for (srv_client_t *client : clients) {
+        if (client->subs.empty()) {
+            continue;
+        }
+        header = client->out.size();
+        client->out.resize(header + sizeof(frame));
+        frame.magic = SRV_MAGIC;
+        frame.type  = SRV_FRAME_NOTIFY;
+        frame.count = 0;
+        for (u32_t id : dirty) {
+            inst = get_instance(id);
+            if (inst == NULL || !client->subs.count(id)) {
+                continue;
+            }
+            CPU::cpu_render_lcd(&inst->state, &bitmap);
+            memset(&reply, 0, sizeof(reply));
+            reply.op   = SRV_OP_SUBSCRIBE;
+            reply.inst = id;
+            reply.size = SRV_LCD_FRAME_SIZE;
+            client->out.insert(client->out.end(), (const u8_t *)&reply, (const u8_t *)&reply + sizeof(reply));
+            client->out.insert(client->out.end(), (const u8_t *)bitmap.rows,
+                               (const u8_t *)bitmap.rows + sizeof(bitmap.rows));
+            client->out.push_back(bitmap.icons);
+            frame.count++;
+        }
+        if (frame.count == 0) {
+            client->out.resize(header);
+            continue;
+        }
+        frame.size = client->out.size() - header - sizeof(frame);
+        memcpy(client->out.data() + header, &frame, sizeof(frame));
+    }
+    for (u32_t id : dirty) {
+        inst = (srv_instance_t *)arena.arena_at(id);
+        if (inst) {
+            inst->dirty = 0;
+            if (publisher && inst->alive) {
+                publisher->publisher_write_state(id, &inst->state);
+            }
+        }
+    }
+    dirty.clear();
+}
+void Server::server_poll(int timeout_ms)
+{
+    std::vector<struct pollfd> fds(clients.size() + 1);
+    u32_t                      n;
+
+    fds[0].fd     = listen_fd;
+    fds[0].events = POLLIN;
+    for (n = 0; n < clients.size(); n++) {
+        fds[n + 1].fd     = clients[n]->fd;
+        fds[n + 1].events = POLLIN | (clients[n]->out.empty() ? 0 : POLLOUT);
+    }
+    if (poll(fds.data(), fds.size(), timeout_ms) <= 0) {
+        return;
+    }
+    if (fds[0].revents & POLLIN) {
+        accept_client();
+    }
+
+    /* Clients are walked backwards so that closing one does not shift the ones still to visit */
+    for (n = fds.size() - 1; n > 0; n--) {
+        if ((fds[n].revents & (POLLIN | POLLHUP | POLLERR)) && read_client(clients[n - 1])) {
+            close_client(n - 1);
+        }
+    }
+    if (!dirty.empty()) {
+        notify();
+    }
+    for (n = clients.size(); n > 0; n--) {
+        if (!clients[n - 1]->out.empty() && write_client(clients[n - 1])) {
+            close_client(n - 1);
+        }
+    }
+}
+void Server::server_set_publisher(FramePublisher *_publisher)
+{
+    publisher = _publisher;
+}
+void Server::server_run(volatile bool_t *stop)
+{
+    while (!*stop) {
+        server_poll(100);
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+#include <stdint.h>
+#include <unordered_set>
+#include <vector>
+#include "cpu.h"
+#include "program.h"
+#include "arena.h"
+#include "publisher.h"
+#include "server_proto.h"
+
+
+#define SRV_DEFAULT_CAPACITY 65536
+#define SRV_MAX_CLIENTS      64
+#define SRV_READ_CHUNK       65536
+
+
+/*
+ * Long-lived process serving many headless pets to local clients over a Unix domain socket.
+ * Single threaded: one poll() loop, one CPU executor bound to each instance state in turn, instance states
+ * allocated from an Arena. Commands are batched per frame (see server_proto.h), so the syscall and wakeup
+ * cost of a request is shared by every command it carries.
+ */
+class Server {
+  private:
+    typedef struct
+    {
+        cpu_state_t state;
+        bool_t      alive;
+        bool_t      dirty;
+    } srv_instance_t;
+
+    typedef struct
+    {
+        int                       fd;
+        std::vector<u8_t>         in;
+        std::vector<u8_t>         out;
+        std::unordered_set<u32_t> subs;
+    } srv_client_t;
+
+  private:
+    CPU                         cpu{nullptr};
+    Arena                       arena;
+    Program                    *program   = 0;
+    int                         listen_fd = -1;
+    const char                 *path      = 0;
+    FramePublisher             *publisher = 0;
+    std::vector<srv_client_t *> clients;
+    std::vector<u32_t>          dirty;
+
+  public:
+    Server(u32_t capacity);
+    ~Server();
+
+    bool_t server_init(Program *_program, const char *_path);
+    void   server_poll(int timeout_ms);
+    void   server_run(volatile bool_t *stop);
+    void   server_set_publisher(FramePublisher *_publisher);
+
+  private:
+    srv_instance_t *get_instance(u32_t id);
+
+    void   accept_client(void);
+    void   close_client(u32_t n);
+    bool_t read_client(srv_client_t *client);
+    bool_t write_client(srv_client_t *client);
+
+    void handle_frame(srv_client_t *client, const srv_frame_t *frame, const u8_t *data);
+    u8_t handle_cmd(srv_client_t *client, const srv_cmd_t *cmd, const u8_t *payload, srv_reply_t *reply);
+    void notify(void);
+};
+#endif
@@ -0,0 +1,77 @@
+#ifndef _SERVER_PROTO_H_
+#define _SERVER_PROTO_H_
+#include <stdint.h>
+
+
+/*
+ * Wire format of the Unix socket server, in host byte order (clients are local).
+ * Every message is a frame header followed by `size` bytes of records:
+ *   client -> server  SRV_FRAME_REQUEST  `count` x (srv_cmd_t + cmd.size payload bytes)
+ *   server -> client  SRV_FRAME_REPLY    `count` x (srv_reply_t + reply.size bytes), one per command, in order
+ *   server -> client  SRV_FRAME_NOTIFY   `count` x (srv_reply_t + SRV_LCD_FRAME_SIZE bytes) for subscribed
+ *                                        instances whose display changed while processing the last request
+ * A snapshot is a cpu_save_t image (versioned, little-endian), see cpu.h.
+ */
+
+#define SRV_MAGIC          0x36433045 /* "E0C6" */
+#define SRV_MAX_FRAME_SIZE (16 * 1024 * 1024)
+#define SRV_LCD_FRAME_SIZE (16 * 4 + 1)
+
+typedef enum
+{
+    SRV_FRAME_REQUEST = 0,
+    SRV_FRAME_REPLY,
+    SRV_FRAME_NOTIFY,
+} srv_frame_type_t;
+
+typedef enum
+{
+    SRV_OP_CREATE = 0, /* -> u32 instance id */
+    SRV_OP_DESTROY,    /* inst */
+    SRV_OP_BUTTON,     /* inst, flags = button (0 left, 1 middle, 2 right), arg = pressed */
+    SRV_OP_RUN,        /* inst, arg = clock cycles (< 2^31) -> u32 cycles run */
+    SRV_OP_GET_FRAME,  /* inst -> 16 x u32 rows (bit x = column x) + u8 icons */
+    SRV_OP_GET_RAM,    /* inst, addr = first nibble address, arg = nibble count -> one nibble per byte */
+    SRV_OP_SNAPSHOT,   /* inst -> cpu_save_t */
+    SRV_OP_RESTORE,    /* inst, payload = cpu_save_t */
+    SRV_OP_SUBSCRIBE,  /* inst, arg = 1 to get LCD change notifications, 0 to stop */
+    SRV_OP_NUM,
+} srv_op_t;
+
+typedef enum
+{
+    SRV_OK = 0,
+    SRV_ERR_OP,
+    SRV_ERR_INSTANCE,
+    SRV_ERR_ARG,
+    SRV_ERR_FULL,
+    SRV_ERR_HALTED,
+} srv_status_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t type;
+    uint16_t count;
+    uint32_t size;
+} srv_frame_t;
+
+typedef struct
+{
+    uint8_t  op;
+    uint8_t  flags;
+    uint16_t addr;
+    uint32_t inst;
+    uint32_t arg;
+    uint32_t size;
+} srv_cmd_t;
+
+typedef struct
+{
+    uint8_t  op;
+    uint8_t  status;
+    uint16_t reserved;
+    uint32_t inst;
+    uint32_t size;
+} srv_reply_t;
+#endif
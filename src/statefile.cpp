@@ -0,0 +1,212 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "statefile.h"
+
+
+static_assert(sizeof(statefile_header_t) <= STATEFILE_HEADER_SIZE, "statefile header must fit its page");
+
+StateFile::~StateFile()
+{
+    statefile_close();
+}
+bool_t StateFile::statefile_open(const char *path, u32_t count)
+{
+    struct stat sb;
+    void       *p;
+    int         fd;
+    u32_t       i;
+
+    statefile_close();
+    if (count == 0) {
+        return 1;
+    }
+    length = STATEFILE_HEADER_SIZE + (size_t)count * sizeof(statefile_slot_t);
+    fd     = open(path, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        return 1;
+    }
+    if (fstat(fd, &sb) != 0 || (sb.st_size == 0 && ftruncate(fd, length) != 0)) {
+        close(fd);
+        return 1;
+    }
+    if (sb.st_size != 0 && (size_t)sb.st_size != length) {
+        close(fd);
+        return 1;
+    }
+    mtime = sb.st_mtime;
+    p     = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return 1;
+    }
+    header  = (statefile_header_t *)p;
+    slots   = (statefile_slot_t *)((u8_t *)p + STATEFILE_HEADER_SIZE);
+    lost    = 0;
+    created = header->magic == 0;
+    if (created) {
+        /* New file, or one whose creation did not complete */
+        memset(p, 0, length);
+        for (i = 0; i < count; i++) {
+            CPU::cpu_init_state(&slots[i].state);
+            slots[i].sum = checksum(&slots[i].state);
+        }
+        header->version     = STATEFILE_VERSION;
+        header->header_size = STATEFILE_HEADER_SIZE;
+        header->state_size  = sizeof(cpu_state_t);
+        header->slots       = count;
+        header->slot_size   = sizeof(statefile_slot_t);
+        msync(slots, length - STATEFILE_HEADER_SIZE, MS_SYNC);
+        header->magic = STATEFILE_MAGIC;
+        msync(header, STATEFILE_HEADER_SIZE, MS_SYNC);
+        return 0;
+    }
+    if (header->magic != STATEFILE_MAGIC || header->version != STATEFILE_VERSION ||
+        header->header_size != STATEFILE_HEADER_SIZE || header->state_size != sizeof(cpu_state_t) ||
+        header->slots != count || header->slot_size != sizeof(statefile_slot_t)) {
+        statefile_close();
+        return 1;
+    }
+    for (i = 0; i < count; i++) {
+        recover(&slots[i]);
+    }
+    return 0;
+}
+void StateFile::statefile_close(void)
+{
+    if (header == 0) {
+        return;
+    }
+    /* Unmapping a shared mapping loses nothing, the page cache writes it back */
+    munmap(header, length);
+    header = 0;
+    slots  = 0;
+}
+u32_t StateFile::statefile_get_slots(void)
+{
+    return header ? header->slots : 0;
+}
+/* The file was (re)initialized by the last open, all slots hold fresh states */
+bool_t StateFile::statefile_is_created(void)
+{
+    return created;
+}
+/* Slots the last open could not recover and reinitialized */
+u32_t StateFile::statefile_get_lost(void)
+{
+    return lost;
+}
+/* When the file was last written before the last open, i.e. when its instances last ran */
+time_t StateFile::statefile_get_mtime(void)
+{
+    return mtime;
+}
+uint64_t StateFile::statefile_get_generation(void)
+{
+    return header ? header->generation : 0;
+}
+cpu_state_t *StateFile::statefile_get_state(u32_t slot)
+{
+    if (header == 0 || slot >= header->slots) {
+        return NULL;
+    }
+    return &slots[slot].state;
+}
+void StateFile::statefile_begin(u32_t slot)
+{
+    statefile_slot_t *s = &slots[slot];
+
+    if ((s->seq & 1) == 0) {
+        __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+    }
+}
+void StateFile::statefile_end(u32_t slot)
+{
+    statefile_slot_t *s = &slots[slot];
+
+    if (s->seq & 1) {
+        s->sum = checksum(&s->state);
+        __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+    }
+}
+/*
+ * Checkpoints every slot that is at an instruction boundary and flushes the file. Slots unchanged since
+ * their newest copy are skipped, so idle instances cost no write-back. Without `wait` the flush is only
+ * scheduled; the checksums make the result safe either way. Returns 1 if the flush failed.
+ */
+bool_t StateFile::statefile_sync(bool_t wait)
+{
+    statefile_slot_t *s;
+    statefile_copy_t *newest, *oldest;
+    uint64_t          gen;
+    u32_t             i;
+    bool_t            res = 0;
+
+    if (header == 0) {
+        return 1;
+    }
+    gen = header->generation + 1;
+    for (i = 0; i < header->slots; i++) {
+        s = &slots[i];
+        if (s->seq & 1) {
+            continue;
+        }
+        newest = &s->copies[s->copies[1].generation > s->copies[0].generation];
+        oldest = &s->copies[s->copies[1].generation <= s->copies[0].generation];
+        if (newest->generation != 0 && newest->sum == s->sum) {
+            continue;
+        }
+        oldest->state      = s->state;
+        oldest->sum        = s->sum;
+        oldest->generation = gen;
+    }
+    res |= msync(slots, length - STATEFILE_HEADER_SIZE, wait ? MS_SYNC : MS_ASYNC) != 0;
+    header->generation = gen;
+    res |= msync(header, STATEFILE_HEADER_SIZE, wait ? MS_SYNC : MS_ASYNC) != 0;
+    return res;
+}
+/* FNV-1a over 64-bit words with a fold after each one, the tail word padded with zeros */
+u32_t StateFile::checksum(const cpu_state_t *state)
+{
+    const u8_t *p = (const u8_t *)state;
+    uint64_t    h = 0xCBF29CE484222325ULL;
+    uint64_t    w;
+    u32_t       i;
+
+    for (i = 0; i < sizeof(cpu_state_t); i += 8) {
+        w = 0;
+        memcpy(&w, p + i, sizeof(cpu_state_t) - i < 8 ? sizeof(cpu_state_t) - i : 8);
+        h = (h ^ w) * 0x100000001B3ULL;
+        h ^= h >> 32;
+    }
+    return (u32_t)h;
+}
+void StateFile::recover(statefile_slot_t *s)
+{
+    statefile_copy_t *best = NULL;
+    u8_t              i;
+
+    if ((s->seq & 1) == 0 && checksum(&s->state) == s->sum && !CPU::cpu_check_state(&s->state)) {
+        return;
+    }
+    for (i = 0; i < 2; i++) {
+        if (s->copies[i].generation == 0 || checksum(&s->copies[i].state) != s->copies[i].sum ||
+            CPU::cpu_check_state(&s->copies[i].state)) {
+            continue;
+        }
+        if (best == NULL || s->copies[i].generation > best->generation) {
+            best = &s->copies[i];
+        }
+    }
+    if (best) {
+        s->state = best->state;
+    } else {
+        CPU::cpu_init_state(&s->state);
+        lost++;
+    }
+    s->state.dirty = MEM_PAGES_ALL;
+    s->sum         = checksum(&s->state);
+    s->seq         = (s->seq + 1) & ~1U;
+}
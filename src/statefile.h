@@ -0,0 +1,86 @@
+#ifndef _STATEFILE_H_
+#define _STATEFILE_H_
+#include <stdint.h>
+#include <time.h>
+#include "cpu.h"
+
+
+#define STATEFILE_MAGIC       0x46533645 /* "E6SF" */
+#define STATEFILE_VERSION     1
+#define STATEFILE_HEADER_SIZE 4096 /* Own page, so that it is flushed separately from the slots */
+
+/*
+ * On-disk layout, host byte order (the magic doubles as the byte order check): a header page followed by
+ * `slots` cache line aligned slots. Instances run directly on a slot's `state`, which the kernel writes
+ * back whenever it likes; `seq` is odd while the instance is being run and `sum` checksums `state` as of the
+ * last time `seq` turned even. statefile_sync() copies the consistent live states into the older of the
+ * two `copies`, stamped with the new generation, then msyncs the slots before the header.
+ */
+typedef struct
+{
+    u32_t    magic;
+    uint16_t version;
+    uint16_t header_size;
+    u32_t    state_size;
+    u32_t    slots;
+    u32_t    slot_size;
+    u32_t    pad;
+    uint64_t generation; /* Last sync that completed */
+} statefile_header_t;
+
+typedef struct
+{
+    uint64_t    generation;
+    u32_t       sum;
+    u32_t       pad;
+    cpu_state_t state;
+} statefile_copy_t;
+
+typedef struct alignas(64)
+{
+    u32_t            seq;
+    u32_t            sum;
+    cpu_state_t      state;
+    statefile_copy_t copies[2];
+} statefile_slot_t;
+
+
+/*
+ * Instance states kept in a memory-mapped file, so that a restart is an mmap and a checksum per slot.
+ * Runs of an instance must be bracketed by statefile_begin()/statefile_end(), both at instruction
+ * boundaries. On open each slot takes its live state if it was left between runs and its checksum holds
+ * (a process that died between runs, or a power loss after its pages were written back), else the newest
+ * intact copy (died mid-run or torn pages: back to the last sync), else a fresh state.
+ */
+class StateFile {
+  private:
+    statefile_header_t *header  = 0;
+    statefile_slot_t   *slots   = 0;
+    size_t              length  = 0;
+    bool_t              created = 0;
+    u32_t               lost    = 0;
+    time_t              mtime   = 0;
+
+  public:
+    ~StateFile();
+
+    bool_t statefile_open(const char *path, u32_t count);
+    void   statefile_close(void);
+    u32_t  statefile_get_slots(void);
+    bool_t statefile_is_created(void);
+    u32_t  statefile_get_lost(void);
+    time_t statefile_get_mtime(void);
+
+    uint64_t     statefile_get_generation(void);
+    cpu_state_t *statefile_get_state(u32_t slot);
+
+    void   statefile_begin(u32_t slot);
+    void   statefile_end(u32_t slot);
+    bool_t statefile_sync(bool_t wait);
+
+  private:
+    static u32_t checksum(const cpu_state_t *state);
+
+    void recover(statefile_slot_t *s);
+};
+#endif
@@ -7,8 +7,12 @@
 #include <getopt.h>
 #include <time.h>
 #include "tamago.h"
-
-extern Tamago *tamgo;
+#include "program.h"
+#include "publisher.h"
+#include "rewind.h"
+#include "statefile.h"
+#include "journal.h"
+#include "movie.h"
 
 
 void *Tamago::hal_malloc(u32_t size)
@@ -19,9 +23,14 @@ void Tamago::hal_free(void *ptr)
 {
     SDL_free(ptr);
 }
+/* Emulator thread: leaves tamalib_mainloop and has the main thread shut down as if the window was closed */
 void Tamago::hal_halt(void)
 {
-    exit(EXIT_SUCCESS);
+    SDL_Event event = {};
+
+    emu_quit.store(1, std::memory_order_release);
+    event.type = SDL_QUIT;
+    SDL_PushEvent(&event);
 }
 timestamp_t Tamago::hal_get_timestamp(void)
 {
@@ -39,46 +48,39 @@ void Tamago::hal_sleep_until(timestamp_t ts)
         nanosleep(&t, NULL);
     }
 }
-void Tamago::hal_update_screen(void)
+/*
+ * Main thread only. Four draw calls per frame: the background, the dot matrix uploaded as one streaming
+ * texture of precomputed cells, the icons as one batch of textured quads, and the present.
+ */
+void Tamago::hal_update_screen(const lcd_bitmap_t *bitmap)
 {
-    unsigned int i, j;
-    SDL_Rect     r, src_icon_r, dest_icon_r;
-    SDL_RenderCopy(renderer, bg, NULL, &bg_rect);
-    for (j = 0; j < LCD_HEIGHT; j++) {
-        for (i = 0; i < LCD_WIDTH; i++) {
-            r.w = PIXEL_SIZE;
-            r.h = PIXEL_SIZE;
-            r.x = i * DEFAULT_PIXEL_STRIDE + LCD_OFFSET_X;
-            r.y = j * DEFAULT_PIXEL_STRIDE + LCD_OFFSET_Y;
-            if (matrix_buffer[j][i]) {
-                SDL_SetRenderDrawColor(renderer, 0, 0, 128, DEFAULT_LCD_ALPHA_ON);
-            } else {
-                SDL_SetRenderDrawColor(renderer, 0, 0, 128, PIXEL_ALPHA_OFF);
+    Uint32      *pixels, *row;
+    int          pitch;
+    unsigned int i, j, y;
+    bool_t       on;
+
+    if (SDL_LockTexture(lcd, NULL, (void **)&pixels, &pitch) == 0) {
+        for (j = 0; j < LCD_HEIGHT; j++) {
+            for (y = 0; y < DEFAULT_PIXEL_STRIDE; y++) {
+                row = (Uint32 *)((u8_t *)pixels + (j * DEFAULT_PIXEL_STRIDE + y) * pitch);
+                for (i = 0; i < LCD_WIDTH; i++) {
+                    on = (bitmap->rows[j] >> i) & 0x1;
+                    memcpy(row + i * DEFAULT_PIXEL_STRIDE, &lcd_cells[on][y * DEFAULT_PIXEL_STRIDE],
+                           DEFAULT_PIXEL_STRIDE * sizeof(Uint32));
+                }
             }
-            SDL_RenderFillRect(renderer, &r);
         }
+        SDL_UnlockTexture(lcd);
     }
     for (i = 0; i < ICON_NUM; i++) {
-        src_icon_r.w = ICON_SRC_SIZE;
-        src_icon_r.h = ICON_SRC_SIZE;
-        src_icon_r.x = (i % 4) * ICON_SRC_SIZE;
-        src_icon_r.y = (i / 4) * ICON_SRC_SIZE;
-
-        dest_icon_r.w = ICON_DEST_SIZE;
-        dest_icon_r.h = ICON_DEST_SIZE;
-
-        dest_icon_r.x = (i % 4) * ICON_STRIDE_X + ICON_OFFSET_X;
-        dest_icon_r.y = (i / 4) * ICON_STRIDE_Y + ICON_OFFSET_Y;
-
-        SDL_SetTextureColorMod(icons, 0, 0, 128);
-        if (icon_buffer[i]) {
-            SDL_SetTextureAlphaMod(icons, DEFAULT_LCD_ALPHA_ON);
-        } else {
-            SDL_SetTextureAlphaMod(icons, PIXEL_ALPHA_OFF);
+        on = (bitmap->icons >> i) & 0x1;
+        for (j = 0; j < 4; j++) {
+            icon_vertices[i * 4 + j].color.a = on ? DEFAULT_LCD_ALPHA_ON : PIXEL_ALPHA_OFF;
         }
-        SDL_RenderCopy(renderer, icons, &src_icon_r, &dest_icon_r);
     }
-
+    SDL_RenderCopy(renderer, bg, NULL, &bg_rect);
+    SDL_RenderCopy(renderer, lcd, NULL, &lcd_rect);
+    SDL_RenderGeometry(renderer, icons, icon_vertices, ICON_NUM * 4, icon_indices, ICON_NUM * 6);
     SDL_RenderPresent(renderer);
 }
 void Tamago::hal_play_frequency(bool_t en)
@@ -87,75 +89,128 @@ void Tamago::hal_play_frequency(bool_t en)
         is_audio_playing = en;
     }
 }
+/* Main thread: anything that touches the emulated device is posted to the emulator thread */
 int Tamago::handle_sdl_events(SDL_Event *event)
 {
-    char save_path[256];
     switch (event->type) {
         case SDL_QUIT:
             return 1;
         case SDL_WINDOWEVENT:
             switch (event->window.event) {
                 case SDL_WINDOWEVENT_SIZE_CHANGED:
+                case SDL_WINDOWEVENT_EXPOSED:
+                    render_redraw = 1;
                     break;
             }
             break;
         case SDL_KEYDOWN:
             switch (event->key.keysym.sym) {
-                case SDLK_AC_BACK:
                 case SDLK_ESCAPE:
+                    /* While catching up, Escape skips the rest of it rather than quitting */
+                    if (catch_up_pct.load(std::memory_order_relaxed) >= 0) {
+                        catch_up_skip.store(1, std::memory_order_relaxed);
+                        break;
+                    }
+                    return 1;
+                case SDLK_AC_BACK:
                 case SDLK_q:
                     return 1;
                 case SDLK_f:
-                    switch (speed) {
-                        case SPEED_1X:
-                            speed = SPEED_10X;
-                            break;
-                        case SPEED_10X:
-                            speed = SPEED_UNLIMITED;
-                            break;
-                        case SPEED_UNLIMITED:
-                            speed = SPEED_1X;
-                            break;
-                    }
-                    TAMALIB_SET_SPEED((u8_t)speed);
+                    emu_post({EMU_CMD_SPEED});
+                    break;
+                case SDLK_s:
+                    emu_post({EMU_CMD_SAVE});
+                    break;
+                case SDLK_l:
+                    emu_post({EMU_CMD_LOAD});
+                    break;
+                case SDLK_BACKSPACE:
+                    emu_post({EMU_CMD_REWIND});
                     break;
                 case SDLK_LEFT:
-                    TAMALIB_SET_BUTTON(BTN_LEFT, BTN_STATE_PRESSED);
+                    emu_post({EMU_CMD_BUTTON, BTN_LEFT, BTN_STATE_PRESSED});
                     break;
                 case SDLK_DOWN:
-                    TAMALIB_SET_BUTTON(BTN_MIDDLE, BTN_STATE_PRESSED);
+                    emu_post({EMU_CMD_BUTTON, BTN_MIDDLE, BTN_STATE_PRESSED});
                     break;
                 case SDLK_RIGHT:
-                    TAMALIB_SET_BUTTON(BTN_RIGHT, BTN_STATE_PRESSED);
+                    emu_post({EMU_CMD_BUTTON, BTN_RIGHT, BTN_STATE_PRESSED});
                     break;
             }
             break;
         case SDL_KEYUP:
             switch (event->key.keysym.sym) {
                 case SDLK_LEFT:
-                    TAMALIB_SET_BUTTON(BTN_LEFT, BTN_STATE_RELEASED);
+                    emu_post({EMU_CMD_BUTTON, BTN_LEFT, BTN_STATE_RELEASED});
                     break;
                 case SDLK_DOWN:
-                    TAMALIB_SET_BUTTON(BTN_MIDDLE, BTN_STATE_RELEASED);
+                    emu_post({EMU_CMD_BUTTON, BTN_MIDDLE, BTN_STATE_RELEASED});
                     break;
                 case SDLK_RIGHT:
-                    TAMALIB_SET_BUTTON(BTN_RIGHT, BTN_STATE_RELEASED);
+                    emu_post({EMU_CMD_BUTTON, BTN_RIGHT, BTN_STATE_RELEASED});
                     break;
             }
             break;
     }
     return 0;
 }
+/* Main thread */
+void Tamago::emu_post(emu_cmd_t cmd)
+{
+    std::lock_guard<std::mutex> guard(cmd_lock);
+    cmd_queue.push_back(cmd);
+    cmd_pending.store(1, std::memory_order_release);
+}
+/* Emulator thread, between two instructions */
+void Tamago::emu_run(const emu_cmd_t *cmd)
+{
+    char save_path[256];
+    switch (cmd->type) {
+        case EMU_CMD_BUTTON:
+            TAMALIB_SET_BUTTON(cmd->btn, cmd->state);
+            break;
+        case EMU_CMD_SPEED:
+            switch (speed) {
+                case SPEED_1X:
+                    speed = SPEED_10X;
+                    break;
+                case SPEED_10X:
+                    speed = SPEED_UNLIMITED;
+                    break;
+                case SPEED_UNLIMITED:
+                    speed = SPEED_1X;
+                    break;
+            }
+            TAMALIB_SET_SPEED((u8_t)speed);
+            break;
+        case EMU_CMD_SAVE:
+            snprintf(save_path, sizeof(save_path), "%s", SAVE_PATH);
+            hw_save_state(save_path);
+            break;
+        case EMU_CMD_LOAD:
+            snprintf(save_path, sizeof(save_path), "%s", SAVE_PATH);
+            hw_load_state(save_path);
+            break;
+        case EMU_CMD_REWIND:
+            hw_rewind(REWIND_KEY_FRAMES);
+            break;
+    }
+}
+/* Emulator thread: runs what the main thread posted, returns 1 once it asked to quit */
 int Tamago::hal_handler(void)
 {
-    SDL_Event   event;
-    timestamp_t ts;
-    while (SDL_PollEvent(&event)) {
-        if (handle_sdl_events(&event)) {
-            return 1;
+    std::vector<emu_cmd_t> cmds;
+
+    if (cmd_pending.load(std::memory_order_relaxed) && cmd_pending.exchange(0, std::memory_order_acquire)) {
+        {
+            std::lock_guard<std::mutex> guard(cmd_lock);
+            cmds.swap(cmd_queue);
+        }
+        for (const emu_cmd_t &cmd : cmds) {
+            emu_run(&cmd);
         }
     }
-    return 0;
+    return emu_quit.load(std::memory_order_acquire);
 }
 void Tamago::audio_callback(void *userdata, Uint8 *stream, int len)
 {
@@ -173,37 +228,82 @@ void Tamago::audio_callback(void *userdata, Uint8 *stream, int len)
 }
 void audio_cb(void *userdata, Uint8 *stream, int len)
 {
-    tamgo->audio_callback(userdata, stream, len);
+    ((Tamago *)userdata)->audio_callback(userdata, stream, len);
 }
 void Tamago::sdl_release(void)
 {
-    SDL_DestroyTexture(icons);
-    SDL_DestroyTexture(bg);
+    render_release();
     IMG_Quit();
     SDL_DestroyWindow(window);
     SDL_Quit();
 }
-bool_t Tamago::sdl_init(void)
+/* Precomputes the pixel cells of the dot matrix texture and the icon quads, all but the icon alpha */
+void Tamago::render_init_lcd(void)
 {
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_AUDIO) != 0) {
-        return 1;
+    SDL_Vertex  *v;
+    float        tex_w = 4 * ICON_SRC_SIZE;
+    float        tex_h = 2 * ICON_SRC_SIZE;
+    int          w, h;
+    unsigned int i, x, y;
+    u8_t         alpha;
+
+    for (i = 0; i < 2; i++) {
+        alpha = i ? DEFAULT_LCD_ALPHA_ON : PIXEL_ALPHA_OFF;
+        for (y = 0; y < DEFAULT_PIXEL_STRIDE; y++) {
+            for (x = 0; x < DEFAULT_PIXEL_STRIDE; x++) {
+                /* The gap to the next pixel stays transparent */
+                lcd_cells[i][y * DEFAULT_PIXEL_STRIDE + x] =
+                    (x < PIXEL_SIZE && y < PIXEL_SIZE)
+                        ? ((Uint32)alpha << 24 | LCD_COLOR_R << 16 | LCD_COLOR_G << 8 | LCD_COLOR_B)
+                        : 0;
+            }
+        }
     }
-    if (IMG_Init(IMG_INIT_PNG) != IMG_INIT_PNG) {
-        SDL_Quit();
-        return 1;
+    lcd_rect.x = LCD_OFFSET_X;
+    lcd_rect.y = LCD_OFFSET_Y;
+    lcd_rect.w = LCD_TEX_WIDTH;
+    lcd_rect.h = LCD_TEX_HEIGHT;
+
+    if (SDL_QueryTexture(icons, NULL, NULL, &w, &h) == 0) {
+        tex_w = w;
+        tex_h = h;
     }
-    window   = SDL_CreateWindow("", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, BG_SIZE, BG_SIZE, SDL_WINDOW_SHOWN);
+    for (i = 0; i < ICON_NUM; i++) {
+        v = &icon_vertices[i * 4];
+        for (y = 0; y < 2; y++) {
+            for (x = 0; x < 2; x++) {
+                v->position.x  = (i % 4) * ICON_STRIDE_X + ICON_OFFSET_X + x * ICON_DEST_SIZE;
+                v->position.y  = (i / 4) * ICON_STRIDE_Y + ICON_OFFSET_Y + y * ICON_DEST_SIZE;
+                v->tex_coord.x = ((i % 4) + x) * ICON_SRC_SIZE / tex_w;
+                v->tex_coord.y = ((i / 4) + y) * ICON_SRC_SIZE / tex_h;
+                v->color       = {LCD_COLOR_R, LCD_COLOR_G, LCD_COLOR_B, PIXEL_ALPHA_OFF};
+                v++;
+            }
+        }
+        /* Two triangles over the corners in row order */
+        icon_indices[i * 6 + 0] = i * 4 + 0;
+        icon_indices[i * 6 + 1] = i * 4 + 1;
+        icon_indices[i * 6 + 2] = i * 4 + 2;
+        icon_indices[i * 6 + 3] = i * 4 + 1;
+        icon_indices[i * 6 + 4] = i * 4 + 3;
+        icon_indices[i * 6 + 5] = i * 4 + 2;
+    }
+}
+/* Main thread: the renderer and all textures are created, used and destroyed there, like the window */
+bool_t Tamago::render_init(void)
+{
     renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    if (!renderer) {
+        return 1;
+    }
     SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
     bg = IMG_LoadTexture(renderer, BACKGROUND_PATH);
     if (!bg) {
-        sdl_release();
         return 1;
     }
 
     icons = IMG_LoadTexture(renderer, ICONS_PATH);
     if (!icons) {
-        sdl_release();
         return 1;
     }
 
@@ -212,6 +312,103 @@ bool_t Tamago::sdl_init(void)
     bg_rect.w = BG_SIZE;
     bg_rect.h = BG_SIZE;
 
+    lcd = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, LCD_TEX_WIDTH,
+                            LCD_TEX_HEIGHT);
+    if (!lcd) {
+        return 1;
+    }
+    SDL_SetTextureBlendMode(lcd, SDL_BLENDMODE_BLEND);
+    render_init_lcd();
+    return 0;
+}
+void Tamago::render_release(void)
+{
+    SDL_DestroyTexture(lcd);
+    SDL_DestroyTexture(icons);
+    SDL_DestroyTexture(bg);
+    SDL_DestroyRenderer(renderer);
+    lcd      = NULL;
+    icons    = NULL;
+    bg       = NULL;
+    renderer = NULL;
+}
+/*
+ * Main thread: handles the window events and presents the newest frame published by the emulator thread
+ * once per display refresh, until asked to quit. Only frames that differ from the one on screen, or a
+ * window that needs repainting, are drawn; a present that takes long only delays this thread, the emulator
+ * keeps publishing and the frames it publishes meanwhile are dropped.
+ */
+void Tamago::render_main(void)
+{
+    const triplebuf_frame_t *frame;
+    SDL_DisplayMode          mode;
+    lcd_bitmap_t             shown  = {};
+    timestamp_t              period = 1000000 / REFRESH_RATE;
+    timestamp_t              next, now;
+    int                      pct, shown_pct = -1;
+    char                     title[64];
+
+    if (SDL_GetWindowDisplayMode(window, &mode) == 0 && mode.refresh_rate > 0) {
+        period = 1000000 / mode.refresh_rate;
+    }
+    next = hal_get_timestamp();
+    while (!render_wait_until(next)) {
+        pct = catch_up_pct.load(std::memory_order_relaxed);
+        if (pct != shown_pct) {
+            shown_pct = pct;
+            if (pct >= 0) {
+                snprintf(title, sizeof(title), "Catching up %d%% (Esc to skip)", pct);
+            }
+            SDL_SetWindowTitle(window, pct >= 0 ? title : "");
+        }
+        frame = g_frames->triplebuf_acquire();
+        if (render_redraw || memcmp(shown.rows, frame->bitmap.rows, sizeof(shown.rows)) != 0 ||
+            shown.icons != frame->bitmap.icons) {
+            render_redraw = 0;
+            shown         = frame->bitmap;
+            hal_update_screen(&shown);
+        }
+        now  = hal_get_timestamp();
+        next += period;
+        /* After a stall, resume on the current refresh rather than catching up */
+        if ((int32_t)(now - next) > (int32_t)period) {
+            next = now;
+        }
+    }
+}
+/* Main thread: handles the events that come before `ts`, returns 1 on the one asking to quit */
+bool_t Tamago::render_wait_until(timestamp_t ts)
+{
+    SDL_Event event;
+    int32_t   remaining;
+
+    while ((remaining = (int32_t)(ts - hal_get_timestamp())) > 0) {
+        if (SDL_WaitEventTimeout(&event, (remaining + 999) / 1000) && handle_sdl_events(&event)) {
+            return 1;
+        }
+    }
+    while (SDL_PollEvent(&event)) {
+        if (handle_sdl_events(&event)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+bool_t Tamago::sdl_init(void)
+{
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_AUDIO) != 0) {
+        return 1;
+    }
+    if (IMG_Init(IMG_INIT_PNG) != IMG_INIT_PNG) {
+        SDL_Quit();
+        return 1;
+    }
+    window = SDL_CreateWindow("", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, BG_SIZE, BG_SIZE, SDL_WINDOW_SHOWN);
+    if (!window || render_init()) {
+        sdl_release();
+        return 1;
+    }
+
     SDL_AudioSpec audio_spec;
     SDL_memset(&audio_spec, 0, sizeof(audio_spec));
 
@@ -220,6 +417,7 @@ bool_t Tamago::sdl_init(void)
     audio_spec.channels = 1;
     audio_spec.samples  = AUDIO_SAMPLES;
     audio_spec.callback = &audio_cb;
+    audio_spec.userdata = this;
 
     SDL_AudioDeviceID audio_dev =
         SDL_OpenAudioDevice(NULL, 0, &audio_spec, &audio_spec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
@@ -273,40 +471,283 @@ void Tamago::tamalib_mainloop(void)
     timestamp_t ts;
     while (!hal_handler()) {
         tamalib_step();
+        if (g_movie) {
+            g_movie->movie_poll(g_cpu->cpu_get_state());
+        }
+        if (g_rewind) {
+            g_rewind->rewind_poll(g_cpu->cpu_get_state());
+        }
         ts = hal_get_timestamp();
         if (ts - screen_ts >= g_ts_freq / DEFAULT_FRAMERATE) {
             screen_ts = ts;
-            hal_update_screen();
+            if (screen_dirty) {
+                screen_dirty = 0;
+                hw_publish_frame();
+            }
+            if (g_publisher) {
+                g_publisher->publisher_write_state(0, g_cpu->cpu_get_state());
+            }
+            if (g_statefile) {
+                /* Frame boundaries are instruction boundaries */
+                g_statefile->statefile_end(0);
+                if (ts - sync_ts >= (timestamp_t)g_ts_freq * STATEFILE_SYNC_S) {
+                    sync_ts = ts;
+                    g_statefile->statefile_sync(0);
+                }
+                g_statefile->statefile_begin(0);
+            }
+            if (g_journal) {
+                if (ts - snap_ts >= (timestamp_t)g_ts_freq * JOURNAL_SNAP_S) {
+                    hw_snapshot_journal();
+                } else {
+                    g_journal->journal_mark(0, g_cpu->cpu_get_state()->tick_counter);
+                    g_journal->journal_poll();
+                }
+            }
         }
     }
+    if (g_journal) {
+        g_journal->journal_mark(0, g_cpu->cpu_get_state()->tick_counter);
+        g_journal->journal_flush();
+    }
+    if (g_statefile) {
+        g_statefile->statefile_end(0);
+        g_statefile->statefile_sync(1);
+    }
 }
 void Tamago::hw_set_lcd_pin(u8_t seg, u8_t com, u8_t val)
 {
-    if (seg_pos[seg] < LCD_WIDTH) {
-        matrix_buffer[com][seg_pos[seg]] = val;
+    bool_t *pixel;
+
+    if (CPU::lcd_seg_pos[seg] < LCD_WIDTH) {
+        pixel = &matrix_buffer[com][CPU::lcd_seg_pos[seg]];
+    } else if (seg == 8 && com < 4) {
+        pixel = &icon_buffer[com];
+    } else if (seg == 28 && com >= 12) {
+        pixel = &icon_buffer[com - 8];
     } else {
-        if (seg == 8 && com < 4) {
-            icon_buffer[com] = val;
-        } else if (seg == 28 && com >= 12) {
-            icon_buffer[com - 8] = val;
+        return;
+    }
+    /* While the display is off nothing shows, hw_enable_lcd() redraws when it comes back on */
+    if (*pixel != val) {
+        *pixel = val;
+        screen_dirty |= lcd_enabled;
+    }
+}
+void Tamago::hw_get_lcd_bitmap(lcd_bitmap_t *bitmap)
+{
+    u8_t i, j;
+
+    memset(bitmap, 0, sizeof(lcd_bitmap_t));
+    for (j = 0; j < LCD_HEIGHT; j++) {
+        for (i = 0; i < LCD_WIDTH; i++) {
+            bitmap->rows[j] |= (u32_t)matrix_buffer[j][i] << i;
         }
     }
+    for (i = 0; i < ICON_NUM; i++) {
+        bitmap->icons |= icon_buffer[i] << i;
+    }
+}
+void Tamago::hw_set_lcd_bitmap(const lcd_bitmap_t *bitmap)
+{
+    u8_t i, j;
+
+    for (j = 0; j < LCD_HEIGHT; j++) {
+        for (i = 0; i < LCD_WIDTH; i++) {
+            matrix_buffer[j][i] = (bitmap->rows[j] >> i) & 0x1;
+        }
+    }
+    for (i = 0; i < ICON_NUM; i++) {
+        icon_buffer[i] = (bitmap->icons >> i) & 0x1;
+    }
+    screen_dirty = 1;
+}
+/* Hands the buffers above to the main thread as a frame, blank while the LCD is off */
+void Tamago::hw_publish_frame(void)
+{
+    lcd_bitmap_t bitmap;
+
+    if (lcd_enabled) {
+        hw_get_lcd_bitmap(&bitmap);
+    } else {
+        memset(&bitmap, 0, sizeof(lcd_bitmap_t));
+    }
+    g_frames->triplebuf_publish(&bitmap);
+}
+/* REG_LCD_CTRL: with all dots off the screen is drawn blank once, then left alone until they come back */
+void Tamago::hw_enable_lcd(bool_t en)
+{
+    if (lcd_enabled != en) {
+        lcd_enabled  = en;
+        screen_dirty = 1;
+    }
 }
 void Tamago::hw_set_button(button_t btn, btn_state_t state)
 {
     pin_state_t pin_state = (state == BTN_STATE_PRESSED) ? PIN_STATE_LOW : PIN_STATE_HIGH;
     switch (btn) {
         case BTN_LEFT:
-            g_cpu->cpu_set_input_pin(PIN_K02, pin_state);
+            hw_set_input_pin(PIN_K02, pin_state);
             break;
         case BTN_MIDDLE:
-            g_cpu->cpu_set_input_pin(PIN_K01, pin_state);
+            hw_set_input_pin(PIN_K01, pin_state);
             break;
         case BTN_RIGHT:
-            g_cpu->cpu_set_input_pin(PIN_K00, pin_state);
+            hw_set_input_pin(PIN_K00, pin_state);
             break;
     }
 }
+/* Inputs go through the journal, at the instruction boundary they are applied at */
+void Tamago::hw_set_input_pin(pin_t pin, pin_state_t state)
+{
+    if (g_journal) {
+        g_journal->journal_record(0, g_cpu->cpu_get_state()->tick_counter, pin, state);
+    }
+    g_cpu->cpu_set_input_pin(pin, state);
+}
+bool_t Tamago::hw_save_state(const char *path)
+{
+    cpu_save_t save;
+    FILE      *f;
+    size_t     n;
+
+    g_cpu->cpu_save_state(&save);
+    f = fopen(path, "wb");
+    if (f == NULL) {
+        return 1;
+    }
+    n = fwrite(&save, sizeof(save), 1, f);
+    fclose(f);
+    return n != 1;
+}
+bool_t Tamago::hw_load_state(const char *path)
+{
+    cpu_save_t save;
+    FILE      *f;
+    size_t     n;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        return 1;
+    }
+    n = fread(&save, 1, sizeof(save), f);
+    fclose(f);
+    if (g_cpu->cpu_load_state(&save, n)) {
+        return 1;
+    }
+    /* Not an input, the journal cannot replay it */
+    if (g_journal) {
+        hw_snapshot_journal();
+    }
+    if (g_movie) {
+        hw_start_movie();
+    }
+    return 0;
+}
+void Tamago::hw_rewind(u32_t frames)
+{
+    cpu_state_t state;
+    u32_t       steps;
+
+    if (!g_rewind) {
+        return;
+    }
+    steps = frames / g_rewind->rewind_get_interval();
+    if (steps > g_rewind->rewind_get_count()) {
+        steps = g_rewind->rewind_get_count();
+    }
+    if (g_rewind->rewind_seek(steps, &state) == 0) {
+        g_cpu->cpu_restore_state(&state);
+        if (g_journal) {
+            hw_snapshot_journal();
+        }
+        if (g_movie) {
+            hw_start_movie();
+        }
+    }
+}
+Program *Tamago::hw_get_program(void)
+{
+    return Program::program_get(g_program, sizeof(g_program) / sizeof(g_program[0]));
+}
+/* Runs the instance on slot 0 of the state file, resuming it unless the file had nothing to resume */
+void Tamago::hw_attach_statefile(void)
+{
+    cpu_state_t *slot = g_statefile->statefile_get_state(0);
+    cpu_state_t  state;
+
+    if (g_statefile->statefile_is_created() || g_statefile->statefile_get_lost()) {
+        g_cpu->cpu_bind_state(slot);
+        g_cpu->cpu_reset();
+    } else {
+        state = *slot;
+        g_cpu->cpu_bind_state(slot);
+        g_cpu->cpu_restore_state(&state);
+        offline_s = hw_get_offline(g_statefile->statefile_get_mtime());
+    }
+    g_statefile->statefile_begin(0);
+}
+/* Resumes the instance from the last snapshot and the inputs journaled after it, if any */
+void Tamago::hw_attach_journal(void)
+{
+    cpu_state_t *states[1] = {g_cpu->cpu_get_state()};
+    cpu_state_t  state;
+    Program     *program = hw_get_program();
+    CPU         *replay  = new CPU(nullptr);
+
+    replay->cpu_init(program, NULL, g_ts_freq);
+    program->program_release();
+    if (g_journal->journal_recover(replay, states) == 0) {
+        state = *states[0];
+        g_cpu->cpu_restore_state(&state);
+        offline_s = hw_get_offline(g_journal->journal_get_mtime());
+    }
+    delete replay;
+    hw_snapshot_journal();
+}
+/* New snapshot and empty journal: periodically to bound replay, and after any state change that is not an input */
+void Tamago::hw_snapshot_journal(void)
+{
+    cpu_state_t *states[1] = {g_cpu->cpu_get_state()};
+
+    g_journal->journal_snapshot(states);
+    snap_ts = hal_get_timestamp();
+}
+/* Records from the current state on, dropping what was recorded before it was replaced */
+void Tamago::hw_start_movie(void)
+{
+    g_movie->movie_start(g_cpu->cpu_get_state(), MOVIE_HASH_TICKS);
+    g_cpu->cpu_set_input_hook(Movie::movie_input_hook, g_movie);
+}
+u32_t Tamago::hw_get_offline(time_t since)
+{
+    time_t now = time(NULL);
+    return (since != 0 && now > since) ? now - since : 0;
+}
+static bool_t catch_up_progress(void *ctx, uint64_t done, uint64_t total)
+{
+    return ((Tamago *)ctx)->hw_catch_up_progress(done, total);
+}
+/* Time-skips the instance over `seconds` spent offline, then resumes real-time pacing */
+void Tamago::hw_catch_up(u32_t seconds)
+{
+    catch_up_skip.store(0, std::memory_order_relaxed);
+    catch_up_pct.store(0, std::memory_order_relaxed);
+    g_cpu->cpu_catch_up((uint64_t)seconds * TICK_FREQUENCY, catch_up_progress, this);
+    catch_up_pct.store(-1, std::memory_order_relaxed);
+    speed = SPEED_1X;
+    TAMALIB_SET_SPEED(speed);
+    /* Not an input, the journal cannot replay it */
+    if (g_journal) {
+        hw_snapshot_journal();
+    }
+}
+/* The main thread shows the progress in the window title; Escape skips the rest, quitting stops it too */
+bool_t Tamago::hw_catch_up_progress(uint64_t done, uint64_t total)
+{
+    catch_up_pct.store((int)(done * 100 / total), std::memory_order_relaxed);
+    return catch_up_skip.load(std::memory_order_relaxed) || emu_quit.load(std::memory_order_relaxed);
+}
 bool_t Tamago::hw_init(void)
 {
     g_cpu->cpu_set_input_pin(PIN_K00, PIN_STATE_HIGH);
@@ -314,18 +755,55 @@ bool_t Tamago::hw_init(void)
     g_cpu->cpu_set_input_pin(PIN_K02, PIN_STATE_HIGH);
     return 0;
 }
-int Tamago::init(int argc, char **argv)
+/* Emulator thread: sets the instance up, which may take a catch-up, then runs it until the main thread quits */
+void Tamago::emu_main(void)
 {
-    sdl_init();
+    uint64_t freq    = 1000000;
+    Program *program = hw_get_program();
 
-    bool_t   res  = 0;
-    uint64_t freq = 1000000;
-    res |= g_cpu->cpu_init(g_program, NULL, freq);
-    res |= hw_init();
+    g_cpu->cpu_init(program, NULL, freq);
+    program->program_release();
+    if (g_statefile) {
+        hw_attach_statefile();
+    }
+    hw_init();
     g_ts_freq = freq;
+    sync_ts   = hal_get_timestamp();
+    if (g_journal) {
+        hw_attach_journal();
+    }
+    if (offline_s >= CATCHUP_MIN_S) {
+        hw_catch_up(offline_s);
+    }
+    if (g_movie) {
+        hw_start_movie();
+    }
 
     tamalib_mainloop();
+    if (g_movie) {
+        g_movie->movie_check(g_cpu->cpu_get_state());
+    }
+}
+/*
+ * The window, its events and the presents stay on the main thread, as SDL requires on some platforms; the
+ * emulator runs on its own thread and the two only share the frames, the posted commands and a few flags.
+ */
+int Tamago::init(int argc, char **argv)
+{
+    triplebuf_stats_t stats;
+
+    if (sdl_init()) {
+        return 1;
+    }
+    emu_thread = std::thread(&Tamago::emu_main, this);
+    render_main();
+    emu_quit.store(1, std::memory_order_release);
+    emu_thread.join();
 
     sdl_release();
+    g_frames->triplebuf_get_stats(&stats);
+    printf("frames: %llu published, %llu dropped, %llu presented, %llu duplicated\n",
+           (unsigned long long)stats.published, (unsigned long long)stats.dropped, (unsigned long long)stats.taken,
+           (unsigned long long)stats.duplicated);
     return 0;
-}
\ No newline at end of file
+}
@@ -2,8 +2,13 @@
 #define _TAMAGO_H_
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "tamago_def.h"
 #include "cpu.h"
+#include "triplebuf.h"
 
 
 typedef enum
@@ -19,16 +24,6 @@ typedef enum
     BTN_RIGHT,
 } button_t;
 
-typedef enum
-{
-    EXEC_MODE_PAUSE,
-    EXEC_MODE_RUN,
-    EXEC_MODE_STEP,
-    EXEC_MODE_NEXT,
-    EXEC_MODE_TO_CALL,
-    EXEC_MODE_TO_RET,
-} exec_mode_t;
-
 typedef enum
 {
     SPEED_UNLIMITED = 0,
@@ -36,11 +31,40 @@ typedef enum
     SPEED_10X       = 10,
 } emulation_speed_t;
 
+/* What the main thread asks of the emulator thread, from the keys it handles */
+typedef enum
+{
+    EMU_CMD_BUTTON,
+    EMU_CMD_SPEED,
+    EMU_CMD_SAVE,
+    EMU_CMD_LOAD,
+    EMU_CMD_REWIND,
+} emu_cmd_type_t;
+
+typedef struct
+{
+    emu_cmd_type_t type;
+    button_t       btn;
+    btn_state_t    state;
+} emu_cmd_t;
+
 
 class CPU;
-class Tamago {
+class Program;
+class FramePublisher;
+class Rewind;
+class StateFile;
+class Journal;
+class Movie;
+class Tamago : public Hal {
   public:
-    CPU *g_cpu = new CPU(this);
+    CPU            *g_cpu       = new CPU(this);
+    FramePublisher *g_publisher = NULL;
+    Rewind         *g_rewind    = NULL;
+    StateFile      *g_statefile = NULL;
+    Journal        *g_journal   = NULL;
+    Movie          *g_movie     = NULL;
+    TripleBuffer   *g_frames    = new TripleBuffer(); /* LCD frames from the emulator thread to the main thread */
 
   private:
     unsigned int sin_pos          = 0;
@@ -52,46 +76,89 @@ class Tamago {
     exec_mode_t exec_mode  = EXEC_MODE_RUN;
     u32_t       step_depth = 0;
     timestamp_t screen_ts  = 0;
+    timestamp_t sync_ts    = 0;
+    timestamp_t snap_ts    = 0;
+    u32_t       offline_s  = 0;
     u32_t       g_ts_freq;
 
+    /* The window, the renderer and the textures are the main thread's */
     SDL_Window   *window   = NULL;
     SDL_Renderer *renderer = NULL;
-    SDL_Texture  *bg;
-    SDL_Texture  *icons;
+    SDL_Texture  *bg       = NULL;
+    SDL_Texture  *icons    = NULL;
+    SDL_Texture  *lcd      = NULL; /* The dot matrix, one cell of DEFAULT_PIXEL_STRIDE texels per pixel */
     SDL_Rect      bg_rect;
+    SDL_Rect      lcd_rect;
+    Uint32        lcd_cells[2][DEFAULT_PIXEL_STRIDE * DEFAULT_PIXEL_STRIDE]; /* Off and on pixel with its gap */
+    SDL_Vertex    icon_vertices[ICON_NUM * 4];
+    int           icon_indices[ICON_NUM * 6];
+
+    bool_t render_redraw = 1; /* The window must be repainted even if the frame did not change */
+
+    std::thread            emu_thread;
+    std::atomic<bool_t>    emu_quit{0};
+    std::mutex             cmd_lock;
+    std::vector<emu_cmd_t> cmd_queue;        /* Under cmd_lock */
+    std::atomic<bool_t>    cmd_pending{0};   /* cmd_queue may be non-empty, spares the emulator the lock */
+    std::atomic<int>       catch_up_pct{-1}; /* Progress of the running catch-up, -1 when there is none */
+    std::atomic<bool_t>    catch_up_skip{0};
 
   private:
     bool_t matrix_buffer[LCD_HEIGHT][LCD_WIDTH] = {{0}};
     bool_t icon_buffer[ICON_NUM]                = {0};
-
-    u8_t seg_pos[40] = {0,  1,  2,  3,  4,  5,  6,  7,  32, 8,  9,  10, 11, 12, 13, 14, 15, 33, 34, 35,
-                        31, 30, 29, 28, 27, 26, 25, 24, 36, 23, 22, 21, 20, 19, 18, 17, 16, 37, 38, 39};
+    bool_t lcd_enabled                          = 1;
+    bool_t screen_dirty                         = 1; /* The last frame published differs from the buffers above */
 
   public:
+    static Program *hw_get_program(void);
+
     int    init(int argc, char **argv);
     bool_t hw_init(void);
     bool_t sdl_init(void);
+    bool_t render_init(void);
+    void   render_init_lcd(void);
+    void   render_release(void);
+    void   render_main(void);
+    bool_t render_wait_until(timestamp_t ts);
+    void   emu_main(void);
+    void   emu_post(emu_cmd_t cmd);
+    void   emu_run(const emu_cmd_t *cmd);
 
     void       *hal_malloc(u32_t size);
     void        hal_free(void *ptr);
     void        hal_halt(void);
     void        hal_sleep_until(timestamp_t ts);
-    void        hal_update_screen(void);
+    void        hal_update_screen(const lcd_bitmap_t *bitmap);
     void        hal_play_frequency(bool_t en);
     int         hal_handler(void);
     timestamp_t hal_get_timestamp(void);
 
-    void tamalib_step(void);
-    void tamalib_mainloop(void);
-    void hw_set_lcd_pin(u8_t seg, u8_t com, u8_t val);
-    void hw_set_button(button_t btn, btn_state_t state);
+    void   tamalib_step(void);
+    void   tamalib_mainloop(void);
+    void   hw_set_lcd_pin(u8_t seg, u8_t com, u8_t val);
+    void   hw_get_lcd_bitmap(lcd_bitmap_t *bitmap);
+    void   hw_set_lcd_bitmap(const lcd_bitmap_t *bitmap);
+    void   hw_publish_frame(void);
+    void   hw_enable_lcd(bool_t en);
+    void   hw_set_button(button_t btn, btn_state_t state);
+    bool_t hw_save_state(const char *path);
+    bool_t hw_load_state(const char *path);
+    void   hw_rewind(u32_t frames);
+    void   hw_attach_statefile(void);
+    void   hw_attach_journal(void);
+    void   hw_snapshot_journal(void);
+    void   hw_start_movie(void);
+    void   hw_set_input_pin(pin_t pin, pin_state_t state);
+    u32_t  hw_get_offline(time_t since);
+    void   hw_catch_up(u32_t seconds);
+    bool_t hw_catch_up_progress(uint64_t done, uint64_t total);
 
     int  handle_sdl_events(SDL_Event *event);
     void audio_callback(void *userdata, Uint8 *stream, int len);
     void sdl_release(void);
 
   private:
-    uint16_t g_program[6144] = {
+    static constexpr uint16_t g_program[6144] = {
         4002, 3207, 3600, 2688, 2688, 2709, 1298, 3664, 32,   4036, 4037, 4038, 4032, 1519, 2941, 3631, 3912, 26,
         4036, 4037, 4038, 4032, 1519, 2941, 3616, 3927, 4048, 4054, 4053, 4052, 4063, 2818, 1340, 3584, 3712, 2854,
         1298, 3810, 3782, 3680, 1289, 3816, 3785, 4063, 3584, 3728, 2082, 1298, 3755, 3824, 3751, 1289, 4063, 3584,
@@ -33,10 +33,14 @@
 
 #define DEFAULT_LCD_ALPHA_ON  255
 #define DEFAULT_LCD_ALPHA_OFF 20
+#define LCD_COLOR_R           0
+#define LCD_COLOR_G           0
+#define LCD_COLOR_B           128
 
 #define RES_PATH        "./res"
 #define BACKGROUND_PATH RES_PATH "/background.png"
 #define ICONS_PATH      RES_PATH "/icons.png"
+#define SAVE_PATH       "./save.bin"
 
 #define AUDIO_FREQUENCY 48000
 #define AUDIO_SAMPLES   480    // 10 ms @ 48000 Hz
@@ -45,6 +49,12 @@
 
 #define MAX_SPRITES       256
 #define DEFAULT_FRAMERATE 30    // fps
+#define REFRESH_RATE      60    // Hz, when the display reports none
+#define REWIND_KEY_FRAMES 30    // one second per key press
+#define STATEFILE_SYNC_S  10    // s between checkpoints of the -m state file
+#define JOURNAL_SYNC_US   1000000    // at most 1 s of input lost on a crash
+#define JOURNAL_SNAP_S    60         // s between snapshots of the -j journal
+#define CATCHUP_MIN_S     2          // s offline before a resumed instance is time-skipped
 
 #define TAMALIB_SET_BUTTON(btn, state) hw_set_button(btn, state)
 #define TAMALIB_SET_SPEED(speed)       g_cpu->cpu_set_speed(speed)
@@ -63,6 +73,8 @@
 #define ICON_STRIDE_X   ((LCD_SIZE * REF_ICON_STRIDE_X) / REF_LCD_SIZE)
 #define ICON_STRIDE_Y   ((LCD_SIZE * REF_ICON_STRIDE_Y) / REF_LCD_SIZE)
 #define PIXEL_ALPHA_OFF ((PIXEL_SIZE != DEFAULT_PIXEL_STRIDE) ? DEFAULT_LCD_ALPHA_OFF : 0)
+#define LCD_TEX_WIDTH   (LCD_WIDTH * DEFAULT_PIXEL_STRIDE)
+#define LCD_TEX_HEIGHT  (LCD_HEIGHT * DEFAULT_PIXEL_STRIDE)
 #define BUTTONS_X       ((LCD_SIZE * REF_BUTTONS_X) / REF_LCD_SIZE)
 #define BUTTONS_Y       ((LCD_SIZE * REF_BUTTONS_Y) / REF_LCD_SIZE)
 #define BUTTONS_WIDTH   ((LCD_SIZE * REF_BUTTONS_WIDTH) / REF_LCD_SIZE)
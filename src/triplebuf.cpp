@@ -0,0 +1,39 @@
+#include "triplebuf.h"
+
+
+/* Writer only */
+void TripleBuffer::triplebuf_publish(const lcd_bitmap_t *bitmap)
+{
+    uint64_t n = published.load(std::memory_order_relaxed) + 1;
+    u8_t     prev;
+
+    frames[back].bitmap = *bitmap;
+    frames[back].frame  = n;
+    /* Release: the reader that takes this slot sees it filled */
+    prev = middle.exchange(back | TRIPLEBUF_FRESH, std::memory_order_acq_rel);
+    back = prev & ~TRIPLEBUF_FRESH;
+    published.store(n, std::memory_order_relaxed);
+    if (prev & TRIPLEBUF_FRESH) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+/* Reader only: the newest frame published, valid until the next call */
+const triplebuf_frame_t *TripleBuffer::triplebuf_acquire(void)
+{
+    /* Only the writer changes `middle` meanwhile, and it always leaves it fresh */
+    if (middle.load(std::memory_order_relaxed) & TRIPLEBUF_FRESH) {
+        front = middle.exchange(front, std::memory_order_acq_rel) & ~TRIPLEBUF_FRESH;
+        taken.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        duplicated.fetch_add(1, std::memory_order_relaxed);
+    }
+    return &frames[front];
+}
+/* From any thread, each counter is exact but they are not read at the same instant */
+void TripleBuffer::triplebuf_get_stats(triplebuf_stats_t *stats)
+{
+    stats->published  = published.load(std::memory_order_relaxed);
+    stats->taken      = taken.load(std::memory_order_relaxed);
+    stats->dropped    = dropped.load(std::memory_order_relaxed);
+    stats->duplicated = duplicated.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,52 @@
+#ifndef _TRIPLEBUF_H_
+#define _TRIPLEBUF_H_
+#include <stdint.h>
+#include <atomic>
+#include "cpu.h"
+
+
+#define TRIPLEBUF_FRESH 0x4 /* Set in `middle` while it holds a frame the reader has not taken */
+
+typedef struct alignas(64)
+{
+    lcd_bitmap_t bitmap;
+    uint64_t     frame; /* Sequence number of the frame, 0 before the first one was published */
+} triplebuf_frame_t;
+
+typedef struct
+{
+    uint64_t published;
+    uint64_t taken;
+    uint64_t dropped;    /* Published, then replaced by a newer frame before the reader took it */
+    uint64_t duplicated; /* Reads that found no new frame and got the last one again */
+} triplebuf_stats_t;
+
+
+/*
+ * Single-writer single-reader triple buffer of LCD frames. The writer fills its back slot and swaps it
+ * with the middle one, the reader swaps the middle one with its front slot when it holds a new frame.
+ * Both swaps are one atomic exchange, so neither side ever waits on the other: a slow reader only makes
+ * the writer drop frames, a slow writer only makes the reader see the same frame again.
+ */
+class TripleBuffer {
+  private:
+    triplebuf_frame_t frames[3] = {};
+
+    alignas(64) std::atomic<u8_t> middle{1};
+
+    /* Writer side */
+    alignas(64) u8_t      back = 0;
+    std::atomic<uint64_t> published{0};
+    std::atomic<uint64_t> dropped{0};
+
+    /* Reader side */
+    alignas(64) u8_t      front = 2;
+    std::atomic<uint64_t> taken{0};
+    std::atomic<uint64_t> duplicated{0};
+
+  public:
+    void                     triplebuf_publish(const lcd_bitmap_t *bitmap);
+    const triplebuf_frame_t *triplebuf_acquire(void);
+    void                     triplebuf_get_stats(triplebuf_stats_t *stats);
+};
+#endif
@@ -0,0 +1,198 @@
+#include <string.h>
+#include "vecenv.h"
+
+
+VecEnv::VecEnv(Program *_program, u32_t _num_envs, u32_t threads, u32_t _frame_skip)
+{
+    u32_t n;
+
+    program    = _program->program_acquire();
+    num_envs   = _num_envs;
+    frame_skip = (_frame_skip > 0) ? _frame_skip : 1;
+    states     = new cpu_state_t[num_envs];
+    obs_lcd.resize((size_t)num_envs * LCD_HEIGHT * LCD_WIDTH);
+    obs_icons.resize((size_t)num_envs * ICON_NUM);
+    obs_done.resize(num_envs);
+
+    /* Default snapshot is power-on with every button released, as Tamago::hw_init leaves it */
+    CPU::cpu_init_state(&snapshot);
+    snapshot.inputs[0].states = 0x7;
+    vecenv_reset_all();
+
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    for (n = 0; n < threads; n++) {
+        workers.emplace_back(&VecEnv::worker_main, this);
+    }
+}
+VecEnv::~VecEnv()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = 1;
+    }
+    start_cv.notify_all();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    delete[] states;
+    program->program_release();
+}
+u32_t VecEnv::vecenv_get_num_envs(void)
+{
+    return num_envs;
+}
+void VecEnv::vecenv_set_ram_watch(const u12_t *addrs, u32_t count)
+{
+    u32_t n;
+
+    ram_watch.assign(addrs, addrs + count);
+    obs_ram.assign((size_t)num_envs * count, 0);
+    for (n = 0; n < num_envs; n++) {
+        observe_env(n);
+    }
+}
+void VecEnv::vecenv_set_snapshot(const cpu_state_t *state)
+{
+    snapshot = *state;
+}
+void VecEnv::vecenv_reset(u32_t env)
+{
+    states[env]   = snapshot;
+    obs_done[env] = 0;
+    observe_env(env);
+}
+void VecEnv::vecenv_reset_all(void)
+{
+    u32_t n;
+
+    for (n = 0; n < num_envs; n++) {
+        vecenv_reset(n);
+    }
+}
+/* Starts an instance over from any state, not just the snapshot */
+void VecEnv::vecenv_load_state(u32_t env, const cpu_state_t *state)
+{
+    states[env]   = *state;
+    obs_done[env] = 0;
+    observe_env(env);
+}
+void VecEnv::vecenv_step(const u8_t *_actions)
+{
+    vecenv_step_envs(_actions, num_envs);
+}
+/* Steps only the first `count` instances, the others are left as they are */
+void VecEnv::vecenv_step_envs(const u8_t *_actions, u32_t count)
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    actions = _actions;
+    active  = (count < num_envs) ? count : num_envs;
+    next_env.store(0);
+    pending = workers.size();
+    generation++;
+    start_cv.notify_all();
+    done_cv.wait(guard, [this] { return pending == 0; });
+}
+cpu_state_t *VecEnv::vecenv_get_state(u32_t env)
+{
+    return &states[env];
+}
+const u8_t *VecEnv::vecenv_get_lcd(void)
+{
+    return obs_lcd.data();
+}
+const u8_t *VecEnv::vecenv_get_icons(void)
+{
+    return obs_icons.data();
+}
+const u8_t *VecEnv::vecenv_get_ram(void)
+{
+    return obs_ram.data();
+}
+const u8_t *VecEnv::vecenv_get_done(void)
+{
+    return obs_done.data();
+}
+void VecEnv::worker_main(void)
+{
+    CPU   cpu(nullptr);
+    u32_t seen = 0;
+    u32_t env, end;
+
+    cpu.cpu_init(program, NULL, 1000000);
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            start_cv.wait(guard, [&] { return quit || generation != seen; });
+            if (quit) {
+                return;
+            }
+            seen = generation;
+        }
+        /* Envs are handed out in small chunks so that slow instances do not leave threads idle */
+        while ((env = next_env.fetch_add(VECENV_CHUNK)) < active) {
+            end = (env + VECENV_CHUNK < active) ? env + VECENV_CHUNK : active;
+            for (; env < end; env++) {
+                step_env(&cpu, env);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (--pending == 0) {
+                done_cv.notify_one();
+            }
+        }
+    }
+}
+void VecEnv::step_env(CPU *cpu, u32_t env)
+{
+    static const pin_t pins[3] = {PIN_K02, PIN_K01, PIN_K00};
+    cpu_state_t       *st      = &states[env];
+    u8_t               action  = actions ? actions[env] : 0;
+    u32_t              target;
+    u8_t               i;
+
+    if (obs_done[env]) {
+        return;
+    }
+    cpu->cpu_bind_state(st);
+    /* Same mapping as Tamago::hw_set_button, only edges are applied so a held button interrupts once */
+    for (i = 0; i < 3; i++) {
+        pin_state_t state = ((action >> i) & 0x1) ? PIN_STATE_LOW : PIN_STATE_HIGH;
+        if (((st->inputs[0].states >> (pins[i] & 0x3)) & 0x1) != state) {
+            cpu->cpu_set_input_pin(pins[i], state);
+        }
+    }
+    target = st->tick_counter + frame_skip * VECENV_FRAME_TICKS;
+    while ((int32_t)(target - st->tick_counter) > 0) {
+        if (cpu->cpu_step()) {
+            obs_done[env] = 1;
+            break;
+        }
+    }
+    observe_env(env);
+}
+void VecEnv::observe_env(u32_t env)
+{
+    const cpu_state_t *st    = &states[env];
+    u8_t              *lcd   = &obs_lcd[(size_t)env * LCD_HEIGHT * LCD_WIDTH];
+    u8_t              *icons = &obs_icons[(size_t)env * ICON_NUM];
+    lcd_bitmap_t       bitmap;
+    u32_t              n;
+    u8_t               x, y;
+
+    CPU::cpu_render_lcd(st, &bitmap);
+    for (y = 0; y < LCD_HEIGHT; y++) {
+        for (x = 0; x < LCD_WIDTH; x++) {
+            lcd[y * LCD_WIDTH + x] = (bitmap.rows[y] >> x) & 0x1;
+        }
+    }
+    for (n = 0; n < ICON_NUM; n++) {
+        icons[n] = (bitmap.icons >> n) & 0x1;
+    }
+    for (n = 0; n < ram_watch.size(); n++) {
+        obs_ram[(size_t)env * ram_watch.size() + n] = GET_MEMORY(st->memory, ram_watch[n]);
+    }
+}
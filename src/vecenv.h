@@ -0,0 +1,80 @@
+#ifndef _VECENV_H_
+#define _VECENV_H_
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "tamago_def.h"
+#include "cpu.h"
+#include "program.h"
+
+
+#define VECENV_FRAME_TICKS (TICK_FREQUENCY / DEFAULT_FRAMERATE)
+#define VECENV_CHUNK       16
+
+/* Action bits, one per button, a set bit holds the button down for the whole step */
+#define VECENV_ACTION_LEFT   0x1
+#define VECENV_ACTION_MIDDLE 0x2
+#define VECENV_ACTION_RIGHT  0x4
+
+
+/*
+ * Batched environment for training agents: N headless instances stepped K frames at a time on a pool of
+ * worker threads, each owning one CPU executor that binds the instance states it is handed.
+ * Observations are written to contiguous buffers owned by the environment:
+ *   lcd   [N][16][32] u8, one byte per pixel (0 or 1)
+ *   icons [N][8]      u8
+ *   ram   [N][R]      u8, the nibbles selected with vecenv_set_ram_watch()
+ *   done  [N]         u8, set when the instance hit an invalid opcode
+ * Resets copy a snapshot state over the instance, so a new episode starts without replaying the boot.
+ */
+class VecEnv {
+  private:
+    u32_t                    num_envs;
+    u32_t                    frame_skip;
+    Program                 *program;
+    cpu_state_t             *states = 0;
+    cpu_state_t              snapshot;
+    std::vector<u12_t>       ram_watch;
+    const u8_t              *actions = 0;
+    std::vector<u8_t>        obs_lcd;
+    std::vector<u8_t>        obs_icons;
+    std::vector<u8_t>        obs_ram;
+    std::vector<u8_t>        obs_done;
+    std::vector<std::thread> workers;
+    std::mutex               lock;
+    std::condition_variable  start_cv;
+    std::condition_variable  done_cv;
+    std::atomic<u32_t>       next_env;
+    u32_t                    active     = 0;
+    u32_t                    pending    = 0;
+    u32_t                    generation = 0;
+    bool_t                   quit       = 0;
+
+  public:
+    VecEnv(Program *_program, u32_t _num_envs, u32_t threads, u32_t _frame_skip);
+    ~VecEnv();
+
+    u32_t vecenv_get_num_envs(void);
+    void  vecenv_set_ram_watch(const u12_t *addrs, u32_t count);
+    void  vecenv_set_snapshot(const cpu_state_t *state);
+    void  vecenv_reset(u32_t env);
+    void  vecenv_reset_all(void);
+    void  vecenv_load_state(u32_t env, const cpu_state_t *state);
+    void  vecenv_step(const u8_t *_actions);
+    void  vecenv_step_envs(const u8_t *_actions, u32_t count);
+
+    cpu_state_t *vecenv_get_state(u32_t env);
+    const u8_t  *vecenv_get_lcd(void);
+    const u8_t  *vecenv_get_icons(void);
+    const u8_t  *vecenv_get_ram(void);
+    const u8_t  *vecenv_get_done(void);
+
+  private:
+    void worker_main(void);
+    void step_env(CPU *cpu, u32_t env);
+    void observe_env(u32_t env);
+};
+#endif
@@ -0,0 +1,154 @@
+/*
+ * Archives two snapshots of a fleet that share most of their pages, writes them to a file, reads the file
+ * into another Archive and checks that restoring each snapshot gives back the archived bytes; then removes
+ * the snapshots one at a time and checks that GC frees the pages only the removed one used, and all of them
+ * at the end. A file with one flipped page byte and a snapshot holding an impossible state must both be
+ * rejected. Exits non-zero on the first failure.
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "archive.h"
+
+
+#define TEST_INSTANCES 600 /* More than two ARCHIVE_CHUNKs, so that several threads take part */
+#define TEST_THREADS   4
+#define TEST_PATH      "archive_test.bin"
+#define TEST_CMP_SIZE  offsetof(cpu_state_t, dirty) /* The registers and memory[], what a snapshot holds */
+
+static u32_t g_seed = 0x6A09E667;
+
+static u32_t rnd(void)
+{
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 17;
+    g_seed ^= g_seed << 5;
+    return g_seed;
+}
+/* Power-on states that differ in their registers and in a few RAM bytes, most memory pages are shared */
+static void random_state(cpu_state_t *state)
+{
+    u8_t n;
+
+    CPU::cpu_init_state(state);
+    state->a            = rnd() & 0xF;
+    state->x            = rnd() & 0xFFF;
+    state->tick_counter = rnd();
+    for (n = 0; n < 2; n++) {
+        state->memory[RAM_TO_MEMORY(rnd() % MEM_RAM_SIZE)] = rnd() & 0xFF;
+    }
+    state->mem_hash = CPU::cpu_hash_memory(state);
+}
+static int compare(const char *what, cpu_state_t *const *restored, const cpu_state_t *expected)
+{
+    u32_t i;
+
+    for (i = 0; i < TEST_INSTANCES; i++) {
+        if (memcmp(restored[i], &expected[i], TEST_CMP_SIZE) != 0 ||
+            restored[i]->mem_hash != CPU::cpu_hash_memory(&expected[i])) {
+            printf("%s: instance %u differs, pc %03X/%03X a %X/%X ticks %u/%u\n", what, i, restored[i]->pc,
+                   expected[i].pc, restored[i]->a, expected[i].a, restored[i]->tick_counter,
+                   expected[i].tick_counter);
+            return 1;
+        }
+    }
+    return 0;
+}
+static bool_t corrupt(const char *path)
+{
+    FILE  *f = fopen(path, "r+b");
+    bool_t res;
+    u8_t   c = 0;
+
+    if (f == NULL) {
+        return 1;
+    }
+    /* First data byte of the first page record */
+    res = fseek(f, sizeof(archive_header_t) + sizeof(archive_hash_t) + 1, SEEK_SET) != 0 || fread(&c, 1, 1, f) != 1;
+    c ^= 0x01;
+    res |= fseek(f, -1, SEEK_CUR) != 0 || fwrite(&c, 1, 1, f) != 1;
+    res |= fclose(f) != 0;
+    return res;
+}
+static int run(Archive *src, Archive *dst)
+{
+    static cpu_state_t snaps[2][TEST_INSTANCES];
+    static cpu_state_t out[TEST_INSTANCES];
+    cpu_state_t       *ptrs[TEST_INSTANCES];
+    u32_t              ids[2];
+    u32_t              i, pages, freed;
+
+    for (i = 0; i < TEST_INSTANCES; i++) {
+        random_state(&snaps[0][i]);
+        snaps[1][i] = snaps[0][i];
+        if (i % 2) {
+            snaps[1][i].tick_counter += 32768;
+            snaps[1][i].b = rnd() & 0xF;
+        }
+        ptrs[i] = &snaps[0][i];
+    }
+    ids[0] = src->archive_add(ptrs, TEST_INSTANCES);
+    for (i = 0; i < TEST_INSTANCES; i++) {
+        ptrs[i] = &snaps[1][i];
+    }
+    ids[1] = src->archive_add(ptrs, TEST_INSTANCES);
+    if (ids[0] == ARCHIVE_NO_SNAPSHOT || ids[1] == ARCHIVE_NO_SNAPSHOT || src->archive_write(TEST_PATH)) {
+        printf("cannot archive the snapshots\n");
+        return 1;
+    }
+    if (dst->archive_read(TEST_PATH) || dst->archive_get_pages() != src->archive_get_pages()) {
+        printf("read back %u pages, %u were written\n", dst->archive_get_pages(), src->archive_get_pages());
+        return 1;
+    }
+    pages = dst->archive_get_pages();
+
+    for (i = 0; i < TEST_INSTANCES; i++) {
+        memset(&out[i], 0xA5, sizeof(out[i]));
+        ptrs[i] = &out[i];
+    }
+    if (dst->archive_restore(ids[0], ptrs) || compare("snapshot 0", ptrs, snaps[0]) ||
+        dst->archive_restore(ids[1], ptrs) || compare("snapshot 1", ptrs, snaps[1])) {
+        return 1;
+    }
+
+    /* Odd instances moved on in snapshot 1, their register pages are its own */
+    dst->archive_remove(ids[0]);
+    freed = dst->archive_gc();
+    if (freed == 0 || freed >= pages || dst->archive_restore(ids[0], ptrs) == 0 ||
+        dst->archive_restore(ids[1], ptrs) || compare("snapshot 1 after removing 0", ptrs, snaps[1])) {
+        printf("removing snapshot 0 freed %u of %u pages\n", freed, pages);
+        return 1;
+    }
+    dst->archive_remove(ids[1]);
+    freed += dst->archive_gc();
+    if (freed != pages || dst->archive_get_pages() != 0 || dst->archive_get_count(ids[1]) != 0) {
+        printf("removing both snapshots freed %u of %u pages, %u left\n", freed, pages, dst->archive_get_pages());
+        return 1;
+    }
+
+    if (corrupt(TEST_PATH) || dst->archive_read(TEST_PATH) == 0 || dst->archive_get_pages() != 0) {
+        printf("a page that does not match its hash was read\n");
+        return 1;
+    }
+    snaps[0][0].pc = 0x2000;
+    ptrs[0]        = &snaps[0][0];
+    ids[0]         = dst->archive_add(ptrs, 1);
+    if (ids[0] == ARCHIVE_NO_SNAPSHOT || dst->archive_restore(ids[0], ptrs) == 0) {
+        printf("a state with pc %04X was restored\n", snaps[0][0].pc);
+        return 1;
+    }
+    printf("%u instances in 2 snapshots restored from %u pages\n", TEST_INSTANCES, pages);
+    return 0;
+}
+
+int main(void)
+{
+    Archive *src = new Archive(TEST_THREADS);
+    Archive *dst = new Archive(TEST_THREADS);
+    int      res = run(src, dst);
+
+    remove(TEST_PATH);
+    delete src;
+    delete dst;
+    return res;
+}
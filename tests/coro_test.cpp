@@ -0,0 +1,157 @@
+/*
+ * Runs two CPUs interleaved on one CoLoop, each through a script of STEP, NEXT, TO_CALL and TO_RET runs, and
+ * checks that every run stops where Tamago::tamalib_step would have paused: after one instruction for STEP,
+ * and at the first instruction boundary whose call depth is <=, > or < the depth the run started at for the
+ * other three. The reference replays the same script on a third CPU with those rules. Exits non-zero on the
+ * first difference.
+ */
+#include <stdio.h>
+#include "coro.h"
+#include "program.h"
+
+
+#define TEST_RUNS 200 /* Runs per CPU */
+
+typedef struct
+{
+    u13_t pc;
+    u32_t depth;
+    u32_t tick;
+} stop_t;
+
+static const exec_mode_t g_script[] = {EXEC_MODE_STEP, EXEC_MODE_NEXT, EXEC_MODE_TO_CALL, EXEC_MODE_TO_RET};
+
+static stop_t g_stops[2][TEST_RUNS];
+static u8_t   g_order[2 * TEST_RUNS]; /* Which CPU completed each run, in completion order */
+static u32_t  g_done = 0;
+
+/*
+ * Page 1: a main loop calling a routine that calls a leaf, then the leaf on its own, so that runs see the
+ * depth go 0 -> 1 -> 2 -> 1 -> 0 -> 1 -> 0.
+ */
+static void build_rom(u12_t *rom)
+{
+    rom[0x100] = 0xFFB; /* NOP5 */
+    rom[0x101] = 0x410; /* CALL 0x10 */
+    rom[0x102] = 0xFFB; /* NOP5 */
+    rom[0x103] = 0x420; /* CALL 0x20 */
+    rom[0x104] = 0x000; /* JP 0x00 */
+    rom[0x110] = 0xFFB; /* NOP5 */
+    rom[0x111] = 0x420; /* CALL 0x20 */
+    rom[0x112] = 0xFDF; /* RET */
+    rom[0x120] = 0xFFB; /* NOP5 */
+    rom[0x121] = 0xFFB; /* NOP5 */
+    rom[0x122] = 0xFDF; /* RET */
+}
+/* The stack must sit in RAM, it starts at 0 and would push the return addresses into the I/O registers */
+static CPU *new_cpu(Program *program)
+{
+    CPU *cpu = new CPU(nullptr);
+
+    cpu->cpu_init(program, NULL, 1000000);
+    cpu->cpu_get_state()->sp = 0x80;
+    return cpu;
+}
+static stop_t get_stop(CPU *cpu)
+{
+    return {cpu->cpu_get_state()->pc, cpu->cpu_get_depth(), cpu->cpu_get_state()->tick_counter};
+}
+/* Run `i` of the script, swapped for one that ends when the ROM cannot go deeper or shallower than `depth` */
+static exec_mode_t pick_mode(u32_t i, u32_t depth)
+{
+    exec_mode_t mode = g_script[i % 4];
+
+    if (mode == EXEC_MODE_TO_CALL && depth >= 2) {
+        return EXEC_MODE_TO_RET;
+    }
+    if (mode == EXEC_MODE_TO_RET && depth == 0) {
+        return EXEC_MODE_TO_CALL;
+    }
+    return mode;
+}
+/* The stop rules of Tamago::tamalib_step, one exec mode at a time */
+static void reference_run(CPU *cpu, exec_mode_t mode)
+{
+    u32_t from = cpu->cpu_get_depth();
+
+    while (!cpu->cpu_step()) {
+        if (mode == EXEC_MODE_STEP || (mode == EXEC_MODE_NEXT && cpu->cpu_get_depth() <= from) ||
+            (mode == EXEC_MODE_TO_CALL && cpu->cpu_get_depth() > from) ||
+            (mode == EXEC_MODE_TO_RET && cpu->cpu_get_depth() < from)) {
+            return;
+        }
+    }
+}
+static CoTask script(CoLoop *loop, CPU *cpu, u8_t id)
+{
+    u32_t i;
+
+    for (i = 0; i < TEST_RUNS; i++) {
+        co_await loop->coloop_exec(cpu, pick_mode(i, cpu->cpu_get_depth()));
+        g_stops[id][i]    = get_stop(cpu);
+        g_order[g_done++] = id;
+    }
+}
+
+int main(void)
+{
+    static u12_t rom[PROGRAM_PC_NUM];
+    Program     *program;
+    CoLoop      *loop = new CoLoop();
+    CPU         *cpus[2];
+    CPU         *ref;
+    stop_t       stop;
+    exec_mode_t  mode;
+    u32_t        i, interleaved = 0;
+    u8_t         id;
+    int          res = 0;
+
+    build_rom(rom);
+    program = Program::program_get(rom, PROGRAM_PC_NUM);
+    for (id = 0; id < 2; id++) {
+        cpus[id] = new_cpu(program);
+    }
+    /* Start the second CPU elsewhere in the loop, so that both do not stop in step */
+    for (i = 0; i < 3; i++) {
+        cpus[1]->cpu_step();
+    }
+    loop->coloop_spawn(script(loop, cpus[0], 0));
+    loop->coloop_spawn(script(loop, cpus[1], 1));
+    loop->coloop_run();
+
+    for (id = 0; id < 2 && res == 0; id++) {
+        ref = new_cpu(program);
+        for (i = 0; i < 3 * id; i++) {
+            ref->cpu_step();
+        }
+        for (i = 0; i < TEST_RUNS; i++) {
+            mode = pick_mode(i, ref->cpu_get_depth());
+            reference_run(ref, mode);
+            stop = get_stop(ref);
+            if (stop.pc != g_stops[id][i].pc || stop.depth != g_stops[id][i].depth ||
+                stop.tick != g_stops[id][i].tick) {
+                printf("cpu %u run %u (mode %u): stopped at pc %03X depth %u tick %u, expected %03X %u %u\n", id, i,
+                       mode, g_stops[id][i].pc, g_stops[id][i].depth, g_stops[id][i].tick, stop.pc,
+                       stop.depth, stop.tick);
+                res = 1;
+                break;
+            }
+        }
+        delete ref;
+    }
+    for (i = 1; i < g_done; i++) {
+        interleaved += g_order[i] != g_order[i - 1];
+    }
+    if (res == 0 && (g_done != 2 * TEST_RUNS || interleaved < TEST_RUNS)) {
+        printf("%u runs completed, %u switches between the CPUs\n", g_done, interleaved);
+        res = 1;
+    }
+    if (res == 0) {
+        printf("%u runs on 2 interleaved CPUs stopped where tamalib_step would\n", g_done);
+    }
+    program->program_release();
+    delete cpus[0];
+    delete cpus[1];
+    delete loop;
+    return res;
+}
@@ -0,0 +1,83 @@
+/*
+ * Links two instances of a ROM that writes the trigger bit of REG_SERIAL_CTRL and then spins, with a
+ * different byte in each side's serial data registers. Two SerialLinks run from the same start must end in
+ * byte-identical states on both sides, whatever the interleaving of their threads, and each side must hold
+ * the byte the other one started with, its transfer completed. Exits non-zero on the first difference.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "cpu_def.h"
+#include "link.h"
+
+
+#define TEST_TICKS 50000 /* Many times LINK_DEFAULT_LATENCY */
+
+static const u8_t g_data[2] = {0x5A, 0xC3};
+
+static void build_rom(u12_t *rom)
+{
+    rom[0x100] = 0xE0F; /* LD A #0xF */
+    rom[0x101] = 0xE80; /* LD XP A */
+    rom[0x102] = 0xB7A; /* LD X #0x7A, X = REG_SERIAL_CTRL */
+    rom[0x103] = 0xE28; /* LD MX #SERIAL_CTRL_TRIGGER */
+    rom[0x104] = 0xFFB; /* NOP5 */
+    rom[0x105] = 0x004; /* JP 0x04 */
+}
+static SerialLink *new_link(Program *program)
+{
+    SerialLink  *link = new SerialLink(program, LINK_DEFAULT_LATENCY);
+    cpu_state_t *st;
+    u8_t         side;
+
+    for (side = 0; side < 2; side++) {
+        st = link->link_get_state(side);
+        SET_IO_MEMORY(st->memory, REG_SERIAL_DATA_L, g_data[side] & 0xF);
+        SET_IO_MEMORY(st->memory, REG_SERIAL_DATA_H, g_data[side] >> 4);
+        st->mem_hash = CPU::cpu_hash_memory(st);
+    }
+    return link;
+}
+static u8_t get_data(const cpu_state_t *st)
+{
+    return GET_IO_MEMORY(st->memory, REG_SERIAL_DATA_L) | (GET_IO_MEMORY(st->memory, REG_SERIAL_DATA_H) << 4);
+}
+
+int main(void)
+{
+    static u12_t rom[PROGRAM_PC_NUM];
+    Program     *program;
+    SerialLink  *links[2];
+    cpu_state_t *st;
+    u8_t         n, side;
+    int          res = 0;
+
+    build_rom(rom);
+    program = Program::program_get(rom, PROGRAM_PC_NUM);
+    for (n = 0; n < 2; n++) {
+        links[n] = new_link(program);
+        links[n]->link_run(TEST_TICKS);
+    }
+    for (side = 0; side < 2 && res == 0; side++) {
+        if (memcmp(links[0]->link_get_state(side), links[1]->link_get_state(side), sizeof(cpu_state_t)) != 0) {
+            printf("side %u differs between the runs: pc %03X/%03X ticks %u/%u data %02X/%02X\n", side,
+                   links[0]->link_get_state(side)->pc, links[1]->link_get_state(side)->pc,
+                   links[0]->link_get_state(side)->tick_counter, links[1]->link_get_state(side)->tick_counter,
+                   get_data(links[0]->link_get_state(side)), get_data(links[1]->link_get_state(side)));
+            res = 1;
+            break;
+        }
+        st = links[0]->link_get_state(side);
+        if (get_data(st) != g_data[side ^ 1] || st->serial_state != SERIAL_IDLE || st->pc < 0x104) {
+            printf("side %u holds %02X in state %u at pc %03X, expected %02X once idle\n", side, get_data(st),
+                   st->serial_state, st->pc, g_data[side ^ 1]);
+            res = 1;
+        }
+    }
+    if (res == 0) {
+        printf("2 runs of %u ticks identical, %02X and %02X swapped\n", TEST_TICKS, g_data[0], g_data[1]);
+    }
+    delete links[0];
+    delete links[1];
+    program->program_release();
+    return res;
+}
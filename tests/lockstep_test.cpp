@@ -0,0 +1,131 @@
+/*
+ * Runs Lockstep lanes and the scalar CPU side by side from the same states and checks after every step that
+ * each lane holds exactly the state CPU::cpu_step produced. The ROM is random valid instructions and every
+ * lane starts from a random state; some lanes point X and Y at the serial and timer registers, so that the
+ * I/O paths are exercised as well as the ALU and memory ones. Exits non-zero on the first difference.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "lockstep.h"
+#include "program.h"
+
+
+#define TEST_LANES      LOCKSTEP_MAX_LANES
+#define TEST_STEPS      50000
+#define TEST_INPUT_STEP 1000 /* Steps between random changes of the K0x and K1x pins */
+
+static u32_t g_seed = 0x2545F491;
+
+static u32_t rnd(void)
+{
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 17;
+    g_seed ^= g_seed << 5;
+    return g_seed;
+}
+static void random_state(cpu_state_t *state, u8_t lane)
+{
+    static const u12_t io_regs[] = {REG_SERIAL_DATA_L, REG_SERIAL_CTRL, REG_SERIAL_INT_MASKS, REG_PROG_TIMER_CTRL};
+    u32_t              n;
+
+    CPU::cpu_init_state(state);
+    state->pc    = rnd() % PROGRAM_PC_NUM;
+    state->x     = rnd() & 0xFFF;
+    state->y     = rnd() & 0xFFF;
+    state->a     = rnd() & 0xF;
+    state->b     = rnd() & 0xF;
+    state->np    = rnd() & 0x1F;
+    state->sp    = rnd() & 0xFF;
+    state->flags = rnd() & 0xF;
+    for (n = RAM_TO_MEMORY(0); n < RAM_TO_MEMORY(MEM_RAM_SIZE); n++) {
+        state->memory[n] = rnd() & 0xFF;
+    }
+    if (lane % 4 == 0) {
+        state->x = io_regs[(lane / 4) % 4];
+        state->y = io_regs[(lane / 4 + 1) % 4];
+    }
+    state->mem_hash = CPU::cpu_hash_memory(state);
+}
+static bool_t compare(u8_t lane, u32_t step, const cpu_state_t *expected, const cpu_state_t *lane_state)
+{
+    if (memcmp(expected, lane_state, sizeof(cpu_state_t)) == 0) {
+        return 0;
+    }
+    printf("lane %u differs after step %u: pc %03X/%03X x %03X/%03X y %03X/%03X a %X/%X serial %u/%u ticks %u/%u\n",
+           lane, step, expected->pc, lane_state->pc, expected->x, lane_state->x, expected->y, lane_state->y,
+           expected->a, lane_state->a, expected->serial_state, lane_state->serial_state, expected->tick_counter,
+           lane_state->tick_counter);
+    return 1;
+}
+
+int main(void)
+{
+    static u12_t       rom[PROGRAM_PC_NUM];
+    static cpu_state_t states[TEST_LANES];
+    cpu_state_t        lane_state;
+    decoded_op_t       dec;
+    Program           *program;
+    Lockstep          *lockstep = new Lockstep(TEST_LANES);
+    CPU               *cpu      = new CPU(nullptr);
+    bool_t             stopped[TEST_LANES] = {0};
+    u32_t              n, step, running;
+    u8_t               lane;
+    pin_t              pin;
+    pin_state_t        pin_state;
+    int                res = 0;
+
+    for (n = 0; n < PROGRAM_PC_NUM; n++) {
+        do {
+            rom[n] = rnd() & 0xFFF;
+        } while (CPU::cpu_decode(rom[n], &dec));
+    }
+    program = Program::program_get(rom, PROGRAM_PC_NUM);
+    cpu->cpu_init(program, NULL, 1000000);
+    lockstep->lockstep_init(program);
+    program->program_release();
+    for (lane = 0; lane < TEST_LANES; lane++) {
+        random_state(&states[lane], lane);
+        lockstep->lockstep_load_lane(lane, &states[lane]);
+    }
+
+    for (step = 1; step <= TEST_STEPS && res == 0; step++) {
+        if (step % TEST_INPUT_STEP == 0) {
+            for (lane = 0; lane < TEST_LANES; lane++) {
+                pin       = (pin_t)(rnd() % 8);
+                pin_state = (pin_state_t)(rnd() & 0x1);
+                cpu->cpu_bind_state(&states[lane]);
+                cpu->cpu_set_input_pin(pin, pin_state);
+                lockstep->lockstep_set_input_pin(lane, pin, pin_state);
+            }
+        }
+        lockstep->lockstep_step();
+        running = 0;
+        for (lane = 0; lane < TEST_LANES && res == 0; lane++) {
+            if (!stopped[lane]) {
+                cpu->cpu_bind_state(&states[lane]);
+                stopped[lane] = cpu->cpu_step();
+                running += !stopped[lane];
+            }
+            if (stopped[lane] != !!(lockstep->lockstep_get_stopped() & ((lane_mask_t)0x1 << lane))) {
+                printf("lane %u stopped on one side only after step %u\n", lane, step);
+                res = 1;
+                break;
+            }
+            memset(&lane_state, 0, sizeof(lane_state));
+            memcpy(lane_state.pad, states[lane].pad, sizeof(lane_state.pad));
+            lockstep->lockstep_store_lane(lane, &lane_state);
+            res = compare(lane, step, &states[lane], &lane_state);
+        }
+        if (running == 0) {
+            break;
+        }
+    }
+    if (res == 0) {
+        printf("%u lanes identical to CPU over %u steps\n", TEST_LANES, step - 1);
+    }
+    delete lockstep;
+    delete cpu;
+    return res;
+}
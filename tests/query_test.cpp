@@ -0,0 +1,106 @@
+/*
+ * Runs the same random predicate sets through RamQuery with its SIMD filters and with the scalar ones, over
+ * fleets whose size is rarely a multiple of 32 so that the scalar tail after the vector loop is exercised,
+ * and checks that both return the ids a plain loop over the nibbles finds. RANGE predicates are drawn with a > b
+ * as often as not, an empty range must match nothing on either path. Exits non-zero on the first difference.
+ */
+#include <stdio.h>
+#include <vector>
+#include "query.h"
+
+
+#define TEST_INSTANCES 203 /* Largest fleet, not a multiple of 32 */
+#define TEST_ROUNDS    2000
+#define TEST_ADDRS     4 /* Addresses the predicates pick from, so that most of them share columns */
+
+static u32_t g_seed = 0x9E3779B9;
+
+static query_pred_t g_preds[QUERY_MAX_PREDS];
+static u8_t         g_pred_num;
+
+static u32_t rnd(void)
+{
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 17;
+    g_seed ^= g_seed << 5;
+    return g_seed;
+}
+static void reference_run(const cpu_state_t *states, u32_t count, std::vector<u32_t> *ids)
+{
+    const query_pred_t *pred;
+    u32_t               i;
+    u8_t                n, v, match;
+
+    ids->clear();
+    for (i = 0; i < count; i++) {
+        for (n = 0, match = 1; n < g_pred_num && match; n++) {
+            pred  = &g_preds[n];
+            v     = GET_RAM_MEMORY(states[i].memory, pred->addr);
+            match = (pred->op == QUERY_EQ && v == pred->a) ||
+                    (pred->op == QUERY_RANGE && v >= pred->a && v <= pred->b) ||
+                    (pred->op == QUERY_MASK && (v & pred->a) == pred->b);
+        }
+        if (match) {
+            ids->push_back(i);
+        }
+    }
+}
+
+int main(void)
+{
+    static cpu_state_t  states[TEST_INSTANCES];
+    query_source_t      sources[TEST_INSTANCES];
+    std::vector<u32_t>  simd_ids, scalar_ids, ref_ids;
+    RamQuery           *simd   = new RamQuery();
+    RamQuery           *scalar = new RamQuery();
+    u32_t               round, i, n, count, matched = 0, empty = 0;
+    u12_t               addr;
+    u4_t                a, b;
+    query_op_t          op;
+    int                 res = 0;
+
+    scalar->query_set_simd(0);
+    for (i = 0; i < TEST_INSTANCES; i++) {
+        CPU::cpu_init_state(&states[i]);
+        sources[i] = {&states[i], NULL};
+    }
+    for (round = 0; round < TEST_ROUNDS && res == 0; round++) {
+        for (i = 0; i < TEST_INSTANCES; i++) {
+            for (n = 0; n < TEST_ADDRS / 2; n++) {
+                states[i].memory[RAM_TO_MEMORY(n * 2)] = rnd() & 0xFF;
+            }
+        }
+        simd->query_clear();
+        scalar->query_clear();
+        for (g_pred_num = rnd() % 3 + 1, n = 0; n < g_pred_num; n++) {
+            addr = rnd() % TEST_ADDRS;
+            op   = (query_op_t)(rnd() % 3);
+            a    = rnd() & 0xF;
+            b    = rnd() & 0xF;
+            empty += op == QUERY_RANGE && a > b;
+            g_preds[n] = {addr, (u8_t)op, a, b};
+            simd->query_add(addr, op, a, b);
+            scalar->query_add(addr, op, a, b);
+        }
+        count = rnd() % TEST_INSTANCES + 1;
+        simd->query_run(sources, count, &simd_ids);
+        scalar->query_run(sources, count, &scalar_ids);
+        reference_run(states, count, &ref_ids);
+        if (simd_ids != ref_ids || scalar_ids != ref_ids) {
+            printf("round %u over %u instances: %zu ids with SIMD, %zu without, %zu expected\n", round, count,
+                   simd_ids.size(), scalar_ids.size(), ref_ids.size());
+            res = 1;
+        }
+        matched += scalar_ids.size();
+    }
+    if (res == 0) {
+        printf("%u rounds identical with and without SIMD (%u matches, %u empty ranges)%s\n", round, matched, empty,
+#if defined(__x86_64__) || defined(__i386__)
+               __builtin_cpu_supports("avx2") ? "" :
+#endif
+                                              ", no SIMD filter on this host");
+    }
+    delete simd;
+    delete scalar;
+    return res;
+}
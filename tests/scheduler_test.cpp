@@ -0,0 +1,150 @@
+/*
+ * Drives a Scheduler from a fake clock and checks every wakeup against a model where an instance added on
+ * tick a wakes on tick a + 1 + id % quantum, then once per quantum. With quanta of 100 and 5000 ticks the
+ * later deadlines sit on wheel levels 1 and 2 and only reach level 0 by cascading, they must still fire on
+ * their own tick. The clock first moves one tick per poll, where every wakeup is on time, then jumps several
+ * ticks at once, where each wakeup must land in the lateness bucket of its own deadline. Exits non-zero on
+ * the first difference.
+ */
+#include <stdio.h>
+#include "scheduler.h"
+
+
+#define TEST_INSTANCES 16
+#define TEST_TICKS     12000 /* Ticks polled one at a time */
+#define TEST_JUMPS     40
+
+static const u32_t g_quanta[] = {100, 5000}; /* In ticks */
+
+static sched_time_t g_now_us = 1000000;
+static u32_t        g_seed   = 0x2545F491;
+
+static u32_t rnd(void)
+{
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 17;
+    g_seed ^= g_seed << 5;
+    return g_seed;
+}
+static sched_time_t fake_clock(void)
+{
+    return g_now_us;
+}
+/* Wakeups the model expects on `tick` */
+static u32_t expected_at(const sched_time_t *first, u32_t quantum, sched_time_t tick)
+{
+    u32_t n, count = 0;
+
+    for (n = 0; n < TEST_INSTANCES; n++) {
+        count += first[n] != 0 && tick >= first[n] && (tick - first[n]) % quantum == 0;
+    }
+    return count;
+}
+/* Bucket n holds lateness in [2^(n-1), 2^n) us */
+static u8_t bucket_of(sched_time_t late)
+{
+    u8_t bucket = (late == 0) ? 0 : 64 - __builtin_clzll(late);
+
+    return (bucket < SCHED_LATENESS_BUCKETS) ? bucket : SCHED_LATENESS_BUCKETS - 1;
+}
+static int run(Program *program, u32_t quantum)
+{
+    static cpu_state_t   states[TEST_INSTANCES];
+    Scheduler           *scheduler = new Scheduler(TEST_INSTANCES, quantum * SCHED_TICK_US);
+    sched_time_t         first[TEST_INSTANCES] = {0};
+    u32_t                buckets[SCHED_LATENESS_BUCKETS] = {0};
+    const sched_stats_t *stats;
+    sched_time_t         tick = 0, from, end_us, max_us = 0;
+    uint64_t             wakeups = 0;
+    u32_t                i, n, jump, count, expected;
+    u32_t                added = 0;
+    int                  res   = 0;
+
+    scheduler->scheduler_set_clock(fake_clock);
+    scheduler->scheduler_init(program);
+    for (i = 0; i < TEST_TICKS && res == 0; i++) {
+        g_now_us += SCHED_TICK_US;
+        tick++;
+        count    = scheduler->scheduler_poll();
+        expected = expected_at(first, quantum, tick);
+        if (count != expected) {
+            printf("quantum %u: %u wakeups on tick %llu, expected %u\n", quantum, count, (unsigned long long)tick,
+                   expected);
+            res = 1;
+        }
+        wakeups += count;
+        /* Add the instances at random points of the first quantum */
+        if (added < TEST_INSTANCES && rnd() % (quantum / TEST_INSTANCES + 1) == 0) {
+            CPU::cpu_init_state(&states[added]);
+            n        = scheduler->scheduler_add(&states[added]);
+            first[n] = tick + 1 + n % quantum;
+            added++;
+        }
+    }
+    stats = scheduler->scheduler_get_stats();
+    if (res == 0 && (added != TEST_INSTANCES || stats->wakeups != wakeups || stats->buckets[0] != wakeups)) {
+        printf("quantum %u: %u instances, %llu wakeups, %u on time, expected %llu\n", quantum, added,
+               (unsigned long long)stats->wakeups, stats->buckets[0], (unsigned long long)wakeups);
+        res = 1;
+    }
+
+    scheduler->scheduler_reset_stats();
+    wakeups = 0;
+    for (i = 0; i < TEST_JUMPS && res == 0; i++) {
+        jump     = rnd() % (3 * quantum) + 1;
+        from     = tick;
+        g_now_us += (sched_time_t)jump * SCHED_TICK_US;
+        end_us   = g_now_us;
+        count    = scheduler->scheduler_poll();
+        expected = 0;
+        for (tick = from + 1; tick <= from + jump; tick++) {
+            n         = expected_at(first, quantum, tick);
+            expected += n;
+            buckets[bucket_of((from + jump - tick) * SCHED_TICK_US)] += n;
+            if (n > 0 && (from + jump - tick) * SCHED_TICK_US > max_us) {
+                max_us = (from + jump - tick) * SCHED_TICK_US;
+            }
+        }
+        tick = from + jump;
+        if (count != expected) {
+            printf("quantum %u: %u wakeups jumping %u ticks to %llu us, expected %u\n", quantum, count, jump,
+                   (unsigned long long)end_us, expected);
+            res = 1;
+        }
+        wakeups += count;
+    }
+    stats = scheduler->scheduler_get_stats();
+    for (n = 0; n < SCHED_LATENESS_BUCKETS && res == 0; n++) {
+        if (stats->buckets[n] != buckets[n]) {
+            printf("quantum %u: %u wakeups in lateness bucket %u, expected %u\n", quantum, stats->buckets[n], n,
+                   buckets[n]);
+            res = 1;
+        }
+    }
+    if (res == 0 && (stats->wakeups != wakeups || stats->max_us != max_us)) {
+        printf("quantum %u: %llu wakeups up to %llu us late, expected %llu up to %llu us\n", quantum,
+               (unsigned long long)stats->wakeups, (unsigned long long)stats->max_us, (unsigned long long)wakeups,
+               (unsigned long long)max_us);
+        res = 1;
+    }
+    if (res == 0) {
+        printf("quantum %u: %llu late wakeups in their buckets, up to %llu us\n", quantum,
+               (unsigned long long)wakeups, (unsigned long long)max_us);
+    }
+    delete scheduler;
+    return res;
+}
+
+int main(void)
+{
+    static u12_t rom[PROGRAM_PC_NUM]; /* JP 0x00 everywhere, the instances only spin */
+    Program     *program = Program::program_get(rom, PROGRAM_PC_NUM);
+    u8_t         q;
+    int          res = 0;
+
+    for (q = 0; q < sizeof(g_quanta) / sizeof(g_quanta[0]) && res == 0; q++) {
+        res = run(program, g_quanta[q]);
+    }
+    program->program_release();
+    return res;
+}
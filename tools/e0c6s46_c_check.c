@@ -0,0 +1,121 @@
+/*
+ * Plain C consumer of libe0c6s46: built by the tree so that the library is known to link from C with nothing
+ * but itself, and run as a test. Runs a ROM that writes a RAM nibble and a display RAM nibble, then counts in
+ * RAM forever, and checks what the header promises: getters return the same pointers before and after a run
+ * and see the writes through them, and a save-state, alone or followed by its deltas, rebuilds the same bytes.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "e0c6s46.h"
+
+
+#define RESET_PC   0x100
+#define ROM_SIZE   (RESET_PC + 8)
+#define RAM_NIBBLE 5   /* Written once by the ROM */
+#define RAM_VALUE  0x9
+#define DISP_VALUE 0xF /* Written once at the first display RAM nibble */
+#define DELTAS     3
+
+static const uint16_t g_program[ROM_SIZE - RESET_PC] = {
+    0xE09, /* LD A #0x9 */
+    0xF85, /* LD M(0x5) A */
+    0xE0E, /* LD A #0xE */
+    0xE80, /* LD XP A */
+    0xB00, /* LD X #0x00, X = 0xE00, the first display RAM nibble */
+    0xE2F, /* LD MX #0xF */
+    0xF60, /* INC M(0x0) */
+    0x006, /* JP 0x06 */
+};
+
+static int check_pointers(e0c6s46_t *inst)
+{
+    const uint8_t       *ram, *disp;
+    const e0c6s46_lcd_t *lcd;
+    uint32_t             ram_size, disp_size;
+
+    ram  = e0c6s46_get_ram(inst, &ram_size);
+    disp = e0c6s46_get_display_ram(inst, &disp_size);
+    lcd  = e0c6s46_get_lcd(inst);
+    if (e0c6s46_run_cycles(inst, E0C6S46_CLOCK_HZ) < E0C6S46_CLOCK_HZ) {
+        fprintf(stderr, "ran %u cycles, expected at least %u\n", e0c6s46_get_cycles(inst), E0C6S46_CLOCK_HZ);
+        return 1;
+    }
+    if (ram == NULL || disp == NULL || lcd == NULL || ram != e0c6s46_get_ram(inst, NULL) ||
+        disp != e0c6s46_get_display_ram(inst, NULL) || lcd != e0c6s46_get_lcd(inst)) {
+        fprintf(stderr, "a getter returned another pointer after running\n");
+        return 1;
+    }
+    if (RAM_NIBBLE / 2 >= ram_size || ((ram[RAM_NIBBLE / 2] >> (RAM_NIBBLE % 2 * 4)) & 0xF) != RAM_VALUE ||
+        disp_size == 0 || (disp[0] & 0xF) != DISP_VALUE) {
+        fprintf(stderr, "RAM nibble %u holds %X, display nibble 0 holds %X, expected %X and %X\n", RAM_NIBBLE,
+                (ram[RAM_NIBBLE / 2] >> (RAM_NIBBLE % 2 * 4)) & 0xF, disp[0] & 0xF, RAM_VALUE, DISP_VALUE);
+        return 1;
+    }
+    return 0;
+}
+static int check_state(e0c6s46_t *inst)
+{
+    static uint8_t start[E0C6S46_SAVE_SIZE], end[E0C6S46_SAVE_SIZE], again[E0C6S46_SAVE_SIZE];
+    static uint8_t deltas[DELTAS][E0C6S46_DELTA_MAX];
+    uint32_t       sizes[DELTAS];
+    uint32_t       n;
+
+    if (e0c6s46_save_state(inst, start, sizeof(start)) != E0C6S46_SAVE_SIZE) {
+        fprintf(stderr, "cannot save the state\n");
+        return 1;
+    }
+    for (n = 0; n < DELTAS; n++) {
+        e0c6s46_run_cycles(inst, 1000);
+        sizes[n] = e0c6s46_save_delta(inst, deltas[n], sizeof(deltas[n]));
+        if (sizes[n] == 0) {
+            fprintf(stderr, "cannot save delta %u\n", n);
+            return 1;
+        }
+    }
+    if (e0c6s46_save_state(inst, end, sizeof(end)) != E0C6S46_SAVE_SIZE || memcmp(start, end, sizeof(end)) == 0) {
+        fprintf(stderr, "the state did not change while running\n");
+        return 1;
+    }
+
+    if (e0c6s46_load_state(inst, start, sizeof(start)) != 0 ||
+        e0c6s46_save_state(inst, again, sizeof(again)) != E0C6S46_SAVE_SIZE || memcmp(start, again, sizeof(again))) {
+        fprintf(stderr, "a loaded save-state does not save back to the same bytes\n");
+        return 1;
+    }
+    for (n = 0; n < DELTAS; n++) {
+        if (e0c6s46_load_delta(inst, deltas[n], sizes[n]) != 0) {
+            fprintf(stderr, "cannot load delta %u\n", n);
+            return 1;
+        }
+    }
+    if (e0c6s46_save_state(inst, again, sizeof(again)) != E0C6S46_SAVE_SIZE || memcmp(end, again, sizeof(again))) {
+        fprintf(stderr, "the save-state and its %u deltas do not rebuild the last state\n", DELTAS);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    static uint16_t rom[ROM_SIZE];
+    e0c6s46_t      *inst;
+    int             res = 0;
+
+    if (e0c6s46_abi_version() != E0C6S46_ABI_VERSION) {
+        fprintf(stderr, "ABI version %u, expected %u\n", e0c6s46_abi_version(), E0C6S46_ABI_VERSION);
+        return 1;
+    }
+    inst = e0c6s46_create();
+    if (inst == NULL) {
+        return 1;
+    }
+    memcpy(&rom[RESET_PC], g_program, sizeof(g_program));
+    if (e0c6s46_load_rom(inst, rom, ROM_SIZE) != 0) {
+        fprintf(stderr, "cannot load the ROM\n");
+        res = 1;
+    } else {
+        res = check_pointers(inst) || check_state(inst);
+    }
+    e0c6s46_destroy(inst);
+    return res;
+}
@@ -0,0 +1,199 @@
+/*
+ * Exercises a server started with `cpp_app -s <socket>`: creates a batch of instances, drives them with
+ * batched press/run requests while subscribed to LCD changes, reads frames and RAM, and checks that a
+ * snapshot restored into an instance replays to the same frame. Exits non-zero on any mismatch.
+ */
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+#include "server_proto.h"
+
+
+typedef struct
+{
+    srv_reply_t          reply;
+    std::vector<uint8_t> data;
+} reply_t;
+
+static int      g_fd            = -1;
+static uint32_t g_notifications = 0;
+static uint32_t g_notified      = 0;
+
+
+static void push_cmd(std::vector<uint8_t> &req, uint8_t op, uint32_t inst, uint8_t flags, uint16_t addr,
+                     uint32_t arg, const void *payload, uint32_t size)
+{
+    srv_cmd_t cmd = {op, flags, addr, inst, arg, size};
+    req.insert(req.end(), (const uint8_t *)&cmd, (const uint8_t *)&cmd + sizeof(cmd));
+    req.insert(req.end(), (const uint8_t *)payload, (const uint8_t *)payload + size);
+}
+static bool read_all(void *buf, size_t size)
+{
+    size_t  got = 0;
+    ssize_t res;
+    while (got < size) {
+        res = recv(g_fd, (uint8_t *)buf + got, size - got, 0);
+        if (res <= 0) {
+            return false;
+        }
+        got += res;
+    }
+    return true;
+}
+/* Sends one batched request and returns its replies, counting notification frames seen meanwhile */
+static bool transact(const std::vector<uint8_t> &req, uint16_t count, std::vector<reply_t> &replies)
+{
+    srv_frame_t          frame = {SRV_MAGIC, SRV_FRAME_REQUEST, count, (uint32_t)req.size()};
+    std::vector<uint8_t> body;
+    size_t               at;
+
+    if (send(g_fd, &frame, sizeof(frame), MSG_MORE) != sizeof(frame) ||
+        send(g_fd, req.data(), req.size(), 0) != (ssize_t)req.size()) {
+        return false;
+    }
+    for (;;) {
+        if (!read_all(&frame, sizeof(frame)) || frame.magic != SRV_MAGIC) {
+            return false;
+        }
+        body.resize(frame.size);
+        if (!read_all(body.data(), body.size())) {
+            return false;
+        }
+        if (frame.type == SRV_FRAME_NOTIFY) {
+            g_notifications++;
+            g_notified += frame.count;
+            continue;
+        }
+        break;
+    }
+    replies.resize(frame.count);
+    for (at = 0, count = 0; count < frame.count; count++) {
+        memcpy(&replies[count].reply, body.data() + at, sizeof(srv_reply_t));
+        at += sizeof(srv_reply_t);
+        replies[count].data.assign(body.begin() + at, body.begin() + at + replies[count].reply.size);
+        at += replies[count].reply.size;
+    }
+    return true;
+}
+static void print_frame(const std::vector<uint8_t> &frame)
+{
+    uint32_t row;
+    int      x, y;
+    for (y = 0; y < 16; y++) {
+        memcpy(&row, frame.data() + y * 4, 4);
+        for (x = 0; x < 32; x++) {
+            putchar(((row >> x) & 1) ? '#' : '.');
+        }
+        putchar('\n');
+    }
+    printf("icons %02X\n", frame[64]);
+}
+int main(int argc, char **argv)
+{
+    struct sockaddr_un    addr;
+    std::vector<uint8_t>  req;
+    std::vector<reply_t>  replies;
+    std::vector<uint32_t> ids;
+    std::vector<uint8_t>  snapshot, frame_a;
+    uint32_t              instances = (argc > 2) ? atoi(argv[2]) : 256;
+    uint32_t              rounds    = (argc > 3) ? atoi(argv[3]) : 300;
+    uint32_t              n, r, cmds = 0;
+    int                   fails = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <socket> [instances] [rounds]\n", argv[0]);
+        return 2;
+    }
+    g_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+    if (connect(g_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("connect");
+        return 1;
+    }
+
+    /* Create and subscribe every instance in one request each */
+    for (n = 0; n < instances; n++) {
+        push_cmd(req, SRV_OP_CREATE, 0, 0, 0, 0, NULL, 0);
+    }
+    if (!transact(req, instances, replies)) {
+        return 1;
+    }
+    for (n = 0; n < instances; n++) {
+        if (replies[n].reply.status != SRV_OK) {
+            fprintf(stderr, "create %u failed: %u\n", n, replies[n].reply.status);
+            return 1;
+        }
+        ids.push_back(replies[n].reply.inst);
+    }
+    req.clear();
+    for (n = 0; n < instances; n++) {
+        push_cmd(req, SRV_OP_SUBSCRIBE, ids[n], 0, 0, 1, NULL, 0);
+    }
+    transact(req, instances, replies);
+
+    /* One request per round: a button edge now and then plus one frame of emulation for every instance */
+    auto t0 = std::chrono::steady_clock::now();
+    for (r = 0; r < rounds; r++) {
+        req.clear();
+        for (n = 0; n < instances; n++) {
+            push_cmd(req, SRV_OP_BUTTON, ids[n], 1, 0, (r % 40) == 30, NULL, 0);
+            push_cmd(req, SRV_OP_RUN, ids[n], 0, 0, 32768 / 30, NULL, 0);
+        }
+        if (!transact(req, 2 * instances, replies)) {
+            return 1;
+        }
+        cmds += 2 * instances;
+    }
+    double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    printf("%u commands in %u requests: %.0f commands/s, %.1f us/request\n", cmds, rounds, cmds / dt,
+           dt * 1e6 / rounds);
+    printf("%u notification frames, %u LCD changes\n", g_notifications, g_notified);
+
+    req.clear();
+    push_cmd(req, SRV_OP_GET_FRAME, ids[0], 0, 0, 0, NULL, 0);
+    push_cmd(req, SRV_OP_GET_RAM, ids[0], 0, 0x000, 0x20, NULL, 0);
+    push_cmd(req, SRV_OP_SNAPSHOT, ids[0], 0, 0, 0, NULL, 0);
+    push_cmd(req, SRV_OP_RUN, ids[0], 0, 0, 32768, NULL, 0);
+    push_cmd(req, SRV_OP_GET_FRAME, ids[0], 0, 0, 0, NULL, 0);
+    transact(req, 5, replies);
+    print_frame(replies[0].data);
+    printf("RAM 000-01F:");
+    for (uint8_t v : replies[1].data) {
+        printf(" %X", v);
+    }
+    printf("\n");
+    snapshot = replies[2].data;
+    frame_a  = replies[4].data;
+
+    /* Restoring the snapshot into another instance must replay to the very same frame */
+    req.clear();
+    push_cmd(req, SRV_OP_RESTORE, ids[instances - 1], 0, 0, 0, snapshot.data(), snapshot.size());
+    push_cmd(req, SRV_OP_RUN, ids[instances - 1], 0, 0, 32768, NULL, 0);
+    push_cmd(req, SRV_OP_GET_FRAME, ids[instances - 1], 0, 0, 0, NULL, 0);
+    push_cmd(req, SRV_OP_GET_RAM, 0xFFFFFF, 0, 0, 1, NULL, 0);
+    transact(req, 4, replies);
+    if (replies[0].reply.status != SRV_OK || replies[2].data != frame_a) {
+        printf("FAIL: restored snapshot diverged\n");
+        fails++;
+    }
+    if (replies[3].reply.status != SRV_ERR_INSTANCE) {
+        printf("FAIL: unknown instance accepted\n");
+        fails++;
+    }
+
+    req.clear();
+    for (n = 0; n < instances; n++) {
+        push_cmd(req, SRV_OP_DESTROY, ids[n], 0, 0, 0, NULL, 0);
+    }
+    transact(req, instances, replies);
+    close(g_fd);
+    printf(fails ? "FAILED\n" : "OK\n");
+    return fails ? 1 : 0;
+}